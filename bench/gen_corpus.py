@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+"""
+Synthetic corpus generator for the sandbox command benchmarks.
+
+Creates (inside --out):
+  text.txt       - word text with normal-length lines (--text-size bytes)
+  longlines.txt  - a few lines that are megabytes long
+  binary.bin     - random bytes including NULs and stray newlines
+  manyfiles/     - a directory with --entries empty files
+  keywords.txt   - --keywords two-word phrases for multi-pattern grep
+  tree/          - nested directories holding --tree-files empty files (find)
+
+Usage: python3 bench/gen_corpus.py [--out DIR] [--text-size 1G] [--entries 100000] [--tree-files 200000]
+"""
+
+import argparse
+import os
+import random
+import sys
+
+WORDS = [
+    "sandbox", "shell", "process", "kernel", "pipe", "fork", "exec", "signal",
+    "memory", "limit", "chroot", "whitelist", "blocked", "allowed", "file",
+    "directory", "inode", "buffer", "stream", "token", "alias", "history",
+    "error", "warning", "the", "a", "of", "and", "to", "in", "is", "on",
+]
+
+CHUNK = 4 * 1024 * 1024
+
+
+def parse_size(text):
+    """Parse sizes like 512K, 64M, 2G into bytes"""
+    units = {"K": 1 << 10, "M": 1 << 20, "G": 1 << 30}
+    text = text.strip().upper()
+    if text and text[-1] in units:
+        return int(float(text[:-1]) * units[text[-1]])
+    return int(text)
+
+
+def make_block(rng, size):
+    """Build one block of word lines; the block is reused so generation stays fast"""
+    lines = []
+    total = 0
+    while total < size:
+        line = " ".join(rng.choice(WORDS) for _ in range(rng.randint(1, 16))) + "\n"
+        lines.append(line)
+        total += len(line)
+    return "".join(lines).encode()
+
+
+def write_text(path, size, rng):
+    blocks = [make_block(rng, CHUNK) for _ in range(4)]
+    written = 0
+    with open(path, "wb") as f:
+        while written < size:
+            block = blocks[rng.randrange(len(blocks))]
+            block = block[:size - written]
+            f.write(block)
+            written += len(block)
+
+
+def write_long_lines(path, line_len, count, rng):
+    with open(path, "wb") as f:
+        for _ in range(count):
+            remaining = line_len
+            while remaining > 0:
+                n = min(CHUNK, remaining)
+                word = rng.choice(WORDS).encode() + b" "
+                f.write((word * (n // len(word) + 1))[:n])
+                remaining -= n
+            f.write(b"\n")
+
+
+def write_binary(path, size, rng):
+    with open(path, "wb") as f:
+        written = 0
+        while written < size:
+            n = min(CHUNK, size - written)
+            f.write(rng.randbytes(n))
+            written += n
+
+
+def write_many_files(path, entries):
+    os.makedirs(path, exist_ok=True)
+    existing = len(os.listdir(path))
+    if existing >= entries:
+        return
+    for i in range(entries):
+        name = os.path.join(path, "f%07d.txt" % i)
+        if not os.path.exists(name):
+            open(name, "wb").close()
+
+
+def write_keywords(path, count, rng):
+    phrases = {f"{rng.choice(WORDS)} {rng.choice(WORDS)}" for _ in range(count)}
+    with open(path, "w") as f:
+        f.writelines(p + "\n" for p in sorted(phrases))
+
+
+def write_tree(path, files):
+    # 100 files per leaf directory, 40 leaves per top-level directory
+    for i in range(files):
+        leaf = os.path.join(path, "d%03d" % (i // 4000), "e%02d" % (i // 100 % 40))
+        if i % 100 == 0:
+            os.makedirs(leaf, exist_ok=True)
+        name = os.path.join(leaf, "f%02d.txt" % (i % 100))
+        if not os.path.exists(name):
+            open(name, "wb").close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate benchmark corpora")
+    parser.add_argument("--out", default="bench/corpus")
+    parser.add_argument("--text-size", default="256M", help="size of text.txt (e.g. 64M, 2G)")
+    parser.add_argument("--long-line", default="8M", help="length of each line in longlines.txt")
+    parser.add_argument("--long-count", type=int, default=4)
+    parser.add_argument("--binary-size", default="64M")
+    parser.add_argument("--entries", type=int, default=100000, help="files in manyfiles/")
+    parser.add_argument("--keywords", type=int, default=500, help="phrases in keywords.txt")
+    parser.add_argument("--tree-files", type=int, default=200000, help="files under tree/")
+    parser.add_argument("--seed", type=int, default=1)
+    opts = parser.parse_args()
+
+    rng = random.Random(opts.seed)
+    os.makedirs(opts.out, exist_ok=True)
+
+    steps = [
+        ("text.txt", lambda p: write_text(p, parse_size(opts.text_size), rng)),
+        ("longlines.txt", lambda p: write_long_lines(p, parse_size(opts.long_line), opts.long_count, rng)),
+        ("binary.bin", lambda p: write_binary(p, parse_size(opts.binary_size), rng)),
+        ("manyfiles", lambda p: write_many_files(p, opts.entries)),
+        ("keywords.txt", lambda p: write_keywords(p, opts.keywords, rng)),
+        ("tree", lambda p: write_tree(p, opts.tree_files)),
+    ]
+    for name, fn in steps:
+        path = os.path.join(opts.out, name)
+        print(f"generating {path} ...", file=sys.stderr)
+        fn(path)
+    print(f"corpus ready in {opts.out}", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
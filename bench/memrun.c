@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+// Benchmark helper: run a command under the shell's sandbox limits and report
+// its peak RSS. Python cannot measure this itself because a child exec'd from
+// the interpreter inherits the interpreter's RSS high-water mark.
+//
+// Usage: memrun <report-file> <memory-MB> <open-files> command [args...]
+// Writes "<exit status> <peak RSS in KiB>" to report-file.
+
+int main(int argc, char *argv[]) {
+    if (argc < 5) {
+        fprintf(stderr, "usage: memrun report-file memory-MB open-files command [args...]\n");
+        return 2;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        struct rlimit limit;
+
+        // Same RLIMIT_AS / RLIMIT_NOFILE as setup_resource_limits()
+        limit.rlim_cur = limit.rlim_max = (rlim_t)atol(argv[2]) * 1024 * 1024;
+        setrlimit(RLIMIT_AS, &limit);
+        limit.rlim_cur = limit.rlim_max = (rlim_t)atol(argv[3]);
+        setrlimit(RLIMIT_NOFILE, &limit);
+
+        execvp(argv[4], argv + 4);
+        perror("memrun");
+        _exit(127);
+    } else if (pid < 0) {
+        perror("memrun: fork");
+        return 2;
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("memrun: wait4");
+        return 2;
+    }
+
+    int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+#ifdef __APPLE__
+    long rss_kb = usage.ru_maxrss / 1024;   // bytes on macOS
+#else
+    long rss_kb = usage.ru_maxrss;          // KiB on Linux
+#endif
+
+    FILE *fp = fopen(argv[1], "w");
+    if (fp) {
+        fprintf(fp, "%d %ld\n", code, rss_kb);
+        fclose(fp);
+    }
+    return code;
+}
@@ -0,0 +1,285 @@
+#!/usr/bin/env python3
+"""
+Replay recorded sessions against one or two builds of myshell.
+
+A recording is what the shell writes with 'record = <file>' in sandbox.conf
+(or myshell --record <file>): one JSON object per input line with the time
+it was typed, its cwd, exit status and latency, and a header per session
+with the aliases it started with. Each recorded session is fed to a fresh
+'myshell --protocol', line by line, either at the pace it was typed
+(--pace original, optionally --speed times faster) or back to back
+(--pace fast). A line's latency is the time from writing it to its 'X'
+frame.
+
+With --baseline the same sessions are replayed against a second build and
+the report compares the two, grouped by the shape of the line (the command
+words and the operators between them, so 'cat a | grep x' and
+'cat b | grep y' are both 'cat | grep'). Without it the build is compared
+with the latencies in the recording.
+
+Lines that write to the sandbox change what later lines and runs see; take
+a snapshot first and pass --restore NAME to run 'sandbox_restore NAME'
+before every replay.
+
+Usage: python3 bench/replay.py RECORDING [--shell ./myshell] [--baseline OTHER]
+                               [--config FILE] [--pace fast|original] [--speed 1]
+                               [--runs 3] [--restore NAME] [--top 20] [--json FILE]
+"""
+
+import argparse
+import json
+import os
+import re
+import select
+import shutil
+import statistics
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+TIMEOUT = 60.0
+# Settings that would make a replay touch the recording, the metrics file or
+# the terminal's saved state
+SKIPPED_KEYS = ("record", "state_file", "metrics_file")
+OPERATORS = re.compile(r"(\|\||&&|[|;&()])")
+
+
+def load_sessions(path):
+    """Recorded sessions in the order they started: dicts with aliases, cwd, lines"""
+    sessions, current = [], {}
+    with open(path) as f:
+        for n, text in enumerate(f, 1):
+            if not text.strip():
+                continue
+            try:
+                rec = json.loads(text)
+            except ValueError:
+                sys.exit(f"{path}:{n}: not a JSON record")
+            key = rec.get("session", 0)
+            if "aliases" in rec or key not in current:
+                current[key] = dict(number=key, cwd=rec.get("cwd"), aliases=rec.get("aliases", []), lines=[])
+                sessions.append(current[key])
+            if "line" in rec:
+                current[key]["lines"].append(rec)
+    return [s for s in sessions if s["lines"]]
+
+
+def shape(line):
+    """Command words and operators: 'cat a | grep x && ls' -> 'cat | grep && ls'"""
+    parts = []
+    for piece in OPERATORS.split(line):
+        piece = piece.strip()
+        if not piece:
+            continue
+        if OPERATORS.fullmatch(piece):
+            parts.append(piece)
+        else:
+            parts.append(piece.split()[0])
+    return " ".join(parts)
+
+
+def replay_config(config, work):
+    """The policy file without the settings a replay must not use"""
+    out = os.path.join(work, "replay.conf")
+    with open(out, "w") as dst:
+        if config:
+            with open(config) as src:
+                for text in src:
+                    key = text.split("=", 1)[0].strip()
+                    if "=" in text and key in SKIPPED_KEYS:
+                        continue
+                    dst.write(text)
+    return out
+
+
+class Shell:
+    """A 'myshell --protocol' process we can send lines to"""
+
+    def __init__(self, argv, cwd):
+        self.proc = subprocess.Popen(argv + ["--protocol"], cwd=cwd, stdin=subprocess.PIPE,
+                                     stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+        self.fd = self.proc.stdout.fileno()
+        self.buf = b""
+        self.frame(b"P")
+
+    def frame(self, want):
+        """Read frames until one of type want; returns its payload"""
+        deadline = time.monotonic() + TIMEOUT
+        while True:
+            while len(self.buf) >= 5:
+                n = struct.unpack(">I", self.buf[1:5])[0]
+                if len(self.buf) < 5 + n:
+                    break
+                kind, payload = self.buf[:1], self.buf[5:5 + n]
+                self.buf = self.buf[5 + n:]
+                if kind == want:
+                    return payload
+            left = deadline - time.monotonic()
+            if left <= 0 or not select.select([self.fd], [], [], left)[0]:
+                raise TimeoutError(f"no '{want.decode()}' frame after {TIMEOUT:.0f} s")
+            chunk = os.read(self.fd, 65536)
+            if not chunk:
+                raise EOFError("shell exited")
+            self.buf += chunk
+
+    def run(self, line):
+        """Send one line; returns (ms until its 'X' frame, its status)"""
+        began = time.monotonic()
+        self.proc.stdin.write(line.encode() + b"\n")
+        self.proc.stdin.flush()
+        done = json.loads(self.frame(b"X"))
+        return (time.monotonic() - began) * 1000, done["status"]
+
+    def close(self):
+        try:
+            self.proc.stdin.close()
+        except BrokenPipeError:
+            pass
+        try:
+            self.proc.wait(timeout=5)
+        except subprocess.TimeoutExpired:
+            self.proc.kill()
+            self.proc.wait()
+
+
+def replay(shell, config, sessions, opts, work):
+    """One pass over every session: [(ms, status)] per session, per line"""
+    argv = [shell, "-f", config]
+    if opts.restore:
+        s = Shell(argv, work)
+        _, status = s.run(f"sandbox_restore {opts.restore}")
+        s.close()
+        if status != 0:
+            sys.exit(f"sandbox_restore {opts.restore} failed with status {status}")
+    results = []
+    for session in sessions:
+        s = Shell(argv, work)
+        # Not timed: put the session back where it started
+        for name, command in session["aliases"]:
+            s.run(f"add_alias {name}='{command}'")
+        if session["cwd"] and os.path.isdir(session["cwd"]):
+            s.run(f"cd {session['cwd']}")
+        times = []
+        first = session["lines"][0]["time"]
+        began = time.monotonic()
+        try:
+            for rec in session["lines"]:
+                if opts.pace == "original":
+                    wait = (rec["time"] - first) / opts.speed - (time.monotonic() - began)
+                    if wait > 0:
+                        time.sleep(wait)
+                times.append(s.run(rec["line"]))
+        except (EOFError, TimeoutError) as e:
+            sys.exit(f"{shell}: session {session['number']}, line {len(times) + 1}: {e}")
+        finally:
+            s.close()
+        results.append(times)
+    return results
+
+
+def measure(shell, config, sessions, opts, work):
+    """Per line: the median ms over --runs replays and the status of the last"""
+    runs = [replay(shell, config, sessions, opts, work) for _ in range(opts.runs)]
+    lines = []
+    for i, session in enumerate(sessions):
+        for j in range(len(session["lines"])):
+            lines.append((statistics.median(run[i][j][0] for run in runs), runs[-1][i][j][1]))
+    return lines
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[max(0, int(round(len(values) * p)) - 1)]
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description="Replay recorded sessions and compare latency")
+    parser.add_argument("recording")
+    parser.add_argument("--shell", default=os.path.join(here, "..", "myshell"))
+    parser.add_argument("--baseline", help="a second build to compare against")
+    parser.add_argument("--config", default=os.path.join(here, "..", "sandbox.conf"),
+                        help="policy file for the replays (record, state_file and metrics_file are ignored)")
+    parser.add_argument("--pace", choices=("fast", "original"), default="fast")
+    parser.add_argument("--speed", type=float, default=1.0, help="with --pace original: this many times faster")
+    parser.add_argument("--runs", type=int, default=3)
+    parser.add_argument("--restore", metavar="NAME", help="sandbox_restore NAME before every replay")
+    parser.add_argument("--top", type=int, default=20, help="command shapes to list")
+    parser.add_argument("--json", help="also write results to this file")
+    opts = parser.parse_args()
+
+    sessions = load_sessions(opts.recording)
+    if not sessions:
+        sys.exit(f"{opts.recording}: no recorded lines")
+    builds = [("build", os.path.abspath(opts.shell))]
+    if opts.baseline:
+        builds.insert(0, ("baseline", os.path.abspath(opts.baseline)))
+    for _, shell in builds:
+        if not os.access(shell, os.X_OK):
+            sys.exit(f"shell not found: {shell} (run make)")
+
+    recorded = [rec for s in sessions for rec in s["lines"]]
+    print(f"{len(recorded)} lines in {len(sessions)} sessions, {len(set(map(shape, (r['line'] for r in recorded))))} "
+          f"command shapes; pace {opts.pace}, {opts.runs} runs per build")
+    work = tempfile.mkdtemp(prefix="replay.")
+    try:
+        config = replay_config(opts.config, work)
+        measured = {name: measure(shell, config, sessions, opts, work) for name, shell in builds}
+    finally:
+        shutil.rmtree(work, ignore_errors=True)
+
+    # Column A is what B is compared with: the baseline build, or the recording
+    if opts.baseline:
+        a_name, a = "baseline", [ms for ms, _ in measured["baseline"]]
+    else:
+        a_name, a = "recorded", [rec["ms"] for rec in recorded]
+    b = [ms for ms, _ in measured["build"]]
+
+    groups = {}
+    for rec, ams, bms in zip(recorded, a, b):
+        groups.setdefault(shape(rec["line"]), []).append((ams, bms))
+    rows = []
+    for name, pairs in groups.items():
+        am = statistics.median(p[0] for p in pairs)
+        bm = statistics.median(p[1] for p in pairs)
+        rows.append(dict(shape=name, lines=len(pairs), a_median_ms=am, b_median_ms=bm,
+                         change_pct=(bm - am) / am * 100 if am > 0 else 0.0,
+                         a_total_ms=sum(p[0] for p in pairs)))
+    rows.sort(key=lambda r: r["a_total_ms"], reverse=True)
+
+    width = max(24, min(48, max(len(r["shape"]) for r in rows)))
+    print(f"\n{'command shape':<{width}} {'lines':>6} {a_name + ' ms':>12} {'build ms':>10} {'change':>8}")
+    for r in rows[:opts.top]:
+        print(f"{r['shape'][:width]:<{width}} {r['lines']:>6} {r['a_median_ms']:>12.2f} "
+              f"{r['b_median_ms']:>10.2f} {r['change_pct']:>+7.1f}%")
+    if len(rows) > opts.top:
+        print(f"... {len(rows) - opts.top} more shapes (--top)")
+    total = dict(a_total_ms=sum(a), b_total_ms=sum(b),
+                 a_p50_ms=percentile(a, 0.5), b_p50_ms=percentile(b, 0.5),
+                 a_p90_ms=percentile(a, 0.9), b_p90_ms=percentile(b, 0.9))
+    print(f"\n{'all lines':<{width}} {len(a):>6} {total['a_total_ms']:>12.1f} {total['b_total_ms']:>10.1f} "
+          f"{(total['b_total_ms'] - total['a_total_ms']) / total['a_total_ms'] * 100 if total['a_total_ms'] else 0:>+7.1f}%")
+    for p in ("p50", "p90"):
+        print(f"{'  ' + p + ' per line':<{width}} {'':>6} {total[f'a_{p}_ms']:>12.2f} {total[f'b_{p}_ms']:>10.2f}")
+
+    # A status that differs means the replay did not do what the user did
+    # (missing files, another policy), so its timing says little
+    expected = [s for _, s in measured["baseline"]] if opts.baseline else [rec["status"] for rec in recorded]
+    differs = [(rec["line"], want, got) for rec, want, (_, got) in zip(recorded, expected, measured["build"])
+               if want != got]
+    if differs:
+        print(f"\n{len(differs)} lines ended with another status than in the {a_name} run, e.g.:")
+        for line, want, got in differs[:5]:
+            print(f"  {line!r}: {want} -> {got}")
+
+    if opts.json:
+        with open(opts.json, "w") as f:
+            json.dump(dict(compared_with=a_name, pace=opts.pace, runs=opts.runs, lines=len(a),
+                           sessions=len(sessions), total=total, shapes=rows,
+                           status_differs=len(differs)), f, indent=2)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,210 @@
+#!/usr/bin/env python3
+"""
+Conformance and performance harness for the sandbox commands.
+
+Runs every sandbox_* binary against the corpus from gen_corpus.py, checks its
+output against the system coreutils, and reports throughput and peak RSS.
+Each sandbox command runs under the same RLIMIT_AS that setup_resource_limits()
+applies in the shell, so a tool that needs more memory shows up as a failure.
+
+Usage: python3 bench/run_bench.py [--corpus DIR] [--bin DIR] [--only cat,wc] [--json FILE]
+"""
+
+import argparse
+import hashlib
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+MAX_MEMORY_MB = 100      # keep in sync with MAX_MEMORY in project_sandboxed.c
+MAX_OPEN_FILES = 64      # keep in sync with MAX_OPEN_FILES
+READ_CHUNK = 1 << 20
+
+REF_ENV = dict(os.environ, LC_ALL="C")
+
+
+def exact(chunks):
+    """Digest of the raw byte stream"""
+    h = hashlib.sha256()
+    for chunk in chunks:
+        h.update(chunk)
+    return h.hexdigest()
+
+
+def tokens(chunks):
+    """Whitespace-separated tokens (wc pads its columns differently)"""
+    return b"".join(chunks).split()
+
+
+def sorted_lines(chunks):
+    """Lines in any order (find walks directories in parallel)"""
+    return sorted(b"".join(chunks).split(b"\n"))
+
+
+def basenames(chunks):
+    """Entry names regardless of layout or directory prefix (ls)"""
+    return [os.path.basename(t) for t in b"".join(chunks).split()]
+
+
+# name, sandbox args, reference argv, stdin file, normalizer, input files
+# (all paths relative to the corpus directory, where both commands run)
+def build_cases(corpus):
+    p = lambda name: os.path.join(corpus, name)
+    return [
+        ("cat", ["text.txt"], ["cat", "text.txt"], None, exact, ["text.txt"]),
+        ("cat", ["longlines.txt"], ["cat", "longlines.txt"], None, exact, ["longlines.txt"]),
+        ("cat", ["binary.bin"], ["cat", "binary.bin"], None, exact, ["binary.bin"]),
+        ("cat", ["<", "text.txt"], ["cat"], p("text.txt"), exact, ["text.txt"]),
+        ("wc", ["text.txt"], ["wc", "text.txt"], None, tokens, ["text.txt"]),
+        ("wc", ["-l", "text.txt"], ["wc", "-l", "text.txt"], None, tokens, ["text.txt"]),
+        ("wc", ["longlines.txt"], ["wc", "longlines.txt"], None, tokens, ["longlines.txt"]),
+        ("wc", ["binary.bin"], ["wc", "binary.bin"], None, tokens, ["binary.bin"]),
+        ("grep", ["kernel", "text.txt"], ["grep", "kernel", "text.txt"], None, exact, ["text.txt"]),
+        ("grep", ["kernel", "longlines.txt"], ["grep", "kernel", "longlines.txt"], None, exact, ["longlines.txt"]),
+        ("grep", ["fork", "binary.bin"], ["grep", "-a", "fork", "binary.bin"], None, exact, ["binary.bin"]),
+        ("grep", ["-F", "-f", "keywords.txt", "text.txt"], ["grep", "-F", "-f", "keywords.txt", "text.txt"],
+         None, exact, ["text.txt"]),
+        ("grep", ["-o", "-f", "keywords.txt", "text.txt"], ["grep", "-o", "-F", "-f", "keywords.txt", "text.txt"],
+         None, exact, ["text.txt"]),
+        ("sort", ["text.txt"], ["sort", "text.txt"], None, exact, ["text.txt"]),
+        ("sort", ["-u", "-k2", "text.txt"], ["sort", "-u", "-k2", "text.txt"], None, exact, ["text.txt"]),
+        ("sort", ["-r", "longlines.txt"], ["sort", "-r", "longlines.txt"], None, exact, ["longlines.txt"]),
+        ("uniq", ["text.txt"], ["uniq", "text.txt"], None, exact, ["text.txt"]),
+        ("uniq", ["-c", "text.txt"], ["uniq", "-c", "text.txt"], None, exact, ["text.txt"]),
+        ("head", ["-n", "1000", "text.txt"], ["head", "-n", "1000", "text.txt"], None, exact, ["text.txt"]),
+        ("tail", ["-n", "1000", "text.txt"], ["tail", "-n", "1000", "text.txt"], None, exact, ["text.txt"]),
+        ("tail", ["-c", "+1000", "longlines.txt"], ["tail", "-c", "+1000", "longlines.txt"], None, exact, ["longlines.txt"]),
+        ("find", ["tree", "-name", "*7.txt"], ["find", "tree", "-name", "*7.txt"], None, sorted_lines, []),
+        ("find", ["tree", "-type", "f", "-size", "-1"], ["find", "tree", "-type", "f", "-size", "-1"],
+         None, sorted_lines, []),
+        ("ls", ["manyfiles"], ["ls", "manyfiles"], None, basenames, []),
+        ("ls", ["-a", "manyfiles"], ["ls", "-a", "manyfiles"], None, basenames, []),
+    ]
+
+
+def run(argv, cwd, stdin_path, normalize, timeout, memrun=None):
+    """Run argv, stream its stdout through normalize, return (result, stats).
+    With memrun, the command runs under the sandbox limits and its own peak
+    RSS and exit status are read back from memrun's report file."""
+    stdin = open(stdin_path, "rb") if stdin_path else subprocess.DEVNULL
+    report = None
+    if memrun:
+        fd, report = tempfile.mkstemp(prefix="memrun.")
+        os.close(fd)
+        argv = [memrun, report, str(MAX_MEMORY_MB), str(MAX_OPEN_FILES)] + argv
+    start = time.monotonic()
+    proc = subprocess.Popen(argv, cwd=cwd, stdin=stdin, stdout=subprocess.PIPE,
+                            stderr=subprocess.DEVNULL, env=REF_ENV)
+    timed_out = threading.Event()
+
+    def on_timeout():
+        timed_out.set()
+        proc.kill()
+
+    timer = threading.Timer(timeout, on_timeout)
+    timer.start()
+
+    def chunks():
+        while True:
+            data = proc.stdout.read(READ_CHUNK)
+            if not data:
+                return
+            yield data
+
+    try:
+        result = normalize(chunks())
+    finally:
+        proc.stdout.close()
+        _, status, usage = os.wait4(proc.pid, 0)
+        timer.cancel()
+        if stdin_path:
+            stdin.close()
+    elapsed = time.monotonic() - start
+
+    code = os.waitstatus_to_exitcode(status)
+    # ru_maxrss is KiB on Linux and bytes on macOS
+    rss = usage.ru_maxrss * (1 if sys.platform == "darwin" else 1024)
+    if report:
+        with open(report) as f:
+            fields = f.read().split()
+        os.unlink(report)
+        if len(fields) == 2:
+            code, rss = int(fields[0]), int(fields[1]) * 1024
+    return result, {
+        "seconds": elapsed,
+        "peak_rss": rss,
+        "exit_status": code,
+        "timed_out": timed_out.is_set(),
+    }
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description="Benchmark and check sandbox commands")
+    parser.add_argument("--corpus", default=os.path.join(here, "corpus"))
+    parser.add_argument("--bin", default=os.path.join(here, "..", "sandbox_commands"),
+                        help="directory containing the sandbox_* binaries")
+    parser.add_argument("--memrun", default=os.path.join(here, "memrun"),
+                        help="path to the compiled bench/memrun helper")
+    parser.add_argument("--only", default="", help="comma-separated command names")
+    parser.add_argument("--timeout", type=float, default=300.0)
+    parser.add_argument("--json", help="also write results to this file")
+    opts = parser.parse_args()
+
+    corpus = os.path.abspath(opts.corpus)
+    if not os.path.isdir(corpus):
+        sys.exit(f"corpus not found: {corpus} (run bench/gen_corpus.py first)")
+    memrun = os.path.abspath(opts.memrun)
+    if not os.access(memrun, os.X_OK):
+        sys.exit(f"memrun helper not found: {memrun} (run make bench)")
+    only = set(filter(None, opts.only.split(",")))
+    limit = MAX_MEMORY_MB * 1024 * 1024
+
+    results = []
+    failures = 0
+    print(f"{'case':<34} {'status':<8} {'MB/s':>9} {'secs':>8} {'ref secs':>8} {'peak RSS':>10}")
+    for cmd, args, ref_argv, stdin_path, normalize, inputs in build_cases(corpus):
+        if only and cmd not in only:
+            continue
+        binary = os.path.abspath(os.path.join(opts.bin, "sandbox_" + cmd))
+        label = " ".join([cmd] + args)
+        if args[:1] == ["<"]:
+            args = []
+
+        expected, ref_stats = run(ref_argv, corpus, stdin_path, normalize, opts.timeout)
+        got, stats = run([binary] + args, corpus, stdin_path, normalize, opts.timeout, memrun)
+
+        if stats["timed_out"]:
+            status = "TIMEOUT"
+        elif stats["exit_status"] != ref_stats["exit_status"]:
+            status = f"EXIT {stats['exit_status']}"
+        elif stats["peak_rss"] > limit:
+            status = "OVERMEM"
+        elif got != expected:
+            status = "DIFF"
+        else:
+            status = "ok"
+        failures += status != "ok"
+
+        size = sum(os.path.getsize(os.path.join(corpus, f)) for f in inputs)
+        mbps = size / stats["seconds"] / (1 << 20) if size and stats["seconds"] else 0.0
+        ref_secs = ref_stats["seconds"]
+        print(f"{label:<34} {status:<8} {mbps:>9.1f} {stats['seconds']:>8.2f} "
+              f"{ref_secs:>8.2f} {stats['peak_rss'] / (1 << 20):>8.1f}MB")
+        results.append(dict(case=label, status=status, input_bytes=size, mb_per_s=mbps,
+                            ref_seconds=ref_secs, **stats))
+
+    if opts.json:
+        with open(opts.json, "w") as f:
+            json.dump(results, f, indent=2)
+    print(f"\n{len(results) - failures}/{len(results)} cases passed "
+          f"(memory limit {MAX_MEMORY_MB} MB)")
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == "__main__":
+    main()
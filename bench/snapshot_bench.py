@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+"""
+Sandbox reset benchmark: sandbox_restore against a full copy.
+
+Builds a sandbox tree of --files small files, takes a sandbox_snapshot of
+it, then repeatedly dirties the tree the way a user session would (edits,
+new files, deletions, a new directory) and puts it back two ways:
+
+  restore   myshell -f <config> running 'sandbox_restore' (whole process)
+  copy      rm -rf the tree, then cp -a from a pristine copy
+
+After every restore the dirtied paths are checked against the pristine copy.
+
+Usage: python3 bench/snapshot_bench.py [--shell ./myshell] [--files 100000]
+                                       [--changes 300] [--runs 5]
+                                       [--dir /tmp] [--json FILE]
+"""
+
+import argparse
+import filecmp
+import json
+import os
+import random
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+FILES_PER_DIR = 1000
+
+
+def build_tree(root, files):
+    for i in range(files):
+        d = os.path.join(root, f"d{i // FILES_PER_DIR:03d}")
+        if i % FILES_PER_DIR == 0:
+            os.makedirs(d)
+        with open(os.path.join(d, f"f{i:06d}.txt"), "w") as f:
+            f.write(f"file {i}\n" * (1 + i % 64))
+
+
+def dirty(root, files, changes, rng):
+    """Edit, add and delete files; returns the relative paths touched"""
+    touched = []
+    for i in rng.sample(range(files), changes):
+        rel = os.path.join(f"d{i // FILES_PER_DIR:03d}", f"f{i:06d}.txt")
+        path = os.path.join(root, rel)
+        kind = i % 3
+        if kind == 0:
+            with open(path, "r+") as f:      # same size, new bytes
+                f.write("X")
+        elif kind == 1:
+            with open(path, "a") as f:
+                f.write("appended\n")
+        else:
+            os.unlink(path)
+        touched.append(rel)
+    extra = os.path.join(root, "session", "work")
+    os.makedirs(extra, exist_ok=True)
+    for i in range(changes // 3):
+        with open(os.path.join(extra, f"new{i}.txt"), "w") as f:
+            f.write("scratch\n")
+    touched.append("session")
+    return touched
+
+
+def check(root, pristine, touched):
+    for rel in touched:
+        a, b = os.path.join(pristine, rel), os.path.join(root, rel)
+        if os.path.lexists(a) != os.path.lexists(b):
+            sys.exit(f"restore left {rel} {'missing' if os.path.lexists(a) else 'behind'}")
+        if os.path.isfile(a) and not filecmp.cmp(a, b, shallow=False):
+            sys.exit(f"restore left {rel} different")
+
+
+def timed(fn):
+    began = time.monotonic()
+    fn()
+    return (time.monotonic() - began) * 1000
+
+
+def run_shell(argv, line):
+    out = subprocess.run(argv, input=line.encode(), stdout=subprocess.PIPE,
+                         stderr=subprocess.STDOUT, check=True).stdout.decode(errors="replace")
+    if "shell:" in out:
+        sys.exit(out)
+    return out
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description="sandbox_restore against a full copy")
+    parser.add_argument("--shell", default=os.path.join(here, "..", "myshell"))
+    parser.add_argument("--files", type=int, default=100000)
+    parser.add_argument("--changes", type=int, default=300)
+    parser.add_argument("--runs", type=int, default=5)
+    parser.add_argument("--dir", help="where to build the trees (default: the temp dir)")
+    parser.add_argument("--json", help="also write results to this file")
+    opts = parser.parse_args()
+
+    shell = os.path.abspath(opts.shell)
+    if not os.access(shell, os.X_OK):
+        sys.exit(f"shell not found: {shell} (run make)")
+    work = tempfile.mkdtemp(prefix="snapbench.", dir=opts.dir)
+    try:
+        root = os.path.join(work, "sandbox")
+        pristine = os.path.join(work, "pristine")
+        config = os.path.join(work, "bench.conf")
+        with open(config, "w") as f:
+            f.write(f"root = {root}\nchroot = off\nsnapshot_dir = {work}/snapshots\n")
+        argv = [shell, "-f", config]
+
+        print(f"building {opts.files} files in {work} ...")
+        os.makedirs(root)
+        build_tree(root, opts.files)
+        subprocess.run(["cp", "-a", root, pristine], check=True)
+        snapshot_ms = timed(lambda: run_shell(argv, "sandbox_snapshot\n"))
+
+        noop_ms = timed(lambda: run_shell(argv, "sandbox_restore\n"))
+        rng = random.Random(1)
+        restores, copies = [], []
+        for _ in range(opts.runs):
+            touched = dirty(root, opts.files, opts.changes, rng)
+            restores.append(timed(lambda: run_shell(argv, "sandbox_restore\n")))
+            check(root, pristine, touched)
+        # Last: a copied tree has all new inodes, which the next restore would
+        # (rightly) treat as changed
+        for _ in range(opts.runs):
+            dirty(root, opts.files, opts.changes, rng)
+            copies.append(timed(lambda: (shutil.rmtree(root),
+                                         subprocess.run(["cp", "-a", pristine, root], check=True))))
+
+        result = {
+            "files": opts.files,
+            "changes": opts.changes,
+            "snapshot_ms": snapshot_ms,
+            "restore_unchanged_ms": noop_ms,
+            "restore_median_ms": statistics.median(restores),
+            "copy_median_ms": statistics.median(copies),
+        }
+        print(f"snapshot                  {snapshot_ms:10.1f} ms")
+        print(f"restore, nothing changed  {noop_ms:10.1f} ms")
+        print(f"restore, {opts.changes} changes      {result['restore_median_ms']:10.1f} ms  (median of {opts.runs})")
+        print(f"rm -rf + cp -a            {result['copy_median_ms']:10.1f} ms  (median of {opts.runs})")
+        print(f"speedup                   {result['copy_median_ms'] / result['restore_median_ms']:10.1f}x")
+        if opts.json:
+            with open(opts.json, "w") as f:
+                json.dump(result, f, indent=2)
+    finally:
+        shutil.rmtree(work, ignore_errors=True)
+
+
+if __name__ == "__main__":
+    main()
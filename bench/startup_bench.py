@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+"""
+Startup benchmark for myshell.
+
+Measures, over many fresh processes, how long the shell takes to show its
+first prompt and to print the result of a first command (pwd) that is
+already waiting on stdin when it starts. Three ways of starting it:
+
+  protocol  myshell --protocol, as the GUI runs it (first 'P' / 'X' frame)
+  pipe      a script on stdin (no terminal)
+  tty       an interactive terminal, through a pseudo-terminal
+
+Usage: python3 bench/startup_bench.py [--shell ./myshell] [--config FILE]
+                                      [--runs 200] [--modes protocol,pipe,tty]
+                                      [--json FILE]
+"""
+
+import argparse
+import json
+import os
+import pty
+import select
+import statistics
+import struct
+import subprocess
+import sys
+import time
+
+PROMPT = b"sandbox>"
+TIMEOUT = 10.0
+
+
+def read_until(fd, done, deadline):
+    """Read fd until done(buffer) is true; returns the time it happened"""
+    buf = b""
+    while not done(buf):
+        left = deadline - time.monotonic()
+        if left <= 0 or not select.select([fd], [], [], left)[0]:
+            raise TimeoutError(buf[-200:])
+        try:
+            chunk = os.read(fd, 65536)
+        except OSError:      # pty master reports EIO once the child is gone
+            chunk = b""
+        if not chunk:
+            raise EOFError(buf[-200:])
+        buf += chunk
+    return time.monotonic()
+
+
+def frames(buf):
+    """Frame types in a protocol stream (1 byte type, 4 byte length, payload)"""
+    types, off = [], 0
+    while off + 5 <= len(buf):
+        n = struct.unpack(">I", buf[off + 1:off + 5])[0]
+        if off + 5 + n > len(buf):
+            break
+        types.append(buf[off:off + 1])
+        off += 5 + n
+    return types
+
+
+def start(mode, argv, command):
+    """Start the shell; returns (process, fd to read output from)"""
+    if mode == "tty":
+        master, slave = pty.openpty()
+        proc = subprocess.Popen(argv, stdin=slave, stdout=slave, stderr=slave, close_fds=True)
+        os.close(slave)
+        if command:
+            os.write(master, command)
+        return proc, master
+    if mode == "protocol":
+        argv = argv + ["--protocol"]
+    proc = subprocess.Popen(argv, stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                            stderr=subprocess.DEVNULL)
+    if command:
+        proc.stdin.write(command)
+        proc.stdin.flush()
+    return proc, proc.stdout.fileno()
+
+
+def stop(proc, fd, mode):
+    if mode == "tty":
+        proc.kill()
+        os.close(fd)
+    else:
+        proc.stdin.close()
+        proc.kill()
+        proc.stdout.close()
+    proc.wait()
+
+
+def measure(mode, argv, cwd_marker):
+    """One fresh process: (ms to first prompt, ms to first command result)"""
+    if mode == "protocol":
+        first_prompt = lambda b: b"P" in frames(b)
+        first_result = lambda b: b"X" in frames(b)
+    else:
+        first_prompt = lambda b: PROMPT in b
+        # pwd's output, then the second prompt
+        first_result = lambda b: b.count(PROMPT) >= 2 and cwd_marker in b.split(PROMPT)[1]
+
+    began = time.monotonic()
+    proc, fd = start(mode, argv, None)
+    try:
+        prompt = read_until(fd, first_prompt, began + TIMEOUT) - began
+    finally:
+        stop(proc, fd, mode)
+
+    began = time.monotonic()
+    proc, fd = start(mode, argv, b"pwd\n")
+    try:
+        result = read_until(fd, first_result, began + TIMEOUT) - began
+    finally:
+        stop(proc, fd, mode)
+    return prompt * 1000, result * 1000
+
+
+def summary(samples):
+    samples = sorted(samples)
+    return {
+        "median_ms": statistics.median(samples),
+        "p90_ms": samples[int(len(samples) * 0.9) - 1],
+        "min_ms": samples[0],
+    }
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description="Time to first prompt and first result")
+    parser.add_argument("--shell", default=os.path.join(here, "..", "myshell"))
+    parser.add_argument("--config", help="policy file passed with -f")
+    parser.add_argument("--runs", type=int, default=200)
+    parser.add_argument("--modes", default="protocol,pipe,tty")
+    parser.add_argument("--json", help="also write results to this file")
+    opts = parser.parse_args()
+
+    shell = os.path.abspath(opts.shell)
+    if not os.access(shell, os.X_OK):
+        sys.exit(f"shell not found: {shell} (run make)")
+    argv = [shell] + (["-f", opts.config] if opts.config else [])
+    # pwd prints the shell's cwd, which is where it is started from
+    cwd_marker = os.getcwd().encode()
+
+    results = []
+    print(f"{'mode':<10} {'first prompt ms':>28} {'first result ms':>28}")
+    print(f"{'':<10} {'median':>9} {'p90':>9} {'min':>8} {'median':>9} {'p90':>9} {'min':>8}")
+    for mode in filter(None, opts.modes.split(",")):
+        prompts, firsts = [], []
+        for _ in range(opts.runs):
+            p, r = measure(mode, argv, cwd_marker)
+            prompts.append(p)
+            firsts.append(r)
+        ps, rs = summary(prompts), summary(firsts)
+        print(f"{mode:<10} {ps['median_ms']:>9.2f} {ps['p90_ms']:>9.2f} {ps['min_ms']:>8.2f} "
+              f"{rs['median_ms']:>9.2f} {rs['p90_ms']:>9.2f} {rs['min_ms']:>8.2f}")
+        results.append(dict(mode=mode, runs=opts.runs, first_prompt=ps, first_result=rs))
+
+    if opts.json:
+        with open(opts.json, "w") as f:
+            json.dump(results, f, indent=2)
+
+
+if __name__ == "__main__":
+    main()
@@ -1,9 +1,11 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/wait.h>
 #include <sys/resource.h>
+#include <sys/time.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <signal.h>
@@ -12,30 +14,385 @@
 #include <dirent.h>
 #include <limits.h>
 #include <time.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sched.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#endif
 
 #define MAX_LINE 1024
 #define MAX_ARGS 64
 #define DELIM " \t\r\n\a"
 #define HISTORY_SIZE 100
 
-// Sandbox configuration
-#define SANDBOX_DIR "/Users/jatin/Desktop/os/sandbox"
-#define SANDBOX_BIN_DIR "/Users/jatin/Desktop/os/sandbox/bin"
-#define CHROOT_DIR "/Users/jatin/Desktop/os/sandbox"  // Chroot to sandbox directory
+// Sandbox configuration (defaults - sandbox.conf overrides these at runtime)
+#define SANDBOX_DIR "/Users/jatin/Desktop/os/sandbox"  // Commands run from SANDBOX_DIR/bin; chroot target
 #define MAX_CPU_TIME 30        // 30 seconds CPU time per process
 #define MAX_MEMORY 100         // 100 MB memory limit
 #define MAX_PROCESSES 20       // Max 20 processes
 #define MAX_OPEN_FILES 64      // Max 64 open files
+#define MAX_WALL_TIME 300      // 5 minutes of wall-clock time per job
+#define KILL_GRACE_MS 2000     // SIGTERM to SIGKILL for a job over its wall time
+#define MAX_BACKGROUND_JOBS 8  // '&' jobs a session may have running at once
 #define USE_CHROOT 1           // Set to 1 to enable chroot (requires root)
 #define USE_SANDBOX_COMMANDS 1 // Use custom sandbox commands instead of system ones
+#define SANDBOX_CONFIG "sandbox.conf"  // Default policy file (see load_policy)
+
+#define MAX_ALIASES 100
+#define MAX_PIPELINE 10
+#define MAX_SESSIONS 256
+
+typedef struct {
+    char *name;
+    char *command;
+} Alias;
+
+// SANDBOX: Command metrics (stats, stats --json and the metrics_file)
+// Latencies are kept in log2 buckets: bucket i counts durations under 2^i
+// microseconds and the last bucket everything slower (about 17 s and up).
+#define HIST_BUCKETS 25
+
+enum { BLOCK_DENYLIST, BLOCK_WHITELIST, BLOCK_PATH, BLOCK_BUILTIN, BLOCK_JOBS, BLOCK_REASONS };
+const char *block_reason_names[BLOCK_REASONS] = { "denylist", "whitelist", "path", "builtin", "jobs" };
+enum { CLASS_FOREGROUND, CLASS_BACKGROUND, SCHED_CLASSES };   // see SchedClass
+const char *sched_class_names[SCHED_CLASSES] = { "foreground", "background" };
+
+typedef struct {
+    char *name;
+    long long count;                // runs started, each pipeline stage counts
+    long long failed;               // runs that exited non-zero
+    long long timeouts;             // runs killed at their wall-clock limit
+    long long launch_sum_us;        // pipeline start to fork
+    long long total_sum_us;         // pipeline start to exit
+    unsigned launch[HIST_BUCKETS];
+    unsigned total[HIST_BUCKETS];
+} CommandMetrics;
+
+typedef struct {
+    CommandMetrics *cmds;           // one per command name seen, grown on demand
+    int ncmds, cap;
+    long long blocked[BLOCK_REASONS];
+    long long bytes_in, bytes_out;  // moved through < and > redirections
+    long long cache_hits, cache_misses;
+    long long class_runs[SCHED_CLASSES];  // commands started per scheduling class
+} Metrics;
+
+// SANDBOX: Phase tracing (see trace_add)
+typedef struct {
+    const char *name;               // phase, always a string literal
+    long long start_ns, dur_ns;     // CLOCK_MONOTONIC
+    int tid;                        // 0 for the shell, else the child's pid
+} TraceEvent;
+
+typedef struct {
+    int size, next;                 // next: slot the following event goes to
+    long long recorded;             // events ever added, to tell a wrapped ring
+    TraceEvent events[];
+} TraceRing;
+
+// A job started with '&'. Whoever waits for any child reaps its processes,
+// so only the process group is kept, with a wall-clock deadline of its own.
+typedef struct {
+    pid_t pgid;
+    long long start_us;
+    long long deadline_us;          // next wall-clock step for it, 0 = none
+    int signals;                    // 1 once SIGTERM went out, 2 after SIGKILL
+    char name[32];                  // its first command, for messages and stats
+} BackgroundJob;
+
+// SANDBOX: Per-session state
+// The terminal shell has exactly one session; --server mode keeps one per
+// connected client. Strings are heap-allocated at their real length so an
+// idle session costs a few hundred bytes, not fixed MAX_LINE tables.
+typedef struct {
+    int fd;                         // client socket, -1 for the terminal
+    char *cwd;                      // working directory between commands
+    Alias aliases[MAX_ALIASES];
+    int alias_count;
+    char *history[HISTORY_SIZE];    // ring buffer, oldest at history_start
+    int history_start;
+    int history_count;
+    int history_total;              // lines ever added (for numbering)
+    time_t start_time;
+    int commands_executed;
+    int commands_blocked;
+    Metrics metrics;                // this session's share of process_metrics
+    long long job_start_us;         // when the running pipeline started
+    pid_t job_pgid;                 // its process group, 0 before the first fork
+    int job_background;
+    long long job_deadline_us;      // next wall-clock step for it, 0 = none
+    int job_signals;                // 1 once SIGTERM went out, 2 after SIGKILL
+    BackgroundJob background[MAX_BACKGROUND_JOBS];
+    int background_count;
+    int cpu_slot;                   // picks its slice of the CPU pool
+    int number;                     // 0 for the terminal, then in connect order
+    int record_started;             // its aliases went to the record file
+    long long record_start_us;      // when the line being recorded started
+    double record_time;             // the same, in seconds since the epoch
+    char *record_cwd;               // where that line runs
+    pid_t stage_pid[MAX_PIPELINE];  // its foreground stages not yet reaped
+    const char *stage_name[MAX_PIPELINE];
+    int stage_count;
+    int redir_in, redir_out;        // its redirections, open until it ends
+    TraceRing *trace;               // phase trace ring, NULL when not tracing
+    long long wait_start_ns;        // when the running job was parked
+    char *capture_key;              // result cache key of the job, if captured
+    size_t capture_key_len;
+    int capture_fd;                 // memfd holding the job's output so far
+    pid_t pending[MAX_PIPELINE];    // foreground children still running
+    int pending_count;
+    pid_t last_pid;                 // last stage of the running foreground job
+    int last_status;                // exit status of the last command line
+    char *list;                     // command list still to run (see list_run)
+    size_t list_pos;                // resume point: just past the parked job
+    int closing;                    // 'exit' seen, close after current line
+    size_t inbuf_len;
+    char inbuf[MAX_LINE];           // partial input line from the client
+} Session;
+
+Session terminal_session = { .fd = -1, .redir_in = -1, .redir_out = -1 };
+Session *session = &terminal_session;  // session the current line belongs to
+Session *sessions[MAX_SESSIONS];         // --server clients
+int server_mode = 0;
+int protocol_mode = 0;
+int proto_cmd_fd = -1;              // protocol mode: where command lines arrive
+int job_control = 0;                // interactive terminal: jobs get the tty
+pid_t subshell_pgid = 0;            // in a ( ) subshell: the group its jobs join
+
+// Exit status conventions for things that never reach exec
+#define STATUS_BLOCKED 126
+#define STATUS_TIMEOUT 124          // killed at its wall-clock limit, as timeout(1)
+
+Metrics process_metrics;            // every session since startup
+
+// SANDBOX: Record a policy rejection for the current session
+void count_blocked(int reason) {
+    session->commands_blocked++;
+    session->last_status = STATUS_BLOCKED;
+    session->metrics.blocked[reason]++;
+    process_metrics.blocked[reason]++;
+}
+
+// Shell-style exit status: the exit code, or 128 + signal number
+int decode_status(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return 1;
+}
+
+long long monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+long long monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+long long monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// SANDBOX: Phase tracing ('trace on', or 'trace = <events>' in sandbox.conf)
+// A traced session keeps its most recent phases - alias expansion, parsing,
+// policy and path checks, cache lookup, fork, the child's setup, command
+// lookup and exec, and the wait - as CLOCK_MONOTONIC spans in a ring, and
+// 'trace dump <file>' writes them as Chrome trace-event JSON for
+// chrome://tracing or Perfetto. A session that is not traced pays one NULL
+// test per phase and never reads the clock.
+#define TRACE_DEFAULT_EVENTS 4096
+#define TRACE_MAX_EVENTS (1 << 20)
+#define TRACE_BEGIN() (session->trace ? monotonic_ns() : 0)
+#define TRACE_END(name, start) \
+    do { if (session->trace && (start)) trace_add(session->trace, name, start, monotonic_ns(), 0); } while (0)
+
+void trace_add(TraceRing *r, const char *name, long long start_ns, long long end_ns, int tid) {
+    TraceEvent *e = &r->events[r->next];
+    e->name = name;
+    e->start_ns = start_ns;
+    e->dur_ns = end_ns - start_ns;
+    e->tid = tid;
+    r->next = (r->next + 1) % r->size;
+    r->recorded++;
+}
+
+// Start tracing s with a fresh ring (events <= 0 stops tracing)
+int trace_start(Session *s, int events) {
+    free(s->trace);
+    s->trace = NULL;
+    if (events <= 0) return 0;
+    s->trace = calloc(1, sizeof(TraceRing) + events * sizeof(TraceEvent));
+    if (!s->trace) return -1;
+    s->trace->size = events;
+    return 0;
+}
+
+// Child side of a traced spawn: the child writes when its setup started
+// and when the command lookup began and ended down a close-on-exec pipe;
+// EOF on that pipe is the moment exec replaced it
+void trace_child(TraceRing *r, int fd, pid_t pid) {
+    long long stamps[3];
+    ssize_t got = 0, n;
+    while (got < (ssize_t)sizeof(stamps) &&
+           ((n = read(fd, (char *)stamps + got, sizeof(stamps) - got)) > 0 || (n < 0 && errno == EINTR))) {
+        if (n > 0) got += n;
+    }
+    char c;
+    while ((n = read(fd, &c, 1)) > 0 || (n < 0 && errno == EINTR)) {}
+    long long exec_done = monotonic_ns();
+    if (got != (ssize_t)sizeof(stamps)) return;   // died before the lookup
+    trace_add(r, "child_setup", stamps[0], stamps[1], pid);
+    trace_add(r, "find_command_path", stamps[1], stamps[2], pid);
+    trace_add(r, "exec", stamps[2], exec_done, pid);
+}
+
+// Chrome trace-event JSON: complete ("X") events in microseconds
+int trace_dump(Session *s, const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) return -1;
+    TraceRing *r = s->trace;
+    int pid = getpid(), tid = s->fd < 0 ? 0 : s->fd;
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                "\"args\":{\"name\":\"session\"}}", pid, tid);
+    int count = r->recorded < r->size ? (int)r->recorded : r->size;
+    int first = r->recorded < r->size ? 0 : r->next;
+    for (int i = 0; i < count; i++) {
+        TraceEvent *e = &r->events[(first + i) % r->size];
+        fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%lld.%03lld,\"dur\":%lld.%03lld}",
+                e->name, pid, e->tid ? e->tid : tid, e->start_ns / 1000, e->start_ns % 1000,
+                e->dur_ns / 1000, e->dur_ns % 1000);
+    }
+    fprintf(fp, "\n]}\n");
+    return fclose(fp);
+}
+
+int hist_bucket(long long us) {
+    int b = 0;
+    while (b < HIST_BUCKETS - 1 && us >= (1LL << b)) b++;
+    return b;
+}
+
+CommandMetrics *metrics_command(Metrics *m, const char *name) {
+    for (int i = 0; i < m->ncmds; i++) {
+        if (strcmp(m->cmds[i].name, name) == 0) return &m->cmds[i];
+    }
+    if (m->ncmds == m->cap) {
+        int cap = m->cap ? m->cap * 2 : 8;
+        CommandMetrics *grown = realloc(m->cmds, cap * sizeof(CommandMetrics));
+        if (!grown) return NULL;
+        m->cmds = grown;
+        m->cap = cap;
+    }
+    CommandMetrics *c = &m->cmds[m->ncmds];
+    memset(c, 0, sizeof(*c));
+    if ((c->name = strdup(name)) == NULL) return NULL;
+    m->ncmds++;
+    return c;
+}
+
+// Count one run of name in the session and the process; a launch time of
+// -1 means it never forked (a builtin or a result cache hit)
+void metrics_start(Session *s, const char *name, long long launch_us) {
+    Metrics *ms[2] = { &s->metrics, &process_metrics };
+    for (int i = 0; i < 2; i++) {
+        CommandMetrics *c = metrics_command(ms[i], name);
+        if (!c) continue;
+        c->count++;
+        if (launch_us >= 0) {
+            c->launch_sum_us += launch_us;
+            c->launch[hist_bucket(launch_us)]++;
+        }
+    }
+}
+
+void metrics_finish(Session *s, const char *name, long long total_us, int status) {
+    Metrics *ms[2] = { &s->metrics, &process_metrics };
+    for (int i = 0; i < 2; i++) {
+        CommandMetrics *c = metrics_command(ms[i], name);
+        if (!c) continue;
+        if (status != 0) c->failed++;
+        c->total_sum_us += total_us;
+        c->total[hist_bucket(total_us)]++;
+    }
+}
+
+// A stage was forked; foreground ones are timed again when reaped
+void metrics_spawned(pid_t pid, const char *name, int background) {
+    metrics_start(session, name, monotonic_us() - session->job_start_us);
+    session->metrics.class_runs[background ? CLASS_BACKGROUND : CLASS_FOREGROUND]++;
+    process_metrics.class_runs[background ? CLASS_BACKGROUND : CLASS_FOREGROUND]++;
+    CommandMetrics *c = metrics_command(&process_metrics, name);
+    if (c && !background && session->stage_count < MAX_PIPELINE) {
+        session->stage_pid[session->stage_count] = pid;
+        session->stage_name[session->stage_count++] = c->name;
+    }
+}
+
+void metrics_reaped(Session *s, pid_t pid, int status) {
+    for (int i = 0; i < s->stage_count; i++) {
+        if (s->stage_pid[i] != pid) continue;
+        metrics_finish(s, s->stage_name[i], monotonic_us() - s->job_start_us, decode_status(status));
+        s->stage_pid[i] = s->stage_pid[--s->stage_count];
+        s->stage_name[i] = s->stage_name[s->stage_count];
+        return;
+    }
+}
+
+// The job hit its wall-clock limit: charge every stage still running
+void metrics_timed_out_command(Session *s, const char *name) {
+    Metrics *ms[2] = { &s->metrics, &process_metrics };
+    for (int k = 0; k < 2; k++) {
+        CommandMetrics *c = metrics_command(ms[k], name);
+        if (c) c->timeouts++;
+    }
+}
+
+void metrics_timed_out(Session *s) {
+    for (int i = 0; i < s->stage_count; i++) metrics_timed_out_command(s, s->stage_name[i]);
+}
+
+// A command the shell answered itself: a builtin or a result cache hit
+void metrics_served(const char *name, int status) {
+    metrics_start(session, name, -1);
+    metrics_finish(session, name, monotonic_us() - session->job_start_us, status);
+}
 
-char history[HISTORY_SIZE][MAX_LINE];
-int history_count = 0;
-time_t sandbox_start_time;
-int commands_executed = 0;
-int commands_blocked = 0;
+// Count what went through a job's redirections (the fds share their file
+// offset with the command's) and close them
+void metrics_redirect(Session *s, int in_fd, int out_fd) {
+    off_t n;
+    if (in_fd >= 0) {
+        if ((n = lseek(in_fd, 0, SEEK_CUR)) > 0) {
+            s->metrics.bytes_in += n;
+            process_metrics.bytes_in += n;
+        }
+        close(in_fd);
+    }
+    if (out_fd >= 0) {
+        if ((n = lseek(out_fd, 0, SEEK_CUR)) > 0) {
+            s->metrics.bytes_out += n;
+            process_metrics.bytes_out += n;
+        }
+        close(out_fd);
+    }
+}
 
-// Command whitelist - only these commands are allowed
+// Default command whitelist - only these commands are allowed
+// (replaced by 'allow' lines in the config file)
 const char *allowed_commands[] = {
     "ls", "cat", "display", "pwd", "grep", "touch", 
     "mkdir", "rmdir", "cp", "mv", "head", "tail",
@@ -44,7 +401,8 @@ const char *allowed_commands[] = {
     NULL
 };
 
-// Dangerous commands that are explicitly blocked
+// Default dangerous commands that are explicitly blocked
+// (replaced by 'deny' lines in the config file)
 const char *blocked_commands[] = {
     "sudo", "su", "rm", "mkfs", "dd", "reboot", 
     "shutdown", "halt", "init", "killall", "pkill",
@@ -52,66 +410,604 @@ const char *blocked_commands[] = {
     NULL
 };
 
-void add_history_command(char *line) {
-    if (history_count < HISTORY_SIZE) {
-        strcpy(history[history_count++], line);
-    } else {
-        for (int i = 1; i < HISTORY_SIZE; i++) {
-            strcpy(history[i-1], history[i]);
+// SANDBOX: Policy loaded from the config file
+// Everything lives in one allocation: the struct plus a string pool that the
+// root, bin dir and command names point into. A reload builds a new policy
+// and swaps the pointer, so a command never sees a half-updated policy.
+#define MAX_POLICY_COMMANDS 64
+#define MAX_COMMAND_LIMITS 32
+#define POLICY_POOL_SIZE 4096
+
+typedef struct {
+    const char *name;      // NULL for the session defaults
+    int cpu_time;          // seconds, 0 = use default
+    int memory;            // MB, 0 = use default
+    int processes;         // 0 = use default
+    int open_files;        // 0 = use default
+    int wall_time;         // seconds, 0 = use default (no limit in the defaults)
+} CommandLimits;
+
+// SANDBOX: Scheduling per command class (sched_foreground, sched_background)
+// Each class can set a nice value, a CPU scheduling policy and an I/O
+// priority; whatever is left unset is inherited from the shell.
+enum { SCHED_KEEP, SCHED_CLASS_OTHER, SCHED_CLASS_BATCH, SCHED_CLASS_IDLE };
+const char *sched_policy_names[] = { "keep", "other", "batch", "idle" };
+enum { IOPRIO_KEEP, IOPRIO_RT, IOPRIO_BE, IOPRIO_IDLE };  // the kernel's IOPRIO_CLASS_*
+const char *ioprio_class_names[] = { "keep", "rt", "be", "idle" };
+#define NICE_KEEP 100
+#define MAX_POLICY_CPUS 256
+
+typedef struct {
+    int nice;              // -20..19, NICE_KEEP = the shell's
+    int policy;            // SCHED_KEEP or SCHED_CLASS_*
+    int ioprio_class;      // IOPRIO_KEEP or IOPRIO_*
+    int ioprio_level;      // 0 (highest) to 7 for rt and be
+} SchedClass;
+
+typedef struct {
+    const char *root;                  // sandbox directory
+    const char *root_resolved;         // realpath() of root, cached at load
+    const char *bin_dir;               // where sandbox commands live
+    int use_chroot;
+    int cache_mb;                      // result cache budget, 0 = off
+    const char *metrics_file;          // Prometheus text file, NULL = off
+    int metrics_interval;              // seconds between rewrites of it
+    int trace_events;                  // trace ring size for new sessions, 0 = off
+    const char *state_file;            // terminal session snapshot, NULL = off
+    const char *snapshot_dir;          // sandbox_snapshot storage, outside root
+    const char *record_file;           // every input line with its timing, NULL = off
+    CommandLimits defaults;
+    SchedClass sched[SCHED_CLASSES];
+    short cpus[MAX_POLICY_CPUS];       // CPU pool for commands, empty = any CPU
+    int cpu_count;
+    int cpus_per_session;              // each session's slice of it, 0 = all
+    CommandLimits limits[MAX_COMMAND_LIMITS];
+    int limit_count;
+    const char *allowed[MAX_POLICY_COMMANDS + 1];
+    const char *blocked[MAX_POLICY_COMMANDS + 1];
+    size_t pool_used;
+    char pool[POLICY_POOL_SIZE];
+} SandboxPolicy;
+
+SandboxPolicy *policy = NULL;
+char config_path[PATH_MAX] = SANDBOX_CONFIG;
+volatile sig_atomic_t reload_requested = 0;
+
+void metrics_tick(int force);
+char *banner_text;                  // rendered banner, dropped on reload
+size_t banner_len;
+
+// Result cache (see below): shrunk on reload, reported by stats
+size_t cache_bytes;
+int cache_entries;
+size_t cache_budget(void);
+void cache_trim(size_t budget);
+
+const char *policy_intern(SandboxPolicy *p, const char *str) {
+    size_t len = strlen(str) + 1;
+    if (p->pool_used + len > POLICY_POOL_SIZE) {
+        return NULL;
+    }
+    char *dst = p->pool + p->pool_used;
+    memcpy(dst, str, len);
+    p->pool_used += len;
+    return dst;
+}
+
+// Append whitespace-separated command names to a NULL-terminated list
+int policy_add_commands(SandboxPolicy *p, const char **list, char *names) {
+    int n = 0;
+    while (list[n] != NULL) n++;
+    char *saveptr;
+    for (char *tok = strtok_r(names, DELIM, &saveptr); tok; tok = strtok_r(NULL, DELIM, &saveptr)) {
+        if (n >= MAX_POLICY_COMMANDS || (list[n] = policy_intern(p, tok)) == NULL) {
+            return -1;
         }
-        strcpy(history[HISTORY_SIZE-1], line);
+        list[++n] = NULL;
     }
+    return 0;
 }
 
-void print_history() {
-    HIST_ENTRY **the_list = history_list();
-    if (the_list) {
-        for (int i = 0; the_list[i]; i++) {
-            printf("%d %s\n", i + history_base, the_list[i]->line);
+// Parse "cpu=30 memory=100 processes=20 open_files=64 wall=60" into limits
+int policy_parse_limits(CommandLimits *l, char *spec) {
+    char *saveptr;
+    for (char *tok = strtok_r(spec, DELIM, &saveptr); tok; tok = strtok_r(NULL, DELIM, &saveptr)) {
+        char *eq = strchr(tok, '=');
+        if (!eq) return -1;
+        *eq = '\0';
+        int value = atoi(eq + 1);
+        if (value <= 0) return -1;
+        if (strcmp(tok, "cpu") == 0) l->cpu_time = value;
+        else if (strcmp(tok, "memory") == 0) l->memory = value;
+        else if (strcmp(tok, "processes") == 0) l->processes = value;
+        else if (strcmp(tok, "open_files") == 0) l->open_files = value;
+        else if (strcmp(tok, "wall") == 0) l->wall_time = value;
+        else return -1;
+    }
+    return 0;
+}
+
+// Parse "nice=10 sched=batch ioprio=be/7" into a scheduling class
+int policy_parse_sched(SchedClass *c, char *spec) {
+    char *saveptr;
+    for (char *tok = strtok_r(spec, DELIM, &saveptr); tok; tok = strtok_r(NULL, DELIM, &saveptr)) {
+        char *eq = strchr(tok, '=');
+        if (!eq) return -1;
+        *eq = '\0';
+        char *value = eq + 1, *end;
+        if (strcmp(tok, "nice") == 0) {
+            long n = strtol(value, &end, 10);
+            if (end == value || *end || n < -20 || n > 19) return -1;
+            c->nice = (int)n;
+        } else if (strcmp(tok, "sched") == 0) {
+            int k = SCHED_CLASS_IDLE;
+            while (k > SCHED_KEEP && strcmp(value, sched_policy_names[k]) != 0) k--;
+            if (k == SCHED_KEEP) return -1;
+            c->policy = k;
+        } else if (strcmp(tok, "ioprio") == 0) {
+            // idle, or be/N and rt/N with N from 0 (highest) to 7
+            char *slash = strchr(value, '/');
+            if (slash) *slash = '\0';
+            int k = IOPRIO_IDLE;
+            while (k > IOPRIO_KEEP && strcmp(value, ioprio_class_names[k]) != 0) k--;
+            if (k == IOPRIO_KEEP || (k == IOPRIO_IDLE) != !slash) return -1;
+            c->ioprio_class = k;
+            c->ioprio_level = 0;
+            if (slash) {
+                long n = strtol(slash + 1, &end, 10);
+                if (end == slash + 1 || *end || n < 0 || n > 7) return -1;
+                c->ioprio_level = (int)n;
+            }
+        } else {
+            return -1;
         }
     }
+    return 0;
 }
 
-#define MAX_ALIASES 100
+// Parse a CPU list such as "0-3,8,10-11" into the policy's CPU pool
+int policy_parse_cpus(SandboxPolicy *p, char *list) {
+    char *saveptr;
+    p->cpu_count = 0;
+    for (char *tok = strtok_r(list, ", \t", &saveptr); tok; tok = strtok_r(NULL, ", \t", &saveptr)) {
+        char *end;
+        long lo = strtol(tok, &end, 10), hi = lo;
+        if (end == tok) return -1;
+        if (*end == '-') {
+            char *start = end + 1;
+            hi = strtol(start, &end, 10);
+            if (end == start) return -1;
+        }
+        if (*end || lo < 0 || hi < lo || hi >= 1024) return -1;
+        for (long cpu = lo; cpu <= hi; cpu++) {
+            if (p->cpu_count == MAX_POLICY_CPUS) return -1;
+            p->cpus[p->cpu_count++] = (short)cpu;
+        }
+    }
+    return 0;
+}
+
+// A path from the config file: relative ones are taken from the config
+// file's directory, which (unlike the cwd) stays put between reloads
+char *config_relative(char *buf, size_t size, const char *value) {
+    const char *slash = strrchr(config_path, '/');
+    if (*value == '/' || !slash) snprintf(buf, size, "%s", value);
+    else snprintf(buf, size, "%.*s/%s", (int)(slash - config_path), config_path, value);
+    return buf;
+}
+
+char *trim(char *s) {
+    while (*s == ' ' || *s == '\t') s++;
+    char *end = s + strlen(s);
+    while (end > s && strchr(" \t\r\n", end[-1])) *--end = '\0';
+    return s;
+}
+
+// Build a policy from the compiled-in defaults plus the config file, if any.
+// Config format (one setting per line, '#' starts a comment):
+//   root = /path/to/sandbox          bin_dir = /path/to/sandbox/bin
+//   chroot = on|off
+//   cpu_time = 30   memory = 100   processes = 20   open_files = 64
+//   wall_time = 300                  (seconds per job, 0 = off)
+//   allow = ls cat grep ...          deny = sudo rm ...
+//   limit = sort cpu=60 memory=200 wall=600
+//   sched_foreground = nice=0        sched_background = nice=10 sched=batch ioprio=be/7
+//   cpus = 0-7   cpus_per_session = 2
+//   cache = 16                       (MB for cached command output, 0 = off)
+//   metrics_file = /path/x.prom      metrics_interval = 15
+//   trace = 4096                     (phase trace events per session, 0 = off)
+//   state_file = .sandbox_state      (aliases, history and cwd kept across runs)
+//   snapshot_dir = /path/snapshots   (sandbox_snapshot; default <root>.snapshots)
+//   record = /path/sessions.jsonl    (input lines with status and latency)
+// Relative paths are taken from the config file's directory. A missing file
+// means the defaults at startup; on reload (must_exist) it is an error.
+// Returns NULL (and prints why) if the file cannot be read or parsed.
+SandboxPolicy *load_policy(const char *path, int must_exist) {
+    SandboxPolicy *p = calloc(1, sizeof(SandboxPolicy));
+    if (!p) return NULL;
+
+    const char *root = SANDBOX_DIR, *bin_dir = NULL;
+    char root_buf[PATH_MAX], bin_buf[PATH_MAX];
+    p->use_chroot = USE_CHROOT;
+    p->defaults.cpu_time = MAX_CPU_TIME;
+    p->defaults.memory = MAX_MEMORY;
+    p->defaults.processes = MAX_PROCESSES;
+    p->defaults.open_files = MAX_OPEN_FILES;
+    p->defaults.wall_time = MAX_WALL_TIME;
+    p->metrics_interval = 15;
+    // Background jobs yield to interactive commands unless configured
+    p->sched[CLASS_FOREGROUND] = (SchedClass){ NICE_KEEP, SCHED_KEEP, IOPRIO_KEEP, 0 };
+    p->sched[CLASS_BACKGROUND] = (SchedClass){ 10, SCHED_CLASS_BATCH, IOPRIO_BE, 7 };
+    int have_allow = 0, have_deny = 0;
+
+    FILE *fp = fopen(path, "r");
+    if (!fp && (must_exist || errno != ENOENT)) {
+        fprintf(stderr, "shell: %s: %s\n", path, strerror(errno));
+        free(p);
+        return NULL;
+    }
+    if (fp) {
+        char line[MAX_LINE];
+        int line_num = 0;
+        while (fgets(line, sizeof(line), fp)) {
+            line_num++;
+            char *hash = strchr(line, '#');
+            if (hash) *hash = '\0';
+            char *key = trim(line);
+            if (*key == '\0') continue;
+            char *eq = strchr(key, '=');
+            if (!eq) goto bad_line;
+            *eq = '\0';
+            char *value = trim(eq + 1);
+            key = trim(key);
+
+            if (strcmp(key, "root") == 0) {
+                root = config_relative(root_buf, sizeof(root_buf), value);
+            } else if (strcmp(key, "bin_dir") == 0) {
+                bin_dir = config_relative(bin_buf, sizeof(bin_buf), value);
+            } else if (strcmp(key, "chroot") == 0) {
+                // Anything but on/off is a mistake, not a quiet "off"
+                if (strcmp(value, "on") == 0 || strcmp(value, "1") == 0) p->use_chroot = 1;
+                else if (strcmp(value, "off") == 0 || strcmp(value, "0") == 0) p->use_chroot = 0;
+                else goto bad_line;
+            } else if (strcmp(key, "cpu_time") == 0 && atoi(value) > 0) {
+                p->defaults.cpu_time = atoi(value);
+            } else if (strcmp(key, "memory") == 0 && atoi(value) > 0) {
+                p->defaults.memory = atoi(value);
+            } else if (strcmp(key, "processes") == 0 && atoi(value) > 0) {
+                p->defaults.processes = atoi(value);
+            } else if (strcmp(key, "open_files") == 0 && atoi(value) > 0) {
+                p->defaults.open_files = atoi(value);
+            } else if (strcmp(key, "wall_time") == 0 && atoi(value) >= 0) {
+                p->defaults.wall_time = atoi(value);
+            } else if (strcmp(key, "cache") == 0 && atoi(value) >= 0) {
+                p->cache_mb = atoi(value);
+            } else if (strcmp(key, "metrics_file") == 0 && *value) {
+                char file[PATH_MAX];
+                if ((p->metrics_file = policy_intern(p, config_relative(file, sizeof(file), value))) == NULL) goto bad_line;
+            } else if (strcmp(key, "state_file") == 0 && *value) {
+                char file[PATH_MAX];
+                if ((p->state_file = policy_intern(p, config_relative(file, sizeof(file), value))) == NULL) goto bad_line;
+            } else if (strcmp(key, "snapshot_dir") == 0 && *value) {
+                char file[PATH_MAX];
+                if ((p->snapshot_dir = policy_intern(p, config_relative(file, sizeof(file), value))) == NULL) goto bad_line;
+            } else if (strcmp(key, "record") == 0 && *value) {
+                char file[PATH_MAX];
+                if ((p->record_file = policy_intern(p, config_relative(file, sizeof(file), value))) == NULL) goto bad_line;
+            } else if (strcmp(key, "metrics_interval") == 0 && atoi(value) > 0) {
+                p->metrics_interval = atoi(value);
+            } else if (strcmp(key, "trace") == 0 && atoi(value) >= 0 && atoi(value) <= TRACE_MAX_EVENTS) {
+                p->trace_events = atoi(value);
+            } else if (strcmp(key, "allow") == 0) {
+                have_allow = 1;
+                if (policy_add_commands(p, p->allowed, value) < 0) goto bad_line;
+            } else if (strcmp(key, "deny") == 0) {
+                have_deny = 1;
+                if (policy_add_commands(p, p->blocked, value) < 0) goto bad_line;
+            } else if (strcmp(key, "sched_foreground") == 0 || strcmp(key, "sched_background") == 0) {
+                // The line replaces the class's defaults entirely
+                SchedClass *sc = &p->sched[key[6] == 'f' ? CLASS_FOREGROUND : CLASS_BACKGROUND];
+                *sc = (SchedClass){ NICE_KEEP, SCHED_KEEP, IOPRIO_KEEP, 0 };
+                if (policy_parse_sched(sc, value) < 0) goto bad_line;
+            } else if (strcmp(key, "cpus") == 0) {
+                if (policy_parse_cpus(p, value) < 0) goto bad_line;
+            } else if (strcmp(key, "cpus_per_session") == 0 && atoi(value) >= 0) {
+                p->cpus_per_session = atoi(value);
+            } else if (strcmp(key, "limit") == 0) {
+                char *saveptr;
+                char *name = strtok_r(value, DELIM, &saveptr);
+                if (!name || p->limit_count >= MAX_COMMAND_LIMITS) goto bad_line;
+                CommandLimits *l = &p->limits[p->limit_count];
+                if ((l->name = policy_intern(p, name)) == NULL) goto bad_line;
+                char *spec = strtok_r(NULL, "", &saveptr);
+                if (spec && policy_parse_limits(l, spec) < 0) goto bad_line;
+                p->limit_count++;
+            } else {
+                goto bad_line;
+            }
+            continue;
+bad_line:
+            fprintf(stderr, "shell: %s:%d: invalid setting '%s'\n", path, line_num, key);
+            fclose(fp);
+            free(p);
+            return NULL;
+        }
+        fclose(fp);
+    }
+
+    // Fall back to the compiled-in lists for anything the file didn't set;
+    // they are static, so the table points at them instead of copying
+    for (int i = 0; !have_allow && allowed_commands[i] != NULL; i++) {
+        p->allowed[i] = allowed_commands[i];
+    }
+    for (int i = 0; !have_deny && blocked_commands[i] != NULL; i++) {
+        p->blocked[i] = blocked_commands[i];
+    }
+
+    // Create the sandbox directory the first time, so it resolves right away
+    char resolved[PATH_MAX];
+    int found = realpath(root, resolved) != NULL;
+    if (!found && errno == ENOENT && mkdir(root, 0755) == 0) {
+        found = realpath(root, resolved) != NULL;
+    }
+    p->root = policy_intern(p, root);
+    p->root_resolved = policy_intern(p, found ? resolved : root);
+    if (bin_dir == NULL) {
+        snprintf(bin_buf, sizeof(bin_buf), "%.*s/bin", PATH_MAX - 5, root);
+        bin_dir = bin_buf;
+    }
+    p->bin_dir = policy_intern(p, bin_dir);
+    if (p->snapshot_dir == NULL && p->root_resolved) {
+        snprintf(bin_buf, sizeof(bin_buf), "%.*s.snapshots", PATH_MAX - 11, p->root_resolved);
+        p->snapshot_dir = policy_intern(p, bin_buf);
+    }
+    if (!p->root || !p->root_resolved || !p->bin_dir || !p->snapshot_dir) {
+        fprintf(stderr, "shell: %s: policy too large\n", path);
+        free(p);
+        return NULL;
+    }
+    return p;
+}
+
+// Look up the limits for a command, falling back to the session defaults
+CommandLimits command_limits(const char *cmd) {
+    CommandLimits l = policy->defaults;
+    for (int i = 0; cmd && i < policy->limit_count; i++) {
+        const CommandLimits *o = &policy->limits[i];
+        if (strcmp(o->name, cmd) == 0) {
+            if (o->cpu_time) l.cpu_time = o->cpu_time;
+            if (o->memory) l.memory = o->memory;
+            if (o->processes) l.processes = o->processes;
+            if (o->open_files) l.open_files = o->open_files;
+            if (o->wall_time) l.wall_time = o->wall_time;
+            break;
+        }
+    }
+    return l;
+}
+
+void sighup_handler(int sig) {
+    reload_requested = 1;
+}
+
+// SANDBOX: Swap in a freshly parsed policy (called between commands)
+void reload_policy() {
+    reload_requested = 0;
+    SandboxPolicy *fresh = load_policy(config_path, 1);
+    if (!fresh) {
+        fprintf(stderr, "\033[1;33m[SANDBOX]\033[0m Policy reload failed, keeping current policy\n");
+        return;
+    }
+    SandboxPolicy *old = policy;
+    policy = fresh;
+    free(old);
+    free(banner_text);      // limits and root may have changed
+    banner_text = NULL;
+    cache_trim(cache_budget());
+    fprintf(stderr, "\033[1;36m[SANDBOX]\033[0m Policy reloaded from %s\n", config_path);
+}
+
+// SANDBOX: Session snapshot (state_file)
+// The terminal session's aliases, history and working directory are saved
+// on exit and mapped read-only at the next start. Restored strings point
+// straight into the mapping and are only copied when add_alias or a new
+// history entry replaces them, so a restore costs one mmap and a check of
+// the offset table however much the snapshot holds.
+//
+// Layout, in the writer's byte order (a foreign one fails the version
+// check): a StateHeader, one offset per string - alias names and commands
+// in pairs, then history oldest first - and the NUL-terminated strings.
+#define STATE_MAGIC "SBXSTAT"
+#define STATE_VERSION 1
 
 typedef struct {
-    char name[MAX_LINE];
-    char command[MAX_LINE];
-} Alias;
+    char magic[8];              // STATE_MAGIC with its NUL
+    uint32_t version;
+    uint32_t size;              // whole file, so a truncated one is caught
+    uint32_t alias_count;
+    uint32_t history_count;
+    uint32_t history_total;
+    uint32_t cwd;               // offset of the cwd string, 0 = none
+    uint32_t strings[];
+} StateHeader;
+
+const char *state_map;          // loaded snapshot, mapped until the process exits
+size_t state_map_size;
+
+// free() for session strings that may still live in the snapshot
+void state_release(char *str) {
+    if (!state_map || str < state_map || str >= state_map + state_map_size) free(str);
+}
+
+// Map the snapshot and point the session at it; a missing, foreign or
+// damaged file only means starting empty
+void state_load(Session *s) {
+    const char *path = policy->state_file;
+    int fd = path ? open(path, O_RDONLY | O_CLOEXEC) : -1;
+    if (fd < 0) return;
+    struct stat st = { 0 };
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(StateHeader) && st.st_size <= UINT32_MAX) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+
+    const StateHeader *h = map;
+    const char *base = map;
+    size_t size = st.st_size, table_end = 0;
+    int ok = map != MAP_FAILED && memcmp(h->magic, STATE_MAGIC, sizeof(h->magic)) == 0
+             && h->version == STATE_VERSION && h->size == size
+             && h->alias_count <= MAX_ALIASES && h->history_count <= HISTORY_SIZE;
+    if (ok) {
+        // Every offset lands past the table and the file ends in a NUL, so
+        // every string terminates inside the mapping
+        table_end = sizeof(StateHeader) + (2 * h->alias_count + h->history_count) * sizeof(uint32_t);
+        ok = table_end <= size && base[size - 1] == '\0'
+             && (h->cwd == 0 || (h->cwd >= table_end && h->cwd < size));
+        for (uint32_t i = 0; ok && i < 2 * h->alias_count + h->history_count; i++) {
+            ok = h->strings[i] >= table_end && h->strings[i] < size;
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "\033[1;33m[SANDBOX]\033[0m %s: not a session snapshot, starting fresh\n", path);
+        if (map != MAP_FAILED) munmap(map, size);
+        return;
+    }
+    state_map = base;
+    state_map_size = size;
+
+    for (uint32_t i = 0; i < h->alias_count; i++) {
+        s->aliases[i].name = (char *)base + h->strings[2 * i];
+        s->aliases[i].command = (char *)base + h->strings[2 * i + 1];
+    }
+    s->alias_count = h->alias_count;
+    const uint32_t *history = h->strings + 2 * h->alias_count;
+    for (uint32_t i = 0; i < h->history_count; i++) {
+        s->history[i] = (char *)base + history[i];
+    }
+    s->history_start = 0;
+    s->history_count = h->history_count;
+    s->history_total = h->history_total > h->history_count ? h->history_total : h->history_count;
+
+    // Go back to the old directory only while it is still inside the sandbox
+    const char *root = policy->root_resolved, *cwd = base + h->cwd;
+    size_t n = strlen(root);
+    if (h->cwd && strncmp(cwd, root, n) == 0 && (cwd[n] == '\0' || cwd[n] == '/' || n == 1)
+        && chdir(cwd) != 0) {
+        // removed since; stay where we started
+    }
+}
+
+uint32_t state_put(char *buf, size_t *off, const char *str) {
+    size_t len = strlen(str) + 1;
+    memcpy(buf + *off, str, len);
+    *off += len;
+    return *off - len;
+}
+
+// Write the snapshot beside the old one and rename it into place, so the
+// copy this process has mapped is never changed under it
+void state_save(Session *s) {
+    const char *path = policy->state_file;
+    if (!path) return;
+    char cwd[PATH_MAX];
+    int have_cwd = getcwd(cwd, sizeof(cwd)) != NULL;
+    uint32_t nstrings = 2 * s->alias_count + s->history_count;
+    size_t table_end = sizeof(StateHeader) + nstrings * sizeof(uint32_t);
+    size_t size = table_end + (have_cwd ? strlen(cwd) + 1 : 0);
+    for (int i = 0; i < s->alias_count; i++) {
+        size += strlen(s->aliases[i].name) + strlen(s->aliases[i].command) + 2;
+    }
+    for (int i = 0; i < s->history_count; i++) {
+        size += strlen(s->history[(s->history_start + i) % HISTORY_SIZE]) + 1;
+    }
+    char *buf = size <= UINT32_MAX ? calloc(1, size) : NULL;
+    if (!buf) return;
+
+    StateHeader *h = (StateHeader *)buf;
+    memcpy(h->magic, STATE_MAGIC, sizeof(h->magic));
+    h->version = STATE_VERSION;
+    h->size = size;
+    h->alias_count = s->alias_count;
+    h->history_count = s->history_count;
+    h->history_total = s->history_total;
+    size_t off = table_end;
+    uint32_t *slot = h->strings;
+    for (int i = 0; i < s->alias_count; i++) {
+        *slot++ = state_put(buf, &off, s->aliases[i].name);
+        *slot++ = state_put(buf, &off, s->aliases[i].command);
+    }
+    for (int i = 0; i < s->history_count; i++) {
+        *slot++ = state_put(buf, &off, s->history[(s->history_start + i) % HISTORY_SIZE]);
+    }
+    if (have_cwd) h->cwd = state_put(buf, &off, cwd);
+
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    ssize_t written = fd < 0 ? -1 : write(fd, buf, size);
+    if (fd >= 0) close(fd);
+    if (written != (ssize_t)size || rename(tmp, path) != 0) {
+        fprintf(stderr, "shell: %s: cannot save session\n", path);
+        unlink(tmp);
+    }
+    free(buf);
+}
+
+void add_history_command(char *line) {
+    int slot = (session->history_start + session->history_count) % HISTORY_SIZE;
+    if (session->history_count < HISTORY_SIZE) {
+        session->history_count++;
+    } else {
+        state_release(session->history[slot]);
+        session->history_start = (session->history_start + 1) % HISTORY_SIZE;
+    }
+    session->history[slot] = strdup(line);
+    session->history_total++;
+}
 
-Alias aliases[MAX_ALIASES];
-int alias_count = 0;
+void print_history() {
+    int first = session->history_total - session->history_count + 1;
+    for (int i = 0; i < session->history_count; i++) {
+        printf("%d %s\n", first + i, session->history[(session->history_start + i) % HISTORY_SIZE]);
+    }
+}
 
 void add_alias(char *name, char *command) {
-    for(int i = 0; i < alias_count; i++) {
+    Alias *aliases = session->aliases;
+    for(int i = 0; i < session->alias_count; i++) {
         if(strcmp(aliases[i].name, name) == 0) {
-            strcpy(aliases[i].command, command);
+            state_release(aliases[i].command);
+            aliases[i].command = strdup(command);
             return;
         }
     }
-    if (alias_count < MAX_ALIASES) {
-        strcpy(aliases[alias_count].name, name);
-        strcpy(aliases[alias_count].command, command);
-        alias_count++;
+    if (session->alias_count < MAX_ALIASES) {
+        aliases[session->alias_count].name = strdup(name);
+        aliases[session->alias_count].command = strdup(command);
+        session->alias_count++;
     }
 }
 
 void remove_alias(char *name) {
-    for (int i = 0; i < alias_count; i++) {
+    Alias *aliases = session->aliases;
+    for (int i = 0; i < session->alias_count; i++) {
         if (strcmp(aliases[i].name, name) == 0) {
-            for (int j = i; j < alias_count - 1; j++) {
+            state_release(aliases[i].name);
+            state_release(aliases[i].command);
+            for (int j = i; j < session->alias_count - 1; j++) {
                 aliases[j] = aliases[j+1];
             }
-            alias_count--;
+            session->alias_count--;
             break;
         }
     }
 }
 
 char* check_alias(char *name) {
-    for (int i = 0; i < alias_count; i++) {
-        if (strcmp(aliases[i].name, name) == 0)
-            return aliases[i].command;
+    for (int i = 0; i < session->alias_count; i++) {
+        if (strcmp(session->aliases[i].name, name) == 0)
+            return session->aliases[i].command;
     }
     return NULL;
 }
@@ -121,34 +1017,74 @@ void sigchld_handler(int sig) {
 }
 
 // SANDBOX: Setup resource limits for child processes
-void setup_resource_limits() {
+void setup_resource_limits(const char *cmd) {
     struct rlimit limit;
+    CommandLimits l = command_limits(cmd);
     
     // Limit CPU time
-    limit.rlim_cur = MAX_CPU_TIME;
-    limit.rlim_max = MAX_CPU_TIME;
+    limit.rlim_cur = l.cpu_time;
+    limit.rlim_max = l.cpu_time;
     setrlimit(RLIMIT_CPU, &limit);
     
     // Limit memory usage
-    limit.rlim_cur = MAX_MEMORY * 1024 * 1024;
-    limit.rlim_max = MAX_MEMORY * 1024 * 1024;
+    limit.rlim_cur = (rlim_t)l.memory * 1024 * 1024;
+    limit.rlim_max = (rlim_t)l.memory * 1024 * 1024;
     setrlimit(RLIMIT_AS, &limit);
     
     // Limit number of open files
-    limit.rlim_cur = MAX_OPEN_FILES;
-    limit.rlim_max = MAX_OPEN_FILES;
+    limit.rlim_cur = l.open_files;
+    limit.rlim_max = l.open_files;
     setrlimit(RLIMIT_NOFILE, &limit);
     
     // Limit number of processes
-    limit.rlim_cur = MAX_PROCESSES;
-    limit.rlim_max = MAX_PROCESSES;
+    limit.rlim_cur = l.processes;
+    limit.rlim_max = l.processes;
     setrlimit(RLIMIT_NPROC, &limit);
 }
 
+// The slice of the CPU pool a session's commands run on; count 0 = any CPU
+void session_cpus(const Session *s, int *first, int *count) {
+    int per = policy->cpus_per_session;
+    if (per <= 0 || per > policy->cpu_count) per = policy->cpu_count;
+    *first = per ? (s->cpu_slot % (policy->cpu_count / per)) * per : 0;
+    *count = per;
+}
+
+// SANDBOX: CPU placement and priority for a command about to exec. Every
+// step is best effort: a nice below the shell's or real-time I/O needs
+// privileges, and the command then keeps what it inherited.
+void setup_scheduling(int background) {
+    const SchedClass *c = &policy->sched[background ? CLASS_BACKGROUND : CLASS_FOREGROUND];
+#ifdef __linux__
+    int first, count;
+    session_cpus(session, &first, &count);
+    if (count > 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int i = 0; i < count; i++) CPU_SET(policy->cpus[first + i], &set);
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+    if (c->policy != SCHED_KEEP) {
+        struct sched_param param = { .sched_priority = 0 };
+        sched_setscheduler(0, c->policy == SCHED_CLASS_BATCH ? SCHED_BATCH :
+                              c->policy == SCHED_CLASS_IDLE ? SCHED_IDLE : SCHED_OTHER, &param);
+    }
+#ifdef SYS_ioprio_set
+    if (c->ioprio_class != IOPRIO_KEEP) {
+        syscall(SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, 0, c->ioprio_class << 13 | c->ioprio_level);
+    }
+#endif
+#endif
+    // SCHED_IDLE ignores nice; set it anyway so ps shows the intent
+    if (c->nice != NICE_KEEP) setpriority(PRIO_PROCESS, 0, c->nice);
+}
+
 // SANDBOX: Setup chroot jail for child processes
 // Note: Requires root privileges. Falls back gracefully if not root.
 void setup_chroot() {
-#if USE_CHROOT
+    if (!policy->use_chroot) {
+        return;
+    }
     // Check if we have root privileges (chroot requires root on most systems)
     if (geteuid() != 0) {
         // Not running as root, chroot will fail - silently skip
@@ -157,7 +1093,7 @@ void setup_chroot() {
     }
     
     // Change root directory to sandbox
-    if (chroot(CHROOT_DIR) != 0) {
+    if (chroot(policy->root) != 0) {
         // Chroot failed - this is OK if not root or if directory doesn't exist
         // Don't print error to avoid noise in non-root environments
         return;
@@ -169,15 +1105,14 @@ void setup_chroot() {
         perror("shell: chdir after chroot");
     }
     
-    // Note: After chroot, paths like /bin/ls become relative to CHROOT_DIR
-    // So /bin/ls actually refers to CHROOT_DIR/bin/ls
-#endif
+    // Note: After chroot, paths like /bin/ls become relative to the sandbox root
+    // So /bin/ls actually refers to <root>/bin/ls
 }
 
 // SANDBOX: Check if command is in whitelist
 int is_command_whitelisted(char *cmd) {
-    for (int i = 0; allowed_commands[i] != NULL; i++) {
-        if (strcmp(cmd, allowed_commands[i]) == 0) {
+    for (int i = 0; policy->allowed[i] != NULL; i++) {
+        if (strcmp(cmd, policy->allowed[i]) == 0) {
             return 1;
         }
     }
@@ -186,8 +1121,8 @@ int is_command_whitelisted(char *cmd) {
 
 // SANDBOX: Check if command is explicitly blocked
 int is_command_blocked(char *cmd) {
-    for (int i = 0; blocked_commands[i] != NULL; i++) {
-        if (strcmp(cmd, blocked_commands[i]) == 0) {
+    for (int i = 0; policy->blocked[i] != NULL; i++) {
+        if (strcmp(cmd, policy->blocked[i]) == 0) {
             return 1;
         }
     }
@@ -199,24 +1134,23 @@ int is_command_allowed(char *cmd) {
     // First check if it's explicitly blocked
     if (is_command_blocked(cmd)) {
         fprintf(stderr, "\033[1;31m[SANDBOX BLOCKED]\033[0m Command '%s' is not allowed (security risk)\n", cmd);
-        commands_blocked++;
+        count_blocked(BLOCK_DENYLIST);
         return 0;
     }
     
     // Then check whitelist
     if (!is_command_whitelisted(cmd)) {
         fprintf(stderr, "\033[1;33m[SANDBOX BLOCKED]\033[0m Command '%s' is not in whitelist\n", cmd);
-        commands_blocked++;
+        count_blocked(BLOCK_WHITELIST);
         return 0;
     }
     
     return 1;
 }
 
-// SANDBOX: Check if path is within allowed sandbox directory
-int is_path_allowed(const char *path) {
+// SANDBOX: Check if path is within allowed sandbox directory, quietly
+int path_in_sandbox(const char *path) {
     char resolved_path[PATH_MAX];
-    char sandbox_resolved[PATH_MAX];
     
     // Get current directory
     char cwd[PATH_MAX];
@@ -233,6 +1167,7 @@ int is_path_allowed(const char *path) {
     }
     
     // Resolve to absolute path (may not exist yet)
+    long long traced = TRACE_BEGIN();
     if (realpath(full_path, resolved_path) == NULL) {
         // If file doesn't exist, check parent directory
         char *last_slash = strrchr(full_path, '/');
@@ -245,14 +1180,10 @@ int is_path_allowed(const char *path) {
             strcpy(resolved_path, cwd);
         }
     }
+    TRACE_END("realpath", traced);
     
-    // Resolve sandbox directory
-    if (realpath(SANDBOX_DIR, sandbox_resolved) == NULL) {
-        // Sandbox dir might not exist, use as-is
-        strcpy(sandbox_resolved, SANDBOX_DIR);
-    }
-    
-    // Check if resolved path is within sandbox
+    // Check if resolved path is within sandbox (root is resolved once at policy load)
+    const char *sandbox_resolved = policy->root_resolved;
     if (strncmp(resolved_path, sandbox_resolved, strlen(sandbox_resolved)) == 0) {
         return 1;
     }
@@ -263,564 +1194,4294 @@ int is_path_allowed(const char *path) {
         strncmp(resolved_path, "/usr/local/bin", 14) == 0) {
         return 1;
     }
-    
+    return 0;
+}
+
+// SANDBOX: Check a path the user named; says why and counts it when denied
+int is_path_allowed(const char *path) {
+    if (path_in_sandbox(path)) {
+        return 1;
+    }
     fprintf(stderr, "\033[1;31m[SANDBOX BLOCKED]\033[0m Access denied to '%s' (outside sandbox)\n", path);
-    commands_blocked++;
+    count_blocked(BLOCK_PATH);
     return 0;
 }
 
-int parse_command(char* line, char** args) {
+// Split a command into words at blanks outside quotes. '...' is literal;
+// inside "..." a backslash only escapes " and \. A word with any quotes is
+// final: quotes and escapes are removed here and quoted[i] is set, so it is
+// never expanded. Other words keep their backslashes for expand_globs,
+// where \* matches a literal *; it removes them afterwards.
+int parse_command(char* line, char** args, char *quoted) {
     int count = 0;
-    char* token = strtok(line, DELIM);
-    while (token != NULL && count < MAX_ARGS - 1) {
-        args[count++] = token;
-        token = strtok(NULL, DELIM);
+    char *p = line;
+    while (count < MAX_ARGS - 1) {
+        while (*p && strchr(DELIM, *p)) p++;
+        if (*p == '\0') break;
+        char *end = p, quote = 0;
+        int any = 0;
+        for (; *end && (quote || !strchr(DELIM, *end)); end++) {
+            if (quote == '\'') {
+                if (*end == '\'') quote = 0;
+            } else if (*end == '\\' && end[1]) {
+                end++;
+            } else if (quote) {
+                if (*end == '"') quote = 0;
+            } else if (*end == '\'' || *end == '"') {
+                quote = *end;
+                any = 1;
+            }
+        }
+        char *next = *end ? end + 1 : end;
+        char *dst = end;
+        if (any) {
+            dst = p;
+            quote = 0;
+            for (char *s = p; s < end; s++) {
+                if (quote == '\'') {
+                    if (*s == '\'') quote = 0;
+                    else *dst++ = *s;
+                } else if (*s == '\\' && s + 1 < end && (!quote || s[1] == '"' || s[1] == '\\')) {
+                    *dst++ = *++s;
+                } else if (quote && *s == '"') {
+                    quote = 0;
+                } else if (!quote && (*s == '\'' || *s == '"')) {
+                    quote = *s;
+                } else {
+                    *dst++ = *s;
+                }
+            }
+        }
+        *dst = '\0';
+        quoted[count] = any;
+        args[count++] = p;
+        p = next;
     }
     args[count] = NULL;
     return count;
 }
 
-void print_sandbox_banner() {
-    int is_root = (geteuid() == 0);
-    int chroot_enabled = USE_CHROOT && is_root;
-    
-    printf("\n");
-    printf("\033[1;33m╔════════════════════════════════════════════════════════════════╗\033[0m\n");
-    printf("\033[1;33m║\033[0m         \033[1;36mSANDBOXED SHELL ENVIRONMENT - ACTIVE\033[0m              \033[1;33m║\033[0m\n");
-    printf("\033[1;33m╠════════════════════════════════════════════════════════════════╣\033[0m\n");
-    printf("\033[1;33m║\033[0m  \033[1;32mSecurity Features:\033[0m                                         \033[1;33m║\033[0m\n");
-    printf("\033[1;33m║\033[0m  \033[1;32m✓\033[0m Resource Limits (CPU: %ds, Memory: %dMB, Procs: %d)   \033[1;33m║\033[0m\n", MAX_CPU_TIME, MAX_MEMORY, MAX_PROCESSES);
-    printf("\033[1;33m║\033[0m  \033[1;32m✓\033[0m Command Whitelist Enforcement                          \033[1;33m║\033[0m\n");
-    printf("\033[1;33m║\033[0m  \033[1;32m✓\033[0m Restricted File System Access                          \033[1;33m║\033[0m\n");
-#if USE_SANDBOX_COMMANDS
-    printf("\033[1;33m║\033[0m  \033[1;32m✓\033[0m Custom Sandbox Commands Only (NO system commands)        \033[1;33m║\033[0m\n");
-#endif
-    if (chroot_enabled) {
-        printf("\033[1;33m║\033[0m  \033[1;32m✓\033[0m Chroot Jail Active (root filesystem isolation)       \033[1;33m║\033[0m\n");
-    } else if (USE_CHROOT) {
-        printf("\033[1;33m║\033[0m  \033[1;33m⚠\033[0m Chroot Disabled (requires root privileges)            \033[1;33m║\033[0m\n");
+// SANDBOX: Glob expansion
+// An argument holding an unescaped *, ? or [...] is a pattern. It is
+// compiled once per component into a list of GlobOps, then matched against
+// directory entries read in a single pass each (getdents64 on Linux, readdir
+// elsewhere); a component without metacharacters is looked up, never listed.
+// '**' as a whole component matches any number of directories, symlinks to
+// directories excepted. As in sh, * ? and [...] skip names starting with '.'
+// unless the pattern spells out the dot, matches come back sorted, and a
+// pattern that matches nothing is passed on as typed. Directories outside
+// the sandbox are never listed and symlinks leading out are dropped, so a
+// pattern cannot reveal names the commands could not open anyway.
+#define GLOB_MAX_BYTES 65536        // all matches of one pattern together
+#define GLOB_DIRBUF 32768
+
+enum { GLOB_CHAR, GLOB_ANY, GLOB_STAR, GLOB_CLASS };
+
+typedef struct {
+    unsigned char op;
+    unsigned char c;                // GLOB_CHAR
+    unsigned char negate;           // GLOB_CLASS: [!...] or [^...]
+    uint32_t set[8];                // GLOB_CLASS: bit c set for each byte listed
+} GlobOp;
+
+typedef struct {
+    char *text;                     // literal components, unescaped
+    int literal;
+    int globstar;                   // the component is exactly **
+    GlobOp *ops;
+    int nops;
+} GlobPart;
+
+typedef struct {
+    GlobPart *parts;
+    int nparts;
+    int dir_only;                   // the pattern ended in '/'
+    char **matches;
+    int count, max;
+    size_t bytes;
+    int overflow;
+} Glob;
+
+typedef struct {
+    char *name;
+    int part;                       // component to carry on with inside it
+} GlobNext;
+
+char *glob_strings[MAX_PIPELINE * MAX_ARGS];    // matches handed out as arguments
+int glob_nstrings;
+
+int glob_is_pattern(const char *s) {
+    for (; *s; s++) {
+        if (*s == '\\' && s[1]) s++;
+        else if (*s == '*' || *s == '?' || *s == '[') return 1;
     }
-    printf("\033[1;33m║\033[0m  \033[1;32m✓\033[0m All operations monitored and logged                    \033[1;33m║\033[0m\n");
-    printf("\033[1;33m║\033[0m                                                                \033[1;33m║\033[0m\n");
-    printf("\033[1;33m║\033[0m  Sandbox Directory: \033[1;36m%-37s\033[0m \033[1;33m║\033[0m\n", SANDBOX_DIR);
-    if (chroot_enabled) {
-        printf("\033[1;33m║\033[0m  Chroot Directory: \033[1;36m%-37s\033[0m \033[1;33m║\033[0m\n", CHROOT_DIR);
+    return 0;
+}
+
+// Compile one component; [ without a closing ] is an ordinary character
+void glob_compile_part(GlobPart *part, const char *text, size_t len) {
+    part->text = strndup(text, len);
+    part->globstar = len == 2 && text[0] == '*' && text[1] == '*';
+    part->literal = !glob_is_pattern(part->text);
+    part->ops = calloc(len + 1, sizeof(GlobOp));
+    part->nops = 0;
+    size_t lit = 0;
+    for (size_t i = 0; i < len; i++) {
+        GlobOp *op = &part->ops[part->nops++];
+        if (text[i] == '\\' && i + 1 < len) {
+            op->op = GLOB_CHAR;
+            op->c = text[++i];
+        } else if (text[i] == '*') {
+            op->op = GLOB_STAR;
+            while (i + 1 < len && text[i + 1] == '*') i++;
+        } else if (text[i] == '?') {
+            op->op = GLOB_ANY;
+        } else if (text[i] == '[') {
+            size_t j = i + 1;
+            int negate = j < len && (text[j] == '!' || text[j] == '^');
+            if (negate) j++;
+            if (j < len && text[j] == ']') j++;         // []...] lists a ]
+            while (j < len && text[j] != ']') j++;
+            if (j >= len) {
+                op->op = GLOB_CHAR;
+                op->c = '[';
+            } else {
+                op->op = GLOB_CLASS;
+                op->negate = negate;
+                size_t k = i + 1 + negate;
+                do {
+                    unsigned char lo = text[k], hi = lo;
+                    if (k + 2 < j && text[k + 1] == '-') {
+                        hi = text[k + 2];
+                        k += 2;
+                    }
+                    for (unsigned c = lo; c <= hi; c++) op->set[c >> 5] |= 1u << (c & 31);
+                } while (++k < j);
+                i = j;
+            }
+        } else {
+            op->op = GLOB_CHAR;
+            op->c = text[i];
+        }
+        if (part->literal && op->op == GLOB_CHAR) part->text[lit++] = op->c;
     }
-    printf("\033[1;33m╚════════════════════════════════════════════════════════════════╝\033[0m\n");
-    printf("\n");
+    if (part->literal) part->text[lit] = '\0';
 }
 
-void print_sandbox_stats() {
-    time_t current = time(NULL);
-    int runtime = (int)difftime(current, sandbox_start_time);
-    printf("\n\033[1;36m[Sandbox Statistics]\033[0m\n");
-    printf("  Runtime: %d seconds\n", runtime);
-    printf("  Commands executed: %d\n", commands_executed);
-    printf("  Commands blocked: %d\n", commands_blocked);
-    printf("\n");
+int glob_compile(Glob *g, const char *pattern) {
+    memset(g, 0, sizeof(*g));
+    size_t len = strlen(pattern);
+    while (len > 1 && pattern[len - 1] == '/') {
+        g->dir_only = 1;
+        len--;
+    }
+    g->parts = calloc(len / 2 + 2, sizeof(GlobPart));
+    if (!g->parts) return -1;
+    const char *p = pattern, *end = pattern + len;
+    if (*p == '/') {
+        // The root is a literal first component: the walk starts at "/"
+        glob_compile_part(&g->parts[g->nparts++], "/", 1);
+        while (p < end && *p == '/') p++;
+    }
+    while (p < end) {
+        const char *slash = memchr(p, '/', end - p);
+        size_t n = slash ? (size_t)(slash - p) : (size_t)(end - p);
+        // a/**/**/b is a/**/b
+        int star2 = n == 2 && p[0] == '*' && p[1] == '*';
+        if (!(star2 && g->nparts > 0 && g->parts[g->nparts - 1].globstar)) {
+            glob_compile_part(&g->parts[g->nparts++], p, n);
+        }
+        p += n;
+        while (p < end && *p == '/') p++;
+    }
+    return 0;
 }
 
-void print_all_commands() {
-    printf("\n");
-    printf("\033[1;36m╔════════════════════════════════════════════════════════════════╗\033[0m\n");
-    printf("\033[1;36m║\033[0m                    \033[1;32mALL AVAILABLE COMMANDS\033[0m                      \033[1;36m║\033[0m\n");
-    printf("\033[1;36m╠════════════════════════════════════════════════════════════════╣\033[0m\n");
-    
-    // Built-in commands
-    printf("\033[1;36m║\033[0m  \033[1;32mBuilt-in Commands (Custom Implementations):\033[0m                 \033[1;36m║\033[0m\n");
-    printf("\033[1;36m║\033[0m     cd, exit, print_history, add_alias, remove_alias, help, stats, commands, echo  \033[1;36m║\033[0m\n");
-    printf("\033[1;36m║\033[0m                                                             \033[1;36m║\033[0m\n");
+void glob_free(Glob *g) {
+    for (int i = 0; i < g->nparts; i++) {
+        free(g->parts[i].text);
+        free(g->parts[i].ops);
+    }
+    free(g->parts);
+    for (int i = 0; i < g->count; i++) free(g->matches[i]);
+    free(g->matches);
+}
+
+int glob_op_matches(const GlobOp *op, unsigned char c) {
+    switch (op->op) {
+    case GLOB_CHAR: return op->c == c;
+    case GLOB_ANY: return 1;
+    default: return ((op->set[c >> 5] >> (c & 31)) & 1) != op->negate;
+    }
+}
+
+// Backtracks to the last * only, so a name is matched in linear time
+int glob_match_part(const GlobPart *part, const char *name) {
+    if (part->literal) return strcmp(part->text, name) == 0;
+    if (name[0] == '.' && (part->ops[0].op != GLOB_CHAR || part->ops[0].c != '.')) return 0;
+    const GlobOp *ops = part->ops;
+    int p = 0, star = -1;
+    const char *s = name, *retry = NULL;
+    while (*s) {
+        if (p < part->nops && ops[p].op == GLOB_STAR) {
+            star = ++p;
+            retry = s;
+        } else if (p < part->nops && glob_op_matches(&ops[p], (unsigned char)*s)) {
+            p++;
+            s++;
+        } else if (star >= 0) {
+            p = star;
+            s = ++retry;
+        } else {
+            return 0;
+        }
+    }
+    while (p < part->nops && ops[p].op == GLOB_STAR) p++;
+    return p == part->nops;
+}
+
+int glob_join(char *buf, size_t size, const char *dir, const char *name) {
+    size_t n = strlen(dir);
+    int len = snprintf(buf, size, "%s%s%s", dir, n && dir[n - 1] != '/' ? "/" : "", name);
+    return len < (int)size ? 0 : -1;
+}
+
+// One directory open at a time: the walk only recurses after closing it
+struct {
+    int fd;
+#if defined(__linux__) && defined(SYS_getdents64)
+    long len, pos;
+    char buf[GLOB_DIRBUF];
+#else
+    DIR *dir;
+#endif
+} glob_dirent;
+
+int glob_opendir(const char *path) {
+#if defined(__linux__) && defined(SYS_getdents64)
+    glob_dirent.len = glob_dirent.pos = 0;
+    glob_dirent.fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    return glob_dirent.fd;
+#else
+    glob_dirent.dir = opendir(path);
+    return glob_dirent.dir ? 0 : -1;
+#endif
+}
+
+// Next entry other than . and .., NULL at the end
+const char *glob_readdir(unsigned char *type) {
+    const char *name;
+    do {
+#if defined(__linux__) && defined(SYS_getdents64)
+        struct linux_dirent64 {
+            uint64_t d_ino;
+            int64_t d_off;
+            unsigned short d_reclen;
+            unsigned char d_type;
+            char d_name[];
+        } *ent;
+        if (glob_dirent.pos >= glob_dirent.len) {
+            glob_dirent.len = syscall(SYS_getdents64, glob_dirent.fd, glob_dirent.buf, GLOB_DIRBUF);
+            glob_dirent.pos = 0;
+            if (glob_dirent.len <= 0) return NULL;
+        }
+        ent = (struct linux_dirent64 *)(glob_dirent.buf + glob_dirent.pos);
+        glob_dirent.pos += ent->d_reclen;
+        name = ent->d_name;
+        *type = ent->d_type;
+#else
+        struct dirent *ent = readdir(glob_dirent.dir);
+        if (!ent) return NULL;
+        name = ent->d_name;
+        *type = ent->d_type;
+#endif
+    } while (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')));
+    return name;
+}
+
+void glob_closedir() {
+#if defined(__linux__) && defined(SYS_getdents64)
+    close(glob_dirent.fd);
+#else
+    closedir(glob_dirent.dir);
+#endif
+}
+
+int glob_is_dir(const char *path, unsigned char type, int follow) {
+    struct stat st;
+    if (type == DT_DIR) return 1;
+    if (type != DT_UNKNOWN && !(follow && type == DT_LNK)) return 0;
+    return (follow ? stat(path, &st) : lstat(path, &st)) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Keep a match; -1 stops the walk once the pattern has too many
+int glob_found(Glob *g, const char *path, unsigned char type) {
+    struct stat st;
+    if (type == DT_UNKNOWN && lstat(path, &st) != 0) return 0;
+    if (g->dir_only && !glob_is_dir(path, type, 1)) return 0;
+    if (type != DT_DIR && type != DT_REG && !path_in_sandbox(path)) return 0;
+    size_t len = strlen(path) + g->dir_only + 1;
+    if (g->count == g->max || g->bytes + len > GLOB_MAX_BYTES) {
+        g->overflow = 1;
+        return -1;
+    }
+    char *match = malloc(len);
+    char **grown = realloc(g->matches, (g->count + 1) * sizeof(char *));
+    if (!match || !grown) {
+        free(match);
+        if (grown) g->matches = grown;
+        g->overflow = 1;
+        return -1;
+    }
+    snprintf(match, len, "%s%s", path, g->dir_only ? "/" : "");
+    g->matches = grown;
+    g->matches[g->count++] = match;
+    g->bytes += len;
+    return 0;
+}
+
+int glob_queue(GlobNext **next, int *n, const char *name, int part) {
+    GlobNext *grown = realloc(*next, (*n + 1) * sizeof(GlobNext));
+    if (!grown) return -1;
+    *next = grown;
+    grown[*n].name = strdup(name);
+    grown[*n].part = part;
+    (*n)++;
+    return 0;
+}
+
+// Match entry name of dir against component idx
+int glob_entry(Glob *g, const char *dir, int idx, const char *name, unsigned char type,
+               GlobNext **next, int *nnext) {
+    char path[PATH_MAX];
+    if (!glob_match_part(&g->parts[idx], name) || glob_join(path, sizeof(path), dir, name) < 0) return 0;
+    if (idx == g->nparts - 1) return glob_found(g, path, type);
+    if (glob_is_dir(path, type, 1)) return glob_queue(next, nnext, name, idx + 1);
+    return 0;
+}
+
+// Expand components idx.. below dir ("" for the current directory)
+int glob_dir(Glob *g, const char *dir, int idx) {
+    GlobPart *part = &g->parts[idx];
+    int last = idx == g->nparts - 1;
+    char path[PATH_MAX];
+    if (part->literal) {
+        if (glob_join(path, sizeof(path), dir, part->text) < 0) return 0;
+        if (last) return glob_found(g, path, DT_UNKNOWN);
+        return glob_dir(g, path, idx + 1);
+    }
+
+    const char *open_path = *dir ? dir : ".";
+    if (!path_in_sandbox(open_path) || glob_opendir(open_path) < 0) return 0;
+    GlobNext *next = NULL;
+    int nnext = 0, rc = 0;
+    const char *name;
+    unsigned char type;
+    while (rc == 0 && (name = glob_readdir(&type)) != NULL) {
+        if (!part->globstar) {
+            rc = glob_entry(g, dir, idx, name, type, &next, &nnext);
+            continue;
+        }
+        // ** matching no directory lets the next component look here;
+        // every visible subdirectory is searched again for **
+        if (!last) rc = glob_entry(g, dir, idx + 1, name, type, &next, &nnext);
+        if (rc != 0 || name[0] == '.' || glob_join(path, sizeof(path), dir, name) < 0) continue;
+        if (last) rc = glob_found(g, path, type);
+        if (rc == 0 && glob_is_dir(path, type, 0)) rc = glob_queue(&next, &nnext, name, idx);
+    }
+    glob_closedir();
+
+    for (int i = 0; i < nnext; i++) {
+        if (rc == 0 && next[i].name && glob_join(path, sizeof(path), dir, next[i].name) == 0) {
+            rc = glob_dir(g, path, next[i].part);
+        }
+        free(next[i].name);
+    }
+    free(next);
+    return rc;
+}
+
+int glob_cmp(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Drop the backslashes of an unquoted word that is not expanded
+void glob_unescape(char *s) {
+    char *dst = s;
+    for (; *s; s++) {
+        if (*s == '\\' && s[1]) s++;
+        *dst++ = *s;
+    }
+    *dst = '\0';
+}
+
+// SANDBOX: Replace every pattern argument by its sorted matches. Returns the
+// new argument count, or -1 (having said why) when the matches would not fit
+// in MAX_ARGS or GLOB_MAX_BYTES; the command is then not run at all.
+// Quoted words (see parse_command) and redirection targets are not expanded;
+// every unquoted word that is not replaced loses its backslashes.
+int expand_globs(char **args, const char *quoted) {
+    char *out[MAX_ARGS];
+    int n = 0, i;
+    long long traced = 0;
+    for (i = 0; args[i] != NULL; i++) {
+        int target = i > 0 && (strcmp(args[i - 1], "<") == 0 || strcmp(args[i - 1], ">") == 0);
+        if (quoted[i] || target || !glob_is_pattern(args[i])) {
+            if (n == MAX_ARGS - 1) goto too_many;
+            if (!quoted[i]) glob_unescape(args[i]);
+            out[n++] = args[i];
+            continue;
+        }
+        if (!traced) traced = TRACE_BEGIN();
+        Glob g;
+        if (glob_compile(&g, args[i]) < 0) goto too_many;
+        g.max = MAX_ARGS - 1 - n;
+        if (g.nparts > 0) glob_dir(&g, "", 0);
+        if (g.overflow || glob_nstrings + g.count > MAX_PIPELINE * MAX_ARGS) {
+            glob_free(&g);
+            goto too_many;
+        }
+        if (g.count == 0) {
+            glob_unescape(args[i]);
+            out[n++] = args[i];
+        } else {
+            qsort(g.matches, g.count, sizeof(char *), glob_cmp);
+            for (int k = 0; k < g.count; k++) {
+                out[n++] = glob_strings[glob_nstrings++] = g.matches[k];
+            }
+            g.count = 0;        // now owned by glob_strings
+        }
+        glob_free(&g);
+    }
+    TRACE_END("glob", traced);
+    memcpy(args, out, n * sizeof(char *));
+    args[n] = NULL;
+    return n;
+
+too_many:
+    fprintf(stderr, "shell: %s: too many matches (a command takes at most %d arguments, %d KB of matches)\n",
+            args[i], MAX_ARGS - 1, GLOB_MAX_BYTES / 1024);
+    session->last_status = 1;
+    return -1;
+}
+
+// Drop the matches handed out for the pipeline that just ran
+void glob_release() {
+    while (glob_nstrings > 0) free(glob_strings[--glob_nstrings]);
+}
+
+void render_banner(FILE *out) {
+    int is_root = (geteuid() == 0);
+    int chroot_enabled = policy->use_chroot && is_root;
+    
+    fprintf(out, "\n");
+    fprintf(out, "\033[1;33m╔════════════════════════════════════════════════════════════════╗\033[0m\n");
+    fprintf(out, "\033[1;33m║\033[0m         \033[1;36mSANDBOXED SHELL ENVIRONMENT - ACTIVE\033[0m              \033[1;33m║\033[0m\n");
+    fprintf(out, "\033[1;33m╠════════════════════════════════════════════════════════════════╣\033[0m\n");
+    fprintf(out, "\033[1;33m║\033[0m  \033[1;32mSecurity Features:\033[0m                                         \033[1;33m║\033[0m\n");
+    fprintf(out, "\033[1;33m║\033[0m  \033[1;32m✓\033[0m Resource Limits (CPU: %ds, Memory: %dMB, Procs: %d)   \033[1;33m║\033[0m\n", policy->defaults.cpu_time, policy->defaults.memory, policy->defaults.processes);
+    fprintf(out, "\033[1;33m║\033[0m  \033[1;32m✓\033[0m Command Whitelist Enforcement                          \033[1;33m║\033[0m\n");
+    fprintf(out, "\033[1;33m║\033[0m  \033[1;32m✓\033[0m Restricted File System Access                          \033[1;33m║\033[0m\n");
+#if USE_SANDBOX_COMMANDS
+    fprintf(out, "\033[1;33m║\033[0m  \033[1;32m✓\033[0m Custom Sandbox Commands Only (NO system commands)        \033[1;33m║\033[0m\n");
+#endif
+    if (chroot_enabled) {
+        fprintf(out, "\033[1;33m║\033[0m  \033[1;32m✓\033[0m Chroot Jail Active (root filesystem isolation)       \033[1;33m║\033[0m\n");
+    } else if (policy->use_chroot) {
+        fprintf(out, "\033[1;33m║\033[0m  \033[1;33m⚠\033[0m Chroot Disabled (requires root privileges)            \033[1;33m║\033[0m\n");
+    }
+    fprintf(out, "\033[1;33m║\033[0m  \033[1;32m✓\033[0m All operations monitored and logged                    \033[1;33m║\033[0m\n");
+    fprintf(out, "\033[1;33m║\033[0m                                                                \033[1;33m║\033[0m\n");
+    fprintf(out, "\033[1;33m║\033[0m  Sandbox Directory: \033[1;36m%-37s\033[0m \033[1;33m║\033[0m\n", policy->root);
+    if (chroot_enabled) {
+        fprintf(out, "\033[1;33m║\033[0m  Chroot Directory: \033[1;36m%-37s\033[0m \033[1;33m║\033[0m\n", policy->root);
+    }
+    fprintf(out, "\033[1;33m╚════════════════════════════════════════════════════════════════╝\033[0m\n");
+    fprintf(out, "\n");
+}
+
+// The banner only changes with the policy, so it is rendered once and each
+// session start (or server client) costs a single write
+void print_sandbox_banner() {
+    if (!banner_text) {
+        FILE *out = open_memstream(&banner_text, &banner_len);
+        if (!out) return;
+        render_banner(out);
+        fclose(out);
+    }
+    fwrite(banner_text, 1, banner_len, stdout);
+}
+
+// Human-readable duration for the stats table
+void format_us(char *buf, size_t size, long long us) {
+    if (us < 1000) snprintf(buf, size, "%lld us", us);
+    else if (us < 1000000) snprintf(buf, size, "%.1f ms", us / 1000.0);
+    else snprintf(buf, size, "%.1f s", us / 1e6);
+}
+
+// Upper bound of the bucket holding quantile q, -1 past the last bound
+long long hist_quantile(const unsigned *h, double q) {
+    long long n = 0, seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) n += h[b];
+    for (int b = 0; b < HIST_BUCKETS - 1; b++) {
+        seen += h[b];
+        if (seen > 0 && seen >= q * n) return 1LL << b;
+    }
+    return -1;
+}
+
+// "batch, nice 10, io be/7"; "inherited" for a class that sets nothing
+void format_sched(char *buf, size_t size, const SchedClass *c) {
+    int n = 0;
+    buf[0] = '\0';
+    if (c->policy != SCHED_KEEP) n += snprintf(buf + n, size - n, "%s", sched_policy_names[c->policy]);
+    if (c->nice != NICE_KEEP && n < (int)size) n += snprintf(buf + n, size - n, "%snice %d", n ? ", " : "", c->nice);
+    if (c->ioprio_class == IOPRIO_IDLE && n < (int)size) n += snprintf(buf + n, size - n, "%sio idle", n ? ", " : "");
+    else if (c->ioprio_class != IOPRIO_KEEP && n < (int)size) {
+        n += snprintf(buf + n, size - n, "%sio %s/%d", n ? ", " : "",
+                      ioprio_class_names[c->ioprio_class], c->ioprio_level);
+    }
+    if (n == 0) snprintf(buf, size, "inherited");
+}
+
+// The session's CPUs as ranges ("2-3,6"), "any" without a CPU pool
+void format_cpus(char *buf, size_t size, const Session *s) {
+    int first, count, n = 0;
+    session_cpus(s, &first, &count);
+    snprintf(buf, size, "any");
+    for (int i = 0; i < count && n < (int)size; i++) {
+        int lo = policy->cpus[first + i];
+        while (i + 1 < count && policy->cpus[first + i + 1] == policy->cpus[first + i] + 1) i++;
+        int hi = policy->cpus[first + i];
+        n += lo == hi ? snprintf(buf + n, size - n, "%s%d", n ? "," : "", lo)
+                      : snprintf(buf + n, size - n, "%s%d-%d", n ? "," : "", lo, hi);
+    }
+}
+
+void print_sandbox_stats() {
+    time_t current = time(NULL);
+    int runtime = (int)difftime(current, session->start_time);
+    Metrics *m = &session->metrics;
+    printf("\n\033[1;36m[Sandbox Statistics]\033[0m\n");
+    printf("  Runtime: %d seconds\n", runtime);
+    printf("  Commands executed: %d\n", session->commands_executed);
+    printf("  Commands blocked: %d", session->commands_blocked);
+    const char *sep = " (";
+    for (int r = 0; r < BLOCK_REASONS; r++) {
+        if (m->blocked[r] == 0) continue;
+        printf("%s%lld %s", sep, m->blocked[r], block_reason_names[r]);
+        sep = ", ";
+    }
+    printf("%s\n", *sep == ',' ? ")" : "");
+    char cpus[256], fg[64], bg[64];
+    format_cpus(cpus, sizeof(cpus), session);
+    format_sched(fg, sizeof(fg), &policy->sched[CLASS_FOREGROUND]);
+    format_sched(bg, sizeof(bg), &policy->sched[CLASS_BACKGROUND]);
+    printf("  Scheduling: CPUs %s; foreground %lld runs (%s); background %lld runs (%s)\n",
+           cpus, m->class_runs[CLASS_FOREGROUND], fg, m->class_runs[CLASS_BACKGROUND], bg);
+    if (m->bytes_in || m->bytes_out) {
+        printf("  Redirected: %lld bytes in, %lld bytes out\n", m->bytes_in, m->bytes_out);
+    }
+    if (policy->cache_mb > 0) {
+        printf("  Result cache: %lld hits, %lld misses (%d entries, %.1f of %d MB)\n",
+               m->cache_hits, m->cache_misses, cache_entries,
+               cache_bytes / 1048576.0, policy->cache_mb);
+    }
+    if (m->ncmds > 0) {
+        printf("  %-14s %6s %7s %8s %10s %10s\n", "Command", "runs", "failed", "timeouts", "p50", "p99");
+        for (int i = 0; i < m->ncmds; i++) {
+            CommandMetrics *c = &m->cmds[i];
+            char p50[32] = "-", p99[32] = "-";
+            long long q;
+            if ((q = hist_quantile(c->total, 0.5)) > 0) format_us(p50, sizeof(p50), q);
+            if ((q = hist_quantile(c->total, 0.99)) > 0) format_us(p99, sizeof(p99), q);
+            printf("  %-14s %6lld %7lld %8lld %10s %10s\n", c->name, c->count, c->failed, c->timeouts, p50, p99);
+        }
+    }
+    printf("\n");
+}
+
+void print_histogram_json(const unsigned *h, long long sum_us) {
+    printf("{\"sum\":%lld,\"buckets\":[", sum_us);
+    for (int b = 0; b < HIST_BUCKETS; b++) printf("%s%u", b ? "," : "", h[b]);
+    printf("]}");
+}
+
+// stats --json: the same numbers on one line for scripts and dashboards.
+// Histogram bucket i counts durations under histogram_le_us[i]; the extra
+// last bucket counts everything slower.
+void print_stats_json() {
+    Metrics *m = &session->metrics;
+    printf("{\"runtime_s\":%d,\"commands_executed\":%d,\"commands_blocked\":%d,\"blocked\":{",
+           (int)difftime(time(NULL), session->start_time),
+           session->commands_executed, session->commands_blocked);
+    for (int r = 0; r < BLOCK_REASONS; r++) {
+        printf("%s\"%s\":%lld", r ? "," : "", block_reason_names[r], m->blocked[r]);
+    }
+    printf("},\"redirected_bytes\":{\"in\":%lld,\"out\":%lld}", m->bytes_in, m->bytes_out);
+    printf(",\"cache\":{\"hits\":%lld,\"misses\":%lld}", m->cache_hits, m->cache_misses);
+    int first, count;
+    session_cpus(session, &first, &count);
+    printf(",\"scheduling\":{\"cpus\":[");
+    for (int i = 0; i < count; i++) printf("%s%d", i ? "," : "", policy->cpus[first + i]);
+    printf("]");
+    for (int k = 0; k < SCHED_CLASSES; k++) {
+        const SchedClass *sc = &policy->sched[k];
+        printf(",\"%s\":{\"runs\":%lld,\"sched\":\"%s\",\"nice\":", sched_class_names[k],
+               m->class_runs[k], sched_policy_names[sc->policy]);
+        if (sc->nice == NICE_KEEP) printf("null");
+        else printf("%d", sc->nice);
+        if (sc->ioprio_class == IOPRIO_KEEP) printf(",\"ioprio\":null}");
+        else if (sc->ioprio_class == IOPRIO_IDLE) printf(",\"ioprio\":\"idle\"}");
+        else printf(",\"ioprio\":\"%s/%d\"}", ioprio_class_names[sc->ioprio_class], sc->ioprio_level);
+    }
+    printf("}");
+    printf(",\"histogram_le_us\":[");
+    for (int b = 0; b < HIST_BUCKETS - 1; b++) printf("%s%lld", b ? "," : "", 1LL << b);
+    printf("],\"commands\":{");
+    for (int i = 0; i < m->ncmds; i++) {
+        CommandMetrics *c = &m->cmds[i];
+        printf("%s\"%s\":{\"count\":%lld,\"failed\":%lld,\"timeouts\":%lld,\"launch_us\":",
+               i ? "," : "", c->name, c->count, c->failed, c->timeouts);
+        print_histogram_json(c->launch, c->launch_sum_us);
+        printf(",\"total_us\":");
+        print_histogram_json(c->total, c->total_sum_us);
+        printf("}");
+    }
+    printf("}}\n");
+}
+
+// SANDBOX: Prometheus text export (metrics_file = <path> in sandbox.conf)
+// Process-wide totals over every session, rewritten every metrics_interval
+// seconds through a temp file and rename(), so a collector such as the node
+// exporter's textfile collector never reads half a file.
+long long metrics_written_us;
+
+void write_histogram(FILE *fp, const char *metric, const char *cmd, const unsigned *h, long long sum_us) {
+    long long cumulative = 0;
+    for (int b = 0; b < HIST_BUCKETS - 1; b++) {
+        cumulative += h[b];
+        fprintf(fp, "%s_bucket{command=\"%s\",le=\"%g\"} %lld\n", metric, cmd, (1LL << b) / 1e6, cumulative);
+    }
+    cumulative += h[HIST_BUCKETS - 1];
+    fprintf(fp, "%s_bucket{command=\"%s\",le=\"+Inf\"} %lld\n", metric, cmd, cumulative);
+    fprintf(fp, "%s_sum{command=\"%s\"} %.6f\n", metric, cmd, sum_us / 1e6);
+    fprintf(fp, "%s_count{command=\"%s\"} %lld\n", metric, cmd, cumulative);
+}
+
+int metrics_write(const char *path) {
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) return -1;
+    Metrics *m = &process_metrics;
+    int active = 0;
+    for (int i = 0; i < MAX_SESSIONS; i++) active += sessions[i] != NULL;
+
+    fprintf(fp, "# HELP sandbox_uptime_seconds Time since the shell started.\n"
+                "# TYPE sandbox_uptime_seconds gauge\n"
+                "sandbox_uptime_seconds %.0f\n", difftime(time(NULL), terminal_session.start_time));
+    fprintf(fp, "# HELP sandbox_sessions Connected sessions.\n"
+                "# TYPE sandbox_sessions gauge\n"
+                "sandbox_sessions %d\n", server_mode ? active : 1);
+    fprintf(fp, "# HELP sandbox_commands_total Commands started, one per pipeline stage.\n"
+                "# TYPE sandbox_commands_total counter\n");
+    for (int i = 0; i < m->ncmds; i++) {
+        fprintf(fp, "sandbox_commands_total{command=\"%s\"} %lld\n", m->cmds[i].name, m->cmds[i].count);
+    }
+    fprintf(fp, "# HELP sandbox_command_failures_total Commands that exited with a non-zero status.\n"
+                "# TYPE sandbox_command_failures_total counter\n");
+    for (int i = 0; i < m->ncmds; i++) {
+        fprintf(fp, "sandbox_command_failures_total{command=\"%s\"} %lld\n", m->cmds[i].name, m->cmds[i].failed);
+    }
+    fprintf(fp, "# HELP sandbox_command_timeouts_total Commands killed at their wall-clock limit.\n"
+                "# TYPE sandbox_command_timeouts_total counter\n");
+    for (int i = 0; i < m->ncmds; i++) {
+        fprintf(fp, "sandbox_command_timeouts_total{command=\"%s\"} %lld\n", m->cmds[i].name, m->cmds[i].timeouts);
+    }
+    fprintf(fp, "# HELP sandbox_command_launch_seconds Pipeline start to fork.\n"
+                "# TYPE sandbox_command_launch_seconds histogram\n");
+    for (int i = 0; i < m->ncmds; i++) {
+        write_histogram(fp, "sandbox_command_launch_seconds", m->cmds[i].name,
+                        m->cmds[i].launch, m->cmds[i].launch_sum_us);
+    }
+    fprintf(fp, "# HELP sandbox_command_duration_seconds Pipeline start to exit.\n"
+                "# TYPE sandbox_command_duration_seconds histogram\n");
+    for (int i = 0; i < m->ncmds; i++) {
+        write_histogram(fp, "sandbox_command_duration_seconds", m->cmds[i].name,
+                        m->cmds[i].total, m->cmds[i].total_sum_us);
+    }
+    fprintf(fp, "# HELP sandbox_class_runs_total Commands started per scheduling class.\n"
+                "# TYPE sandbox_class_runs_total counter\n");
+    for (int k = 0; k < SCHED_CLASSES; k++) {
+        fprintf(fp, "sandbox_class_runs_total{class=\"%s\"} %lld\n", sched_class_names[k], m->class_runs[k]);
+    }
+    fprintf(fp, "# HELP sandbox_blocked_total Policy rejections by reason.\n"
+                "# TYPE sandbox_blocked_total counter\n");
+    for (int r = 0; r < BLOCK_REASONS; r++) {
+        fprintf(fp, "sandbox_blocked_total{reason=\"%s\"} %lld\n", block_reason_names[r], m->blocked[r]);
+    }
+    fprintf(fp, "# HELP sandbox_redirected_bytes_total Bytes read through < and written through >.\n"
+                "# TYPE sandbox_redirected_bytes_total counter\n"
+                "sandbox_redirected_bytes_total{direction=\"in\"} %lld\n"
+                "sandbox_redirected_bytes_total{direction=\"out\"} %lld\n", m->bytes_in, m->bytes_out);
+    fprintf(fp, "# HELP sandbox_cache_requests_total Result cache lookups.\n"
+                "# TYPE sandbox_cache_requests_total counter\n"
+                "sandbox_cache_requests_total{result=\"hit\"} %lld\n"
+                "sandbox_cache_requests_total{result=\"miss\"} %lld\n", m->cache_hits, m->cache_misses);
+    if (fclose(fp) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// Rewrite the metrics file when it is due, or right away when force is set
+void metrics_tick(int force) {
+    if (!policy->metrics_file) return;
+    long long now = monotonic_us();
+    if (!force && now - metrics_written_us < policy->metrics_interval * 1000000LL) return;
+    metrics_written_us = now;
+    if (metrics_write(policy->metrics_file) < 0) {
+        fprintf(stderr, "shell: metrics_file %s: %s\n", policy->metrics_file, strerror(errno));
+    }
+}
+
+// Poll timeout until the next metrics file write, -1 when there is none
+int metrics_timeout_ms() {
+    if (!policy->metrics_file) return -1;
+    long long left = metrics_written_us + policy->metrics_interval * 1000000LL - monotonic_us();
+    return left > 0 ? (int)((left + 999) / 1000) : 0;
+}
+
+// SANDBOX: Sandbox tree snapshots (sandbox_snapshot / sandbox_restore)
+// A snapshot lives in <snapshot_dir>/<name>: tree/ holds every regular file
+// of the sandbox, cloned with FICLONE where the file system shares extents
+// and copied where it cannot, and manifest lists every entry with its type,
+// mode, owner, size and mtime. Files are not hard-linked into the farm: a
+// command that rewrites a sandbox file in place would rewrite the snapshot
+// with it.
+//
+// The manifest also keeps the inode and ctime each live file had when it
+// last matched the snapshot. Nothing run inside the sandbox can set a
+// ctime back, so a restore leaves a file alone while inode, ctime, size,
+// mtime and mode all still agree, and only deletes, recopies or recreates
+// what differs; restore -f recopies every file regardless.
+//
+// Manifest: a "sandbox-snapshot 1" line, then for each entry, parents first,
+//   <type> <mode> <uid> <gid> <size> <mtime_ns> <ino> <ctime_ns>\t<path>\0<link target>\0
+// with type d, f or l and the path relative to the root.
+#define SNAP_MAGIC "sandbox-snapshot 1\n"
+#define SNAP_COPY_BUF (1 << 20)
+
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
+uint64_t fnv1a(uint64_t h, const void *p, size_t n);
+long long stat_mtime_ns(const struct stat *st);
+
+typedef struct {
+    char *path;                 // relative to the root
+    char *target;               // symlink target, NULL for the rest
+    char type;                  // 'd', 'f' or 'l'
+    mode_t mode;                // permission bits
+    uid_t uid;
+    gid_t gid;
+    long long size;
+    long long mtime_ns;
+    unsigned long long ino;     // the live entry when it last matched
+    long long ctime_ns;
+    int child;                  // first entry inside a directory, -1 = none
+    int sibling;                // next entry in the same directory
+    int seen;                   // found (or recreated) by this restore
+} SnapEntry;
+
+typedef struct {
+    SnapEntry *entries;
+    int count, cap;
+    int *table;                 // path hash -> entry, -1 = empty slot
+    int table_mask;
+    int top;                    // first entry directly under the root
+    char dir[PATH_MAX];         // <snapshot_dir>/<name>
+    int tree;                   // <dir>/tree, -1 until opened
+    int force;
+    int kept, copied, created, removed, failed;
+    char *buf;                  // for copies the kernel cannot do itself
+} Snapshot;
+
+long long stat_ctime_ns(const struct stat *st) {
+#ifdef __APPLE__
+    return (long long)st->st_ctimespec.tv_sec * 1000000000LL + st->st_ctimespec.tv_nsec;
+#else
+    return (long long)st->st_ctim.tv_sec * 1000000000LL + st->st_ctim.tv_nsec;
+#endif
+}
+
+void snap_warn(Snapshot *s, const char *what, const char *path) {
+    fprintf(stderr, "shell: %s: '%s': %s\n", what, path, strerror(errno));
+    s->failed++;
+}
+
+void snap_free(Snapshot *s) {
+    for (int i = 0; i < s->count; i++) {
+        free(s->entries[i].path);
+        free(s->entries[i].target);
+    }
+    free(s->entries);
+    free(s->table);
+    free(s->buf);
+    if (s->tree >= 0) close(s->tree);
+}
+
+SnapEntry *snap_add(Snapshot *s, char type, const char *path, const char *target) {
+    if (s->count == s->cap) {
+        int cap = s->cap ? s->cap * 2 : 1024;
+        SnapEntry *grown = realloc(s->entries, cap * sizeof(SnapEntry));
+        if (!grown) return NULL;
+        s->entries = grown;
+        s->cap = cap;
+    }
+    SnapEntry *e = &s->entries[s->count];
+    memset(e, 0, sizeof(*e));
+    e->type = type;
+    e->path = strdup(path);
+    e->target = target ? strdup(target) : NULL;
+    if (!e->path || (target && !e->target)) {
+        free(e->path);
+        free(e->target);
+        return NULL;
+    }
+    s->count++;
+    return e;
+}
+
+void snap_set_stat(SnapEntry *e, const struct stat *st) {
+    e->mode = st->st_mode & 07777;
+    e->uid = st->st_uid;
+    e->gid = st->st_gid;
+    e->size = e->type == 'f' ? (long long)st->st_size : 0;
+    e->mtime_ns = stat_mtime_ns(st);
+    e->ino = st->st_ino;
+    e->ctime_ns = stat_ctime_ns(st);
+}
+
+int snap_lookup(const Snapshot *s, const char *path, size_t len) {
+    uint64_t h = fnv1a(0xcbf29ce484222325ULL, path, len);
+    for (int slot = h & s->table_mask; s->table[slot] >= 0; slot = (slot + 1) & s->table_mask) {
+        const char *p = s->entries[s->table[slot]].path;
+        if (strncmp(p, path, len) == 0 && p[len] == '\0') return s->table[slot];
+    }
+    return -1;
+}
+
+// Hash the paths and thread each entry onto its directory's child list
+int snap_index(Snapshot *s) {
+    int size = 1024;
+    while (size < s->count * 2) size *= 2;
+    free(s->table);
+    if ((s->table = malloc(size * sizeof(int))) == NULL) return -1;
+    memset(s->table, 0xff, size * sizeof(int));
+    s->table_mask = size - 1;
+    s->top = -1;
+    for (int i = 0; i < s->count; i++) {
+        const char *p = s->entries[i].path;
+        uint64_t h = fnv1a(0xcbf29ce484222325ULL, p, strlen(p));
+        int slot = h & s->table_mask;
+        while (s->table[slot] >= 0) slot = (slot + 1) & s->table_mask;
+        s->table[slot] = i;
+        s->entries[i].child = -1;
+    }
+    // Backwards, so pushing onto the front leaves each list in manifest order
+    for (int i = s->count - 1; i >= 0; i--) {
+        SnapEntry *e = &s->entries[i];
+        const char *slash = strrchr(e->path, '/');
+        int parent = slash ? snap_lookup(s, e->path, slash - e->path) : -1;
+        if (slash && (parent < 0 || parent >= i || s->entries[parent].type != 'd')) return -1;
+        int *head = parent < 0 ? &s->top : &s->entries[parent].child;
+        e->sibling = *head;
+        *head = i;
+    }
+    return 0;
+}
+
+// Move all of in to out: reflink, in-kernel copy, then through the buffer
+int snap_copy(int in, int out, long long size, char *buf) {
+#ifdef __linux__
+    if (ioctl(out, FICLONE, in) == 0) return 0;
+    long long done = 0;
+    while (done < size) {
+        ssize_t n = copy_file_range(in, NULL, out, NULL, size - done, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (done == 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+                              errno == EOPNOTSUPP || errno == EBADF)) break;
+            return -1;
+        }
+        if (n == 0) break;
+        done += n;
+    }
+    if (done == size && size > 0) return 0;
+#else
+    (void)size;
+#endif
+    for (;;) {
+        ssize_t n = read(in, buf, SNAP_COPY_BUF);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) return 0;
+        for (ssize_t off = 0; off < n; ) {
+            ssize_t k = write(out, buf + off, n - off);
+            if (k < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            off += k;
+        }
+    }
+}
+
+// Names in a directory, read up front since the caller changes it
+int snap_list(int dirfd, char ***names) {
+    int fd = dup(dirfd);
+    DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!dir) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    rewinddir(dir);
+    int count = 0, cap = 0;
+    *names = NULL;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+        if (count == cap) {
+            cap = cap ? cap * 2 : 32;
+            *names = realloc(*names, cap * sizeof(char *));
+        }
+        (*names)[count++] = strdup(ent->d_name);
+    }
+    closedir(dir);
+    return count;
+}
+
+void snap_free_list(char **names, int count) {
+    for (int i = 0; i < count; i++) free(names[i]);
+    free(names);
+}
+
+// Append name to the relative path in rel; returns the new length or -1
+int snap_join(char *rel, size_t len, const char *name) {
+    int n = snprintf(rel + len, PATH_MAX - len, "%s%s", len ? "/" : "", name);
+    if (n < 0 || len + n >= PATH_MAX) {
+        rel[len] = '\0';
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return (int)(len + n);
+}
+
+// Delete name under dirfd, a whole tree if it is a directory; never follows links
+int snap_remove(int dirfd, const char *name) {
+    struct stat st;
+    if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) return errno == ENOENT ? 0 : -1;
+    if (!S_ISDIR(st.st_mode)) return unlinkat(dirfd, name, 0);
+    int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) return -1;
+    fchmod(fd, 0700);              // a read-only directory can't be emptied
+    char **names;
+    int count = snap_list(fd, &names), rc = count < 0 ? -1 : 0;
+    for (int i = 0; i < count; i++) {
+        if (snap_remove(fd, names[i]) != 0) rc = -1;
+    }
+    if (count > 0) snap_free_list(names, count);
+    close(fd);
+    return rc == 0 ? unlinkat(dirfd, name, AT_REMOVEDIR) : -1;
+}
+
+// Walk the live tree below dirfd into the manifest and the farm
+void snap_capture(Snapshot *s, int dirfd, char *rel, size_t len) {
+    char **names;
+    int count = snap_list(dirfd, &names);
+    if (count < 0) {
+        snap_warn(s, "sandbox_snapshot", rel);
+        return;
+    }
+    char target[PATH_MAX];
+    for (int i = 0; i < count; i++) {
+        int n = snap_join(rel, len, names[i]);
+        struct stat st;
+        if (n < 0 || fstatat(dirfd, names[i], &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            snap_warn(s, "sandbox_snapshot", n < 0 ? names[i] : rel);
+            continue;
+        }
+        SnapEntry *e = NULL;
+        if (S_ISDIR(st.st_mode)) {
+            int fd = openat(dirfd, names[i], O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (fd < 0 || mkdirat(s->tree, rel, 0700) != 0 || (e = snap_add(s, 'd', rel, NULL)) == NULL) {
+                snap_warn(s, "sandbox_snapshot", rel);
+            } else {
+                snap_set_stat(e, &st);
+                snap_capture(s, fd, rel, n);
+            }
+            if (fd >= 0) close(fd);
+        } else if (S_ISREG(st.st_mode)) {
+            int in = openat(dirfd, names[i], O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+            int out = in < 0 ? -1 : openat(s->tree, rel, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+            if (out < 0 || fstat(in, &st) != 0 || snap_copy(in, out, st.st_size, s->buf) != 0 ||
+                (e = snap_add(s, 'f', rel, NULL)) == NULL) {
+                snap_warn(s, "sandbox_snapshot", rel);
+            } else {
+                snap_set_stat(e, &st);
+                s->copied++;
+            }
+            if (in >= 0) close(in);
+            if (out >= 0) close(out);
+        } else if (S_ISLNK(st.st_mode)) {
+            ssize_t k = readlinkat(dirfd, names[i], target, sizeof(target) - 1);
+            if (k >= 0) target[k] = '\0';
+            if (k < 0 || (e = snap_add(s, 'l', rel, target)) == NULL) {
+                snap_warn(s, "sandbox_snapshot", rel);
+            } else {
+                snap_set_stat(e, &st);
+            }
+        } else {
+            fprintf(stderr, "shell: sandbox_snapshot: '%s': skipping special file\n", rel);
+        }
+        rel[len] = '\0';
+    }
+    snap_free_list(names, count);
+}
+
+int snap_write_manifest(Snapshot *s, const char *path) {
+    char tmp[PATH_MAX + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) return -1;
+    fputs(SNAP_MAGIC, fp);
+    for (int i = 0; i < s->count; i++) {
+        const SnapEntry *e = &s->entries[i];
+        fprintf(fp, "%c %o %u %u %lld %lld %llu %lld\t", e->type, (unsigned)e->mode,
+                (unsigned)e->uid, (unsigned)e->gid, e->size, e->mtime_ns, e->ino, e->ctime_ns);
+        fwrite(e->path, 1, strlen(e->path) + 1, fp);
+        fwrite(e->target ? e->target : "", 1, (e->target ? strlen(e->target) : 0) + 1, fp);
+    }
+    if (fclose(fp) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// Read <dir>/manifest into s; -1 with errno set if missing, EINVAL if damaged
+int snap_read_manifest(Snapshot *s) {
+    char path[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s/manifest", s->dir);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0) return -1;
+    char *data = fstat(fd, &st) == 0 ? malloc(st.st_size + 1) : NULL;
+    ssize_t got = 0;
+    while (data && got < st.st_size) {
+        ssize_t n = read(fd, data + got, st.st_size - got);
+        if (n <= 0) break;
+        got += n;
+    }
+    close(fd);
+    if (!data || got != st.st_size) {
+        free(data);
+        errno = EIO;
+        return -1;
+    }
+    data[got] = '\0';
+
+    size_t magic = strlen(SNAP_MAGIC);
+    int ok = (size_t)got >= magic && memcmp(data, SNAP_MAGIC, magic) == 0;
+    char *p = data + magic, *end = data + got;
+    while (ok && p < end) {
+        char type = *p;
+        unsigned long long v[7];
+        char *q = p + 1;
+        for (int k = 0; k < 7; k++) v[k] = strtoull(q, &q, k == 0 ? 8 : 10);
+        if (*q != '\t' || !type || !strchr("dfl", type)) {
+            ok = 0;
+            break;
+        }
+        char *path_start = q + 1;
+        char *target = path_start + strlen(path_start) + 1;
+        p = target < end ? target + strlen(target) + 1 : end + 1;
+        SnapEntry *e;
+        if (p > end || !*path_start ||
+            (e = snap_add(s, type, path_start, type == 'l' ? target : NULL)) == NULL) {
+            ok = 0;
+            break;
+        }
+        e->mode = v[0] & 07777;
+        e->uid = v[1];
+        e->gid = v[2];
+        e->size = v[3];
+        e->mtime_ns = v[4];
+        e->ino = v[5];
+        e->ctime_ns = v[6];
+    }
+    free(data);
+    if (!ok || snap_index(s) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+void snap_times(const SnapEntry *e, struct timespec times[2]) {
+    times[0].tv_sec = 0;
+    times[0].tv_nsec = UTIME_OMIT;
+    times[1].tv_sec = e->mtime_ns / 1000000000LL;
+    times[1].tv_nsec = e->mtime_ns % 1000000000LL;
+}
+
+// Put the snapshot's copy of e at name, through a temporary and a rename
+void snap_put_file(Snapshot *s, int dirfd, const char *name, SnapEntry *e) {
+    char tmp[64];
+    snprintf(tmp, sizeof(tmp), ".sandbox_restore.%d", (int)getpid());
+    unlinkat(dirfd, tmp, 0);       // left by an interrupted restore
+    int in = openat(s->tree, e->path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    int out = in < 0 ? -1 : openat(dirfd, tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    struct timespec times[2];
+    snap_times(e, times);
+    int rc = out < 0 ? -1 : snap_copy(in, out, e->size, s->buf);
+    if (rc == 0 && geteuid() == 0) rc = fchown(out, e->uid, e->gid);
+    if (rc == 0) rc = fchmod(out, e->mode);
+    if (rc == 0) rc = futimens(out, times);
+    if (in >= 0) close(in);
+    if (out >= 0 && close(out) != 0) rc = -1;
+    struct stat st;
+    if (rc == 0) rc = renameat(dirfd, tmp, dirfd, name);
+    if (rc == 0) rc = fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW);
+    if (rc != 0) {
+        snap_warn(s, "sandbox_restore", e->path);
+        if (out >= 0) unlinkat(dirfd, tmp, 0);
+        return;
+    }
+    // rename moves the ctime on, so read the pair back after it
+    e->ino = st.st_ino;
+    e->ctime_ns = stat_ctime_ns(&st);
+    s->copied++;
+}
+
+int snap_file_changed(const SnapEntry *e, const struct stat *st) {
+    return st->st_ino != e->ino || stat_ctime_ns(st) != e->ctime_ns ||
+           st->st_size != e->size || stat_mtime_ns(st) != e->mtime_ns ||
+           (st->st_mode & 07777) != e->mode ||
+           (geteuid() == 0 && (st->st_uid != e->uid || st->st_gid != e->gid));
+}
+
+int snap_link_matches(int dirfd, const char *name, const SnapEntry *e) {
+    char target[PATH_MAX];
+    ssize_t k = readlinkat(dirfd, name, target, sizeof(target) - 1);
+    if (k < 0) return 0;
+    target[k] = '\0';
+    return strcmp(target, e->target) == 0;
+}
+
+void snap_restore_dir(Snapshot *s, int dirfd, char *rel, size_t len, int dir);
+
+// Bring back an entry that is missing from the live tree
+void snap_create(Snapshot *s, int dirfd, char *rel, size_t len, int idx) {
+    SnapEntry *e = &s->entries[idx];
+    const char *slash = strrchr(e->path, '/');
+    const char *name = slash ? slash + 1 : e->path;
+    if (e->type == 'f') {
+        snap_put_file(s, dirfd, name, e);
+        return;
+    }
+    int rc;
+    if (e->type == 'l') {
+        rc = symlinkat(e->target, dirfd, name);
+        if (rc == 0 && geteuid() == 0) fchownat(dirfd, name, e->uid, e->gid, AT_SYMLINK_NOFOLLOW);
+        if (rc == 0) {
+            struct timespec times[2];
+            snap_times(e, times);
+            utimensat(dirfd, name, times, AT_SYMLINK_NOFOLLOW);
+        }
+    } else {
+        rc = mkdirat(dirfd, name, 0700);
+        int fd = rc == 0 ? openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC) : -1;
+        int n = fd < 0 ? -1 : snap_join(rel, len, name);
+        if (n < 0) {
+            rc = -1;
+        } else {
+            snap_restore_dir(s, fd, rel, n, idx);
+            rel[len] = '\0';
+            struct timespec times[2];
+            snap_times(e, times);
+            if (geteuid() == 0) fchown(fd, e->uid, e->gid);
+            fchmod(fd, e->mode);
+            futimens(fd, times);
+        }
+        if (fd >= 0) close(fd);
+    }
+    if (rc != 0) snap_warn(s, "sandbox_restore", e->path);
+    else s->created++;
+}
+
+// Diff one live directory against its manifest entries (dir < 0 = the root)
+void snap_restore_dir(Snapshot *s, int dirfd, char *rel, size_t len, int dir) {
+    char **names;
+    int count = snap_list(dirfd, &names);
+    if (count < 0) {
+        snap_warn(s, "sandbox_restore", len ? rel : ".");
+        return;
+    }
+    int changed = 0;
+    for (int i = 0; i < count; i++) {
+        int n = snap_join(rel, len, names[i]);
+        struct stat st;
+        if (n < 0 || fstatat(dirfd, names[i], &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            snap_warn(s, "sandbox_restore", n < 0 ? names[i] : rel);
+            continue;
+        }
+        int idx = snap_lookup(s, rel, n);
+        SnapEntry *e = idx >= 0 ? &s->entries[idx] : NULL;
+        char type = S_ISDIR(st.st_mode) ? 'd' : S_ISREG(st.st_mode) ? 'f' : S_ISLNK(st.st_mode) ? 'l' : '?';
+        if (!e || e->type != type || (type == 'l' && !snap_link_matches(dirfd, names[i], e))) {
+            // Not in the snapshot in this form; if it is, it is recreated below
+            if (snap_remove(dirfd, names[i]) != 0) snap_warn(s, "sandbox_restore", rel);
+            else s->removed++;
+            changed = 1;
+        } else if (type == 'd') {
+            e->seen = 1;
+            int fd = openat(dirfd, names[i], O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (fd < 0) {
+                snap_warn(s, "sandbox_restore", rel);
+            } else {
+                // Writable by us while it is diffed, then the snapshot's mode
+                if ((st.st_mode & 07777) != (e->mode | S_IRWXU)) fchmod(fd, e->mode | S_IRWXU);
+                if (geteuid() == 0 && (st.st_uid != e->uid || st.st_gid != e->gid)) fchown(fd, e->uid, e->gid);
+                snap_restore_dir(s, fd, rel, n, idx);
+                if ((e->mode & S_IRWXU) != S_IRWXU) fchmod(fd, e->mode);
+                close(fd);
+            }
+            s->kept++;
+        } else if (type == 'f' && (s->force || snap_file_changed(e, &st))) {
+            e->seen = 1;
+            snap_put_file(s, dirfd, names[i], e);
+            changed = 1;
+        } else {
+            e->seen = 1;
+            s->kept++;
+        }
+        rel[len] = '\0';
+    }
+    snap_free_list(names, count);
+
+    for (int c = dir < 0 ? s->top : s->entries[dir].child; c >= 0; c = s->entries[c].sibling) {
+        if (s->entries[c].seen) continue;
+        s->entries[c].seen = 1;
+        snap_create(s, dirfd, rel, len, c);
+        changed = 1;
+    }
+    // Adding and removing entries moved the directory's own mtime
+    if (changed && dir >= 0) {
+        struct timespec times[2];
+        snap_times(&s->entries[dir], times);
+        futimens(dirfd, times);
+    }
+}
+
+// A snapshot name becomes a directory name: no slashes, no leading dot
+int snap_name_ok(const char *name) {
+    if (!*name || *name == '.' || strchr(name, '/') || strlen(name) > NAME_MAX - 8) {
+        fprintf(stderr, "shell: invalid snapshot name '%s'\n", name);
+        return 0;
+    }
+    return 1;
+}
+
+int snap_open_root() {
+    size_t n = strlen(policy->root_resolved);
+    if (strncmp(policy->snapshot_dir, policy->root_resolved, n) == 0 &&
+        (policy->snapshot_dir[n] == '/' || policy->snapshot_dir[n] == '\0' || n == 1)) {
+        fprintf(stderr, "shell: snapshot_dir %s is inside the sandbox\n", policy->snapshot_dir);
+        return -1;
+    }
+    int fd = open(policy->root_resolved, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) fprintf(stderr, "shell: %s: %s\n", policy->root_resolved, strerror(errno));
+    return fd;
+}
+
+// SANDBOX: Capture the sandbox tree as <snapshot_dir>/<name>. It is built
+// under <name>.tmp and renamed over the old one only once complete.
+int sandbox_snapshot(const char *name) {
+    if (!snap_name_ok(name)) return 1;
+    int rootfd = snap_open_root();
+    if (rootfd < 0) return 1;
+    long long began = monotonic_us();
+    Snapshot s = {0};
+    s.tree = -1;
+    char final[PATH_MAX], old[PATH_MAX], path[PATH_MAX + 16], rel[PATH_MAX] = "";
+    snprintf(final, sizeof(final), "%s/%s", policy->snapshot_dir, name);
+    snprintf(s.dir, sizeof(s.dir), "%s/%s.tmp", policy->snapshot_dir, name);
+    snprintf(old, sizeof(old), "%s/%s.old", policy->snapshot_dir, name);
+    snprintf(path, sizeof(path), "%s/tree", s.dir);
+    snap_remove(AT_FDCWD, s.dir);
+    if ((mkdir(policy->snapshot_dir, 0700) != 0 && errno != EEXIST) ||
+        mkdir(s.dir, 0700) != 0 || mkdir(path, 0700) != 0 ||
+        (s.tree = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0 ||
+        (s.buf = malloc(SNAP_COPY_BUF)) == NULL) {
+        fprintf(stderr, "shell: sandbox_snapshot: %s: %s\n", s.dir, strerror(errno));
+        snap_remove(AT_FDCWD, s.dir);
+        close(rootfd);
+        snap_free(&s);
+        return 1;
+    }
+    snap_capture(&s, rootfd, rel, 0);
+    close(rootfd);
+
+    snprintf(path, sizeof(path), "%s/manifest", s.dir);
+    if (!s.failed && snap_write_manifest(&s, path) != 0) snap_warn(&s, "sandbox_snapshot", path);
+    int status = 0;
+    if (s.failed) {
+        fprintf(stderr, "shell: sandbox_snapshot: %d entries failed, '%s' left as it was\n", s.failed, name);
+        snap_remove(AT_FDCWD, s.dir);
+        status = 1;
+    } else {
+        snap_remove(AT_FDCWD, old);
+        int had_old = rename(final, old) == 0;
+        if (rename(s.dir, final) != 0) {
+            fprintf(stderr, "shell: sandbox_snapshot: %s: %s\n", final, strerror(errno));
+            if (had_old) rename(old, final);
+            snap_remove(AT_FDCWD, s.dir);
+            status = 1;
+        } else {
+            snap_remove(AT_FDCWD, old);
+            char took[32];
+            format_us(took, sizeof(took), monotonic_us() - began);
+            printf("sandbox_snapshot: '%s': %d entries, %d files in %s\n", name, s.count, s.copied, took);
+        }
+    }
+    snap_free(&s);
+    return status;
+}
+
+// SANDBOX: Put the sandbox tree back as snapshot <name> left it
+int sandbox_restore(const char *name, int force) {
+    if (!snap_name_ok(name)) return 1;
+    Snapshot s = {0};
+    s.tree = -1;
+    snprintf(s.dir, sizeof(s.dir), "%s/%s", policy->snapshot_dir, name);
+    s.force = force;
+    if (snap_read_manifest(&s) != 0) {
+        if (errno == ENOENT) fprintf(stderr, "shell: sandbox_restore: no snapshot named '%s'\n", name);
+        else fprintf(stderr, "shell: sandbox_restore: %s: %s\n", s.dir, strerror(errno));
+        snap_free(&s);
+        return 1;
+    }
+    char path[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s/tree", s.dir);
+    if ((s.tree = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        fprintf(stderr, "shell: sandbox_restore: %s: %s\n", path, strerror(errno));
+        snap_free(&s);
+        return 1;
+    }
+    int rootfd = snap_open_root();
+    if (rootfd < 0 || (s.buf = malloc(SNAP_COPY_BUF)) == NULL) {
+        if (rootfd >= 0) close(rootfd);
+        snap_free(&s);
+        return 1;
+    }
+    long long began = monotonic_us();
+    char rel[PATH_MAX] = "";
+    snap_restore_dir(&s, rootfd, rel, 0, -1);
+    close(rootfd);
+
+    // Recopied files have a new inode and ctime to compare against next time
+    snprintf(path, sizeof(path), "%s/manifest", s.dir);
+    if (s.copied && snap_write_manifest(&s, path) != 0) snap_warn(&s, "sandbox_restore", path);
+    // The working directory may have been one of the removed ones
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd)) && chdir(policy->root_resolved) != 0) perror("shell: chdir");
+
+    char took[32];
+    format_us(took, sizeof(took), monotonic_us() - began);
+    printf("sandbox_restore: '%s': %d unchanged, %d copied, %d removed, %d created in %s\n",
+           name, s.kept, s.copied, s.removed, s.created, took);
+    int status = s.failed ? 1 : 0;
+    if (s.failed) fprintf(stderr, "shell: sandbox_restore: %d entries failed\n", s.failed);
+    snap_free(&s);
+    return status;
+}
+
+void print_all_commands() {
+    printf("\n");
+    printf("\033[1;36m╔════════════════════════════════════════════════════════════════╗\033[0m\n");
+    printf("\033[1;36m║\033[0m                    \033[1;32mALL AVAILABLE COMMANDS\033[0m                      \033[1;36m║\033[0m\n");
+    printf("\033[1;36m╠════════════════════════════════════════════════════════════════╣\033[0m\n");
+    
+    // Built-in commands
+    printf("\033[1;36m║\033[0m  \033[1;32mBuilt-in Commands (Custom Implementations):\033[0m                 \033[1;36m║\033[0m\n");
+    printf("\033[1;36m║\033[0m     cd, exit, print_history, add_alias, remove_alias, help, stats, commands, echo  \033[1;36m║\033[0m\n");
+    printf("\033[1;36m║\033[0m     sandbox_snapshot, sandbox_restore (operator only), watch    \033[1;36m║\033[0m\n");
+    printf("\033[1;36m║\033[0m                                                             \033[1;36m║\033[0m\n");
+    
+    // Whitelisted external commands
+    printf("\033[1;36m║\033[0m  \033[1;32mWhitelisted External Commands:\033[0m                             \033[1;36m║\033[0m\n");
+    printf("\033[1;36m║\033[0m     ");
+    int count = 0;
+    for (int i = 0; policy->allowed[i] != NULL; i++) {
+        printf("%s", policy->allowed[i]);
+        if (policy->allowed[i + 1] != NULL) {
+            printf(", ");
+        }
+        count++;
+        // Line break every 4 commands for readability
+        if (count % 4 == 0 && policy->allowed[i + 1] != NULL) {
+            printf("\n\033[1;36m║\033[0m     ");
+            count = 0;
+        }
+    }
+    printf("                                                      \033[1;36m║\033[0m\n");
+    
+    printf("\033[1;36m║\033[0m                                                             \033[1;36m║\033[0m\n");
+    
+    // Blocked commands
+    printf("\033[1;36m║\033[0m  \033[1;31mBlocked Commands (Security):\033[0m                                \033[1;36m║\033[0m\n");
+    printf("\033[1;36m║\033[0m     ");
+    count = 0;
+    for (int i = 0; policy->blocked[i] != NULL; i++) {
+        printf("\033[1;31m%s\033[0m", policy->blocked[i]);
+        if (policy->blocked[i + 1] != NULL) {
+            printf(", ");
+        }
+        count++;
+        if (count % 4 == 0 && policy->blocked[i + 1] != NULL) {
+            printf("\n\033[1;36m║\033[0m     ");
+            count = 0;
+        }
+    }
+    printf("                                                      \033[1;36m║\033[0m\n");
+    
+    // Summary
+    int total_allowed = 0;
+    for (int i = 0; policy->allowed[i] != NULL; i++) total_allowed++;
+    int total_blocked = 0;
+    for (int i = 0; policy->blocked[i] != NULL; i++) total_blocked++;
+    
+    printf("\033[1;36m║\033[0m                                                             \033[1;36m║\033[0m\n");
+    printf("\033[1;36m║\033[0m  \033[1;33mSummary:\033[0m                                                  \033[1;36m║\033[0m\n");
+    printf("\033[1;36m║\033[0m     Total allowed commands: \033[1;32m%d\033[0m (including 7 built-ins)      \033[1;36m║\033[0m\n", total_allowed + 7);
+    printf("\033[1;36m║\033[0m     Total blocked commands: \033[1;31m%d\033[0m (security risks)            \033[1;36m║\033[0m\n", total_blocked);
+    printf("\033[1;36m╚════════════════════════════════════════════════════════════════╝\033[0m\n");
+    printf("\n");
+    printf("  \033[1;33mTip:\033[0m Use TAB for autocomplete, type 'help' for detailed information\n");
+    printf("  \033[1;33mNote:\033[0m All file operations are restricted to: \033[1;36m%s\033[0m\n\n", policy->root);
+}
+
+int execute_builtin(char** args) {
+    if (args[0] == NULL) return 1;
+
+    if (strcmp(args[0], "cd") == 0) {
+        if (args[1] == NULL) {
+            fprintf(stderr, "shell: expected argument to \"cd\"\n");
+            session->last_status = 1;
+        } else {
+            // SANDBOX: Validate path before changing directory
+            if (!is_path_allowed(args[1])) {
+                return 1;
+            }
+            if (chdir(args[1]) != 0) {
+                perror("shell");
+                session->last_status = 1;
+            }
+        }
+        return 1;
+    }
+    if (strcmp(args[0], "exit") == 0) {
+        print_sandbox_stats();
+        if (server_mode || protocol_mode) {
+            // Only this client's session ends; the process keeps serving
+            session->closing = 1;
+            return 1;
+        }
+        metrics_tick(1);
+        state_save(session);
+        exit(0);
+    }
+    // ONLY our custom print_history - NO original history command
+    if (strcmp(args[0], "print_history") == 0) {
+        print_history();
+        return 1;
+    }
+    // Block original history command
+    if (strcmp(args[0], "history") == 0) {
+        fprintf(stderr, "\033[1;31m[SANDBOX BLOCKED]\033[0m Command 'history' is not allowed (use 'print_history' instead - our custom implementation)\n");
+        count_blocked(BLOCK_BUILTIN);
+        return 1;
+    }
+    if (strcmp(args[0], "sandbox_stats") == 0 || strcmp(args[0], "stats") == 0) {
+        if (args[1] && strcmp(args[1], "--json") == 0) {
+            print_stats_json();
+        } else {
+            print_sandbox_stats();
+        }
+        return 1;
+    }
+    // SANDBOX: Phase tracing - trace [on [events] | off | dump <file>]
+    if (strcmp(args[0], "trace") == 0) {
+        if (args[1] && strcmp(args[1], "on") == 0) {
+            int events = args[2] ? atoi(args[2]) : TRACE_DEFAULT_EVENTS;
+            if (events <= 0 || events > TRACE_MAX_EVENTS || trace_start(session, events) < 0) {
+                fprintf(stderr, "shell: trace: cannot keep %d events\n", events);
+                session->last_status = 1;
+            }
+        } else if (args[1] && strcmp(args[1], "off") == 0) {
+            trace_start(session, 0);
+        } else if (args[1] && strcmp(args[1], "dump") == 0 && args[2]) {
+            if (!session->trace) {
+                fprintf(stderr, "shell: trace: tracing is off (trace on)\n");
+                session->last_status = 1;
+            } else if (is_path_allowed(args[2]) && trace_dump(session, args[2]) != 0) {
+                perror("shell: trace");
+                session->last_status = 1;
+            }
+        } else if (args[1] == NULL) {
+            if (session->trace) {
+                printf("trace: on, %lld events recorded, ring of %d\n",
+                       session->trace->recorded, session->trace->size);
+            } else {
+                printf("trace: off\n");
+            }
+        } else {
+            fprintf(stderr, "shell: trace: usage: trace [on [events] | off | dump <file>]\n");
+            session->last_status = 1;
+        }
+        return 1;
+    }
+    // SANDBOX: sandbox_snapshot [name] / sandbox_restore [-f] [name] - the
+    // operator's, so a server client may not wipe the tree under the others
+    if (strcmp(args[0], "sandbox_snapshot") == 0 || strcmp(args[0], "sandbox_restore") == 0) {
+        if (server_mode) {
+            fprintf(stderr, "\033[1;31m[SANDBOX BLOCKED]\033[0m Command '%s' is only available to the shell's own terminal\n", args[0]);
+            count_blocked(BLOCK_BUILTIN);
+            session->last_status = 1;
+            return 1;
+        }
+        int restore = args[0][8] == 'r', force = 0, i = 1;
+        if (restore && args[i] && strcmp(args[i], "-f") == 0) {
+            force = 1;
+            i++;
+        }
+        if (args[i] && args[i + 1]) {
+            fprintf(stderr, "shell: usage: %s\n", restore ? "sandbox_restore [-f] [name]" : "sandbox_snapshot [name]");
+            session->last_status = 1;
+            return 1;
+        }
+        const char *name = args[i] ? args[i] : "default";
+        session->last_status = restore ? sandbox_restore(name, force) : sandbox_snapshot(name);
+        return 1;
+    }
+    if (strcmp(args[0], "help") == 0) {
+        printf("\n\033[1;36mAvailable Commands:\033[0m\n");
+        printf("  \033[1;32mBuilt-in commands:\033[0m\n");
+        printf("    cd, exit, print_history, add_alias, remove_alias, help, stats, commands, trace\n");
+        printf("    sandbox_snapshot [name], sandbox_restore [-f] [name]\n");
+        printf("    watch [-n secs] [--on-change path[,path...]] command\n\n");
+        printf("  \033[1;32mWhitelisted external commands:\033[0m\n");
+        printf("    ");
+        for (int i = 0; policy->allowed[i] != NULL; i++) {
+            printf("%s ", policy->allowed[i]);
+            if ((i + 1) % 8 == 0) printf("\n    ");
+        }
+        printf("\n\n");
+        printf("  \033[1;33mNote:\033[0m All file operations are restricted to: %s\n", policy->root);
+        printf("  \033[1;33mTip:\033[0m Type 'commands' for a complete formatted list\n\n");
+        return 1;
+    }
+    if (strcmp(args[0], "commands") == 0) {
+        print_all_commands();
+        return 1;
+    }
+    // Block original alias command
+    if (strcmp(args[0], "alias") == 0) {
+        fprintf(stderr, "\033[1;31m[SANDBOX BLOCKED]\033[0m Command 'alias' is not allowed (use 'add_alias' instead - our custom implementation)\n");
+        count_blocked(BLOCK_BUILTIN);
+        return 1;
+    }
+    // Block original unalias command
+    if (strcmp(args[0], "unalias") == 0) {
+        fprintf(stderr, "\033[1;31m[SANDBOX BLOCKED]\033[0m Command 'unalias' is not allowed (use 'remove_alias' instead - our custom implementation)\n");
+        count_blocked(BLOCK_BUILTIN);
+        return 1;
+    }
+    // ONLY our custom add_alias - NO original alias command
+    if (strcmp(args[0], "add_alias") == 0) {
+        if (args[1] == NULL) {
+            // List all aliases
+            for (int i = 0; i < session->alias_count; i++) {
+                printf("alias %s='%s'\n", session->aliases[i].name, session->aliases[i].command);
+            }
+        } else {
+            // Reconstruct the full argument string to handle quotes properly
+            char full_arg[MAX_LINE] = "";
+            strcpy(full_arg, args[1]);
+            for (int i = 2; args[i] != NULL; i++) {
+                strcat(full_arg, " ");
+                strcat(full_arg, args[i]);
+            }
+            
+            char *equal = strchr(full_arg, '=');
+            if (equal) {
+                *equal = '\0';
+                char *name = full_arg;
+                char *value = equal + 1;
+
+                // Strip surrounding quotes if present
+                size_t val_len = strlen(value);
+                if (val_len >= 2 && 
+                    ((value[0] == '\'' && value[val_len - 1] == '\'') ||
+                     (value[0] == '"' && value[val_len - 1] == '"'))) {
+                    value[val_len - 1] = '\0';
+                    value++;
+                }
+
+                // Store the alias (value is now the command without quotes)
+                add_alias(name, value);
+            } else {
+                fprintf(stderr, "shell: invalid alias format\n");
+                fprintf(stderr, "Usage: add_alias name='command'\n");
+                session->last_status = 1;
+            }
+        }
+        return 1;
+    }
+    // ONLY our custom remove_alias - NO original unalias command
+    if (strcmp(args[0], "remove_alias") == 0) {
+        if (args[1] == NULL) {
+            fprintf(stderr, "shell: remove_alias: usage: remove_alias name\n");
+            session->last_status = 1;
+        } else {
+            remove_alias(args[1]);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+// SANDBOX: Find command path - ONLY use sandbox/bin, NO system fallback
+char* find_command_path(const char *cmd) {
+    static char path[PATH_MAX];
+    struct stat st;
+    
+#if USE_SANDBOX_COMMANDS
+    // ONLY check sandbox/bin directory - NO system fallback
+    snprintf(path, sizeof(path), "%s/%s", policy->bin_dir, cmd);
+    if (stat(path, &st) == 0 && (st.st_mode & S_IXUSR)) {
+        return path;  // Found sandbox command
+    }
+    // NOT FOUND - return NULL to indicate command doesn't exist
+    return NULL;
+#else
+    // Fall back to system PATH (if sandbox commands disabled)
+    return (char*)cmd;
+#endif
+}
+
+void handle_redirection(char** args, int *in_redir, int *out_redir, char** in_file, char** out_file) {
+    for (int i = 0; args[i] != NULL; i++) {
+        if (strcmp(args[i], "<") == 0) {
+            *in_redir = 1;
+            *in_file = args[i + 1];
+            args[i] = NULL;
+        }
+        else if (strcmp(args[i], ">") == 0) {
+            *out_redir = 1;
+            *out_file = args[i + 1];
+            args[i] = NULL;
+        }
+    }
+}
+
+// SANDBOX: Result cache for pure commands (opt-in: 'cache = <MB>' in sandbox.conf)
+// cat, wc, grep, ls, sort and uniq print the same bytes for the same argv and
+// the same inputs, so a successful run is kept in memory. The key is the argv,
+// the cwd, the command binary and (dev, inode, size, mtime_ns) of every input
+// path and of stdin when it is redirected from a file; a directory operand
+// also keys on the metadata of each entry, which is what ls -l prints. A hit
+// writes the saved bytes straight to the destination without forking. On a
+// miss a tee child copies the output to its destination and into a memfd,
+// and cache_finish() keeps it once the job exits with status 0. The least
+// recently used entries go first when the byte budget runs out.
+#define CACHE_BUCKETS 1024
+#define CACHE_ENTRY_SHARE 8    // one entry may use at most 1/8 of the budget
+#define CACHE_RACY_SECS 2      // inputs this fresh may change within one mtime tick
+
+const char *cacheable_commands[] = { "cat", "wc", "grep", "ls", "sort", "uniq", NULL };
+
+typedef struct CacheEntry {
+    struct CacheEntry *chain;           // next in the hash bucket
+    struct CacheEntry *prev, *next;     // LRU list, most recent at cache_head
+    uint64_t hash;
+    size_t key_len;
+    size_t data_len;
+    char *key;
+    char *data;
+} CacheEntry;
+
+CacheEntry *cache_buckets[CACHE_BUCKETS];
+CacheEntry *cache_head, *cache_tail;
+
+typedef struct {
+    char *data;
+    size_t len, cap;
+} KeyBuf;
+
+void key_add(KeyBuf *k, const void *p, size_t n) {
+    if (k->len + n > k->cap) {
+        k->cap = (k->len + n) * 2 + 256;
+        k->data = realloc(k->data, k->cap);
+    }
+    memcpy(k->data + k->len, p, n);
+    k->len += n;
+}
+
+uint64_t fnv1a(uint64_t h, const void *p, size_t n) {
+    const unsigned char *b = p;
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ b[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+long long stat_mtime_ns(const struct stat *st) {
+#ifdef __APPLE__
+    return (long long)st->st_mtimespec.tv_sec * 1000000000LL + st->st_mtimespec.tv_nsec;
+#else
+    return (long long)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+#endif
+}
+
+void key_add_stat(KeyBuf *k, char tag, const struct stat *st, time_t *newest) {
+    long long fields[4] = { (long long)st->st_dev, (long long)st->st_ino,
+                            (long long)st->st_size, stat_mtime_ns(st) };
+    key_add(k, &tag, 1);
+    key_add(k, fields, sizeof(fields));
+    if (st->st_mtime > *newest) *newest = st->st_mtime;
+}
+
+// Fold the name and metadata of every entry into a 128-bit digest
+void key_add_dir(KeyBuf *k, const char *path, time_t *newest) {
+    uint64_t digest[2] = { 0xcbf29ce484222325ULL, 0x84222325cbf29ce4ULL };
+    DIR *dir = opendir(path);
+    if (dir) {
+        struct dirent *ent;
+        while ((ent = readdir(dir)) != NULL) {
+            struct stat st;
+            if (fstatat(dirfd(dir), ent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+            long long fields[7] = { (long long)st.st_ino, (long long)st.st_size, stat_mtime_ns(&st),
+                                    (long long)st.st_mode, (long long)st.st_uid,
+                                    (long long)st.st_gid, (long long)st.st_nlink };
+            size_t len = strlen(ent->d_name) + 1;
+            digest[0] = fnv1a(fnv1a(digest[0], ent->d_name, len), fields, sizeof(fields));
+            digest[1] = fnv1a(fnv1a(digest[1] * 31 + len, fields, sizeof(fields)), ent->d_name, len);
+            if (st.st_mtime > *newest) *newest = st.st_mtime;
+        }
+        closedir(dir);
+    }
+    key_add(k, digest, sizeof(digest));
+}
+
+// Build the cache key for a command line. Returns 0 if the command is pure
+// and reads only files the key covers; *store says whether the inputs have
+// been still for long enough that the result may be kept.
+int cache_key(char **args, int in_fd, KeyBuf *k, int *store) {
+    int pure = 0;
+    for (int i = 0; cacheable_commands[i] != NULL; i++) {
+        pure |= strcmp(args[0], cacheable_commands[i]) == 0;
+    }
+    if (!pure) return -1;
+
+    struct stat st;
+    time_t newest = 0;
+    int has_input = 0;
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) return -1;
+    for (int i = 0; args[i] != NULL; i++) {
+        key_add(k, args[i], strlen(args[i]) + 1);
+    }
+    key_add(k, "", 1);
+    key_add(k, cwd, strlen(cwd) + 1);
+    char *cmd_path = find_command_path(args[0]);
+    if (cmd_path && stat(cmd_path, &st) == 0) key_add_stat(k, 'B', &st, &newest);
+
+    if (in_fd >= 0) {
+        if (fstat(in_fd, &st) != 0 || !S_ISREG(st.st_mode)) goto uncacheable;
+        key_add_stat(k, 'I', &st, &newest);
+        has_input = 1;
+    }
+
+    // grep's first operand is the pattern unless -e or -f supplied one
+    int skip_pattern = strcmp(args[0], "grep") == 0;
+    int operands = 0;
+    for (int i = 1; args[i] != NULL; i++) {
+        if (skip_pattern && (strcmp(args[i], "-e") == 0 || strcmp(args[i], "-f") == 0)) skip_pattern = 0;
+        if (strcmp(args[i], "-") == 0) goto uncacheable;       // explicit stdin
+        if (args[i][0] == '-') continue;
+        if (skip_pattern && operands++ == 0) continue;
+        if (stat(args[i], &st) != 0) {
+            key_add(k, "M", 1);   // option value or missing file; the argv covers it
+            continue;
+        }
+        // A FIFO, socket or device gives different bytes on every read
+        if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) goto uncacheable;
+        key_add_stat(k, S_ISDIR(st.st_mode) ? 'D' : 'F', &st, &newest);
+        if (S_ISDIR(st.st_mode)) key_add_dir(k, args[i], &newest);
+        has_input = 1;
+    }
+    if (!has_input && strcmp(args[0], "ls") == 0 && stat(".", &st) == 0) {
+        key_add_stat(k, 'D', &st, &newest);
+        key_add_dir(k, ".", &newest);
+        has_input = 1;
+    }
+    if (!has_input) goto uncacheable;          // it would read the terminal or socket
+    *store = newest < time(NULL) - CACHE_RACY_SECS;
+    return 0;
+
+uncacheable:
+    free(k->data);
+    k->data = NULL;
+    return -1;
+}
+
+size_t cache_budget(void) {
+    return (size_t)policy->cache_mb << 20;
+}
+
+void cache_unlink(CacheEntry *e) {
+    if (e->prev) e->prev->next = e->next; else cache_head = e->next;
+    if (e->next) e->next->prev = e->prev; else cache_tail = e->prev;
+}
+
+void cache_push_front(CacheEntry *e) {
+    e->prev = NULL;
+    e->next = cache_head;
+    if (cache_head) cache_head->prev = e; else cache_tail = e;
+    cache_head = e;
+}
+
+void cache_remove(CacheEntry *e) {
+    CacheEntry **link = &cache_buckets[e->hash % CACHE_BUCKETS];
+    while (*link != e) link = &(*link)->chain;
+    *link = e->chain;
+    cache_unlink(e);
+    cache_bytes -= e->key_len + e->data_len;
+    cache_entries--;
+    free(e->key);
+    free(e->data);
+    free(e);
+}
+
+// Evict least recently used entries until the cache fits in budget bytes
+void cache_trim(size_t budget) {
+    while (cache_tail && cache_bytes > budget) {
+        cache_remove(cache_tail);
+    }
+}
+
+CacheEntry *cache_lookup(const char *key, size_t len) {
+    uint64_t hash = fnv1a(0xcbf29ce484222325ULL, key, len);
+    for (CacheEntry *e = cache_buckets[hash % CACHE_BUCKETS]; e; e = e->chain) {
+        if (e->hash == hash && e->key_len == len && memcmp(e->key, key, len) == 0) {
+            cache_unlink(e);
+            cache_push_front(e);
+            return e;
+        }
+    }
+    return NULL;
+}
+
+// Takes ownership of key and data
+void cache_insert(char *key, size_t key_len, char *data, size_t data_len) {
+    CacheEntry *old = cache_lookup(key, key_len);
+    if (old) cache_remove(old);    // another session ran it meanwhile
+    size_t budget = cache_budget();
+    CacheEntry *e = malloc(sizeof(CacheEntry));
+    if (!e || key_len + data_len > budget / CACHE_ENTRY_SHARE) {
+        free(e);
+        free(key);
+        free(data);
+        return;
+    }
+    cache_trim(budget - (key_len + data_len));
+    e->hash = fnv1a(0xcbf29ce484222325ULL, key, key_len);
+    e->key = key;
+    e->key_len = key_len;
+    e->data = data;
+    e->data_len = data_len;
+    e->chain = cache_buckets[e->hash % CACHE_BUCKETS];
+    cache_buckets[e->hash % CACHE_BUCKETS] = e;
+    cache_push_front(e);
+    cache_bytes += key_len + data_len;
+    cache_entries++;
+}
+
+// Called once a session's foreground job is over: keep its captured output
+void cache_finish(Session *s) {
+    if (!s->capture_key) return;
+    off_t size = lseek(s->capture_fd, 0, SEEK_END);
+    size_t limit = cache_budget() / CACHE_ENTRY_SHARE;
+    char *data = NULL;
+    if (s->last_status == 0 && size >= 0 && (size_t)size + s->capture_key_len <= limit &&
+        (data = malloc(size + 1)) != NULL && pread(s->capture_fd, data, size, 0) == size) {
+        cache_insert(s->capture_key, s->capture_key_len, data, size);
+    } else {
+        free(data);
+        free(s->capture_key);
+    }
+    close(s->capture_fd);
+    s->capture_key = NULL;
+}
+
+// The session's foreground job has been reaped: keep its output if it was
+// captured for the cache and count what went through its redirections
+void job_finish(Session *s) {
+    if (s->job_signals) s->last_status = STATUS_TIMEOUT;
+    s->job_deadline_us = 0;
+    s->job_signals = 0;
+    if (s->trace && s->wait_start_ns) trace_add(s->trace, "wait", s->wait_start_ns, monotonic_ns(), 0);
+    s->wait_start_ns = 0;
+    cache_finish(s);
+    metrics_redirect(s, s->redir_in, s->redir_out);
+    s->redir_in = s->redir_out = -1;
+    s->stage_count = 0;
+}
+
+// SANDBOX: Jobs and wall-clock limits
+// Each pipeline gets a process group of its own, started by its first fork,
+// so one kill() reaches every stage and anything they forked. At an
+// interactive terminal a foreground group also takes the tty, which keeps
+// Ctrl-C and keyboard reads with the job rather than the shell. Called on
+// both sides of the fork so neither can run ahead of the other.
+void job_join(pid_t pid) {
+    pid_t pgid = session->job_pgid ? session->job_pgid : pid;
+    setpgid(pid, pgid);
+    if (job_control && !session->job_background) tcsetpgrp(STDIN_FILENO, pgid);
+}
+
+// Give the terminal back to the shell once its foreground job is over
+void job_reclaim_tty() {
+    if (job_control) tcsetpgrp(STDIN_FILENO, getpgrp());
+}
+
+// Drop the session's '&' jobs whose process group is gone
+void background_prune(Session *s) {
+    for (int i = 0; i < s->background_count; ) {
+        if (kill(-s->background[i].pgid, 0) < 0 && errno == ESRCH) {
+            s->background[i] = s->background[--s->background_count];
+        } else {
+            i++;
+        }
+    }
+}
+
+// Parent side of a fork for the running job. The smallest wall_time among
+// its commands caps the whole job, counted from its start; a background
+// job keeps its deadline in the session's table of '&' jobs.
+void job_forked(pid_t pid, const char *cmd) {
+    job_join(pid);
+    if (!session->job_pgid) session->job_pgid = pid;
+    if (subshell_pgid) return;      // the group's job holds the deadline
+    int wall = cmd ? command_limits(cmd).wall_time : 0;
+    long long deadline = session->job_start_us + wall * 1000000LL;
+    long long *slot = &session->job_deadline_us;
+    if (session->job_background) {
+        BackgroundJob *b = NULL;
+        for (int i = 0; i < session->background_count && !b; i++) {
+            if (session->background[i].pgid == session->job_pgid) b = &session->background[i];
+        }
+        if (!b && session->background_count < MAX_BACKGROUND_JOBS) {
+            b = &session->background[session->background_count++];
+            *b = (BackgroundJob){ .pgid = session->job_pgid, .start_us = session->job_start_us };
+            snprintf(b->name, sizeof(b->name), "%s", cmd ? cmd : "job");
+        }
+        if (!b) return;
+        slot = &b->deadline_us;
+    }
+    if (wall > 0 && (!*slot || deadline < *slot)) *slot = deadline;
+}
+
+int job_notices;                    // timeout messages so far (see readline_idle)
+
+void job_timeout_notice(Session *s, const char *name, long long secs) {
+    char msg[256];
+    job_notices++;
+    int n = snprintf(msg, sizeof(msg), "\033[1;31m[SANDBOX TIMEOUT]\033[0m '%s' ran past its wall-clock limit (%llds), stopping it\n",
+                     name, secs);
+    if (s->fd >= 0) {
+        (void)write(s->fd, msg, n < (int)sizeof(msg) ? n : (int)sizeof(msg) - 1);
+    } else {
+        fputs(msg, stderr);
+    }
+}
+
+// At the deadline the job's group gets SIGTERM (and SIGCONT, so a stopped
+// job sees it), then SIGKILL KILL_GRACE_MS later if anything is left.
+// Background jobs go through the same two steps.
+void job_check_deadline(Session *s) {
+    long long now = monotonic_us();
+    for (int i = 0; i < s->background_count; i++) {
+        BackgroundJob *b = &s->background[i];
+        if (!b->deadline_us || now < b->deadline_us) continue;
+        if (kill(-b->pgid, 0) < 0 && errno == ESRCH) {
+            b->deadline_us = 0;             // finished in time; pruned below
+        } else if (b->signals == 0) {
+            job_timeout_notice(s, b->name, (b->deadline_us - b->start_us) / 1000000);
+            metrics_timed_out_command(s, b->name);
+            kill(-b->pgid, SIGTERM);
+            kill(-b->pgid, SIGCONT);
+            b->signals = 1;
+            b->deadline_us = now + KILL_GRACE_MS * 1000LL;
+        } else {
+            kill(-b->pgid, SIGKILL);
+            b->signals = 2;
+            b->deadline_us = 0;
+        }
+    }
+    background_prune(s);
+
+    if (!s->job_deadline_us || s->job_pgid <= 0 || now < s->job_deadline_us) return;
+    if (s->job_signals == 0) {
+        job_timeout_notice(s, s->stage_count ? s->stage_name[0] : "job",
+                           (s->job_deadline_us - s->job_start_us) / 1000000);
+        metrics_timed_out(s);
+        kill(-s->job_pgid, SIGTERM);
+        kill(-s->job_pgid, SIGCONT);
+        s->job_signals = 1;
+        s->job_deadline_us = monotonic_us() + KILL_GRACE_MS * 1000LL;
+    } else {
+        kill(-s->job_pgid, SIGKILL);
+        s->job_signals = 2;
+        s->job_deadline_us = 0;
+    }
+}
+
+// A session's '&' jobs do not outlive it
+void background_kill_all(Session *s) {
+    for (int i = 0; i < s->background_count; i++) kill(-s->background[i].pgid, SIGKILL);
+    s->background_count = 0;
+}
+
+// Poll timeout until the next deadline of any running job, -1 when none
+int job_timeout_ms() {
+    long long next = 0;
+    for (int i = -1; i < MAX_SESSIONS; i++) {
+        Session *s = i < 0 ? &terminal_session : sessions[i];
+        if (!s) continue;
+        if (s->job_deadline_us && (!next || s->job_deadline_us < next)) next = s->job_deadline_us;
+        for (int j = 0; j < s->background_count; j++) {
+            long long d = s->background[j].deadline_us;
+            if (d && (!next || d < next)) next = d;
+        }
+    }
+    if (!next) return -1;
+    long long left = next - monotonic_us();
+    return left > 0 ? (int)((left + 999) / 1000) : 0;
+}
+
+void job_check_deadlines() {
+    for (int i = -1; i < MAX_SESSIONS; i++) {
+        Session *s = i < 0 ? &terminal_session : sessions[i];
+        if (s) job_check_deadline(s);
+    }
+}
+
+// Earlier of two poll timeouts, either of which may be -1 for none
+int min_timeout(int a, int b) {
+    return a < 0 ? b : (b < 0 || a < b) ? a : b;
+}
+
+// Wait for one stage of a terminal job. Under a deadline this is a poll()
+// on a pidfd (Linux 5.3+) that wakes on the exit or the deadline; without
+// pidfd_open it looks at waitpid every 50 ms instead.
+pid_t job_wait(pid_t pid, int *status) {
+    if (!session->job_deadline_us) return waitpid(pid, status, 0);
+    int pidfd = -1;
+#if defined(__linux__) && defined(SYS_pidfd_open)
+    pidfd = syscall(SYS_pidfd_open, pid, 0);
+#endif
+    pid_t r;
+    while ((r = waitpid(pid, status, WNOHANG)) == 0) {
+        int timeout = min_timeout(job_timeout_ms(), pidfd >= 0 ? -1 : 50);
+        struct pollfd pfd = { .fd = pidfd, .events = POLLIN };
+        poll(&pfd, pidfd >= 0, timeout);
+        job_check_deadline(session);
+    }
+    if (pidfd >= 0) close(pidfd);
+    return r;
+}
+
+// SANDBOX: Shared spawn path for every external command
+// Forks, applies the sandbox (limits, chroot), wires up stdin/stdout and execs
+// the command from the sandbox bin dir. in_fd/out_fd of -1 keep the inherited
+// descriptor; close_fds lists descriptors (other pipe ends) the child must drop.
+pid_t spawn_command(char **args, int in_fd, int out_fd, const int *close_fds, int nclose) {
+    // Traced: the child reports its own phases down tp (see trace_child)
+    int tp[2] = { -1, -1 };
+    if (session->trace && pipe(tp) == 0) {
+        fcntl(tp[0], F_SETFD, FD_CLOEXEC);
+        fcntl(tp[1], F_SETFD, FD_CLOEXEC);
+    }
+    long long traced = TRACE_BEGIN();
+    pid_t pid = fork();
+    if (pid != 0) {
+        TRACE_END("fork", traced);
+        if (pid < 0) perror("shell: fork failed");
+        else job_forked(pid, args[0]);
+        if (tp[0] >= 0) {
+            close(tp[1]);
+            if (pid > 0) trace_child(session->trace, tp[0], pid);
+            close(tp[0]);
+        }
+        return pid;
+    }
+    long long stamps[3] = { tp[1] >= 0 ? monotonic_ns() : 0 };
+    if (tp[0] >= 0) close(tp[0]);
+
+    // Server mode ignores SIGPIPE; commands should die on a closed pipe as usual
+    signal(SIGPIPE, SIG_DFL);
+    job_join(getpid());
+    signal(SIGTTOU, SIG_DFL);
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+
+    // SANDBOX: Apply resource limits in child process
+    setup_resource_limits(args[0]);
+    setup_scheduling(session->job_background);
+
+    // SANDBOX: Tell commands where the sandbox is (find stays under the root
+    // and only -execs commands from the bin dir)
+    setenv("SANDBOX_ROOT", policy->root_resolved, 1);
+    setenv("SANDBOX_BIN", policy->bin_dir, 1);
+
+    // SANDBOX: Setup chroot jail (requires root privileges)
+    setup_chroot();
     
-    // Whitelisted external commands
-    printf("\033[1;36m║\033[0m  \033[1;32mWhitelisted External Commands:\033[0m                             \033[1;36m║\033[0m\n");
-    printf("\033[1;36m║\033[0m     ");
-    int count = 0;
-    for (int i = 0; allowed_commands[i] != NULL; i++) {
-        printf("%s", allowed_commands[i]);
-        if (allowed_commands[i + 1] != NULL) {
-            printf(", ");
+    if (in_fd >= 0) {
+        dup2(in_fd, STDIN_FILENO);
+    }
+    if (out_fd >= 0) {
+        dup2(out_fd, STDOUT_FILENO);
+    }
+    for (int k = 0; k < nclose; k++) {
+        close(close_fds[k]);
+    }
+    
+    // SANDBOX: ONLY use sandbox commands - NO system fallback
+    if (tp[1] >= 0) stamps[1] = monotonic_ns();
+    char *cmd_path = find_command_path(args[0]);
+    if (tp[1] >= 0) {
+        stamps[2] = monotonic_ns();
+        (void)write(tp[1], stamps, sizeof(stamps));
+    }
+    
+    if (cmd_path == NULL) {
+        // Command not found in sandbox/bin - BLOCK IT
+        fprintf(stderr, "\033[1;31m[SANDBOX BLOCKED]\033[0m Command '%s' not found in sandbox/bin (only sandbox commands allowed)\n", args[0]);
+        exit(EXIT_FAILURE);
+    }
+    
+    // Use sandbox command (cmd_path is full path to sandbox/bin/command)
+    execv(cmd_path, args);
+    perror("shell");
+    exit(EXIT_FAILURE);
+}
+
+// Wait for a foreground command. In server and protocol mode the event loop
+// must not block, so the pids are parked on the session and reaped there.
+// The exit status of the last stage becomes the session's last_status.
+void wait_foreground(const pid_t *pids, int count) {
+    if (count == 0) return;
+    session->last_pid = pids[count - 1];
+    session->wait_start_ns = TRACE_BEGIN();
+    if (server_mode || protocol_mode) {
+        for (int i = 0; i < count && session->pending_count < MAX_PIPELINE; i++) {
+            session->pending[session->pending_count++] = pids[i];
+        }
+        return;
+    }
+    // Hold SIGCHLD so sigchld_handler cannot reap (and lose the status of)
+    // the children we are waiting for
+    sigset_t chld, old;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &old);
+    for (int i = 0; i < count; i++) {
+        int status;
+        if (job_wait(pids[i], &status) < 0) continue;
+        if (pids[i] == session->last_pid) {
+            session->last_status = decode_status(status);
+        }
+        metrics_reaped(session, pids[i], status);
+    }
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    job_reclaim_tty();
+    job_finish(session);
+}
+
+int proto_output(const char *data, size_t len);
+
+// SANDBOX: Serve a cache hit to where the command's stdout would have gone
+void cache_serve(int out_fd, const char *data, size_t len) {
+    if (out_fd < 0 && protocol_mode) {
+        // The shell drains its own stdout pipe; writing a large hit into it
+        // would deadlock, so it goes out as frames directly. A client that
+        // is gone fails the protocol loop's next frame too, which ends it.
+        proto_output(data, len);
+        return;
+    }
+    fflush(stdout);
+    int fd = out_fd >= 0 ? out_fd : STDOUT_FILENO;
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("shell: cached output");
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+// An anonymous, close-on-exec file for collecting a command's output
+int memory_file(const char *name) {
+    int fd;
+#ifdef __linux__
+    fd = memfd_create(name, MFD_CLOEXEC);
+#else
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "/tmp/%s.XXXXXX", name);
+    if ((fd = mkstemp(tmp)) >= 0) {
+        unlink(tmp);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+#endif
+    return fd;
+}
+
+// SANDBOX: Run a cacheable command with a tee child between it and its
+// destination, which also copies the output (up to the entry limit) into a
+// memfd for cache_finish(). Takes ownership of key on success.
+int cache_spawn(char **args, int in_fd, int out_fd, KeyBuf *key, pid_t pids[2]) {
+    int mfd = memory_file("sandbox-cache");
+    int p[2];
+    if (mfd < 0 || pipe(p) < 0) {
+        if (mfd >= 0) close(mfd);
+        return -1;
+    }
+    fflush(stdout);
+    pids[0] = fork();
+    if (pids[0] < 0) {
+        perror("shell: fork failed");
+        close(p[0]);
+        close(p[1]);
+        close(mfd);
+        return -1;
+    }
+    if (pids[0] == 0) {
+        signal(SIGPIPE, SIG_DFL);
+        job_join(getpid());
+        signal(SIGTTOU, SIG_DFL);
+        close(p[1]);
+        int dest = out_fd >= 0 ? out_fd : STDOUT_FILENO;
+        size_t room = cache_budget() / CACHE_ENTRY_SHARE + 1;   // +1 marks "too big"
+        char buf[65536];
+        ssize_t n;
+        while ((n = read(p[0], buf, sizeof(buf))) != 0) {
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            for (ssize_t off = 0; off < n; ) {
+                ssize_t k = write(dest, buf + off, n - off);
+                if (k < 0 && errno == EINTR) continue;
+                if (k < 0) _exit(1);
+                off += k;
+            }
+            size_t keep = (size_t)n < room ? (size_t)n : room;
+            if (keep > 0 && write(mfd, buf, keep) == (ssize_t)keep) room -= keep;
+            else room = 0;
+        }
+        _exit(0);
+    }
+    job_forked(pids[0], NULL);
+    pids[1] = spawn_command(args, in_fd, p[1], p, 2);
+    close(p[0]);
+    close(p[1]);
+    if (pids[1] < 0) {
+        waitpid(pids[0], NULL, 0);   // the tee sees EOF and exits
+        session->job_pgid = 0;
+        job_reclaim_tty();
+        close(mfd);
+        return -1;
+    }
+    session->capture_fd = mfd;
+    session->capture_key = key->data;
+    session->capture_key_len = key->len;
+    key->data = NULL;
+    return 0;
+}
+
+void execute_command(char** args, int background) {
+    // SANDBOX: Block original echo command (use display instead)
+    if (strcmp(args[0], "echo") == 0) {
+        fprintf(stderr, "\033[1;31m[SANDBOX BLOCKED]\033[0m Command 'echo' is not allowed (use 'display' instead - our custom implementation)\n");
+        count_blocked(BLOCK_BUILTIN);
+        return;
+    }
+    
+    // SANDBOX: Check if command is allowed
+    long long traced = TRACE_BEGIN();
+    int allowed = is_command_allowed(args[0]);
+    TRACE_END("policy", traced);
+    if (!allowed) {
+        return;
+    }
+    
+    int in_redir = 0, out_redir = 0;
+    char *in_file = NULL, *out_file = NULL;
+    handle_redirection(args, &in_redir, &out_redir, &in_file, &out_file);
+    
+    // SANDBOX: Validate file paths for redirection
+    if (in_redir && !is_path_allowed(in_file)) {
+        return;
+    }
+    if (out_redir && !is_path_allowed(out_file)) {
+        return;
+    }
+    
+    int in_fd = -1, out_fd = -1;
+    traced = TRACE_BEGIN();
+    if (in_redir && (in_fd = open(in_file, O_RDONLY)) < 0) {
+        perror("shell: input redirection");
+        session->last_status = 1;
+        return;
+    }
+    if (out_redir && (out_fd = open(out_file, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        perror("shell: output redirection");
+        session->last_status = 1;
+        if (in_fd >= 0) close(in_fd);
+        return;
+    }
+    if (in_redir || out_redir) TRACE_END("redirect", traced);
+    
+    // SANDBOX: Pure commands may be answered from the result cache
+    if (!background && policy->cache_mb > 0) {
+        KeyBuf key = {0};
+        int store = 0;
+        traced = TRACE_BEGIN();
+        if (cache_key(args, in_fd, &key, &store) == 0) {
+            CacheEntry *hit = cache_lookup(key.data, key.len);
+            TRACE_END("cache_lookup", traced);
+            pid_t pids[2];
+            int handled = 1;
+            if (hit) {
+                session->metrics.cache_hits++;
+                process_metrics.cache_hits++;
+                cache_serve(out_fd, hit->data, hit->data_len);
+                metrics_served(args[0], 0);
+                metrics_redirect(session, in_fd, out_fd);
+            } else {
+                session->metrics.cache_misses++;
+                process_metrics.cache_misses++;
+                handled = store && cache_spawn(args, in_fd, out_fd, &key, pids) == 0;
+            }
+            free(key.data);
+            if (handled) {
+                session->commands_executed++;
+                if (!hit) {
+                    metrics_spawned(pids[1], args[0], 0);
+                    session->redir_in = in_fd;
+                    session->redir_out = out_fd;
+                    wait_foreground(pids, 2);
+                }
+                return;
+            }
+        }
+    }
+
+    pid_t pid = spawn_command(args, in_fd, out_fd, NULL, 0);
+    if (pid > 0 && !background) {
+        // Held until the job ends so metrics_redirect() can count the bytes
+        session->redir_in = in_fd;
+        session->redir_out = out_fd;
+    } else {
+        if (in_fd >= 0) close(in_fd);
+        if (out_fd >= 0) close(out_fd);
+    }
+    if (pid > 0) {
+        session->commands_executed++;
+        metrics_spawned(pid, args[0], background);
+        if (!background) {
+            wait_foreground(&pid, 1);
+        } else {
+            printf("[Background pid %d]\n", pid);
+        }
+    }
+}
+
+// The next '|' at p that is not quoted or escaped, or the end of the line;
+// quoting follows parse_command, so grep -E "a|b" is one stage
+char *pipe_scan(char *p) {
+    char quote = 0;
+    for (; *p; p++) {
+        if (*p == '\\' && p[1] && quote != '\'') {
+            p++;
+        } else if (quote) {
+            if (*p == quote) quote = 0;
+        } else if (*p == '\'' || *p == '"') {
+            quote = *p;
+        } else if (*p == '|') {
+            break;
+        }
+    }
+    return p;
+}
+
+void execute_pipe(char* line, int background) {
+    char *cmds[MAX_PIPELINE];
+    int cmd_count = 0;
+    for (char *p = line; *p && cmd_count < MAX_PIPELINE - 1; ) {
+        char *bar = pipe_scan(p);
+        char *next = *bar ? bar + 1 : bar;
+        *bar = '\0';
+        if (bar > p) cmds[cmd_count++] = p;
+        p = next;
+    }
+    cmds[cmd_count] = NULL;
+    
+    // Each stage is parsed and its patterns expanded once, up front
+    char *stage_args[MAX_PIPELINE][MAX_ARGS];
+    char quoted[MAX_ARGS];
+    for (int i = 0; i < cmd_count; i++) {
+        parse_command(cmds[i], stage_args[i], quoted);
+        if (expand_globs(stage_args[i], quoted) < 0) {
+            return;
+        }
+    }
+
+    // SANDBOX: Validate all commands in pipeline before executing
+    long long traced = TRACE_BEGIN();
+    for (int i = 0; i < cmd_count; i++) {
+        if (stage_args[i][0] != NULL && !is_command_allowed(stage_args[i][0])) {
+            return;
+        }
+    }
+    TRACE_END("policy", traced);
+    
+    int npipefds = 2 * (cmd_count - 1);
+    int pipefds[2 * MAX_PIPELINE];
+    for (int i = 0; i < cmd_count - 1; i++) {
+        if (pipe(pipefds + i*2) < 0) {
+            perror("shell: pipe");
+            for (int k = 0; k < i*2; k++) close(pipefds[k]);
+            return;
+        }
+    }
+    pid_t pids[MAX_PIPELINE];
+    int launched = 0;
+    for (int i = 0; i < cmd_count; i++) {
+        char **args = stage_args[i];
+        int in_fd = (i != 0) ? pipefds[(i-1)*2] : -1;
+        int out_fd = (i != cmd_count - 1) ? pipefds[i*2 + 1] : -1;
+        pid_t pid = spawn_command(args, in_fd, out_fd, pipefds, npipefds);
+        if (pid < 0) {
+            break;
+        }
+        if (args[0]) metrics_spawned(pid, args[0], background);
+        pids[launched++] = pid;
+    }
+    for (int i = 0; i < npipefds; i++) {
+        close(pipefds[i]);
+    }
+    session->commands_executed++;
+    if (!background) {
+        wait_foreground(pids, launched);
+    } else {
+        printf("[Background pipeline]\n");
+    }
+}
+
+// SANDBOX: Completion, shared by readline and the 'complete' request
+// Candidates come from the shell's own tables: builtins, the policy's
+// allowed commands and the session's aliases for a command word, entries
+// of a directory inside the sandbox for anything else. A front end that
+// asks the shell offers exactly what the shell would then accept.
+//
+//   complete <line> <cursor>
+// completes the word that ends at byte <cursor> of <line> (everything
+// between "complete " and the last space). The answer is one line of JSON,
+//   {"start":4,"end":6,"candidates":["notes.md","notes/"]}
+// where bytes start..end of the line are what a candidate replaces and a
+// directory ends in '/'. In protocol mode it is a single 'C' frame instead,
+// with no 'S', 'X' or 'P' frames, sent once every line before it started.
+#define MAX_COMPLETIONS 1000
+#define COMPLETE_BREAKS " \t\n|;&<>()"
+
+const char *builtin_names[] = {
+    "cd", "exit", "print_history", "add_alias", "remove_alias", "help", "stats", "commands", "trace",
+    "sandbox_snapshot", "sandbox_restore", "watch", NULL
+};
+
+typedef struct {
+    char **items;
+    int count, cap;
+} Completions;
+
+void completions_add(Completions *c, const char *dir, size_t dir_len, const char *name, int is_dir) {
+    if (c->count >= MAX_COMPLETIONS) return;
+    if (c->count == c->cap) {
+        int cap = c->cap ? c->cap * 2 : 32;
+        char **grown = realloc(c->items, cap * sizeof(char *));
+        if (!grown) return;
+        c->items = grown;
+        c->cap = cap;
+    }
+    size_t len = strlen(name);
+    char *item = malloc(dir_len + len + 2);
+    if (!item) return;
+    memcpy(item, dir, dir_len);
+    memcpy(item + dir_len, name, len);
+    strcpy(item + dir_len + len, is_dir ? "/" : "");
+    c->items[c->count++] = item;
+}
+
+void completions_free(Completions *c) {
+    for (int i = 0; i < c->count; i++) free(c->items[i]);
+    free(c->items);
+}
+
+int completions_cmp(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+void complete_commands(Completions *c, const char *word, size_t len) {
+    for (int i = 0; builtin_names[i]; i++) {
+        if (strncmp(builtin_names[i], word, len) == 0) completions_add(c, "", 0, builtin_names[i], 0);
+    }
+    for (int i = 0; policy->allowed[i]; i++) {
+        if (strncmp(policy->allowed[i], word, len) == 0) completions_add(c, "", 0, policy->allowed[i], 0);
+    }
+    for (int i = 0; i < session->alias_count; i++) {
+        if (strncmp(session->aliases[i].name, word, len) == 0) completions_add(c, "", 0, session->aliases[i].name, 0);
+    }
+}
+
+// Entries of the word's directory that start with its last component; the
+// directory has to be one the shell would let a command use
+void complete_files(Completions *c, const char *word, size_t len) {
+    size_t dir_len = len;
+    while (dir_len > 0 && word[dir_len - 1] != '/') dir_len--;
+    const char *base = word + dir_len;
+    size_t base_len = len - dir_len;
+    char dir[PATH_MAX], path[PATH_MAX];
+    if (dir_len >= sizeof(dir)) return;
+    snprintf(dir, sizeof(dir), "%.*s", dir_len ? (int)dir_len : 1, dir_len ? word : ".");
+    if (!path_in_sandbox(dir)) return;
+    DIR *d = opendir(dir);
+    if (!d) return;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        const char *name = ent->d_name;
+        if (strncmp(name, base, base_len) != 0) continue;
+        if (name[0] == '.' && (base_len == 0 || strcmp(name, ".") == 0 || strcmp(name, "..") == 0)) continue;
+        if (glob_join(path, sizeof(path), dir, name) < 0) continue;
+        // Like glob_found: a link (or unknown type) must not lead outside
+        int is_dir = ent->d_type == DT_DIR;
+        if (ent->d_type != DT_DIR && ent->d_type != DT_REG) {
+            struct stat st;
+            if (!path_in_sandbox(path)) continue;
+            is_dir = stat(path, &st) == 0 && S_ISDIR(st.st_mode);
         }
-        count++;
-        // Line break every 4 commands for readability
-        if (count % 4 == 0 && allowed_commands[i + 1] != NULL) {
-            printf("\n\033[1;36m║\033[0m     ");
-            count = 0;
+        completions_add(c, word, dir_len, name, is_dir);
+    }
+    closedir(d);
+}
+
+// Candidates for the word ending at cursor, sorted and without duplicates;
+// returns where the word starts
+int complete_collect(const char *line, int cursor, Completions *c) {
+    int len = strlen(line);
+    if (cursor < 0 || cursor > len) cursor = len;
+    int start = cursor;
+    while (start > 0 && !strchr(COMPLETE_BREAKS, line[start - 1])) start--;
+    int before = start;
+    while (before > 0 && (line[before - 1] == ' ' || line[before - 1] == '\t')) before--;
+    int command = before == 0 || strchr("|;&(", line[before - 1]) != NULL;
+
+    const char *word = line + start;
+    size_t word_len = cursor - start;
+    if (command && !memchr(word, '/', word_len)) complete_commands(c, word, word_len);
+    else complete_files(c, word, word_len);
+
+    qsort(c->items, c->count, sizeof(char *), completions_cmp);
+    int kept = 0;
+    for (int i = 0; i < c->count; i++) {
+        if (kept > 0 && strcmp(c->items[kept - 1], c->items[i]) == 0) free(c->items[i]);
+        else c->items[kept++] = c->items[i];
+    }
+    c->count = kept;
+    return start;
+}
+
+void json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        unsigned char ch = *s;
+        if (ch == '"' || ch == '\\') fprintf(out, "\\%c", ch);
+        else if (ch < 0x20) fprintf(out, "\\u%04x", ch);
+        else fputc(ch, out);
+    }
+    fputc('"', out);
+}
+
+// Answer "complete <line> <cursor>" (req is what follows "complete ")
+int complete_request(const char *req, FILE *out) {
+    const char *space = strrchr(req, ' ');
+    char *end;
+    long cursor = space ? strtol(space + 1, &end, 10) : -1;
+    if (!space || end == space + 1 || *end != '\0' || cursor < 0) {
+        fprintf(out, "{\"start\":0,\"end\":0,\"candidates\":[]}\n");
+        fprintf(stderr, "shell: usage: complete <line> <cursor>\n");
+        return 2;
+    }
+    char line[MAX_LINE];
+    snprintf(line, sizeof(line), "%.*s", (int)(space - req), req);
+    Completions c = {0};
+    int start = complete_collect(line, (int)cursor, &c);
+    if (cursor > (long)strlen(line)) cursor = strlen(line);
+    fprintf(out, "{\"start\":%d,\"end\":%ld,\"candidates\":[", start, cursor);
+    for (int i = 0; i < c.count; i++) {
+        if (i) fputc(',', out);
+        json_string(out, c.items[i]);
+    }
+    fprintf(out, "]}\n");
+    completions_free(&c);
+    return 0;
+}
+
+int is_complete_request(const char *line) {
+    return strncmp(line, "complete ", 9) == 0;
+}
+
+// readline hook: the same candidates, with their longest common prefix
+// first as readline expects
+char **shell_completion(const char *text, int start, int end) {
+    rl_completion_append_character = '\0';
+    rl_attempted_completion_over = 1;
+
+    Completions c = {0};
+    complete_collect(rl_line_buffer, end, &c);
+    if (c.count == 0) {
+        completions_free(&c);
+        return NULL;
+    }
+    char **matches = malloc((c.count + 2) * sizeof(char *));
+    if (!matches) {
+        completions_free(&c);
+        return NULL;
+    }
+    size_t common = strlen(c.items[0]);
+    for (int i = 1; i < c.count; i++) {
+        size_t k = 0;
+        while (k < common && c.items[i][k] == c.items[0][k]) k++;
+        common = k;
+    }
+    if (c.count == 1) {
+        matches[0] = c.items[0];
+        matches[1] = NULL;
+    } else {
+        matches[0] = strndup(c.items[0], common);
+        memcpy(matches + 1, c.items, c.count * sizeof(char *));
+        matches[c.count + 1] = NULL;
+    }
+    free(c.items);
+    return matches;
+}
+
+void watch_builtin(const char *spec);
+
+// Run one pipeline of a list: alias expansion, then a pipeline, a builtin
+// or a single command. Each pipeline starts from status 0 so a builtin that
+// succeeds does not inherit the failure of the command before it.
+// ( list ) runs in a subshell: a fork of the shell that runs the list in
+// place, waits for everything it started and exits with the list's status.
+// A cd, alias or history entry inside it ends with it. The group is one job:
+// every command in it joins the subshell's process group, so Ctrl-C, a
+// hangup or the wall-clock limit stop all of it, and that limit is the
+// default wall_time for the group as a whole; a 'limit = cmd wall=N' line
+// does not apply inside one. stats counts it as one run of "( )".
+#define GROUP_NAME "( )"
+
+void list_run(int resuming);
+
+void run_group(const char *group) {
+    const char *close_paren = strrchr(group, ')');
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("shell: fork failed");
+        session->last_status = 1;
+        return;
+    }
+    if (pid == 0) {
+        job_join(getpid());
+        subshell_pgid = getpgrp();
+        // The group already has the terminal if it is in front; its
+        // commands stay in its process group and are waited for in place
+        job_control = 0;
+        server_mode = protocol_mode = 0;
+        session->record_start_us = 0;
+        session->background_count = 0;
+        for (int i = 0; i < MAX_SESSIONS; i++) {
+            if (sessions[i] && sessions[i] != session) close(sessions[i]->fd);
         }
+        signal(SIGCHLD, SIG_DFL);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGPIPE, SIG_DFL);
+        sigset_t chld;
+        sigemptyset(&chld);
+        sigaddset(&chld, SIGCHLD);
+        sigprocmask(SIG_UNBLOCK, &chld, NULL);
+        free(session->list);
+        session->list = strndup(group + 1, close_paren ? close_paren - group - 1 : strlen(group + 1));
+        session->list_pos = 0;
+        list_run(0);
+        fflush(stdout);
+        fflush(stderr);
+        while (waitpid(-1, NULL, 0) > 0 || errno == EINTR);   // its '&' jobs
+        _exit(session->last_status);
     }
-    printf("                                                      \033[1;36m║\033[0m\n");
-    
-    printf("\033[1;36m║\033[0m                                                             \033[1;36m║\033[0m\n");
-    
-    // Blocked commands
-    printf("\033[1;36m║\033[0m  \033[1;31mBlocked Commands (Security):\033[0m                                \033[1;36m║\033[0m\n");
-    printf("\033[1;36m║\033[0m     ");
-    count = 0;
-    for (int i = 0; blocked_commands[i] != NULL; i++) {
-        printf("\033[1;31m%s\033[0m", blocked_commands[i]);
-        if (blocked_commands[i + 1] != NULL) {
-            printf(", ");
+    job_forked(pid, GROUP_NAME);
+    session->commands_executed++;
+    metrics_spawned(pid, GROUP_NAME, session->job_background);
+    if (!session->job_background) {
+        wait_foreground(&pid, 1);
+    } else {
+        printf("[Background pid %d]\n", pid);
+    }
+}
+
+void run_pipeline(char *line, int background) {
+    char *args[MAX_ARGS], quoted[MAX_ARGS];
+    session->last_status = 0;
+    session->job_start_us = monotonic_us();
+    session->job_pgid = subshell_pgid;
+    session->job_background = background;
+
+    // Alias expansion
+    long long traced = TRACE_BEGIN();
+    char *tokens[MAX_ARGS];
+    int token_count = 0;
+    char *saveptr;
+    char *temp_line = strdup(line);
+    char *token = strtok_r(temp_line, DELIM, &saveptr);
+    while (token != NULL && token_count < MAX_ARGS - 1) {
+        tokens[token_count++] = token;
+        token = strtok_r(NULL, DELIM, &saveptr);
+    }
+    tokens[token_count] = NULL;
+
+    if (token_count > 0) {
+        char *alias_expansion = check_alias(tokens[0]);
+        if (alias_expansion != NULL) {
+            char new_line[MAX_LINE];
+            strcpy(new_line, alias_expansion);
+            for (int i = 1; i < token_count; i++) {
+                strcat(new_line, " ");
+                strcat(new_line, tokens[i]);
+            }
+            strcpy(line, new_line);
         }
-        count++;
-        if (count % 4 == 0 && blocked_commands[i + 1] != NULL) {
-            printf("\n\033[1;36m║\033[0m     ");
-            count = 0;
+    }
+    free(temp_line);
+    TRACE_END("alias", traced);
+
+    // The terminal's SIGCHLD handler reaps whatever exits; hold it from
+    // before the fork so a fast job's status is still there for && and ||
+    sigset_t chld, old;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &old);
+    const char *rest = line + strspn(line, " \t");
+    if (background) background_prune(session);
+    if (background && session->background_count == MAX_BACKGROUND_JOBS) {
+        fprintf(stderr, "\033[1;31m[SANDBOX BLOCKED]\033[0m %d background jobs are already running; wait for one to finish\n",
+                MAX_BACKGROUND_JOBS);
+        count_blocked(BLOCK_JOBS);
+    } else if (strncmp(rest, "watch", 5) == 0 && (rest[5] == '\0' || rest[5] == ' ' || rest[5] == '\t')) {
+        // Takes the rest of the line whole, pipes included
+        int blocked = session->commands_blocked;
+        traced = TRACE_BEGIN();
+        watch_builtin(rest + 5);
+        if (session->commands_blocked == blocked) {
+            TRACE_END("builtin", traced);
+            metrics_served("watch", session->last_status);
+        }
+    } else if (*rest == '(') {
+        run_group(rest);
+    } else if (*pipe_scan(line) == '|') {
+        execute_pipe(line, background);
+    } else {
+        traced = TRACE_BEGIN();
+        parse_command(line, args, quoted);
+        TRACE_END("parse", traced);
+        if (args[0] != NULL && expand_globs(args, quoted) >= 0) {
+            int blocked = session->commands_blocked;
+            traced = TRACE_BEGIN();
+            if (!execute_builtin(args)) {
+                execute_command(args, background);
+            } else if (session->commands_blocked == blocked) {
+                TRACE_END("builtin", traced);
+                metrics_served(args[0], session->last_status);
+            }
         }
     }
-    printf("                                                      \033[1;36m║\033[0m\n");
-    
-    // Summary
-    int total_allowed = 0;
-    for (int i = 0; allowed_commands[i] != NULL; i++) total_allowed++;
-    int total_blocked = 0;
-    for (int i = 0; blocked_commands[i] != NULL; i++) total_blocked++;
-    
-    printf("\033[1;36m║\033[0m                                                             \033[1;36m║\033[0m\n");
-    printf("\033[1;36m║\033[0m  \033[1;33mSummary:\033[0m                                                  \033[1;36m║\033[0m\n");
-    printf("\033[1;36m║\033[0m     Total allowed commands: \033[1;32m%d\033[0m (including 7 built-ins)      \033[1;36m║\033[0m\n", total_allowed + 7);
-    printf("\033[1;36m║\033[0m     Total blocked commands: \033[1;31m%d\033[0m (security risks)            \033[1;36m║\033[0m\n", total_blocked);
-    printf("\033[1;36m╚════════════════════════════════════════════════════════════════╝\033[0m\n");
-    printf("\n");
-    printf("  \033[1;33mTip:\033[0m Use TAB for autocomplete, type 'help' for detailed information\n");
-    printf("  \033[1;33mNote:\033[0m All file operations are restricted to: \033[1;36m%s\033[0m\n\n", SANDBOX_DIR);
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    glob_release();
 }
 
-int execute_builtin(char** args) {
-    if (args[0] == NULL) return 1;
+// SANDBOX: Session recording ('record = <file>' or myshell --record <file>)
+// Each input line is appended to the file as one JSON object once it has
+// finished, so a recording is the real mix of commands users type:
+//   {"session":1,"time":1760861000.125,"cwd":"/sandbox/docs","line":"ls | wc -l","status":0,"ms":3.412}
+// time is when the line started, in seconds since the epoch, and ms how
+// long it took until the next prompt. Sessions are numbered from 0 (the
+// terminal or GUI) in the order they connected; the first record of each
+// lists the aliases it started with instead of a line:
+//   {"session":1,"time":...,"cwd":"...","aliases":[["ll","ls -l"]]}
+// bench/replay.py plays a recording back against one or two builds.
+const char *record_override = NULL;    // --record, wins over the policy
+const char *record_path = NULL;        // what record_fd was opened for
+int record_fd = -1;
 
-    if (strcmp(args[0], "cd") == 0) {
-        if (args[1] == NULL) {
-            fprintf(stderr, "shell: expected argument to \"cd\"\n");
+// The record file for the current policy, opened on first use; -1 if
+// recording is off or the file cannot be opened (reported once)
+int record_open() {
+    const char *path = record_override ? record_override : policy->record_file;
+    if (record_path && path && strcmp(path, record_path) == 0) return record_fd;
+    if (record_fd >= 0) close(record_fd);
+    free((char *)record_path);
+    record_fd = -1;
+    record_path = NULL;
+    if (!path) return -1;
+    record_path = strdup(path);
+    record_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (record_fd < 0) {
+        fprintf(stderr, "shell: record %s: %s\n", path, strerror(errno));
+    }
+    return record_fd;
+}
+
+// One record in a single write, so sessions never interleave inside a line
+void record_write(FILE *out, char **buf, size_t *len) {
+    fclose(out);
+    if (*buf && *len > 0 && write(record_fd, *buf, *len) < 0) {
+        fprintf(stderr, "shell: record %s: %s\n", record_path, strerror(errno));
+    }
+    free(*buf);
+}
+
+FILE *record_header(Session *s, char **buf, size_t *len) {
+    FILE *out = open_memstream(buf, len);
+    if (!out) return NULL;
+    fprintf(out, "{\"session\":%d,\"time\":%.3f,\"cwd\":", s->number, s->record_time);
+    json_string(out, s->record_cwd ? s->record_cwd : "");
+    return out;
+}
+
+// A line is about to run in session s
+void record_begin(Session *s) {
+    if (record_open() < 0) return;
+    struct timespec now;
+    char cwd[PATH_MAX];
+    clock_gettime(CLOCK_REALTIME, &now);
+    s->record_time = now.tv_sec + now.tv_nsec / 1e9;
+    free(s->record_cwd);
+    s->record_cwd = strdup(getcwd(cwd, sizeof(cwd)) ? cwd : "");
+    if (!s->record_started) {
+        char *buf = NULL;
+        size_t len = 0;
+        FILE *out = record_header(s, &buf, &len);
+        if (!out) return;
+        fprintf(out, ",\"aliases\":[");
+        for (int i = 0; i < s->alias_count; i++) {
+            fprintf(out, "%s[", i ? "," : "");
+            json_string(out, s->aliases[i].name);
+            fputc(',', out);
+            json_string(out, s->aliases[i].command);
+            fputc(']', out);
+        }
+        fprintf(out, "]}\n");
+        record_write(out, &buf, &len);
+        s->record_started = 1;
+    }
+    s->record_start_us = monotonic_us();
+}
+
+// The line record_begin saw has finished with s->last_status
+void record_end(Session *s, const char *line) {
+    if (!s->record_start_us || record_fd < 0) return;
+    double ms = (monotonic_us() - s->record_start_us) / 1000.0;
+    s->record_start_us = 0;
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *out = record_header(s, &buf, &len);
+    if (!out) return;
+    fprintf(out, ",\"line\":");
+    json_string(out, line);
+    fprintf(out, ",\"status\":%d,\"ms\":%.3f}\n", s->last_status, ms);
+    record_write(out, &buf, &len);
+}
+
+// SANDBOX: Command lists
+// A line is a list of pipelines joined by ';', '&', '&&' and '||', with
+// ( ... ) for grouping:  mkdir out && (sort a > out/a || display failed); ls out
+// '&&' runs the next element only if the last status was 0 and '||' only if
+// it was not. A skipped element leaves the status alone, so a group's status
+// is that of the last pipeline it ran. A group runs in a subshell (see
+// run_group), so a cd inside one ends with it. Operators inside quotes or
+// after a backslash are text (find ... -exec wc -l {} \; works).
+// In server and protocol mode a foreground job parks on the session; the
+// rest of the list waits in session->list until the event loop reaps the
+// job and calls list_run(1).
+const char *skip_blanks(const char *p) {
+    while (*p && strchr(DELIM, *p)) p++;
+    return p;
+}
+
+// End of the pipeline text starting at p: the next list operator or the end
+const char *list_scan(const char *p, int depth) {
+    char quote = 0;
+    for (; *p; p++) {
+        if (*p == '\\' && p[1] && quote != '\'') {
+            p++;
+        } else if (quote) {
+            if (*p == quote) quote = 0;
+        } else if (*p == '\'' || *p == '"') {
+            quote = *p;
+        } else if (*p == ';' || *p == '&' || (*p == '|' && p[1] == '|') ||
+                   (*p == ')' && depth > 0)) {
+            break;
+        }
+    }
+    return p;
+}
+
+// The operator at p: ';', '&', ')', 'A' for &&, 'O' for ||, 0 for none
+int list_op(const char *p, int *len) {
+    *len = 2;
+    if (p[0] == '&' && p[1] == '&') return 'A';
+    if (p[0] == '|' && p[1] == '|') return 'O';
+    *len = 1;
+    if (*p == ';' || *p == '&' || *p == ')') return *p;
+    *len = 0;
+    return 0;
+}
+
+const char *list_error(const char *p) {
+    int len;
+    if (*p == '\0') {
+        fprintf(stderr, "shell: syntax error: unexpected end of line\n");
+    } else {
+        list_op(p, &len);
+        fprintf(stderr, "shell: syntax error near '%.*s'\n", len ? len : 1, p);
+    }
+    return NULL;
+}
+
+// Check a whole list before any of it runs, so a typo at the end cannot
+// leave the first half done. Returns where the list at this depth ends.
+const char *list_check(const char *p, int depth) {
+    while (1) {
+        p = skip_blanks(p);
+        if (*p == '(') {
+            p = list_check(p + 1, depth + 1);
+            if (!p) return NULL;
+            if (*p != ')') return list_error(p);
+            p = skip_blanks(p + 1);
         } else {
-            // SANDBOX: Validate path before changing directory
-            if (!is_path_allowed(args[1])) {
-                return 1;
+            const char *end = list_scan(p, depth);
+            if (end == p) return list_error(p);
+            p = end;
+        }
+        int len, op = list_op(p, &len);
+        if (op == 0) return *p ? list_error(p) : p;
+        if (op == ')') return depth > 0 ? p : list_error(p);
+        p = skip_blanks(p + len);
+        // ';' and '&' may also end a list
+        if ((op == ';' || op == '&') && (*p == '\0' || (*p == ')' && depth > 0))) {
+            return p;
+        }
+    }
+}
+
+// Step over one element (a pipeline or a whole group) without running it
+const char *list_skip(const char *p, int depth) {
+    if (*p != '(') return list_scan(p, depth);
+    p++;
+    while (1) {
+        p = skip_blanks(p);
+        if (*p == ')') return p + 1;
+        if (*p == '\0') return p;
+        p = skip_blanks(list_skip(p, depth + 1));
+        int len;
+        if (*p != ')' && list_op(p, &len)) p += len;
+    }
+}
+
+// Run session->list from list_pos until a job parks or the list is done
+void list_run(int resuming) {
+    Session *s = session;
+    const char *p = s->list + s->list_pos;
+    int run = 1;
+    while (!s->closing) {
+        if (resuming) {
+            // Just past a pipeline or a group: the operator decides what's next
+            p = skip_blanks(p);
+            int len, op = list_op(p, &len);
+            if (op == 0) break;
+            p = skip_blanks(p + len);
+            run = op == 'A' ? s->last_status == 0 : op == 'O' ? s->last_status != 0 : 1;
+            if (*p == '\0') continue;
+        }
+        resuming = 1;
+        const char *end = list_skip(p, 0);
+        if (run) {
+            // A group goes to run_pipeline whole, parentheses included
+            char pipeline[MAX_LINE];
+            const char *op = skip_blanks(end);
+            snprintf(pipeline, sizeof(pipeline), "%.*s", (int)(end - p), p);
+            run_pipeline(pipeline, op[0] == '&' && op[1] != '&');
+        }
+        p = end;
+        if (s->pending_count > 0) {
+            s->list_pos = p - s->list;
+            return;
+        }
+    }
+    record_end(s, s->list);
+    free(s->list);
+    s->list = NULL;
+}
+
+// SANDBOX: watch [-n secs] [--on-change path[,path...]] command
+// Runs command - the rest of the line, pipes and lists included - again and
+// again, and redraws only when its output (stdout and stderr together)
+// differs from the last run's. Only the first WATCH_MAX_OUTPUT bytes of a run
+// are kept for the screen; the rest is counted, and hashed so that a change
+// past that point still redraws. With -n it runs every secs seconds, 2 by
+// default. With --on-change it runs when one of the paths changes instead:
+// inotify on Linux, a stat of each path every WATCH_POLL_MS elsewhere. A
+// burst of changes counts as one once it has been quiet for
+// WATCH_DEBOUNCE_MS (or has gone on for WATCH_DEBOUNCE_MAX_MS); -n then
+// adds a run every secs seconds as well. Each run is a fork of the shell,
+// so the command gets every check a typed line gets and a cd inside it
+// stays there. Ctrl-C or the next line of input ends it, and that line then
+// runs as usual. Server clients cannot use it: it holds the event loop.
+#define WATCH_DEFAULT_SECS 2
+#define WATCH_DEBOUNCE_MS 100
+#define WATCH_DEBOUNCE_MAX_MS 1000
+#define WATCH_POLL_MS 250
+#define WATCH_MAX_PATHS 16
+#define WATCH_MAX_OUTPUT 65536
+#define WATCH_USAGE "watch [-n secs] [--on-change path[,path...]] command"
+
+typedef struct {
+    char path[PATH_MAX];
+    const char *base;       // its last component
+    int wd, dir_wd;         // inotify watches on it and on its directory
+    struct stat st;         // last seen by the polling fallback
+    int exists;
+} WatchPath;
+
+typedef struct {
+    WatchPath paths[WATCH_MAX_PATHS];
+    int count;
+    int fd;                 // inotify descriptor, -1 when polling
+    long long interval_ms;  // 0 = only on change
+} Watch;
+
+// What one run printed
+typedef struct {
+    char data[WATCH_MAX_OUTPUT];    // the start of it
+    size_t len;
+    size_t total;                   // bytes in all
+    uint64_t hash;                  // of all of it
+} WatchOutput;
+
+volatile sig_atomic_t watch_interrupted = 0;
+
+void watch_sigint(int sig) {
+    watch_interrupted = 1;
+}
+
+// Watch each path, and the directory of each file so that a file which is
+// replaced (editors write a new one and rename it over) or created later is
+// still seen. Called again after every change to follow replaced inodes.
+void watch_arm(Watch *w) {
+#ifdef __linux__
+    if (w->fd < 0) return;
+    for (int i = 0; i < w->count; i++) {
+        WatchPath *p = &w->paths[i];
+        p->wd = inotify_add_watch(w->fd, p->path, IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE |
+                                  IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+        struct stat st;
+        if (stat(p->path, &st) == 0 && S_ISDIR(st.st_mode)) {
+            p->dir_wd = -1;
+            continue;
+        }
+        char dir[PATH_MAX];
+        snprintf(dir, sizeof(dir), "%.*s", p->base > p->path ? (int)(p->base - p->path) : 1,
+                 p->base > p->path ? p->path : ".");
+        p->dir_wd = inotify_add_watch(w->fd, dir, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+    }
+#endif
+}
+
+// Drain pending inotify events; 1 if any was about a watched path
+int watch_events(Watch *w) {
+    int hit = 0;
+#ifdef __linux__
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    while ((n = read(w->fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n; ) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            for (int i = 0; i < w->count && !hit; i++) {
+                if (ev->wd == w->paths[i].wd) hit = 1;
+                if (ev->wd == w->paths[i].dir_wd && ev->len && strcmp(ev->name, w->paths[i].base) == 0) hit = 1;
             }
-            if (chdir(args[1]) != 0) perror("shell");
+            p += sizeof(struct inotify_event) + ev->len;
         }
-        return 1;
     }
-    if (strcmp(args[0], "exit") == 0) {
-        print_sandbox_stats();
-        exit(0);
+#endif
+    return hit;
+}
+
+// Polling fallback: 1 if any path appeared, went away or was modified
+int watch_changed(Watch *w) {
+    int changed = 0;
+    for (int i = 0; i < w->count; i++) {
+        WatchPath *p = &w->paths[i];
+        struct stat st;
+        int exists = stat(p->path, &st) == 0;
+        if (exists != p->exists || (exists && (st.st_ino != p->st.st_ino || st.st_size != p->st.st_size ||
+                                               stat_ctime_ns(&st) != stat_ctime_ns(&p->st)))) {
+            changed = 1;
+        }
+        p->exists = exists;
+        if (exists) p->st = st;
     }
-    // ONLY our custom print_history - NO original history command
-    if (strcmp(args[0], "print_history") == 0) {
-        print_history();
-        return 1;
+    return changed;
+}
+
+// A line is waiting: typed at the terminal, or sent by the protocol client
+int watch_input_fd() {
+    return protocol_mode ? proto_cmd_fd : STDIN_FILENO;
+}
+
+// Sleep until the command is due again: 1 to run it, 0 to stop watching
+int watch_wait(Watch *w) {
+    long long now = monotonic_ms();
+    long long due = w->interval_ms ? now + w->interval_ms : 0;
+    long long burst = 0, settle = 0;
+    // The protocol loop may already hold the next line
+    if (protocol_mode && memchr(session->inbuf, '\n', session->inbuf_len)) return 0;
+    while (!watch_interrupted) {
+        now = monotonic_ms();
+        if ((settle && now >= settle) || (due && now >= due)) return 1;
+        long long next = settle && (!due || settle < due) ? settle : due;
+        int timeout = next ? (int)(next - now) : -1;
+        if (w->count && w->fd < 0 && (timeout < 0 || timeout > WATCH_POLL_MS)) timeout = WATCH_POLL_MS;
+        struct pollfd fds[2] = {
+            { .fd = watch_input_fd(), .events = POLLIN },
+            { .fd = w->fd, .events = POLLIN },
+        };
+        if (poll(fds, 2, timeout) < 0) {
+            if (errno == EINTR) continue;
+            perror("shell: watch");
+            return 0;
+        }
+        if (fds[0].revents) return 0;
+        if (w->fd >= 0 ? fds[1].revents && watch_events(w) : w->count && watch_changed(w)) {
+            now = monotonic_ms();
+            if (!burst) burst = now;
+            settle = now + WATCH_DEBOUNCE_MS;
+            if (settle > burst + WATCH_DEBOUNCE_MAX_MS) settle = burst + WATCH_DEBOUNCE_MAX_MS;
+        }
     }
-    // Block original history command
-    if (strcmp(args[0], "history") == 0) {
-        fprintf(stderr, "\033[1;31m[SANDBOX BLOCKED]\033[0m Command 'history' is not allowed (use 'print_history' instead - our custom implementation)\n");
-        commands_blocked++;
+    return 0;
+}
+
+void watch_take(WatchOutput *out, const char *buf, size_t n) {
+    size_t keep = WATCH_MAX_OUTPUT - out->len;
+    if (keep > n) keep = n;
+    memcpy(out->data + out->len, buf, keep);
+    out->len += keep;
+    out->total += n;
+    out->hash = fnv1a(out->hash, buf, n);
+}
+
+// One run of the command in a fork of the shell. Its output is read from a
+// pipe as it comes, into *out, and its exit status returned.
+int watch_run(const char *command, WatchOutput *out) {
+    out->len = out->total = 0;
+    out->hash = 0xcbf29ce484222325ULL;
+    int p[2];
+    if (pipe(p) < 0) {
+        perror("shell: watch");
         return 1;
     }
-    if (strcmp(args[0], "sandbox_stats") == 0 || strcmp(args[0], "stats") == 0) {
-        print_sandbox_stats();
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("shell: fork failed");
+        close(p[0]);
+        close(p[1]);
         return 1;
     }
-    if (strcmp(args[0], "help") == 0) {
-        printf("\n\033[1;36mAvailable Commands:\033[0m\n");
-        printf("  \033[1;32mBuilt-in commands:\033[0m\n");
-        printf("    cd, exit, print_history, add_alias, remove_alias, help, stats, commands\n\n");
-        printf("  \033[1;32mWhitelisted external commands:\033[0m\n");
-        printf("    ");
-        for (int i = 0; allowed_commands[i] != NULL; i++) {
-            printf("%s ", allowed_commands[i]);
-            if ((i + 1) % 8 == 0) printf("\n    ");
+    if (pid == 0) {
+        close(p[0]);
+        dup2(p[1], STDOUT_FILENO);
+        dup2(p[1], STDERR_FILENO);
+        close(p[1]);
+        // An ordinary terminal line from here on: wait for jobs in place
+        server_mode = protocol_mode = 0;
+        session->record_start_us = 0;
+        sigset_t chld;
+        sigemptyset(&chld);
+        sigaddset(&chld, SIGCHLD);
+        sigprocmask(SIG_UNBLOCK, &chld, NULL);
+        free(session->list);
+        session->list = strdup(command);
+        session->list_pos = 0;
+        list_run(0);
+        fflush(stdout);
+        fflush(stderr);
+        _exit(session->last_status);
+    }
+    close(p[1]);
+    // Usually this ends at EOF. A job the command left running with & can
+    // hold the pipe open, though, so once the run has exited whatever is
+    // already in the pipe is the last of it.
+    fcntl(p[0], F_SETFL, O_NONBLOCK);
+    char buf[8192];
+    int status, exited = 0;
+    for (;;) {
+        ssize_t n = read(p[0], buf, sizeof(buf));
+        if (n > 0) {
+            watch_take(out, buf, n);
+            continue;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EINTR)) break;
+        if (errno == EINTR) continue;
+        if (exited) break;
+        exited = waitpid(pid, &status, WNOHANG) == pid;
+        if (!exited) {
+            struct pollfd pfd = { .fd = p[0], .events = POLLIN };
+            poll(&pfd, 1, WATCH_POLL_MS);
         }
-        printf("\n\n");
-        printf("  \033[1;33mNote:\033[0m All file operations are restricted to: %s\n", SANDBOX_DIR);
-        printf("  \033[1;33mTip:\033[0m Type 'commands' for a complete formatted list\n\n");
-        return 1;
     }
-    if (strcmp(args[0], "commands") == 0) {
-        print_all_commands();
-        return 1;
+    close(p[0]);
+    if (!exited) {
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
     }
-    // Block original alias command
-    if (strcmp(args[0], "alias") == 0) {
-        fprintf(stderr, "\033[1;31m[SANDBOX BLOCKED]\033[0m Command 'alias' is not allowed (use 'add_alias' instead - our custom implementation)\n");
-        commands_blocked++;
-        return 1;
+    return decode_status(status);
+}
+
+void watch_show(const Watch *w, const char *spec, const char *command, int status, const WatchOutput *out) {
+    char head[MAX_LINE * 2], when[32];
+    time_t now = time(NULL);
+    strftime(when, sizeof(when), "%H:%M:%S", localtime(&now));
+    char trigger[PATH_MAX + 64];
+    if (!w->count) {
+        snprintf(trigger, sizeof(trigger), "Every %gs", w->interval_ms / 1000.0);
+    } else if (w->interval_ms) {
+        snprintf(trigger, sizeof(trigger), "On change of %s, every %gs", spec, w->interval_ms / 1000.0);
+    } else {
+        snprintf(trigger, sizeof(trigger), "On change of %s", spec);
     }
-    // Block original unalias command
-    if (strcmp(args[0], "unalias") == 0) {
-        fprintf(stderr, "\033[1;31m[SANDBOX BLOCKED]\033[0m Command 'unalias' is not allowed (use 'remove_alias' instead - our custom implementation)\n");
-        commands_blocked++;
-        return 1;
+    int n = snprintf(head, sizeof(head), "%s%s: %s    [%s%s]\n\n",
+                     isatty(STDOUT_FILENO) ? "\033[H\033[2J" : "", trigger, command, when,
+                     status ? ", failed" : "");
+    // Written the way a cache hit is, so protocol mode frames it directly
+    cache_serve(-1, head, n < (int)sizeof(head) ? (size_t)n : sizeof(head) - 1);
+    if (out->len) cache_serve(-1, out->data, out->len);
+    if (out->total > out->len) {
+        char more[64];
+        n = snprintf(more, sizeof(more), "%s... %zu more bytes\n",
+                     out->data[out->len - 1] == '\n' ? "" : "\n", out->total - out->len);
+        cache_serve(-1, more, n);
     }
-    // ONLY our custom add_alias - NO original alias command
-    if (strcmp(args[0], "add_alias") == 0) {
-        if (args[1] == NULL) {
-            // List all aliases
-            for (int i = 0; i < alias_count; i++) {
-                printf("alias %s='%s'\n", aliases[i].name, aliases[i].command);
-            }
-        } else {
-            // Reconstruct the full argument string to handle quotes properly
-            char full_arg[MAX_LINE] = "";
-            strcpy(full_arg, args[1]);
-            for (int i = 2; args[i] != NULL; i++) {
-                strcat(full_arg, " ");
-                strcat(full_arg, args[i]);
-            }
-            
-            char *equal = strchr(full_arg, '=');
-            if (equal) {
-                *equal = '\0';
-                char *name = full_arg;
-                char *value = equal + 1;
+}
 
-                // Strip surrounding quotes if present
-                size_t val_len = strlen(value);
-                if (val_len >= 2 && 
-                    ((value[0] == '\'' && value[val_len - 1] == '\'') ||
-                     (value[0] == '"' && value[val_len - 1] == '"'))) {
-                    value[val_len - 1] = '\0';
-                    value++;
-                }
+// spec is what follows "watch" on the line
+void watch_builtin(const char *spec) {
+    Watch w = { .count = 0, .fd = -1, .interval_ms = 0 };
+    char word[PATH_MAX], paths[PATH_MAX] = "";
+    const char *p = skip_blanks(spec);
+    double secs = 0;
+    session->last_status = 1;
+    if (server_mode) {
+        fprintf(stderr, "\033[1;31m[SANDBOX BLOCKED]\033[0m Command 'watch' is only available to the shell's own terminal\n");
+        count_blocked(BLOCK_BUILTIN);
+        session->last_status = 1;
+        return;
+    }
+    while (*p == '-') {
+        int n = strcspn(p, " \t");
+        snprintf(word, sizeof(word), "%.*s", n, p);
+        p = skip_blanks(p + n);
+        if (strcmp(word, "--") == 0) break;
+        int is_interval = strcmp(word, "-n") == 0;
+        if (!is_interval && strcmp(word, "--on-change") != 0) goto usage;
+        n = strcspn(p, " \t");
+        if (n == 0 || n >= (int)sizeof(word)) goto usage;
+        snprintf(word, sizeof(word), "%.*s", n, p);
+        p = skip_blanks(p + n);
+        if (is_interval) {
+            char *end;
+            secs = strtod(word, &end);
+            if (*end || !(secs >= 0.1 && secs <= 86400)) goto usage;
+            continue;
+        }
+        snprintf(paths, sizeof(paths), "%s", word);
+        for (char *save, *path = strtok_r(word, ",", &save); path; path = strtok_r(NULL, ",", &save)) {
+            if (w.count == WATCH_MAX_PATHS) {
+                fprintf(stderr, "shell: watch: at most %d paths\n", WATCH_MAX_PATHS);
+                return;
+            }
+            if (!is_path_allowed(path)) return;
+            WatchPath *wp = &w.paths[w.count++];
+            snprintf(wp->path, sizeof(wp->path), "%s", path);
+            const char *slash = strrchr(wp->path, '/');
+            wp->base = slash && slash[1] ? slash + 1 : wp->path;
+        }
+        if (w.count == 0) goto usage;
+    }
+    // The command is the rest of the line; one pair of quotes around all of
+    // it is dropped, so a quoted pipeline reads as it would unquoted
+    char command[MAX_LINE];
+    size_t clen = strlen(p);
+    while (clen && (p[clen - 1] == ' ' || p[clen - 1] == '\t')) clen--;
+    if (clen >= 2 && (p[0] == '\'' || p[0] == '"') && p[clen - 1] == p[0] && !memchr(p + 1, p[0], clen - 2)) {
+        p++;
+        clen -= 2;
+    }
+    snprintf(command, sizeof(command), "%.*s", (int)clen, p);
+    const char *start = skip_blanks(command);
+    if (*start == '\0') goto usage;
+    const char *end = list_check(start, 0);
+    if (end && *end) end = list_error(end);
+    if (!end) {
+        session->last_status = 2;
+        return;
+    }
+    if (w.count == 0 && secs == 0) secs = WATCH_DEFAULT_SECS;
+    w.interval_ms = (long long)(secs * 1000);
+    WatchOutput *out = malloc(sizeof(*out));
+    if (!out) {
+        perror("shell: watch");
+        return;
+    }
 
-                // Store the alias (value is now the command without quotes)
-                add_alias(name, value);
-            } else {
-                fprintf(stderr, "shell: invalid alias format\n");
-                fprintf(stderr, "Usage: add_alias name='command'\n");
-            }
-        }
-        return 1;
+#ifdef __linux__
+    if (w.count) {
+        w.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        watch_arm(&w);
     }
-    // ONLY our custom remove_alias - NO original unalias command
-    if (strcmp(args[0], "remove_alias") == 0) {
-        if (args[1] == NULL) {
-            fprintf(stderr, "shell: remove_alias: usage: remove_alias name\n");
-        } else {
-            remove_alias(args[1]);
+#endif
+    if (w.fd < 0) watch_changed(&w);       // what the first poll compares with
+
+    struct sigaction sa = { .sa_handler = watch_sigint }, old_sa;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, &old_sa);
+    watch_interrupted = 0;
+
+    size_t last_total = 0;
+    uint64_t last_hash = 0;
+    int shown = 0;
+    do {
+        int status = watch_run(start, out);
+        session->last_status = status;
+        // Ctrl-C that reached the command ends the watch too
+        if (status == 128 + SIGINT) watch_interrupted = 1;
+        if (!shown || out->total != last_total || out->hash != last_hash) {
+            watch_show(&w, paths, start, status, out);
+            shown = 1;
+            last_total = out->total;
+            last_hash = out->hash;
         }
-        return 1;
+        if (w.fd >= 0) watch_arm(&w);
+    } while (!watch_interrupted && watch_wait(&w));
+
+    free(out);
+    if (w.fd >= 0) close(w.fd);
+    sigaction(SIGINT, &old_sa, NULL);
+    if (watch_interrupted && isatty(STDOUT_FILENO)) printf("\n");
+    return;
+
+usage:
+    fprintf(stderr, "shell: usage: %s\n", WATCH_USAGE);
+}
+
+// Run one input line for the current session
+void process_line(const char *input) {
+    char line[MAX_LINE];
+
+    if (is_complete_request(input)) {
+        session->last_status = complete_request(input + 9, stdout);
+        return;
+    }
+    snprintf(line, sizeof(line), "%s", input);
+    add_history_command(line);
+    session->last_status = 0;
+
+    const char *start = skip_blanks(line);
+    if (*start == '\0') return;
+    record_begin(session);
+    const char *end = list_check(start, 0);
+    if (end && *end) end = list_error(end);
+    if (!end) {
+        session->last_status = 2;
+        record_end(session, start);
+        return;
+    }
+    free(session->list);
+    session->list = strdup(start);
+    session->list_pos = 0;
+    long long traced = TRACE_BEGIN();
+    list_run(0);
+    TRACE_END("line", traced);
+}
+
+// SANDBOX: Multi-session server mode (myshell --server <socket>)
+// One process serves many clients over a Unix socket from a single event loop.
+// While a session's line runs, the client socket is dup'd onto the shell's
+// stdin/stdout/stderr, so builtins and spawned commands talk to that client
+// exactly as they would to a terminal. Foreground children are parked on the
+// session (see wait_foreground) and reaped when SIGCHLD arrives through a
+// self-pipe; the session stops being read until its command finishes so the
+// command can consume its own stdin.
+#define SERVER_PROMPT "sandbox> "
+
+int sigchld_pipe[2] = { -1, -1 };
+
+void server_sigchld_handler(int sig) {
+    int saved_errno = errno;
+    (void)write(sigchld_pipe[1], "c", 1);
+    errno = saved_errno;
+}
+
+// SIGTERM/SIGINT end the server loop, which then stops every session's jobs;
+// the byte on the SIGCHLD pipe wakes the loop if it is waiting
+volatile sig_atomic_t server_stopping = 0;
+
+void server_stop_handler(int sig) {
+    server_stopping = 1;
+    server_sigchld_handler(sig);
+}
+
+// Deliver SIGCHLD to an event loop as a readable byte on sigchld_pipe[0]
+int setup_sigchld_pipe() {
+    if (pipe(sigchld_pipe) < 0) {
+        perror("shell: pipe");
+        return -1;
     }
+    for (int i = 0; i < 2; i++) {
+        fcntl(sigchld_pipe[i], F_SETFL, O_NONBLOCK);
+        fcntl(sigchld_pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+    struct sigaction sa = { .sa_handler = server_sigchld_handler, .sa_flags = SA_RESTART };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
     return 0;
 }
 
-// SANDBOX: Find command path - ONLY use sandbox/bin, NO system fallback
-char* find_command_path(const char *cmd) {
-    static char path[PATH_MAX];
-    struct stat st;
-    
-#if USE_SANDBOX_COMMANDS
-    // ONLY check sandbox/bin directory - NO system fallback
-    snprintf(path, sizeof(path), "%s/%s", SANDBOX_BIN_DIR, cmd);
-    if (stat(path, &st) == 0 && (st.st_mode & S_IXUSR)) {
-        return path;  // Found sandbox command
+// A session's socket is read only while it is idle. While a command runs
+// its input waits in the socket, but a hangup (EPOLLHUP, which epoll always
+// reports) still gets through, so a client that goes away mid-command does
+// not leave the job running. A half-close is not a hangup: the client still
+// gets the output.
+void server_watch(int epfd, Session *s, int on) {
+#ifdef __linux__
+    struct epoll_event ev = { .events = on ? EPOLLIN : 0, .data.ptr = s };
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, s->fd, &ev) < 0 && errno == ENOENT) {
+        epoll_ctl(epfd, EPOLL_CTL_ADD, s->fd, &ev);
     }
-    // NOT FOUND - return NULL to indicate command doesn't exist
-    return NULL;
-#else
-    // Fall back to system PATH (if sandbox commands disabled)
-    return (char*)cmd;
 #endif
+    // The poll() fallback rebuilds its fd set from session state every loop
 }
 
-void handle_redirection(char** args, int *in_redir, int *out_redir, char** in_file, char** out_file) {
-    for (int i = 0; args[i] != NULL; i++) {
-        if (strcmp(args[i], "<") == 0) {
-            *in_redir = 1;
-            *in_file = args[i + 1];
-            args[i] = NULL;
+void session_free(Session *s) {
+    for (int i = 0; i < s->alias_count; i++) {
+        state_release(s->aliases[i].name);
+        state_release(s->aliases[i].command);
+    }
+    for (int i = 0; i < s->history_count; i++) {
+        state_release(s->history[(s->history_start + i) % HISTORY_SIZE]);
+    }
+    if (s->capture_key) {
+        free(s->capture_key);
+        close(s->capture_fd);
+    }
+    if (s->redir_in >= 0) close(s->redir_in);
+    if (s->redir_out >= 0) close(s->redir_out);
+    for (int i = 0; i < s->metrics.ncmds; i++) {
+        free(s->metrics.cmds[i].name);
+    }
+    free(s->metrics.cmds);
+    free(s->trace);
+    free(s->record_cwd);
+    free(s->list);
+    free(s->cwd);
+    free(s);
+}
+
+void session_close(int epfd, Session *s) {
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        if (sessions[i] == s) sessions[i] = NULL;
+    }
+    background_kill_all(s);
+#ifdef __linux__
+    epoll_ctl(epfd, EPOLL_CTL_DEL, s->fd, NULL);
+#endif
+    close(s->fd);
+    session_free(s);
+}
+
+// Kill the session's running job and reap its stages, so server_reap()
+// never looks for the session again
+void session_kill_jobs(Session *s) {
+    if (s->pending_count > 0 && s->job_pgid > 0) kill(-s->job_pgid, SIGKILL);
+    for (int i = 0; i < s->pending_count; i++) {
+        kill(s->pending[i], SIGKILL);
+        while (waitpid(s->pending[i], NULL, 0) < 0 && errno == EINTR);
+    }
+    s->pending_count = 0;
+}
+
+// The client went away, or the server is stopping: the running job goes
+// with the session
+void session_hangup(int epfd, Session *s) {
+    session_kill_jobs(s);
+    session_close(epfd, s);
+}
+
+// Run one line with the session's socket as stdio and its cwd as ours;
+// a NULL line carries on with the session's unfinished command list
+void session_run_line(Session *s, const char *line) {
+    int saved[3];
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < 3; i++) {
+        saved[i] = dup(i);
+        dup2(s->fd, i);
+    }
+    session = s;
+    if (chdir(s->cwd) != 0) perror("shell: session cwd");
+
+    if (line) {
+        process_line(line);
+    } else {
+        list_run(1);
+    }
+
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) != NULL && strcmp(cwd, s->cwd) != 0) {
+        free(s->cwd);
+        s->cwd = strdup(cwd);
+    }
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < 3; i++) {
+        dup2(saved[i], i);
+        close(saved[i]);
+    }
+    session = &terminal_session;
+}
+
+// Run every complete buffered line until the session is busy or closing
+void session_drain(int epfd, Session *s) {
+    while (s->pending_count == 0 && !s->closing) {
+        char *nl = memchr(s->inbuf, '\n', s->inbuf_len);
+        if (!nl) break;
+        *nl = '\0';
+        if (nl > s->inbuf && nl[-1] == '\r') nl[-1] = '\0';
+        if (reload_requested) reload_policy();
+        if (s->inbuf[0] != '\0') {
+            session_run_line(s, s->inbuf);
         }
-        if (strcmp(args[i], ">") == 0) {
-            *out_redir = 1;
-            *out_file = args[i + 1];
-            args[i] = NULL;
+        size_t used = nl + 1 - s->inbuf;
+        memmove(s->inbuf, nl + 1, s->inbuf_len - used);
+        s->inbuf_len -= used;
+        if (s->pending_count == 0 && !s->closing) {
+            (void)write(s->fd, SERVER_PROMPT, strlen(SERVER_PROMPT));
         }
     }
+    if (s->closing && s->pending_count == 0) {
+        session_close(epfd, s);
+    } else if (s->pending_count > 0) {
+        server_watch(epfd, s, 0);
+    }
 }
 
-void execute_command(char** args, int background) {
-    // SANDBOX: Block original echo command (use display instead)
-    if (strcmp(args[0], "echo") == 0) {
-        fprintf(stderr, "\033[1;31m[SANDBOX BLOCKED]\033[0m Command 'echo' is not allowed (use 'display' instead - our custom implementation)\n");
-        commands_blocked++;
+int sessions_connected = 0;
+
+void server_accept(int epfd, int listen_fd) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) return;
+    int slot = 0;
+    while (slot < MAX_SESSIONS && sessions[slot]) slot++;
+    if (slot == MAX_SESSIONS) {
+        const char *msg = "[SANDBOX] Server full, try again later\n";
+        (void)write(fd, msg, strlen(msg));
+        close(fd);
         return;
     }
-    
-    // SANDBOX: Check if command is allowed
-    if (!is_command_allowed(args[0])) {
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    Session *s = calloc(1, sizeof(Session));
+    char cwd[PATH_MAX];
+    s->fd = fd;
+    s->cpu_slot = slot;
+    s->number = ++sessions_connected;
+    s->redir_in = s->redir_out = -1;
+    trace_start(s, policy->trace_events);
+    s->cwd = strdup(getcwd(cwd, sizeof(cwd)) ? cwd : policy->root);
+    s->start_time = time(NULL);
+    sessions[slot] = s;
+
+    int saved = dup(STDOUT_FILENO);
+    fflush(stdout);
+    dup2(fd, STDOUT_FILENO);
+    print_sandbox_banner();
+    printf("%s", SERVER_PROMPT);
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    server_watch(epfd, s, 1);
+}
+
+void server_read(int epfd, Session *s) {
+    if (s->pending_count > 0) {
+        session_hangup(epfd, s);      // only a hangup is watched while busy
         return;
     }
-    
-    int in_redir = 0, out_redir = 0;
-    char *in_file = NULL, *out_file = NULL;
-    handle_redirection(args, &in_redir, &out_redir, &in_file, &out_file);
-    
-    // SANDBOX: Validate file paths for redirection
-    if (in_redir && !is_path_allowed(in_file)) {
-        return;
+    if (s->inbuf_len == sizeof(s->inbuf)) {
+        // Line longer than MAX_LINE: drop it rather than stall the session
+        s->inbuf_len = 0;
     }
-    if (out_redir && !is_path_allowed(out_file)) {
+    ssize_t n = read(s->fd, s->inbuf + s->inbuf_len, sizeof(s->inbuf) - s->inbuf_len);
+    if (n <= 0) {
+        session_close(epfd, s);
         return;
     }
-    
-    pid_t pid = fork();
-    if (pid == 0) {
-        // SANDBOX: Apply resource limits in child process
-        setup_resource_limits();
-        
-        // SANDBOX: Setup chroot jail (requires root privileges)
-        setup_chroot();
-        
-        if (in_redir) {
-            int fd = open(in_file, O_RDONLY);
-            if (fd < 0) {
-                perror("shell: input redirection");
-                exit(1);
+    s->inbuf_len += n;
+    session_drain(epfd, s);
+}
+
+void server_reap(int epfd) {
+    char buf[64];
+    while (read(sigchld_pipe[0], buf, sizeof(buf)) > 0);
+
+    pid_t pid;
+    int status;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (int i = 0; i < MAX_SESSIONS; i++) {
+            Session *s = sessions[i];
+            if (!s) continue;
+            for (int j = 0; j < s->pending_count; j++) {
+                if (s->pending[j] != pid) continue;
+                if (pid == s->last_pid) s->last_status = decode_status(status);
+                metrics_reaped(s, pid, status);
+                s->pending[j] = s->pending[--s->pending_count];
+                if (s->pending_count == 0) {
+                    job_finish(s);
+                    // The rest of a command list may start another job
+                    if (s->list) session_run_line(s, NULL);
+                    if (s->pending_count > 0) goto next_pid;
+                    if (!s->closing) {
+                        (void)write(s->fd, SERVER_PROMPT, strlen(SERVER_PROMPT));
+                    }
+                    server_watch(epfd, s, 1);
+                    session_drain(epfd, s);
+                }
+                goto next_pid;
             }
-            dup2(fd, STDIN_FILENO);
-            close(fd);
-        }
-        if (out_redir) {
-            int fd = open(out_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-            if (fd < 0) {
-                perror("shell: output redirection");
-                exit(1);
-            }
-            dup2(fd, STDOUT_FILENO);
-            close(fd);
-        }
-        
-        // SANDBOX: ONLY use sandbox commands - NO system fallback
-        char *cmd_path = find_command_path(args[0]);
-        
-        if (cmd_path == NULL) {
-            // Command not found in sandbox/bin - BLOCK IT
-            fprintf(stderr, "\033[1;31m[SANDBOX BLOCKED]\033[0m Command '%s' not found in sandbox/bin (only sandbox commands allowed)\n", args[0]);
-            exit(EXIT_FAILURE);
-        }
-        
-        // Use sandbox command (cmd_path is full path to sandbox/bin/command)
-        if (execv(cmd_path, args) == -1) {
-            perror("shell");
-        }
-        exit(EXIT_FAILURE);
-    } else if (pid > 0) {
-        commands_executed++;
-        if (!background) {
-            waitpid(pid, NULL, 0);
-        } else {
-            printf("[Background pid %d]\n", pid);
         }
-    } else {
-        perror("shell: fork failed");
+next_pid:;
     }
 }
 
-void execute_pipe(char* line, int background) {
-    char *cmds[10];
-    int cmd_count = 0;
-    cmds[cmd_count] = strtok(line, "|");
-    while (cmds[cmd_count] != NULL && cmd_count < 9) {
-        cmds[++cmd_count] = strtok(NULL, "|");
+int run_server(const char *socket_path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "shell: socket path too long: %s\n", socket_path);
+        return EXIT_FAILURE;
     }
-    
-    // SANDBOX: Validate all commands in pipeline before executing
-    for (int i = 0; i < cmd_count; i++) {
-        char *args[MAX_ARGS];
-        char temp_line[MAX_LINE];
-        strcpy(temp_line, cmds[i]);
-        parse_command(temp_line, args);
-        if (args[0] != NULL && !is_command_allowed(args[0])) {
-            return;
-        }
+    strcpy(addr.sun_path, socket_path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listen_fd, 64) < 0) {
+        perror("shell: server socket");
+        return EXIT_FAILURE;
     }
-    
-    int pipefds[2 * (cmd_count - 1)];
-    for (int i = 0; i < cmd_count - 1; i++) {
-        if (pipe(pipefds + i*2) < 0) {
-            perror("shell: pipe");
-            exit(EXIT_FAILURE);
-        }
+    fcntl(listen_fd, F_SETFD, FD_CLOEXEC);
+
+    if (setup_sigchld_pipe() < 0) {
+        return EXIT_FAILURE;
     }
-    int pid;
-    for (int i = 0; i < cmd_count; i++) {
-        char *args[MAX_ARGS];
-        parse_command(cmds[i], args);
-        pid = fork();
-        if (pid == 0) {
-            // SANDBOX: Apply resource limits in child process
-            setup_resource_limits();
-            
-            // SANDBOX: Setup chroot jail (requires root privileges)
-            setup_chroot();
-            
-            if (i != 0) {
-                dup2(pipefds[(i-1)*2], 0);
-            }
-            if (i != cmd_count - 1) {
-                dup2(pipefds[i*2 + 1], 1);
-            }
-            for (int k = 0; k < 2*(cmd_count-1); k++) {
-                close(pipefds[k]);
-            }
-            
-            // SANDBOX: ONLY use sandbox commands - NO system fallback
-            char *cmd_path = find_command_path(args[0]);
-            
-            if (cmd_path == NULL) {
-                // Command not found in sandbox/bin - BLOCK IT
-                fprintf(stderr, "\033[1;31m[SANDBOX BLOCKED]\033[0m Command '%s' not found in sandbox/bin (only sandbox commands allowed)\n", args[0]);
-                exit(EXIT_FAILURE);
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction stop = { .sa_handler = server_stop_handler };
+    sigemptyset(&stop.sa_mask);
+    sigaction(SIGTERM, &stop, NULL);
+    sigaction(SIGINT, &stop, NULL);
+
+    server_mode = 1;
+    fprintf(stderr, "[SANDBOX] Serving sessions on %s\n", socket_path);
+
+#ifdef __linux__
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    // data.ptr NULL marks the listener, &sigchld_pipe the SIGCHLD pipe
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+    ev.data.ptr = sigchld_pipe;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, sigchld_pipe[0], &ev);
+
+    struct epoll_event events[64];
+    while (!server_stopping) {
+        int n = epoll_wait(epfd, events, 64, min_timeout(metrics_timeout_ms(), job_timeout_ms()));
+        if (reload_requested) reload_policy();
+        metrics_tick(0);
+        job_check_deadlines();
+        for (int i = 0; i < n; i++) {
+            void *ptr = events[i].data.ptr;
+            if (ptr == NULL) {
+                server_accept(epfd, listen_fd);
+            } else if (ptr == sigchld_pipe) {
+                server_reap(epfd);
+            } else {
+                // A session may have been closed by server_reap() above
+                int live = 0;
+                for (int j = 0; j < MAX_SESSIONS; j++) live |= (sessions[j] == ptr);
+                if (live) server_read(epfd, ptr);
             }
-            
-            // Use sandbox command (cmd_path is full path to sandbox/bin/command)
-            if (execv(cmd_path, args) == -1) {
-                perror("shell");
-                exit(EXIT_FAILURE);
+        }
+    }
+#else
+    int epfd = -1;
+    struct pollfd fds[MAX_SESSIONS + 2];
+    Session *owners[MAX_SESSIONS + 2];
+    while (!server_stopping) {
+        int nfds = 0;
+        fds[nfds].fd = listen_fd; fds[nfds].events = POLLIN; owners[nfds++] = NULL;
+        fds[nfds].fd = sigchld_pipe[0]; fds[nfds].events = POLLIN; owners[nfds++] = NULL;
+        for (int i = 0; i < MAX_SESSIONS; i++) {
+            if (sessions[i]) {
+                // Busy sessions are there for POLLHUP alone
+                fds[nfds].fd = sessions[i]->fd;
+                fds[nfds].events = sessions[i]->pending_count == 0 ? POLLIN : 0;
+                owners[nfds++] = sessions[i];
             }
-        } else if (pid < 0) {
-            perror("fork failed");
-            exit(EXIT_FAILURE);
         }
+        int n = poll(fds, nfds, min_timeout(metrics_timeout_ms(), job_timeout_ms()));
+        if (reload_requested) reload_policy();
+        metrics_tick(0);
+        job_check_deadlines();
+        if (n <= 0) continue;
+        if (fds[1].revents) server_reap(epfd);
+        for (int i = 2; i < nfds; i++) {
+            // A session may have been closed by server_reap() above
+            int live = 0;
+            for (int j = 0; j < MAX_SESSIONS; j++) live |= (sessions[j] == owners[i]);
+            if (live && fds[i].revents) server_read(epfd, owners[i]);
+        }
+        if (fds[0].revents) server_accept(epfd, listen_fd);
     }
-    for (int i = 0; i < 2*(cmd_count-1); i++) {
-        close(pipefds[i]);
+#endif
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        if (sessions[i]) session_hangup(epfd, sessions[i]);
     }
-    commands_executed++;
-    if (!background) {
-        for (int i = 0; i < cmd_count; i++) {
-            wait(NULL);
+    unlink(socket_path);
+    return 0;
+}
+
+// SANDBOX: Framed protocol mode (myshell --protocol)
+// For GUI and automation clients. Instead of a terminal stream the shell
+// writes length-prefixed frames to stdout:
+//   1 byte type | 4 byte big-endian payload length | payload
+// Types:
+//   'S' command start   payload: the command line
+//   'O' stdout chunk    payload: raw bytes
+//   'E' stderr chunk    payload: raw bytes
+//   'X' command exit    payload: JSON {"status":..,"wall_ms":..,"user_ms":..,
+//                                      "sys_ms":..,"maxrss_kb":..}
+//   'P' prompt ready    payload: current directory
+//   'C' completions     payload: JSON, the answer to a "complete" line
+//                       (see complete_request); no 'S'/'X'/'P' around it
+// Command lines are read from stdin, one per line. Commands (and builtins)
+// write into two pipes that the shell drains into 'O'/'E' frames, batched up
+// to PROTO_BATCH bytes or PROTO_FLUSH_MS milliseconds. Frames are written
+// with blocking writes, so a client that stops reading stalls the pipe pump
+// and, through the full pipe, the command producing the output. A client
+// that closes its end ends the session: the running command is killed and
+// the shell exits the way it does at the end of input (see protocol_end).
+#define PROTO_BATCH 32768
+#define PROTO_FLUSH_MS 20
+#define PROTO_PIPE_SIZE (1024 * 1024)
+
+typedef struct {
+    int fd;                 // read end of the command output pipe
+    char type;              // 'O' or 'E'
+    size_t len;
+    long long first_ms;     // when the oldest buffered byte arrived
+    char buf[PROTO_BATCH];
+} ProtoStream;
+
+int proto_fd = -1;
+ProtoStream proto_streams[2] = { { .type = 'O' }, { .type = 'E' } };
+
+int proto_lost;             // a frame could not be written: the client is gone
+
+// -1 once the client has gone away; later writes fail straight away
+int proto_write_all(const char *data, size_t len) {
+    while (len > 0 && !proto_lost) {
+        ssize_t n = write(proto_fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            proto_lost = 1;
+            break;
         }
-    } else {
-        printf("[Background pipeline]\n");
+        data += n;
+        len -= n;
     }
+    return proto_lost ? -1 : 0;
 }
 
-char *command_generator(const char *text, int state) {
-    static int list_index, len;
-    static const char *commands[] = {
-        "cd", "exit", "print_history", "add_alias", "remove_alias", "help", "stats", "commands",
-        "ls", "cat", "display", "pwd", "grep", "touch", "mkdir", "rmdir", "cp", "mv",
-        "head", "tail", "wc", "sort", "uniq", "find", "which", "date", "clear",
-        NULL
+int proto_send(char type, const char *payload, size_t len) {
+    unsigned char header[5] = {
+        (unsigned char)type,
+        (unsigned char)(len >> 24), (unsigned char)(len >> 16),
+        (unsigned char)(len >> 8), (unsigned char)len
     };
+    if (proto_write_all((const char *)header, sizeof(header)) < 0) return -1;
+    return proto_write_all(payload, len);
+}
+
+int proto_flush(ProtoStream *ps) {
+    size_t len = ps->len;
+    if (len == 0) return 0;
+    ps->len = 0;
+    return proto_send(ps->type, ps->buf, len);
+}
 
-    if (!state) {
-        list_index = 0;
-        len = strlen(text);
+// Move whatever the pipe currently holds into the batch, framing full batches
+int proto_pump(ProtoStream *ps) {
+    while (1) {
+        ssize_t n = read(ps->fd, ps->buf + ps->len, PROTO_BATCH - ps->len);
+        if (n <= 0) return 0;
+        if (ps->len == 0) ps->first_ms = monotonic_ms();
+        ps->len += n;
+        if (ps->len == PROTO_BATCH && proto_flush(ps) < 0) return -1;
     }
+}
 
-    const char *match;
-    while ((match = commands[list_index++]) != NULL) {
-        if (strncmp(match, text, len) == 0)
-            return strdup(match);
+// Output produced inside the shell (a result cache hit) goes out as 'O'
+// frames, after whatever the stdout pipe already holds
+int proto_output(const char *data, size_t len) {
+    fflush(stdout);
+    if (proto_pump(&proto_streams[0]) < 0 || proto_flush(&proto_streams[0]) < 0) return -1;
+    while (len > 0) {
+        size_t n = len < PROTO_BATCH ? len : PROTO_BATCH;
+        if (proto_send('O', data, n) < 0) return -1;
+        data += n;
+        len -= n;
     }
-    return NULL;
+    return 0;
 }
 
-char *file_generator(const char *text, int state) {
-    static DIR *dir = NULL;
-    static struct dirent *entry;
+int proto_prompt() {
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) cwd[0] = '\0';
+    return proto_send('P', cwd, strlen(cwd));
+}
 
-    if (!state) {
-        if (dir) closedir(dir);
-        dir = opendir(".");
+// Frame what is left in both pipes
+int proto_drain(ProtoStream *streams) {
+    for (int i = 0; i < 2; i++) {
+        if (proto_pump(&streams[i]) < 0 || proto_flush(&streams[i]) < 0) return -1;
     }
+    return 0;
+}
+
+// The end of input or of the client. A client that went away leaves its
+// command running, so that is killed first (as for a server session that
+// hangs up); background jobs go in both cases, after the snapshot is saved.
+int protocol_end(Session *s, int lost) {
+    if (lost) session_kill_jobs(s);
+    metrics_tick(1);
+    state_save(s);
+    background_kill_all(s);
+    return lost ? EXIT_FAILURE : 0;
+}
 
-    if (!dir) return NULL;
+int run_protocol() {
+    // Keep the real stdin/stdout for commands and frames; the commands get
+    // /dev/null as stdin so they cannot swallow the next command lines
+    int cmd_fd = dup(STDIN_FILENO);
+    proto_cmd_fd = cmd_fd;
+    proto_fd = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_RDONLY);
+    if (cmd_fd < 0 || proto_fd < 0 || devnull < 0) {
+        perror("shell: protocol setup");
+        return EXIT_FAILURE;
+    }
+    dup2(devnull, STDIN_FILENO);
+    close(devnull);
+    fcntl(cmd_fd, F_SETFD, FD_CLOEXEC);
+    fcntl(proto_fd, F_SETFD, FD_CLOEXEC);
 
-    while ((entry = readdir(dir)) != NULL) {
-        if (strncmp(entry->d_name, text, strlen(text)) == 0) {
-            return strdup(entry->d_name);
+    ProtoStream *streams = proto_streams;
+    for (int i = 0; i < 2; i++) {
+        int p[2];
+        if (pipe(p) < 0) {
+            perror("shell: pipe");
+            return EXIT_FAILURE;
         }
+#ifdef F_SETPIPE_SZ
+        // Builtins write into the same pipe the shell drains, so give their
+        // output (help, commands, history) room to fit without blocking
+        fcntl(p[1], F_SETPIPE_SZ, PROTO_PIPE_SIZE);
+#endif
+        fcntl(p[0], F_SETFL, O_NONBLOCK);
+        fcntl(p[0], F_SETFD, FD_CLOEXEC);
+        dup2(p[1], i == 0 ? STDOUT_FILENO : STDERR_FILENO);
+        close(p[1]);
+        streams[i].fd = p[0];
     }
+    if (setup_sigchld_pipe() < 0) {
+        return EXIT_FAILURE;
+    }
+    // A client that closes its end shows up as a failed write, not a signal
+    signal(SIGPIPE, SIG_IGN);
+    protocol_mode = 1;
 
-    closedir(dir);
-    dir = NULL;
-    return NULL;
+    Session *s = session;
+    int busy = 0, eof = 0;
+    long long started_ms = 0;
+    struct rusage usage = {0};
+    long maxrss = 0;
+    if (proto_prompt() < 0) return protocol_end(s, 1);
+
+    while (1) {
+        // Start the next buffered line once the previous one has finished
+        char *nl = NULL;
+        if (!busy && (s->closing || (eof && !memchr(s->inbuf, '\n', s->inbuf_len)))) {
+            break;
+        }
+        // A completion request is answered as soon as it comes up, even
+        // while the command before it still runs
+        if ((nl = memchr(s->inbuf, '\n', s->inbuf_len)) != NULL &&
+            (!busy || is_complete_request(s->inbuf))) {
+            *nl = '\0';
+            if (nl > s->inbuf && nl[-1] == '\r') nl[-1] = '\0';
+            size_t used = nl + 1 - s->inbuf;
+            if (is_complete_request(s->inbuf)) {
+                char *answer = NULL;
+                size_t len = 0;
+                FILE *out = open_memstream(&answer, &len);
+                if (out) {
+                    complete_request(s->inbuf + 9, out);
+                    fclose(out);
+                }
+                // One JSON object per frame; the trailing newline is dropped
+                int sent = proto_send('C', answer ? answer : "", len > 0 ? len - 1 : 0);
+                free(answer);
+                if (sent < 0) return protocol_end(s, 1);
+                memmove(s->inbuf, nl + 1, s->inbuf_len - used);
+                s->inbuf_len -= used;
+                continue;
+            }
+            if (reload_requested) reload_policy();
+            if (proto_send('S', s->inbuf, strlen(s->inbuf)) < 0) return protocol_end(s, 1);
+            started_ms = monotonic_ms();
+            memset(&usage, 0, sizeof(usage));
+            maxrss = 0;
+            if (s->inbuf[0] != '\0') {
+                process_line(s->inbuf);
+            }
+            fflush(stdout);
+            fflush(stderr);
+            memmove(s->inbuf, nl + 1, s->inbuf_len - used);
+            s->inbuf_len -= used;
+            busy = 1;
+        }
+
+        if (busy && s->pending_count == 0) {
+            job_finish(s);
+            if (s->list) {
+                // Next job of a command list; one X frame covers the line
+                list_run(1);
+                fflush(stdout);
+                fflush(stderr);
+                if (s->pending_count > 0) continue;
+            }
+            // Everything the job wrote is in the pipes by now
+            char exit_info[256];
+            if (proto_drain(streams) < 0) return protocol_end(s, 1);
+            snprintf(exit_info, sizeof(exit_info),
+                     "{\"status\":%d,\"wall_ms\":%lld,\"user_ms\":%ld,\"sys_ms\":%ld,\"maxrss_kb\":%ld}",
+                     s->last_status, monotonic_ms() - started_ms,
+                     (long)(usage.ru_utime.tv_sec * 1000 + usage.ru_utime.tv_usec / 1000),
+                     (long)(usage.ru_stime.tv_sec * 1000 + usage.ru_stime.tv_usec / 1000),
+                     maxrss);
+            if (proto_send('X', exit_info, strlen(exit_info)) < 0) return protocol_end(s, 1);
+            busy = 0;
+            if (!s->closing && proto_prompt() < 0) return protocol_end(s, 1);
+            continue;
+        }
+
+        struct pollfd fds[4] = {
+            { .fd = streams[0].fd, .events = POLLIN },
+            { .fd = streams[1].fd, .events = POLLIN },
+            { .fd = sigchld_pipe[0], .events = POLLIN },
+            { .fd = (busy || eof) ? -1 : cmd_fd, .events = POLLIN },
+        };
+        int timeout = min_timeout(metrics_timeout_ms(), job_timeout_ms());
+        for (int i = 0; i < 2; i++) {
+            if (streams[i].len > 0) {
+                long long left = streams[i].first_ms + PROTO_FLUSH_MS - monotonic_ms();
+                if (left < 0) left = 0;
+                if (timeout < 0 || left < timeout) timeout = (int)left;
+            }
+        }
+        if (poll(fds, 4, timeout) < 0 && errno != EINTR) {
+            perror("shell: poll");
+            return EXIT_FAILURE;
+        }
+        metrics_tick(0);
+        job_check_deadlines();
+
+        for (int i = 0; i < 2; i++) {
+            if ((fds[i].revents & POLLIN) && proto_pump(&streams[i]) < 0) return protocol_end(s, 1);
+            if (streams[i].len > 0 && monotonic_ms() - streams[i].first_ms >= PROTO_FLUSH_MS
+                && proto_flush(&streams[i]) < 0) {
+                return protocol_end(s, 1);
+            }
+        }
+
+        if (fds[2].revents & POLLIN) {
+            char buf[64];
+            while (read(sigchld_pipe[0], buf, sizeof(buf)) > 0);
+            pid_t pid;
+            int status;
+            struct rusage ru;
+            while ((pid = wait4(-1, &status, WNOHANG, &ru)) > 0) {
+                for (int j = 0; j < s->pending_count; j++) {
+                    if (s->pending[j] != pid) continue;
+                    if (pid == s->last_pid) s->last_status = decode_status(status);
+                    metrics_reaped(s, pid, status);
+                    timeradd(&usage.ru_utime, &ru.ru_utime, &usage.ru_utime);
+                    timeradd(&usage.ru_stime, &ru.ru_stime, &usage.ru_stime);
+                    if (ru.ru_maxrss > maxrss) maxrss = ru.ru_maxrss;
+                    s->pending[j] = s->pending[--s->pending_count];
+                    break;
+                }
+            }
+        }
+
+        if (fds[3].revents & (POLLIN | POLLHUP)) {
+            if (s->inbuf_len == sizeof(s->inbuf)) s->inbuf_len = 0;
+            ssize_t n = read(cmd_fd, s->inbuf + s->inbuf_len, sizeof(s->inbuf) - s->inbuf_len);
+            if (n <= 0) {
+                eof = 1;
+                // A final line without a newline still counts
+                if (s->inbuf_len > 0 && s->inbuf_len < sizeof(s->inbuf)) {
+                    s->inbuf[s->inbuf_len++] = '\n';
+                }
+            } else {
+                s->inbuf_len += n;
+            }
+        }
+    }
+    return protocol_end(s, proto_drain(streams) < 0);
 }
 
-char **shell_completion(const char *text, int start, int end) {
-    rl_completion_append_character = '\0';
-    rl_attempted_completion_over = 1;
+#define SHELL_PROMPT "\033[1;36msandbox>\033[0m "
 
-    if (start == 0) {
-        return rl_completion_matches(text, command_generator);
-    } else {
-        return rl_completion_matches(text, file_generator);
+// Read a line from a non-terminal stdin the way readline would: a byte at
+// a time, so a command run from the script still gets the lines after its
+// own, with the prompt and the line echoed to stdout
+char *read_plain_line(const char *prompt) {
+    fputs(prompt, stdout);
+    fflush(stdout);
+    size_t len = 0, cap = 128;
+    char *line = malloc(cap);
+    char c;
+    ssize_t n;
+    while (line) {
+        // Background jobs run out of time while we wait for input too,
+        // and the metrics file stays current
+        struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+        int ready = poll(&pfd, 1, min_timeout(metrics_timeout_ms(), job_timeout_ms()));
+        int err = errno;
+        job_check_deadlines();
+        metrics_tick(0);
+        if (ready == 0) continue;
+        errno = err;
+        n = ready < 0 ? -1 : read(STDIN_FILENO, &c, 1);
+        if (n == 0) break;
+        if (n < 0) {
+            if (errno == EINTR && !reload_requested) continue;
+            break;
+        }
+        if (c == '\n') break;
+        if (len + 1 == cap) {
+            char *grown = realloc(line, cap *= 2);
+            if (!grown) break;
+            line = grown;
+        }
+        line[len++] = c;
+    }
+    if (!line || (len == 0 && n <= 0)) {
+        free(line);
+        return NULL;
     }
+    line[len] = '\0';
+    printf("%s\n", line);
+    fflush(stdout);
+    return line;
 }
 
-int main() {
-    char line[MAX_LINE];
-    char *args[MAX_ARGS];
+// readline calls this about ten times a second while it waits for a key;
+// a timeout message printed meanwhile gets a fresh prompt under it
+int readline_idle(void) {
+    int notices = job_notices;
+    job_check_deadlines();
+    metrics_tick(0);
+    if (job_notices != notices) {
+        rl_on_new_line();
+        rl_redisplay();
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *server_socket = NULL;
+    int protocol = 0;
     
     // Initialize sandbox
-    sandbox_start_time = time(NULL);
+    terminal_session.start_time = time(NULL);
     
-    // Create sandbox directory if it doesn't exist
-    mkdir(SANDBOX_DIR, 0755);
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-f") == 0 || strcmp(argv[i], "--config") == 0) && i + 1 < argc) {
+            snprintf(config_path, sizeof(config_path), "%s", argv[++i]);
+        } else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+            server_socket = argv[++i];
+        } else if (strcmp(argv[i], "--protocol") == 0) {
+            protocol = 1;
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_override = argv[++i];
+        }
+    }
+    // Reloads happen wherever the sessions have cd'd to, and --record's
+    // file is opened there too
+    char resolved[PATH_MAX], cwd[PATH_MAX];
+    if (realpath(config_path, resolved)) {
+        snprintf(config_path, sizeof(config_path), "%s", resolved);
+    } else if (config_path[0] != '/' && getcwd(cwd, sizeof(cwd)) &&
+               strlen(cwd) + strlen(config_path) + 2 <= sizeof(config_path)) {
+        strcat(strcat(cwd, "/"), config_path);
+        strcpy(config_path, cwd);
+    }
+    static char record_arg[PATH_MAX];
+    if (record_override && record_override[0] != '/' && getcwd(record_arg, sizeof(record_arg)) &&
+        strlen(record_arg) + strlen(record_override) + 2 <= sizeof(record_arg)) {
+        strcat(strcat(record_arg, "/"), record_override);
+        record_override = record_arg;
+    }
+    policy = load_policy(config_path, 0);
+    if (!policy) {
+        return EXIT_FAILURE;
+    }
     
-    signal(SIGCHLD, sigchld_handler);
-    rl_bind_key('\t', rl_complete);
-    rl_attempted_completion_function = shell_completion;
+    trace_start(&terminal_session, policy->trace_events);
     
-    print_sandbox_banner();
-    printf("Type '\033[1;32mhelp\033[0m' for available commands, '\033[1;32mstats\033[0m' for sandbox statistics\n\n");
+    signal(SIGHUP, sighup_handler);
+    if (server_socket) {
+        return run_server(server_socket);
+    }
+    // Server clients start empty; the single terminal or GUI session
+    // carries on from its last run
+    state_load(&terminal_session);
+    if (protocol) {
+        return run_protocol();
+    }
+    
+    signal(SIGCHLD, sigchld_handler);
+    // SANDBOX: Fast start - readline, completion and the banner are only
+    // set up for a person at a terminal; scripts and pipes skip all three
+    int interactive = isatty(STDIN_FILENO);
+    if (interactive) {
+        // Foreground jobs take the terminal (see job_join); the shell must
+        // not be stopped when it takes it back
+        job_control = 1;
+        signal(SIGTTOU, SIG_IGN);
+        rl_bind_key('\t', rl_complete);
+        rl_attempted_completion_function = shell_completion;
+        rl_basic_word_break_characters = (char *)COMPLETE_BREAKS;
+        rl_event_hook = readline_idle;
+        for (int i = 0; i < terminal_session.history_count; i++) {
+            add_history(terminal_session.history[i]);
+        }
+        print_sandbox_banner();
+        printf("Type '\033[1;32mhelp\033[0m' for available commands, '\033[1;32mstats\033[0m' for sandbox statistics\n\n");
+    }
     
     while (1) {
-        char *input = readline("\033[1;36msandbox>\033[0m ");
+        char *input = interactive ? readline(SHELL_PROMPT) : read_plain_line(SHELL_PROMPT);
         if (!input) {
+            // readline gives up on the current line when SIGHUP arrives;
+            // that is a policy reload, not the end of the session
+            if (reload_requested) {
+                reload_policy();
+                continue;
+            }
             break;
         }
         if (strlen(input) == 0) {
             free(input);
             continue;
         }
-        strcpy(line, input);
-        add_history_command(line);
-        add_history(input);
-        free(input);
-
-        int background = 0;
-        if (line[strlen(line) - 1] == '&') {
-            background = 1;
-            line[strlen(line) - 1] = '\0';
-        }
-
-        // Alias expansion
-        char *tokens[MAX_ARGS];
-        int token_count = 0;
-        char *saveptr;
-        char *temp_line = strdup(line);
-        char *token = strtok_r(temp_line, DELIM, &saveptr);
-        while (token != NULL && token_count < MAX_ARGS - 1) {
-            tokens[token_count++] = token;
-            token = strtok_r(NULL, DELIM, &saveptr);
-        }
-        tokens[token_count] = NULL;
-
-        if (token_count > 0) {
-            char *alias_expansion = check_alias(tokens[0]);
-            if (alias_expansion != NULL) {
-                char new_line[MAX_LINE];
-                strcpy(new_line, alias_expansion);
-                for (int i = 1; i < token_count; i++) {
-                    strcat(new_line, " ");
-                    strcat(new_line, tokens[i]);
-                }
-                strcpy(line, new_line);
-            }
-        }
-        free(temp_line);
-
-        if (strchr(line, '|') != NULL) {
-            execute_pipe(line, background);
-        } else {
-            parse_command(line, args);
-            if (args[0] == NULL) continue;
-            if (execute_builtin(args)) continue;
-            execute_command(args, background);
+        // SANDBOX: Apply a pending SIGHUP policy reload before running anything
+        if (reload_requested) {
+            reload_policy();
         }
+        if (interactive) add_history(input);
+        process_line(input);
+        free(input);
+        metrics_tick(0);
     }
     print_sandbox_stats();
+    metrics_tick(1);
+    state_save(&terminal_session);
+    background_kill_all(&terminal_session);
     return 0;
 }
-
@@ -12,10 +12,12 @@ int main(int argc, char *argv[]) {
         return 0;
     }
     
+    int status = 0;
     for (int i = 1; i < argc; i++) {
         FILE *fp = fopen(argv[i], "r");
         if (!fp) {
             fprintf(stderr, "sandbox_cat: %s: No such file or directory\n", argv[i]);
+            status = 1;
             continue;
         }
         
@@ -26,6 +28,6 @@ int main(int argc, char *argv[]) {
         fclose(fp);
     }
     
-    return 0;
+    return status;
 }
 
@@ -0,0 +1,637 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+// Custom cp implementation - Sandboxed Shell
+// Usage: cp [-r] [-p] [-n] source... dest
+//   -r  copy directories recursively; modes and times are kept
+//   -p  keep mode and times for plain file copies as well
+//   -n  never overwrite an existing file
+//
+// File data moves by the cheapest means the file system offers: a FICLONE
+// reflink shares the extents outright (btrfs, xfs), copy_file_range keeps
+// the copy inside the kernel, and only when both refuse does it go through
+// a 1 MB buffer. -r spreads the tree over a small thread pool: each worker
+// owns a deque of directories to copy, works depth first from its own end
+// and steals from the other end of a busy worker's deque when it runs dry.
+// Symlinks and FIFOs inside a tree are recreated, never followed or read;
+// device nodes and sockets are skipped.
+//
+// SANDBOX: every source and destination must resolve to a path under
+// $SANDBOX_ROOT (set by the shell; the current directory when run by hand).
+// Directories below a copied tree are opened relative to its top with
+// openat2(RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS), and files with O_NOFOLLOW,
+// so nothing swapped in mid-copy can lead outside.
+
+#define MAX_WORKERS 8
+#define WORKER_STACK (256 << 10)
+#define COPY_BUF (1 << 20)
+#define DENTS_BUF (32 << 10)
+
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
+int recursive = 0;
+int preserve = 0;
+int no_clobber = 0;
+volatile int exit_status = 0;
+char sandbox_root[PATH_MAX];
+
+void warn_path(const char *path, const char *rel, int err) {
+    fprintf(stderr, "sandbox_cp: '%s%s%s': %s\n", path, rel && *rel ? "/" : "", rel ? rel : "",
+            strerror(err));
+    exit_status = 1;
+}
+
+void stat_times(const struct stat *st, struct timespec times[2]) {
+#ifdef __APPLE__
+    times[0] = st->st_atimespec;
+    times[1] = st->st_mtimespec;
+#else
+    times[0] = st->st_atim;
+    times[1] = st->st_mtim;
+#endif
+}
+
+// Move everything from in to out: reflink, in-kernel copy, then a buffer
+int copy_data(int in, int out, off_t size, char *buf) {
+#ifdef __linux__
+    if (ioctl(out, FICLONE, in) == 0) return 0;
+    off_t done = 0;
+    while (done < size) {
+        size_t want = size - done > (1 << 30) ? (1 << 30) : (size_t)(size - done);
+        ssize_t n = copy_file_range(in, NULL, out, NULL, want, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (done == 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+                              errno == EOPNOTSUPP || errno == EBADF)) break;
+            return -1;
+        }
+        if (n == 0) break;         // the file shrank; the loop below finds EOF
+        done += n;
+    }
+    if (done == size && size > 0) return 0;
+#else
+    (void)size;
+#endif
+    for (;;) {
+        ssize_t n = read(in, buf, COPY_BUF);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) return 0;
+        for (ssize_t off = 0; off < n; ) {
+            ssize_t k = write(out, buf + off, n - off);
+            if (k < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            off += k;
+        }
+    }
+}
+
+// Copy one regular file; follow says whether symlinks at either end count
+int copy_file(int sfd, const char *sname, int dfd, const char *dname, const struct stat *st,
+              int keep, int follow, char *buf, const char *where, const char *rel) {
+    int nofollow = follow ? 0 : O_NOFOLLOW;
+    int in = openat(sfd, sname, O_RDONLY | O_CLOEXEC | nofollow);
+    if (in < 0) {
+        warn_path(where, rel, errno);
+        return -1;
+    }
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | nofollow | (no_clobber ? O_EXCL : 0);
+    int out = openat(dfd, dname, flags, st->st_mode & 0777);
+    if (out < 0) {
+        int err = errno;
+        close(in);
+        if (no_clobber && err == EEXIST) return 0;
+        warn_path(where, rel, err);
+        return -1;
+    }
+    int rc = copy_data(in, out, st->st_size, buf);
+    if (rc < 0) warn_path(where, rel, errno);
+    if (rc == 0 && keep) {
+        struct timespec times[2];
+        stat_times(st, times);
+        fchmod(out, st->st_mode & 07777);
+        futimens(out, times);
+    }
+    close(in);
+    if (close(out) < 0 && rc == 0) {
+        warn_path(where, rel, errno);
+        rc = -1;
+    }
+    return rc;
+}
+
+int copy_link(int sfd, const char *name, int dfd, const struct stat *st,
+              const char *where, const char *rel) {
+    char target[PATH_MAX];
+    ssize_t n = readlinkat(sfd, name, target, sizeof(target) - 1);
+    if (n < 0) {
+        warn_path(where, rel, errno);
+        return -1;
+    }
+    target[n] = '\0';
+    if (symlinkat(target, dfd, name) < 0) {
+        if (errno == EEXIST && no_clobber) return 0;
+        warn_path(where, rel, errno);
+        return -1;
+    }
+    struct timespec times[2];
+    stat_times(st, times);
+    utimensat(dfd, name, times, AT_SYMLINK_NOFOLLOW);
+    return 0;
+}
+
+// ---- recursive copy on a work-stealing pool ----
+
+typedef struct {
+    size_t len;
+    char rel[];                    // path below the tree's top ("" for the top)
+} Dir;
+
+// Directories get their real mode and times once everything inside is written
+typedef struct DirAttr {
+    struct DirAttr *next;
+    mode_t mode;
+    struct timespec times[2];
+    char rel[];
+} DirAttr;
+
+typedef struct {
+    pthread_mutex_t lock;
+    Dir **items;                   // items[head..tail) waiting to be copied
+    size_t head, tail, cap;
+    char rel[PATH_MAX];
+    char dents[DENTS_BUF];
+    char *buf;                     // COPY_BUF bytes for the fallback copy
+} Worker;
+
+Worker *workers;
+int nworkers;
+
+const char *src_top;               // tree being copied, as given
+int src_fd, dst_fd;                // its top and the destination's top
+
+long queued;                       // directories sitting in some deque
+long outstanding;                  // directories queued or being copied
+int sleepers;
+pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+
+DirAttr *dir_attrs;
+pthread_mutex_t attr_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void record_dir(const char *rel, size_t len, const struct stat *st) {
+    DirAttr *a = malloc(sizeof(DirAttr) + len + 1);
+    if (!a) return;
+    a->mode = st->st_mode & 07777;
+    stat_times(st, a->times);
+    memcpy(a->rel, rel, len + 1);
+    pthread_mutex_lock(&attr_lock);
+    a->next = dir_attrs;
+    dir_attrs = a;
+    pthread_mutex_unlock(&attr_lock);
+}
+
+void push_dir(Worker *w, const char *rel, size_t len) {
+    Dir *d = malloc(sizeof(Dir) + len + 1);
+    if (!d) {
+        perror("sandbox_cp");
+        exit(1);
+    }
+    d->len = len;
+    memcpy(d->rel, rel, len + 1);
+
+    __atomic_add_fetch(&outstanding, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&w->lock);
+    if (w->tail == w->cap) {
+        if (w->head > 0) {
+            memmove(w->items, w->items + w->head, (w->tail - w->head) * sizeof(Dir *));
+            w->tail -= w->head;
+            w->head = 0;
+        }
+        if (w->tail == w->cap) {
+            w->cap = w->cap ? w->cap * 2 : 64;
+            w->items = realloc(w->items, w->cap * sizeof(Dir *));
+        }
+    }
+    w->items[w->tail++] = d;
+    pthread_mutex_unlock(&w->lock);
+    __atomic_add_fetch(&queued, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&sleepers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&idle_lock);
+        pthread_cond_signal(&idle_cond);
+        pthread_mutex_unlock(&idle_lock);
+    }
+}
+
+// Pop from our own back, else steal from the front of another deque
+Dir *take_dir(int self) {
+    for (int k = 0; k < nworkers; k++) {
+        Worker *v = &workers[(self + k) % nworkers];
+        Dir *d = NULL;
+        pthread_mutex_lock(&v->lock);
+        if (v->head < v->tail) {
+            d = k == 0 ? v->items[--v->tail] : v->items[v->head++];
+            if (v->head == v->tail) v->head = v->tail = 0;
+        }
+        pthread_mutex_unlock(&v->lock);
+        if (d) {
+            __atomic_sub_fetch(&queued, 1, __ATOMIC_SEQ_CST);
+            return d;
+        }
+    }
+    return NULL;
+}
+
+#if defined(__linux__) && defined(SYS_openat2)
+struct cp_open_how {
+    uint64_t flags;
+    uint64_t mode;
+    uint64_t resolve;
+};
+#define CP_RESOLVE_NO_MAGICLINKS 0x02
+#define CP_RESOLVE_NO_SYMLINKS 0x04
+#define CP_RESOLVE_BENEATH 0x08
+int have_openat2 = 1;
+#endif
+
+// Open a directory below base without following any symlink
+int open_beneath(int base, const char *rel) {
+    int flags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+    if (*rel == '\0') rel = ".";
+#if defined(__linux__) && defined(SYS_openat2)
+    if (have_openat2) {
+        struct cp_open_how how = {
+            flags, 0, CP_RESOLVE_BENEATH | CP_RESOLVE_NO_SYMLINKS | CP_RESOLVE_NO_MAGICLINKS
+        };
+        int fd = syscall(SYS_openat2, base, rel, &how, sizeof(how));
+        if (fd >= 0 || (errno != ENOSYS && errno != EPERM)) return fd;
+        have_openat2 = 0;
+    }
+#endif
+    // One component at a time, each with O_NOFOLLOW
+    char buf[PATH_MAX];
+    snprintf(buf, sizeof(buf), "%s", rel);
+    int fd = dup(base);
+    char *saveptr;
+    for (char *part = strtok_r(buf, "/", &saveptr); part && fd >= 0;
+         part = strtok_r(NULL, "/", &saveptr)) {
+        int next = openat(fd, part, flags);
+        int err = errno;
+        close(fd);
+        errno = err;
+        fd = next;
+    }
+    return fd;
+}
+
+void copy_entry(Worker *w, const Dir *d, int sfd, int dfd, const char *name) {
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) return;
+    size_t nlen = strlen(name);
+    size_t len = d->len + (d->len > 0) + nlen;
+    if (len >= PATH_MAX) {
+        warn_path(src_top, name, ENAMETOOLONG);
+        return;
+    }
+    memcpy(w->rel, d->rel, d->len);
+    if (d->len > 0) w->rel[d->len] = '/';
+    memcpy(w->rel + len - nlen, name, nlen + 1);
+
+    struct stat st;
+    if (fstatat(sfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        warn_path(src_top, w->rel, errno);
+        return;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        struct stat existing;
+        if (mkdirat(dfd, name, 0700) != 0 &&
+            (errno != EEXIST || fstatat(dfd, name, &existing, AT_SYMLINK_NOFOLLOW) != 0 ||
+             !S_ISDIR(existing.st_mode))) {
+            warn_path(src_top, w->rel, errno == EEXIST ? ENOTDIR : errno);
+            return;
+        }
+        record_dir(w->rel, len, &st);
+        push_dir(w, w->rel, len);
+    } else if (S_ISREG(st.st_mode)) {
+        copy_file(sfd, name, dfd, name, &st, 1, 0, w->buf, src_top, w->rel);
+    } else if (S_ISLNK(st.st_mode)) {
+        copy_link(sfd, name, dfd, &st, src_top, w->rel);
+    } else if (S_ISFIFO(st.st_mode)) {
+        struct timespec times[2];
+        stat_times(&st, times);
+        if (mkfifoat(dfd, name, st.st_mode & 07777) != 0 && !(errno == EEXIST && no_clobber)) {
+            warn_path(src_top, w->rel, errno);
+        } else {
+            utimensat(dfd, name, times, AT_SYMLINK_NOFOLLOW);
+        }
+    } else {
+        fprintf(stderr, "sandbox_cp: '%s/%s': not copying special file\n", src_top, w->rel);
+        exit_status = 1;
+    }
+}
+
+void copy_dir(Worker *w, const Dir *d) {
+    int sfd = open_beneath(src_fd, d->rel);
+    if (sfd < 0) {
+        warn_path(src_top, d->rel, errno);
+        return;
+    }
+    int dfd = open_beneath(dst_fd, d->rel);
+    if (dfd < 0) {
+        warn_path(src_top, d->rel, errno);
+        close(sfd);
+        return;
+    }
+#ifdef __linux__
+    // struct linux_dirent64 as the kernel lays it out
+    for (;;) {
+        long n = syscall(SYS_getdents64, sfd, w->dents, sizeof(w->dents));
+        if (n < 0) {
+            warn_path(src_top, d->rel, errno);
+            break;
+        }
+        if (n == 0) break;
+        for (long off = 0; off < n; ) {
+            unsigned short reclen;
+            memcpy(&reclen, w->dents + off + 16, sizeof(reclen));
+            copy_entry(w, d, sfd, dfd, w->dents + off + 19);
+            off += reclen;
+        }
+    }
+    close(sfd);
+#else
+    DIR *dir = fdopendir(sfd);
+    if (!dir) {
+        warn_path(src_top, d->rel, errno);
+        close(sfd);
+        close(dfd);
+        return;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        copy_entry(w, d, sfd, dfd, ent->d_name);
+    }
+    closedir(dir);
+#endif
+    close(dfd);
+}
+
+void *worker_loop(void *arg) {
+    int self = (int)(intptr_t)arg;
+    Worker *w = &workers[self];
+    for (;;) {
+        Dir *d = take_dir(self);
+        if (d) {
+            copy_dir(w, d);
+            free(d);
+            if (__atomic_sub_fetch(&outstanding, 1, __ATOMIC_SEQ_CST) == 0) {
+                pthread_mutex_lock(&idle_lock);
+                pthread_cond_broadcast(&idle_cond);
+                pthread_mutex_unlock(&idle_lock);
+            }
+            continue;
+        }
+        pthread_mutex_lock(&idle_lock);
+        __atomic_add_fetch(&sleepers, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&queued, __ATOMIC_SEQ_CST) == 0 &&
+               __atomic_load_n(&outstanding, __ATOMIC_SEQ_CST) > 0) {
+            pthread_cond_wait(&idle_cond, &idle_lock);
+        }
+        __atomic_sub_fetch(&sleepers, 1, __ATOMIC_SEQ_CST);
+        int done = __atomic_load_n(&outstanding, __ATOMIC_SEQ_CST) == 0;
+        pthread_mutex_unlock(&idle_lock);
+        if (done) break;
+    }
+    return NULL;
+}
+
+void copy_tree(const char *src, const char *dst, const struct stat *st) {
+    if (mkdir(dst, 0700) != 0 && errno != EEXIST) {
+        warn_path(dst, NULL, errno);
+        return;
+    }
+    src_fd = open(src, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (src_fd < 0) {
+        warn_path(src, NULL, errno);
+        return;
+    }
+    dst_fd = open(dst, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (dst_fd < 0) {
+        warn_path(dst, NULL, errno);
+        close(src_fd);
+        return;
+    }
+    src_top = src;
+    record_dir("", 0, st);
+    push_dir(&workers[0], "", 0);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, WORKER_STACK);
+    pthread_t threads[MAX_WORKERS];
+    int started = 1;
+    for (; started < nworkers; started++) {
+        // Running short of threads (RLIMIT_NPROC) just means fewer workers
+        if (pthread_create(&threads[started], &attr, worker_loop, (void *)(intptr_t)started) != 0) break;
+    }
+    pthread_attr_destroy(&attr);
+    worker_loop((void *)0);
+    for (int i = 1; i < started; i++) pthread_join(threads[i], NULL);
+
+    while (dir_attrs) {
+        DirAttr *a = dir_attrs;
+        dir_attrs = a->next;
+        int fd = open_beneath(dst_fd, a->rel);
+        if (fd >= 0) {
+            fchmod(fd, a->mode);
+            futimens(fd, a->times);
+            close(fd);
+        }
+        free(a);
+    }
+    close(src_fd);
+    close(dst_fd);
+}
+
+// ---- operands ----
+
+// SANDBOX: path (or, if it does not exist yet, its parent) must be inside
+int inside_sandbox(const char *path) {
+    char resolved[PATH_MAX], parent[PATH_MAX];
+    if (realpath(path, resolved) == NULL) {
+        if (errno != ENOENT) return 0;
+        snprintf(parent, sizeof(parent), "%s", path);
+        char *slash = strrchr(parent, '/');
+        if (slash == parent) slash[1] = '\0';
+        else if (slash) *slash = '\0';
+        else strcpy(parent, ".");
+        if (realpath(parent, resolved) == NULL) return 0;
+    }
+    size_t n = strlen(sandbox_root);
+    if (n == 1) return 1;          // root is "/"
+    return strncmp(resolved, sandbox_root, n) == 0 && (resolved[n] == '\0' || resolved[n] == '/');
+}
+
+// Refuse cp -r dir dir/sub, which would copy forever
+int copies_into_itself(const char *src, const char *dst) {
+    char s[PATH_MAX], d[PATH_MAX];
+    if (!realpath(src, s)) return 0;
+    if (!realpath(dst, d)) {
+        char parent[PATH_MAX];
+        snprintf(parent, sizeof(parent), "%s", dst);
+        char *slash = strrchr(parent, '/');
+        if (!slash) return 0;
+        *slash = '\0';
+        if (!realpath(*parent ? parent : "/", d)) return 0;
+    }
+    size_t n = strlen(s);
+    return strncmp(d, s, n) == 0 && (d[n] == '\0' || d[n] == '/');
+}
+
+void copy_operand(const char *src, const char *dst, char *buf) {
+    if (!inside_sandbox(src) || !inside_sandbox(dst)) {
+        fprintf(stderr, "sandbox_cp: '%s' -> '%s': outside the sandbox\n", src, dst);
+        exit_status = 1;
+        return;
+    }
+    struct stat st, dst_st;
+    if ((recursive ? lstat(src, &st) : stat(src, &st)) != 0) {
+        warn_path(src, NULL, errno);
+        return;
+    }
+    int dst_exists = stat(dst, &dst_st) == 0;
+    if (dst_exists && st.st_dev == dst_st.st_dev && st.st_ino == dst_st.st_ino) {
+        fprintf(stderr, "sandbox_cp: '%s' and '%s' are the same file\n", src, dst);
+        exit_status = 1;
+        return;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        if (!recursive) {
+            fprintf(stderr, "sandbox_cp: -r not specified; omitting directory '%s'\n", src);
+            exit_status = 1;
+        } else if (copies_into_itself(src, dst)) {
+            fprintf(stderr, "sandbox_cp: cannot copy a directory, '%s', into itself, '%s'\n", src, dst);
+            exit_status = 1;
+        } else if (dst_exists && !S_ISDIR(dst_st.st_mode)) {
+            fprintf(stderr, "sandbox_cp: cannot overwrite non-directory '%s' with directory '%s'\n",
+                    dst, src);
+            exit_status = 1;
+        } else {
+            copy_tree(src, dst, &st);
+        }
+    } else if (S_ISREG(st.st_mode)) {
+        copy_file(AT_FDCWD, src, AT_FDCWD, dst, &st, preserve || recursive, 1, buf, src, NULL);
+    } else if (S_ISLNK(st.st_mode)) {
+        char target[PATH_MAX];
+        ssize_t n = readlink(src, target, sizeof(target) - 1);
+        if (n >= 0) {
+            target[n] = '\0';
+            if (!dst_exists || !no_clobber) {
+                if (dst_exists && lstat(dst, &dst_st) == 0 && !S_ISDIR(dst_st.st_mode)) unlink(dst);
+                if (symlink(target, dst) != 0) warn_path(dst, NULL, errno);
+            }
+        } else {
+            warn_path(src, NULL, errno);
+        }
+    } else {
+        fprintf(stderr, "sandbox_cp: '%s': not copying special file\n", src);
+        exit_status = 1;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        for (const char *p = argv[i] + 1; *p; p++) {
+            if (*p == 'r' || *p == 'R') recursive = 1;
+            else if (*p == 'p') preserve = 1;
+            else if (*p == 'n') no_clobber = 1;
+            else {
+                fprintf(stderr, "sandbox_cp: unknown option -%c\n", *p);
+                return 1;
+            }
+        }
+    }
+    if (argc - i < 2) {
+        fprintf(stderr, "sandbox_cp: usage: cp [-r] [-p] [-n] source... dest\n");
+        return 1;
+    }
+    if (!realpath(getenv("SANDBOX_ROOT") ? getenv("SANDBOX_ROOT") : ".", sandbox_root)) {
+        perror("sandbox_cp: sandbox root");
+        return 1;
+    }
+
+#ifdef M_ARENA_MAX
+    // Extra malloc arenas each reserve 64 MB of address space, which the
+    // shell's RLIMIT_AS cannot afford; the workers allocate little anyway
+    mallopt(M_ARENA_MAX, 1);
+#endif
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nworkers = ncpu < 1 ? 1 : ncpu > MAX_WORKERS ? MAX_WORKERS : (int)ncpu;
+    if (!recursive) nworkers = 1;
+    workers = calloc(nworkers, sizeof(Worker));
+    for (int k = 0; k < nworkers; k++) {
+        pthread_mutex_init(&workers[k].lock, NULL);
+        if ((workers[k].buf = malloc(COPY_BUF)) == NULL) {
+            perror("sandbox_cp");
+            return 1;
+        }
+    }
+
+    const char *dest = argv[argc - 1];
+    struct stat st;
+    int dest_is_dir = stat(dest, &st) == 0 && S_ISDIR(st.st_mode);
+    if (argc - i > 2 && !dest_is_dir) {
+        fprintf(stderr, "sandbox_cp: target '%s' is not a directory\n", dest);
+        return 1;
+    }
+    for (; i < argc - 1; i++) {
+        const char *src = argv[i];
+        if (!dest_is_dir) {
+            copy_operand(src, dest, workers[0].buf);
+            continue;
+        }
+        // cp file dir/ lands at dir/<basename of file>
+        char target[PATH_MAX];
+        size_t end = strlen(src);
+        while (end > 1 && src[end - 1] == '/') end--;
+        size_t base = end;
+        while (base > 0 && src[base - 1] != '/') base--;
+        if (snprintf(target, sizeof(target), "%s%s%.*s", dest,
+                     dest[strlen(dest) - 1] == '/' ? "" : "/", (int)(end - base), src + base)
+            >= (int)sizeof(target)) {
+            warn_path(src, NULL, ENAMETOOLONG);
+            continue;
+        }
+        copy_operand(src, target, workers[0].buf);
+    }
+    return exit_status;
+}
@@ -0,0 +1,852 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+// Custom find implementation - Sandboxed Shell
+// Usage: find [path...] [-maxdepth N] [-mindepth N] [tests...] [actions...]
+//   tests:   -name glob  -iname glob  -type [fdlpsbc]  -size [+-]N[bckwMG]
+//            -mtime [+-]N   ! or -not before a test negates it
+//   actions: -print  -exec cmd args... {} ;  -exec cmd args... {} +
+// Tests are and-ed left to right; without an action every match is printed.
+//
+// The walk runs on a small thread pool. Each worker owns a deque of
+// directories still to be read: it pushes and pops subdirectories at the
+// back (depth first, so its path lookups stay warm) and idle workers steal
+// from the front of someone else's deque, which hands them the biggest
+// untouched subtrees. Directories are read with getdents64 in large batches
+// and d_type decides most -type tests and where to descend, so an entry is
+// only stat()ed when a test needs its size or mtime (or the file system
+// does not fill in d_type).
+//
+// SANDBOX: find never leaves the sandbox. Starting points must resolve to a
+// path under $SANDBOX_ROOT (set by the shell; the current directory when
+// run by hand), symlinks are never followed, and every directory is opened
+// relative to its starting point with openat2(RESOLVE_BENEATH |
+// RESOLVE_NO_SYMLINKS), so a directory swapped for a symlink mid-walk
+// cannot take the walk outside. -exec only runs commands from the sandbox
+// bin dir ($SANDBOX_BIN).
+
+#define MAX_WORKERS 8
+#define WORKER_STACK (256 << 10)
+#define DENTS_BUF (32 << 10)
+#define OUT_BUF (64 << 10)
+#define EXEC_MAX_ARGS 1024
+#define EXEC_MAX_BYTES (128 << 10)
+
+// ---- glob patterns for -name / -iname ----
+
+enum { G_CHAR, G_ANY, G_STAR, G_CLASS };
+
+typedef struct {
+    int kind;
+    unsigned char c;               // G_CHAR
+    unsigned char set[32];         // G_CLASS, one bit per byte value
+} GlobOp;
+
+typedef struct {
+    GlobOp *ops;
+    int count;
+    int fold;                      // -iname: compare lowercased
+} Glob;
+
+void set_bit(unsigned char *set, int c) {
+    set[c >> 3] |= 1 << (c & 7);
+}
+
+// Parse a [...] class starting just past the '['; returns the index past the
+// closing ']' or -1 if there is none (the '[' is then an ordinary char)
+int compile_class(const char *p, int i, GlobOp *op, int fold) {
+    int negate = 0;
+    memset(op->set, 0, sizeof(op->set));
+    if (p[i] == '!' || p[i] == '^') {
+        negate = 1;
+        i++;
+    }
+    int first = 1;
+    while (p[i] && (p[i] != ']' || first)) {
+        first = 0;
+        unsigned char lo = p[i] == '\\' && p[i + 1] ? p[++i] : p[i];
+        unsigned char hi = lo;
+        i++;
+        if (p[i] == '-' && p[i + 1] && p[i + 1] != ']') {
+            hi = p[i + 1] == '\\' && p[i + 2] ? p[i + 2] : p[i + 1];
+            i += p[i + 1] == '\\' ? 3 : 2;
+        }
+        for (int c = lo; c <= hi; c++) {
+            set_bit(op->set, fold ? tolower(c) : c);
+            if (fold) set_bit(op->set, toupper(c));
+        }
+    }
+    if (p[i] != ']') return -1;
+    if (negate) {
+        for (int k = 0; k < 32; k++) op->set[k] = ~op->set[k];
+    }
+    op->kind = G_CLASS;
+    return i + 1;
+}
+
+Glob *compile_glob(const char *pattern, int fold) {
+    Glob *g = calloc(1, sizeof(Glob));
+    g->ops = calloc(strlen(pattern) + 1, sizeof(GlobOp));
+    g->fold = fold;
+    for (int i = 0; pattern[i]; ) {
+        GlobOp *op = &g->ops[g->count++];
+        char c = pattern[i];
+        if (c == '*') {
+            op->kind = G_STAR;
+            while (pattern[i] == '*') i++;   // ** is the same as *
+            continue;
+        }
+        if (c == '?') {
+            op->kind = G_ANY;
+        } else if (c == '[') {
+            int next = compile_class(pattern, i + 1, op, fold);
+            if (next > 0) {
+                i = next;
+                continue;
+            }
+            op->kind = G_CHAR;
+            op->c = '[';
+        } else {
+            if (c == '\\' && pattern[i + 1]) c = pattern[++i];
+            op->kind = G_CHAR;
+            op->c = fold ? tolower((unsigned char)c) : (unsigned char)c;
+        }
+        i++;
+    }
+    return g;
+}
+
+// Iterative wildcard match: on a mismatch only the most recent * takes one
+// more character, which is enough because an earlier * can never do better
+int glob_match(const Glob *g, const char *name) {
+    const unsigned char *s = (const unsigned char *)name;
+    const unsigned char *star_s = NULL;
+    int t = 0, star_t = -1;
+    while (*s) {
+        if (t < g->count) {
+            const GlobOp *op = &g->ops[t];
+            int c = g->fold ? tolower(*s) : *s;
+            if (op->kind == G_STAR) {
+                star_t = ++t;
+                star_s = s;
+                continue;
+            }
+            if (op->kind == G_ANY || (op->kind == G_CHAR && op->c == c) ||
+                (op->kind == G_CLASS && (op->set[*s >> 3] & (1 << (*s & 7))))) {
+                t++;
+                s++;
+                continue;
+            }
+        }
+        if (star_t < 0) return 0;
+        t = star_t;
+        s = ++star_s;
+    }
+    while (t < g->count && g->ops[t].kind == G_STAR) t++;
+    return t == g->count;
+}
+
+// ---- expression ----
+
+enum { T_NAME, T_TYPE, T_SIZE, T_MTIME, T_PRINT, T_EXEC };
+
+typedef struct {
+    char **argv;                   // command template; {} marks the file
+    int argc;
+    int batch;                     // -exec ... {} +
+    char path[PATH_MAX];           // command resolved in the sandbox bin dir
+    pthread_mutex_t lock;          // guards the pending batch
+    char **pending;
+    int npending;
+    size_t pending_bytes;
+} Exec;
+
+typedef struct {
+    int kind;
+    int negate;
+    int cmp;                       // -1 less than, 0 exactly, 1 more than
+    long long value;
+    long long unit;                // -size unit in bytes
+    unsigned types;                // -type, bitmask of TYPE_BIT()
+    Glob *glob;
+    Exec *exec;
+} Test;
+
+#define TYPE_BIT(mode) (1u << (((mode) & S_IFMT) >> 12))
+
+Test *tests;
+int test_count;
+int maxdepth = INT_MAX;
+int mindepth = 0;
+time_t start_time;
+volatile int exit_status = 0;
+
+// One directory entry on its way through the tests
+typedef struct {
+    int dirfd;                     // directory holding it (AT_FDCWD for starts)
+    const char *name;              // name relative to dirfd
+    const char *path;              // path as printed
+    mode_t type;                   // S_IFMT bits, 0 until known
+    int have_stat;
+    struct stat st;
+} Entry;
+
+void warn_path(const char *path, int err) {
+    fprintf(stderr, "sandbox_find: '%s': %s\n", path, strerror(err));
+    exit_status = 1;
+}
+
+int entry_stat(Entry *e) {
+    if (!e->have_stat) {
+        if (fstatat(e->dirfd, e->name, &e->st, AT_SYMLINK_NOFOLLOW) != 0) {
+            warn_path(e->path, errno);
+            return -1;
+        }
+        e->have_stat = 1;
+        e->type = e->st.st_mode & S_IFMT;
+    }
+    return 0;
+}
+
+mode_t entry_type(Entry *e) {
+    if (e->type == 0 && entry_stat(e) < 0) return 0;
+    return e->type;
+}
+
+mode_t dtype_to_mode(unsigned char d_type) {
+    switch (d_type) {
+    case DT_REG: return S_IFREG;
+    case DT_DIR: return S_IFDIR;
+    case DT_LNK: return S_IFLNK;
+    case DT_FIFO: return S_IFIFO;
+    case DT_SOCK: return S_IFSOCK;
+    case DT_CHR: return S_IFCHR;
+    case DT_BLK: return S_IFBLK;
+    default: return 0;             // DT_UNKNOWN: ask stat
+    }
+}
+
+int compare(long long have, const Test *t) {
+    return t->cmp < 0 ? have < t->value : t->cmp > 0 ? have > t->value : have == t->value;
+}
+
+// ---- output ----
+
+pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void write_all(const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t k = write(STDOUT_FILENO, p, n);
+        if (k < 0) {
+            if (errno == EINTR) continue;
+            perror("sandbox_find: write error");
+            exit(1);
+        }
+        p += k;
+        n -= k;
+    }
+}
+
+// ---- -exec ----
+
+int run_command(Exec *x, char **argv) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("sandbox_find: fork");
+        return 0;
+    }
+    if (pid == 0) {
+        execv(x->path, argv);
+        static const char msg[] = "sandbox_find: -exec: cannot run command\n";
+        if (write(STDERR_FILENO, msg, sizeof(msg) - 1) < 0) _exit(127);
+        _exit(127);
+    }
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Run the command once for this file, {} replaced by its path
+int exec_one(Exec *x, const char *path) {
+    char **argv = malloc((x->argc + 1) * sizeof(char *));
+    for (int i = 0; i < x->argc; i++) {
+        argv[i] = strcmp(x->argv[i], "{}") == 0 ? (char *)path : x->argv[i];
+    }
+    argv[x->argc] = NULL;
+    int ok = run_command(x, argv);
+    free(argv);
+    return ok;
+}
+
+// Run the command on a batch of paths appended after the template
+void exec_batch(Exec *x, char **paths, int n) {
+    if (n == 0) return;
+    char **argv = malloc((x->argc + n + 1) * sizeof(char *));
+    memcpy(argv, x->argv, x->argc * sizeof(char *));
+    memcpy(argv + x->argc, paths, n * sizeof(char *));
+    argv[x->argc + n] = NULL;
+    if (!run_command(x, argv)) exit_status = 1;
+    free(argv);
+    for (int i = 0; i < n; i++) free(paths[i]);
+    free(paths);
+}
+
+void exec_add(Exec *x, const char *path) {
+    char **full = NULL;
+    int n = 0;
+    pthread_mutex_lock(&x->lock);
+    if (!x->pending) x->pending = malloc(EXEC_MAX_ARGS * sizeof(char *));
+    x->pending[x->npending++] = strdup(path);
+    x->pending_bytes += strlen(path) + 1 + sizeof(char *);
+    if (x->npending == EXEC_MAX_ARGS || x->pending_bytes >= EXEC_MAX_BYTES) {
+        // Take the full batch and run it without holding up other matches
+        full = x->pending;
+        n = x->npending;
+        x->pending = NULL;
+        x->npending = 0;
+        x->pending_bytes = 0;
+    }
+    pthread_mutex_unlock(&x->lock);
+    exec_batch(x, full, n);
+}
+
+// Resolve the -exec command in the sandbox bin dir; nothing else may run
+int exec_resolve(Exec *x) {
+    const char *cmd = x->argv[0];
+    const char *bin = getenv("SANDBOX_BIN");
+    if (strchr(cmd, '/') != NULL || !bin) {
+        fprintf(stderr, "sandbox_find: -exec: '%s' is not a sandbox command\n", cmd);
+        return -1;
+    }
+    snprintf(x->path, sizeof(x->path), "%s/%s", bin, cmd);
+    if (access(x->path, X_OK) != 0) {
+        fprintf(stderr, "sandbox_find: -exec: '%s' is not a sandbox command\n", cmd);
+        return -1;
+    }
+    return 0;
+}
+
+// ---- work-stealing pool ----
+
+typedef struct {
+    int depth;
+    size_t len;
+    char path[];                   // printed path of the directory
+} Dir;
+
+typedef struct {
+    pthread_mutex_t lock;
+    Dir **items;                   // items[head..tail) waiting to be read
+    size_t head, tail, cap;
+    size_t out_len;
+    char out[OUT_BUF];
+    char path[PATH_MAX];
+    char dents[DENTS_BUF];
+} Worker;
+
+Worker *workers;
+int nworkers;
+
+int start_fd;                      // the starting point being walked
+char start_name[PATH_MAX];         // its last component, for -name
+size_t rel_off;                    // where paths below it become relative
+
+long queued;                       // directories sitting in some deque
+long outstanding;                  // directories queued or being read
+int sleepers;
+pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+
+void emit(Worker *w, const char *path) {
+    size_t n = strlen(path);
+    if (w->out_len + n + 1 > OUT_BUF) {
+        pthread_mutex_lock(&out_lock);
+        write_all(w->out, w->out_len);
+        pthread_mutex_unlock(&out_lock);
+        w->out_len = 0;
+    }
+    memcpy(w->out + w->out_len, path, n);
+    w->out[w->out_len + n] = '\n';
+    w->out_len += n + 1;
+}
+
+void flush_worker(Worker *w) {
+    pthread_mutex_lock(&out_lock);
+    write_all(w->out, w->out_len);
+    pthread_mutex_unlock(&out_lock);
+    w->out_len = 0;
+}
+
+void evaluate(Worker *w, Entry *e) {
+    for (int i = 0; i < test_count; i++) {
+        Test *t = &tests[i];
+        int r = 1;
+        switch (t->kind) {
+        case T_NAME:
+            r = glob_match(t->glob, e->dirfd == AT_FDCWD ? start_name : e->name);
+            break;
+        case T_TYPE: {
+            mode_t type = entry_type(e);
+            if (type == 0) return;
+            r = (t->types & TYPE_BIT(type)) != 0;
+            break;
+        }
+        case T_SIZE:
+            if (entry_stat(e) < 0) return;
+            r = compare((e->st.st_size + t->unit - 1) / t->unit, t);
+            break;
+        case T_MTIME: {
+            if (entry_stat(e) < 0) return;
+            double age = difftime(start_time, e->st.st_mtime);
+            long long days = (long long)(age / 86400);
+            if (age < 0 && days * 86400 != age) days--;
+            r = compare(days, t);
+            break;
+        }
+        case T_PRINT:
+            emit(w, e->path);
+            break;
+        case T_EXEC:
+            if (t->exec->batch) {
+                exec_add(t->exec, e->path);
+            } else {
+                flush_worker(w);
+                r = exec_one(t->exec, e->path);
+            }
+            break;
+        }
+        if (r == t->negate) return;
+    }
+}
+
+void push_dir(Worker *w, const char *path, size_t len, int depth) {
+    Dir *d = malloc(sizeof(Dir) + len + 1);
+    if (!d) {
+        perror("sandbox_find");
+        exit(1);
+    }
+    d->depth = depth;
+    d->len = len;
+    memcpy(d->path, path, len + 1);
+
+    __atomic_add_fetch(&outstanding, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&w->lock);
+    if (w->tail == w->cap) {
+        if (w->head > 0) {
+            memmove(w->items, w->items + w->head, (w->tail - w->head) * sizeof(Dir *));
+            w->tail -= w->head;
+            w->head = 0;
+        }
+        if (w->tail == w->cap) {
+            w->cap = w->cap ? w->cap * 2 : 64;
+            w->items = realloc(w->items, w->cap * sizeof(Dir *));
+        }
+    }
+    w->items[w->tail++] = d;
+    pthread_mutex_unlock(&w->lock);
+    __atomic_add_fetch(&queued, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&sleepers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&idle_lock);
+        pthread_cond_signal(&idle_cond);
+        pthread_mutex_unlock(&idle_lock);
+    }
+}
+
+// Pop from our own back, else steal from the front of another deque
+Dir *take_dir(int self) {
+    for (int k = 0; k < nworkers; k++) {
+        Worker *v = &workers[(self + k) % nworkers];
+        Dir *d = NULL;
+        pthread_mutex_lock(&v->lock);
+        if (v->head < v->tail) {
+            d = k == 0 ? v->items[--v->tail] : v->items[v->head++];
+            if (v->head == v->tail) v->head = v->tail = 0;
+        }
+        pthread_mutex_unlock(&v->lock);
+        if (d) {
+            __atomic_sub_fetch(&queued, 1, __ATOMIC_SEQ_CST);
+            return d;
+        }
+    }
+    return NULL;
+}
+
+#if defined(__linux__) && defined(SYS_openat2)
+struct find_open_how {
+    uint64_t flags;
+    uint64_t mode;
+    uint64_t resolve;
+};
+#define FIND_RESOLVE_NO_MAGICLINKS 0x02
+#define FIND_RESOLVE_NO_SYMLINKS 0x04
+#define FIND_RESOLVE_BENEATH 0x08
+int have_openat2 = 1;
+#endif
+
+// Open a directory below the starting point without following any symlink
+int open_beneath(const char *rel) {
+    int flags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+#if defined(__linux__) && defined(SYS_openat2)
+    if (have_openat2) {
+        struct find_open_how how = {
+            flags, 0, FIND_RESOLVE_BENEATH | FIND_RESOLVE_NO_SYMLINKS | FIND_RESOLVE_NO_MAGICLINKS
+        };
+        int fd = syscall(SYS_openat2, start_fd, rel, &how, sizeof(how));
+        if (fd >= 0 || (errno != ENOSYS && errno != EPERM)) return fd;
+        have_openat2 = 0;
+    }
+#endif
+    // One component at a time, each with O_NOFOLLOW
+    char buf[PATH_MAX];
+    snprintf(buf, sizeof(buf), "%s", rel);
+    int fd = dup(start_fd);
+    char *saveptr;
+    for (char *part = strtok_r(buf, "/", &saveptr); part && fd >= 0;
+         part = strtok_r(NULL, "/", &saveptr)) {
+        int next = openat(fd, part, flags);
+        int err = errno;
+        close(fd);
+        errno = err;
+        fd = next;
+    }
+    return fd;
+}
+
+void visit(Worker *w, const Dir *d, int fd, const char *name, unsigned char d_type) {
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) return;
+    size_t nlen = strlen(name);
+    int slash = d->len > 0 && d->path[d->len - 1] != '/';
+    size_t len = d->len + slash + nlen;
+    if (len >= PATH_MAX) {
+        warn_path(name, ENAMETOOLONG);
+        return;
+    }
+    memcpy(w->path, d->path, d->len);
+    if (slash) w->path[d->len] = '/';
+    memcpy(w->path + d->len + slash, name, nlen + 1);
+
+    Entry e = { .dirfd = fd, .name = name, .path = w->path, .type = dtype_to_mode(d_type) };
+    int depth = d->depth + 1;
+    if (depth >= mindepth) evaluate(w, &e);
+    if (depth < maxdepth && entry_type(&e) == S_IFDIR) push_dir(w, w->path, len, depth);
+}
+
+void read_dir(Worker *w, const Dir *d) {
+    int fd = open_beneath(d->len > rel_off ? d->path + rel_off : ".");
+    if (fd < 0) {
+        warn_path(d->path, errno);
+        return;
+    }
+#ifdef __linux__
+    // struct linux_dirent64 as the kernel lays it out
+    for (;;) {
+        long n = syscall(SYS_getdents64, fd, w->dents, sizeof(w->dents));
+        if (n < 0) {
+            warn_path(d->path, errno);
+            break;
+        }
+        if (n == 0) break;
+        for (long off = 0; off < n; ) {
+            char *rec = w->dents + off;
+            unsigned short reclen;
+            memcpy(&reclen, rec + 16, sizeof(reclen));
+            visit(w, d, fd, rec + 19, (unsigned char)rec[18]);
+            off += reclen;
+        }
+    }
+    close(fd);
+#else
+    DIR *dir = fdopendir(fd);
+    if (!dir) {
+        warn_path(d->path, errno);
+        close(fd);
+        return;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        visit(w, d, fd, ent->d_name, ent->d_type);
+    }
+    closedir(dir);
+#endif
+}
+
+void *worker_loop(void *arg) {
+    int self = (int)(intptr_t)arg;
+    Worker *w = &workers[self];
+    for (;;) {
+        Dir *d = take_dir(self);
+        if (d) {
+            read_dir(w, d);
+            free(d);
+            if (__atomic_sub_fetch(&outstanding, 1, __ATOMIC_SEQ_CST) == 0) {
+                pthread_mutex_lock(&idle_lock);
+                pthread_cond_broadcast(&idle_cond);
+                pthread_mutex_unlock(&idle_lock);
+            }
+            continue;
+        }
+        pthread_mutex_lock(&idle_lock);
+        __atomic_add_fetch(&sleepers, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&queued, __ATOMIC_SEQ_CST) == 0 &&
+               __atomic_load_n(&outstanding, __ATOMIC_SEQ_CST) > 0) {
+            pthread_cond_wait(&idle_cond, &idle_lock);
+        }
+        __atomic_sub_fetch(&sleepers, 1, __ATOMIC_SEQ_CST);
+        int done = __atomic_load_n(&outstanding, __ATOMIC_SEQ_CST) == 0;
+        pthread_mutex_unlock(&idle_lock);
+        if (done) break;
+    }
+    flush_worker(w);
+    return NULL;
+}
+
+// ---- starting points ----
+
+char sandbox_root[PATH_MAX];
+
+int inside_sandbox(const char *path) {
+    char resolved[PATH_MAX];
+    if (realpath(path, resolved) == NULL) return -1;
+    size_t n = strlen(sandbox_root);
+    if (n == 1) return 1;          // root is "/"
+    return strncmp(resolved, sandbox_root, n) == 0 && (resolved[n] == '\0' || resolved[n] == '/');
+}
+
+void walk(const char *start) {
+    int inside = inside_sandbox(start);
+    if (inside < 0) {
+        warn_path(start, errno);
+        return;
+    }
+    if (!inside) {
+        fprintf(stderr, "sandbox_find: '%s': outside the sandbox\n", start);
+        exit_status = 1;
+        return;
+    }
+
+    Worker *w = &workers[0];
+    size_t len = strlen(start);
+    if (len >= PATH_MAX) {
+        warn_path(start, ENAMETOOLONG);
+        return;
+    }
+    memcpy(w->path, start, len + 1);
+    size_t end = len;
+    while (end > 1 && start[end - 1] == '/') end--;
+    size_t base = end;
+    while (base > 0 && start[base - 1] != '/') base--;
+    if (end > base && start[base] == '/') base++;
+    snprintf(start_name, sizeof(start_name), "%.*s", (int)(end - base), start + base);
+    Entry e = { .dirfd = AT_FDCWD, .name = start, .path = w->path };
+    if (entry_stat(&e) < 0) return;
+    if (mindepth == 0) evaluate(w, &e);
+    if (maxdepth == 0 || e.type != S_IFDIR) {
+        flush_worker(w);
+        return;
+    }
+
+    start_fd = open(start, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (start_fd < 0) {
+        warn_path(start, errno);
+        return;
+    }
+    rel_off = len + (start[len - 1] != '/');
+    push_dir(w, start, len, 0);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, WORKER_STACK);
+    pthread_t threads[MAX_WORKERS];
+    int started = 1;
+    for (; started < nworkers; started++) {
+        // Running short of threads (RLIMIT_NPROC) just means fewer workers
+        if (pthread_create(&threads[started], &attr, worker_loop, (void *)(intptr_t)started) != 0) break;
+    }
+    pthread_attr_destroy(&attr);
+    worker_loop((void *)0);
+    for (int i = 1; i < started; i++) pthread_join(threads[i], NULL);
+    close(start_fd);
+}
+
+// ---- command line ----
+
+int parse_number(const char *text, Test *t, long long *unit) {
+    const char *p = text;
+    t->cmp = *p == '+' ? 1 : *p == '-' ? -1 : 0;
+    if (t->cmp) p++;
+    if (!isdigit((unsigned char)*p)) return -1;
+    char *end;
+    errno = 0;
+    t->value = strtoll(p, &end, 10);
+    if (errno) return -1;
+    if (unit) {
+        switch (*end) {
+        case '\0': *unit = 512; break;
+        case 'b': *unit = 512; end++; break;
+        case 'c': *unit = 1; end++; break;
+        case 'w': *unit = 2; end++; break;
+        case 'k': *unit = 1024; end++; break;
+        case 'M': *unit = 1024 * 1024; end++; break;
+        case 'G': *unit = 1024LL * 1024 * 1024; end++; break;
+        default: return -1;
+        }
+    }
+    return *end == '\0' ? 0 : -1;
+}
+
+int parse_types(const char *text, unsigned *types) {
+    *types = 0;
+    for (const char *p = text; *p; p++) {
+        switch (*p) {
+        case 'f': *types |= TYPE_BIT(S_IFREG); break;
+        case 'd': *types |= TYPE_BIT(S_IFDIR); break;
+        case 'l': *types |= TYPE_BIT(S_IFLNK); break;
+        case 'p': *types |= TYPE_BIT(S_IFIFO); break;
+        case 's': *types |= TYPE_BIT(S_IFSOCK); break;
+        case 'b': *types |= TYPE_BIT(S_IFBLK); break;
+        case 'c': *types |= TYPE_BIT(S_IFCHR); break;
+        default: return -1;
+        }
+        if (p[1] == ',') p++;
+    }
+    return *types ? 0 : -1;
+}
+
+int usage_error(const char *fmt, const char *arg) {
+    fprintf(stderr, "sandbox_find: ");
+    fprintf(stderr, fmt, arg);
+    fprintf(stderr, "\n");
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    int i = 1;
+    int first_start = i;
+    while (i < argc && argv[i][0] != '-' && strcmp(argv[i], "!") != 0) i++;
+    int nstarts = i - first_start;
+
+    tests = calloc(argc + 1, sizeof(Test));
+    int have_action = 0, negate = 0;
+    for (; i < argc; i++) {
+        const char *opt = argv[i];
+        const char *arg = i + 1 < argc ? argv[i + 1] : NULL;
+        Test *t = &tests[test_count];
+        memset(t, 0, sizeof(*t));
+        t->negate = negate;
+
+        if (strcmp(opt, "!") == 0 || strcmp(opt, "-not") == 0) {
+            negate = !negate;
+            continue;
+        }
+        if (strcmp(opt, "-a") == 0 || strcmp(opt, "-and") == 0) continue;
+        if (strcmp(opt, "-print") == 0) {
+            t->kind = T_PRINT;
+            have_action = 1;
+        } else if (strcmp(opt, "-exec") == 0) {
+            Exec *x = calloc(1, sizeof(Exec));
+            int j = i + 1;
+            while (j < argc && strcmp(argv[j], ";") != 0 &&
+                   !(strcmp(argv[j], "+") == 0 && strcmp(argv[j - 1], "{}") == 0)) j++;
+            if (j >= argc || j == i + 1) return usage_error("missing argument to %s", opt);
+            x->batch = argv[j][0] == '+';
+            x->argv = argv + i + 1;
+            x->argc = j - i - 1 - x->batch;   // for +, the trailing {} is where paths go
+            pthread_mutex_init(&x->lock, NULL);
+            if (exec_resolve(x) < 0) return 1;
+            t->kind = T_EXEC;
+            t->exec = x;
+            have_action = 1;
+            i = j;
+        } else if (strcmp(opt, "-o") == 0 || strcmp(opt, "-or") == 0 ||
+                   strcmp(opt, "(") == 0 || strcmp(opt, ")") == 0) {
+            return usage_error("'%s' is not supported; tests can only be and-ed", opt);
+        } else if (!arg && (strcmp(opt, "-name") == 0 || strcmp(opt, "-iname") == 0 ||
+                            strcmp(opt, "-type") == 0 || strcmp(opt, "-size") == 0 ||
+                            strcmp(opt, "-mtime") == 0 || strcmp(opt, "-maxdepth") == 0 ||
+                            strcmp(opt, "-mindepth") == 0)) {
+            return usage_error("missing argument to %s", opt);
+        } else if (strcmp(opt, "-name") == 0 || strcmp(opt, "-iname") == 0) {
+            t->kind = T_NAME;
+            t->glob = compile_glob(arg, opt[1] == 'i');
+            i++;
+        } else if (strcmp(opt, "-type") == 0) {
+            t->kind = T_TYPE;
+            if (parse_types(arg, &t->types) < 0) return usage_error("unknown argument to -type: %s", arg);
+            i++;
+        } else if (strcmp(opt, "-size") == 0) {
+            t->kind = T_SIZE;
+            if (parse_number(arg, t, &t->unit) < 0) return usage_error("invalid argument to -size: %s", arg);
+            i++;
+        } else if (strcmp(opt, "-mtime") == 0) {
+            t->kind = T_MTIME;
+            if (parse_number(arg, t, NULL) < 0) return usage_error("invalid argument to -mtime: %s", arg);
+            i++;
+        } else if (strcmp(opt, "-maxdepth") == 0 || strcmp(opt, "-mindepth") == 0) {
+            char *end;
+            long depth = strtol(arg, &end, 10);
+            if (!isdigit((unsigned char)*arg) || *end) return usage_error("invalid depth: %s", arg);
+            if (opt[2] == 'a') maxdepth = depth;
+            else mindepth = depth;
+            i++;
+            continue;
+        } else {
+            return usage_error("unknown predicate '%s'", opt);
+        }
+        negate = 0;
+        test_count++;
+    }
+    if (!have_action) tests[test_count++].kind = T_PRINT;
+
+    if (!realpath(getenv("SANDBOX_ROOT") ? getenv("SANDBOX_ROOT") : ".", sandbox_root)) {
+        perror("sandbox_find: sandbox root");
+        return 1;
+    }
+    start_time = time(NULL);
+
+#ifdef M_ARENA_MAX
+    // Extra malloc arenas each reserve 64 MB of address space, which the
+    // shell's RLIMIT_AS cannot afford; the workers allocate little anyway
+    mallopt(M_ARENA_MAX, 1);
+#endif
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nworkers = ncpu < 1 ? 1 : ncpu > MAX_WORKERS ? MAX_WORKERS : (int)ncpu;
+    workers = calloc(nworkers, sizeof(Worker));
+    for (int k = 0; k < nworkers; k++) pthread_mutex_init(&workers[k].lock, NULL);
+
+    if (nstarts == 0) {
+        walk(".");
+    }
+    for (int k = 0; k < nstarts; k++) {
+        walk(argv[first_start + k]);
+    }
+
+    for (int k = 0; k < test_count; k++) {
+        Exec *x = tests[k].exec;
+        if (x && x->batch) {
+            exec_batch(x, x->pending, x->npending);
+            x->pending = NULL;
+        }
+    }
+    return exit_status;
+}
@@ -1,47 +1,1197 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 
-void grep_file(FILE *fp, const char *pattern, const char *filename, int show_filename) {
-    char line[4096];
-    int line_num = 0;
-    
-    while (fgets(line, sizeof(line), fp)) {
-        line_num++;
-        if (strstr(line, pattern) != NULL) {
-            if (show_filename) {
-                printf("%s:", filename);
+// Custom grep implementation - Sandboxed Shell
+// Usage: grep [-E | -F] [-o] [-e pattern]... [-f file]... [pattern] [file...]
+//   -F  fixed string match (default)
+//   -E  extended regular expression
+//   -e  add a pattern (may be repeated)
+//   -f  add the patterns in file, one per line
+//   -o  print only the matched strings, one per line (-F only)
+// A line is selected if any pattern matches it.
+// Exit status: 0 if a line matched, 1 if none did, 2 on error.
+//
+// -E never backtracks, so matching is linear in the input for any pattern:
+// the pattern is parsed to a syntax tree, compiled to a Thompson NFA, and
+// run as a DFA that is built lazily, one state per distinct NFA state set
+// actually reached. DFA states live in a cache of DFA_CACHE_BYTES; when it
+// fills up it is flushed, and if it keeps thrashing the rest of the input is
+// matched by simulating the NFA directly. A literal that every match must
+// contain is pulled out of the pattern and used to skip non-candidate lines
+// with memmem()/memchr().
+//
+// Several -F patterns are searched together with an Aho-Corasick automaton,
+// so the input is read once however many keywords there are. The automaton
+// is flattened into a dense transition table over byte classes (bytes that
+// occur in no pattern share one class) whenever that fits in AC_TABLE_BYTES.
+
+#define READ_CHUNK (1 << 20)
+#define MAX_NFA_STATES 65536
+#define MAX_REPEAT 255
+#define DFA_CACHE_BYTES (16 << 20)
+#define MAX_LITERAL 256
+#define AC_TABLE_BYTES (32 << 20)
+
+// ---------------------------------------------------------------- charsets
+
+typedef struct {
+    unsigned char bits[32];
+} CharSet;
+
+CharSet *sets = NULL;
+int set_count = 0, set_cap = 0;
+
+int new_set() {
+    if (set_count == set_cap) {
+        set_cap = set_cap ? set_cap * 2 : 64;
+        sets = realloc(sets, set_cap * sizeof(CharSet));
+    }
+    memset(&sets[set_count], 0, sizeof(CharSet));
+    return set_count++;
+}
+
+void set_add(int s, int c) { sets[s].bits[c >> 3] |= 1 << (c & 7); }
+int set_has(int s, int c) { return (sets[s].bits[c >> 3] >> (c & 7)) & 1; }
+
+void set_negate(int s) {
+    for (int i = 0; i < 32; i++) sets[s].bits[i] = ~sets[s].bits[i];
+    sets[s].bits['\n' >> 3] &= ~(1 << ('\n' & 7));   // never match across lines
+}
+
+// ---------------------------------------------------------------- parser
+
+enum { N_SET, N_CAT, N_ALT, N_STAR, N_PLUS, N_QUEST, N_REPEAT, N_BOL, N_EOL, N_EMPTY };
+
+typedef struct {
+    int type;
+    int left, right;    // children (node indices)
+    int min, max;       // N_REPEAT bounds, max -1 = unbounded
+    int set;            // N_SET
+} Node;
+
+Node *nodes = NULL;
+int node_count = 0, node_cap = 0;
+
+const char *re_src;     // parse cursor
+const char *re_error;
+
+int new_node(int type, int left, int right) {
+    if (node_count == node_cap) {
+        node_cap = node_cap ? node_cap * 2 : 64;
+        nodes = realloc(nodes, node_cap * sizeof(Node));
+    }
+    Node *n = &nodes[node_count];
+    n->type = type;
+    n->left = left;
+    n->right = right;
+    n->min = n->max = 0;
+    n->set = -1;
+    return node_count++;
+}
+
+int char_node(int c) {
+    int n = new_node(N_SET, -1, -1);
+    nodes[n].set = new_set();
+    set_add(nodes[n].set, c);
+    return n;
+}
+
+int parse_alt();
+
+// Add a [:name:] class to set s; returns 0 for unknown names
+int add_named_class(int s, const char *name, size_t len) {
+    static const struct { const char *name; const char *test; } classes[] = {
+        { "alpha", "a" }, { "digit", "d" }, { "alnum", "ad" }, { "upper", "u" },
+        { "lower", "l" }, { "space", "s" }, { "blank", "b" }, { "punct", "p" },
+        { "xdigit", "x" }, { "print", "r" }, { "graph", "g" }, { "cntrl", "c" },
+    };
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        if (strlen(classes[i].name) != len || strncmp(classes[i].name, name, len) != 0) continue;
+        for (int c = 0; c < 128; c++) {
+            int in = 0;
+            for (const char *t = classes[i].test; *t; t++) {
+                switch (*t) {
+                    case 'a': in |= (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); break;
+                    case 'd': in |= (c >= '0' && c <= '9'); break;
+                    case 'u': in |= (c >= 'A' && c <= 'Z'); break;
+                    case 'l': in |= (c >= 'a' && c <= 'z'); break;
+                    case 's': in |= (c == ' ' || (c >= '\t' && c <= '\r')); break;
+                    case 'b': in |= (c == ' ' || c == '\t'); break;
+                    case 'p': in |= (c > ' ' && c < 127 && !((c >= 'a' && c <= 'z') ||
+                                     (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))); break;
+                    case 'x': in |= (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'); break;
+                    case 'r': in |= (c >= ' ' && c < 127); break;
+                    case 'g': in |= (c > ' ' && c < 127); break;
+                    case 'c': in |= (c < ' ' || c == 127); break;
+                }
+            }
+            if (in) set_add(s, c);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+int parse_bracket() {
+    int s = new_set();
+    int negate = 0;
+    if (*re_src == '^') {
+        negate = 1;
+        re_src++;
+    }
+    int first = 1;
+    while (*re_src && (*re_src != ']' || first)) {
+        first = 0;
+        if (re_src[0] == '[' && re_src[1] == ':') {
+            const char *end = strstr(re_src + 2, ":]");
+            if (!end || !add_named_class(s, re_src + 2, end - (re_src + 2))) {
+                re_error = "invalid character class";
+                return -1;
+            }
+            re_src = end + 2;
+            continue;
+        }
+        unsigned char lo = *re_src++;
+        if (re_src[0] == '-' && re_src[1] && re_src[1] != ']') {
+            unsigned char hi = re_src[1];
+            re_src += 2;
+            if (hi < lo) {
+                re_error = "invalid range end";
+                return -1;
+            }
+            for (int c = lo; c <= hi; c++) set_add(s, c);
+        } else {
+            set_add(s, lo);
+        }
+    }
+    if (*re_src != ']') {
+        re_error = "unmatched [";
+        return -1;
+    }
+    re_src++;
+    if (negate) set_negate(s);
+    int n = new_node(N_SET, -1, -1);
+    nodes[n].set = s;
+    return n;
+}
+
+int parse_atom() {
+    char c = *re_src++;
+    int n, s;
+    switch (c) {
+        case '(':
+            if (*re_src == ')') {
+                re_src++;
+                return new_node(N_EMPTY, -1, -1);
+            }
+            n = parse_alt();
+            if (n < 0) return -1;
+            if (*re_src != ')') {
+                re_error = "unmatched (";
+                return -1;
+            }
+            re_src++;
+            return n;
+        case '[':
+            return parse_bracket();
+        case '.':
+            n = new_node(N_SET, -1, -1);
+            nodes[n].set = s = new_set();
+            set_negate(s);
+            return n;
+        case '^':
+            return new_node(N_BOL, -1, -1);
+        case '$':
+            return new_node(N_EOL, -1, -1);
+        case '\\':
+            c = *re_src++;
+            if (c == '\0') {
+                re_error = "trailing backslash";
+                return -1;
+            }
+            if (strchr("wWsSdD", c)) {
+                n = new_node(N_SET, -1, -1);
+                nodes[n].set = s = new_set();
+                char lower = c | 0x20;
+                add_named_class(s, lower == 'w' ? "alnum" : lower == 's' ? "space" : "digit", 5);
+                if (lower == 'w') set_add(s, '_');
+                if (c != lower) set_negate(s);
+                return n;
+            }
+            return char_node((unsigned char)c);
+        default:
+            return char_node((unsigned char)c);
+    }
+}
+
+// Parse "{m}", "{m,}", "{m,n}"; returns 0 (cursor untouched) if not an interval
+int parse_interval(int *min, int *max) {
+    const char *p = re_src + 1;
+    if (*p < '0' || *p > '9') return 0;
+    *min = (int)strtol(p, (char **)&p, 10);
+    *max = *min;
+    if (*p == ',') {
+        p++;
+        *max = (*p >= '0' && *p <= '9') ? (int)strtol(p, (char **)&p, 10) : -1;
+    }
+    if (*p != '}') return 0;
+    re_src = p + 1;
+    return 1;
+}
+
+int parse_repeat() {
+    int n;
+    // A leading repetition operator is an ordinary character
+    if (*re_src == '*' || *re_src == '+' || *re_src == '?') {
+        n = char_node((unsigned char)*re_src++);
+    } else {
+        n = parse_atom();
+    }
+    while (n >= 0) {
+        int min, max;
+        if (*re_src == '*') {
+            n = new_node(N_STAR, n, -1);
+        } else if (*re_src == '+') {
+            n = new_node(N_PLUS, n, -1);
+        } else if (*re_src == '?') {
+            n = new_node(N_QUEST, n, -1);
+        } else if (*re_src == '{' && parse_interval(&min, &max)) {
+            if (min > MAX_REPEAT || max > MAX_REPEAT || (max >= 0 && max < min)) {
+                re_error = "invalid repetition count";
+                return -1;
+            }
+            n = new_node(N_REPEAT, n, -1);
+            nodes[n].min = min;
+            nodes[n].max = max;
+            continue;
+        } else {
+            break;
+        }
+        re_src++;
+    }
+    return n;
+}
+
+int parse_cat() {
+    int n = -1;
+    while (*re_src && *re_src != '|' && *re_src != ')') {
+        int r = parse_repeat();
+        if (r < 0) return -1;
+        n = (n < 0) ? r : new_node(N_CAT, n, r);
+    }
+    return n < 0 ? new_node(N_EMPTY, -1, -1) : n;
+}
+
+int parse_alt() {
+    int n = parse_cat();
+    while (n >= 0 && *re_src == '|') {
+        re_src++;
+        int r = parse_cat();
+        if (r < 0) return -1;
+        n = new_node(N_ALT, n, r);
+    }
+    return n;
+}
+
+// ---------------------------------------------------------------- NFA
+
+enum { S_SET, S_SPLIT, S_BOL, S_EOL, S_MATCH };
+
+typedef struct {
+    unsigned char op;
+    int set;
+    int out, out1;
+} NState;
+
+NState *nfa = NULL;
+int nfa_count = 0, nfa_cap = 0;
+int nfa_start;
+
+// Dangling exits are chained through the out fields they will fill in:
+// a hole is encoded as state * 2 + (0 for out, 1 for out1), -1 ends the list
+typedef struct {
+    int start;
+    int holes;
+} Frag;
+
+int new_state(int op, int set, int out, int out1) {
+    if (nfa_count >= MAX_NFA_STATES) {
+        re_error = "regular expression too big";
+        return -1;
+    }
+    if (nfa_count == nfa_cap) {
+        nfa_cap = nfa_cap ? nfa_cap * 2 : 256;
+        nfa = realloc(nfa, nfa_cap * sizeof(NState));
+    }
+    nfa[nfa_count] = (NState){ (unsigned char)op, set, out, out1 };
+    return nfa_count++;
+}
+
+int *hole_slot(int hole) {
+    return (hole & 1) ? &nfa[hole >> 1].out1 : &nfa[hole >> 1].out;
+}
+
+void patch(int holes, int target) {
+    while (holes >= 0) {
+        int *slot = hole_slot(holes);
+        holes = *slot;
+        *slot = target;
+    }
+}
+
+int append_holes(int a, int b) {
+    if (a < 0) return b;
+    int h = a;
+    while (*hole_slot(h) >= 0) h = *hole_slot(h);
+    *hole_slot(h) = b;
+    return a;
+}
+
+int compile(int n, Frag *f);
+
+// Empty fragment: a SPLIT with one dangling exit (out1 stays -1, unused)
+int compile_empty(Frag *f) {
+    int s = new_state(S_SPLIT, -1, -1, -1);
+    if (s < 0) return -1;
+    f->start = s;
+    f->holes = s * 2;
+    return 0;
+}
+
+int compile_star(int child, Frag *f) {
+    Frag e;
+    int s = new_state(S_SPLIT, -1, -1, -1);
+    if (s < 0 || compile(child, &e) < 0) return -1;
+    nfa[s].out = e.start;
+    patch(e.holes, s);
+    f->start = s;
+    f->holes = s * 2 + 1;
+    return 0;
+}
+
+int compile_quest(int child, Frag *f) {
+    Frag e;
+    int s = new_state(S_SPLIT, -1, -1, -1);
+    if (s < 0 || compile(child, &e) < 0) return -1;
+    nfa[s].out = e.start;
+    f->start = s;
+    f->holes = append_holes(e.holes, s * 2 + 1);
+    return 0;
+}
+
+int compile_cat(Frag *a, Frag *b, Frag *f) {
+    patch(a->holes, b->start);
+    f->start = a->start;
+    f->holes = b->holes;
+    return 0;
+}
+
+int compile(int n, Frag *f) {
+    Node *node = &nodes[n];
+    Frag a, b;
+    int s;
+    switch (node->type) {
+        case N_SET:
+        case N_BOL:
+        case N_EOL:
+            s = new_state(node->type == N_SET ? S_SET : node->type == N_BOL ? S_BOL : S_EOL,
+                          node->set, -1, -1);
+            if (s < 0) return -1;
+            f->start = s;
+            f->holes = s * 2;
+            return 0;
+        case N_EMPTY:
+            return compile_empty(f);
+        case N_CAT:
+            if (compile(node->left, &a) < 0 || compile(node->right, &b) < 0) return -1;
+            return compile_cat(&a, &b, f);
+        case N_ALT:
+            s = new_state(S_SPLIT, -1, -1, -1);
+            if (s < 0 || compile(node->left, &a) < 0 || compile(node->right, &b) < 0) return -1;
+            nfa[s].out = a.start;
+            nfa[s].out1 = b.start;
+            f->start = s;
+            f->holes = append_holes(a.holes, b.holes);
+            return 0;
+        case N_STAR:
+            return compile_star(node->left, f);
+        case N_QUEST:
+            return compile_quest(node->left, f);
+        case N_PLUS:
+            // x+ = x x*
+            if (compile(node->left, &a) < 0 || compile_star(node->left, &b) < 0) return -1;
+            return compile_cat(&a, &b, f);
+        case N_REPEAT: {
+            // x{m,n} = x repeated m times, then (n - m) optional copies (or x*)
+            int have = 0;
+            Frag acc, part;
+            for (int i = 0; i < node->min; i++) {
+                if (compile(node->left, &part) < 0) return -1;
+                if (have) compile_cat(&acc, &part, &acc); else acc = part;
+                have = 1;
+            }
+            if (node->max < 0) {
+                if (compile_star(node->left, &part) < 0) return -1;
+                if (have) compile_cat(&acc, &part, &acc); else acc = part;
+                have = 1;
+            } else {
+                for (int i = node->min; i < node->max; i++) {
+                    if (compile_quest(node->left, &part) < 0) return -1;
+                    if (have) compile_cat(&acc, &part, &acc); else acc = part;
+                    have = 1;
+                }
             }
-            printf("%s", line);
+            if (!have) return compile_empty(f);
+            *f = acc;
+            return 0;
         }
     }
+    return -1;
+}
+
+// ---------------------------------------------------------------- literal prefilter
+
+// Find the longest run of single-byte literals that every match contains.
+// Only descends through concatenation and mandatory repetition, which is
+// where required literals can be read off without any set algebra.
+void find_literal(int n, char *run, int *run_len, char *best, int *best_len) {
+    Node *node = &nodes[n];
+    if (node->type == N_CAT) {
+        find_literal(node->left, run, run_len, best, best_len);
+        find_literal(node->right, run, run_len, best, best_len);
+        return;
+    }
+    if (node->type == N_BOL || node->type == N_EOL) {
+        return;   // zero width, doesn't break a run
+    }
+    if (node->type == N_SET) {
+        int only = -1, count = 0;
+        for (int c = 0; c < 256 && count < 2; c++) {
+            if (set_has(node->set, c)) {
+                only = c;
+                count++;
+            }
+        }
+        if (count == 1 && only != '\n' && *run_len < MAX_LITERAL) {
+            run[(*run_len)++] = (char)only;
+            if (*run_len > *best_len) {
+                memcpy(best, run, *run_len);
+                *best_len = *run_len;
+            }
+            return;
+        }
+    }
+    *run_len = 0;
+    if (node->type == N_PLUS || (node->type == N_REPEAT && node->min > 0)) {
+        find_literal(node->left, run, run_len, best, best_len);
+        *run_len = 0;
+    }
+}
+
+// ---------------------------------------------------------------- NFA simulation
+
+// Symbols: byte classes 0..nclasses-1, then begin- and end-of-line markers
+int class_of[256];
+int class_rep[256];
+int nclasses;
+int sym_bol, sym_eol, nsyms;
+
+int *mark;          // mark[state] == generation when already in the list
+int generation = 0;
+int *stack;
+
+void compute_classes() {
+    unsigned char boundary[256] = {0};
+    for (int s = 0; s < set_count; s++) {
+        for (int c = 1; c < 256; c++) {
+            if (set_has(s, c) != set_has(s, c - 1)) boundary[c] = 1;
+        }
+    }
+    nclasses = 0;
+    for (int c = 0; c < 256; c++) {
+        if (c == 0 || boundary[c]) class_rep[nclasses++] = c;
+        class_of[c] = nclasses - 1;
+    }
+    sym_bol = nclasses;
+    sym_eol = nclasses + 1;
+    nsyms = nclasses + 2;
+}
+
+// Add the epsilon closure of state s to list (only non-SPLIT states are kept).
+// Anchors are zero-width: right after a begin/end-of-line marker, further
+// anchors of the same kind hold too (as in "^^a"), so the op bits in eps are
+// followed like SPLITs.
+void add_closure(int *list, int *count, int s, int eps) {
+    int sp = 0;
+    stack[sp++] = s;
+    while (sp > 0) {
+        s = stack[--sp];
+        if (s < 0 || mark[s] == generation) continue;
+        mark[s] = generation;
+        if (nfa[s].op == S_SPLIT) {
+            stack[sp++] = nfa[s].out1;
+            stack[sp++] = nfa[s].out;
+        } else if (eps & (1 << nfa[s].op)) {
+            stack[sp++] = nfa[s].out;
+        } else {
+            list[(*count)++] = s;
+        }
+    }
+}
+
+// One NFA step on symbol sym; unanchored search restarts at every position
+int nfa_step(const int *cur, int ncur, int sym, int *next) {
+    int n = 0;
+    generation++;
+    for (int i = 0; i < ncur; i++) {
+        NState *st = &nfa[cur[i]];
+        int ok = (st->op == S_SET && sym < nclasses && set_has(st->set, class_rep[sym])) ||
+                 (st->op == S_BOL && sym == sym_bol) ||
+                 (st->op == S_EOL && sym == sym_eol);
+        int eps = sym == sym_bol ? 1 << S_BOL : sym == sym_eol ? 1 << S_EOL : 0;
+        if (ok) add_closure(next, &n, st->out, eps);
+    }
+    if (sym != sym_eol) add_closure(next, &n, nfa_start, 0);
+    return n;
+}
+
+int list_has_match(const int *list, int n) {
+    for (int i = 0; i < n; i++) {
+        if (nfa[list[i]].op == S_MATCH) return 1;
+    }
+    return 0;
+}
+
+int *nfa_cur, *nfa_next;
+
+int nfa_match_line(const unsigned char *p, size_t len) {
+    int ncur = 0;
+    generation++;
+    add_closure(nfa_cur, &ncur, nfa_start, 0);
+    ncur = nfa_step(nfa_cur, ncur, sym_bol, nfa_next);
+    int *cur = nfa_next, *next = nfa_cur;
+    for (size_t i = 0; ; i++) {
+        if (list_has_match(cur, ncur)) return 1;
+        if (i > len) return 0;
+        int sym = (i == len) ? sym_eol : class_of[p[i]];
+        ncur = nfa_step(cur, ncur, sym, next);
+        int *tmp = cur; cur = next; next = tmp;
+    }
+}
+
+// ---------------------------------------------------------------- lazy DFA
+
+typedef struct {
+    int *states;        // sorted NFA states
+    int nstates;
+    int match;
+    int next[];         // per symbol, -1 = not computed yet
+} DState;
+
+DState **dstates = NULL;
+int dcount = 0, dcap = 0;
+int *dhash = NULL;      // open addressing, dstate index + 1, 0 = empty
+int dhash_size = 0;
+size_t dbytes = 0;
+int dfa_bol = -1;       // state after the begin-of-line marker
+int use_nfa = 0;        // cache thrashed; simulate the NFA instead
+size_t bytes_since_flush = 0;
+unsigned long flush_count = 0;
+
+unsigned hash_states(const int *s, int n) {
+    unsigned h = 2166136261u;
+    for (int i = 0; i < n; i++) h = (h ^ (unsigned)s[i]) * 16777619u;
+    return h;
+}
+
+int cmp_int(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+void dfa_flush() {
+    for (int i = 0; i < dcount; i++) {
+        free(dstates[i]->states);
+        free(dstates[i]);
+    }
+    dcount = 0;
+    dbytes = 0;
+    memset(dhash, 0, dhash_size * sizeof(int));
+    dfa_bol = -1;
+    flush_count++;
+}
+
+void dhash_grow() {
+    dhash_size = dhash_size ? dhash_size * 2 : 1024;
+    dhash = realloc(dhash, dhash_size * sizeof(int));
+    memset(dhash, 0, dhash_size * sizeof(int));
+    for (int i = 0; i < dcount; i++) {
+        unsigned j = hash_states(dstates[i]->states, dstates[i]->nstates) & (dhash_size - 1);
+        while (dhash[j]) j = (j + 1) & (dhash_size - 1);
+        dhash[j] = i + 1;
+    }
+}
+
+int dfa_lookup(int *list, int n) {
+    if (2 * (dcount + 1) > dhash_size) {
+        dhash_grow();
+    }
+    qsort(list, n, sizeof(int), cmp_int);
+    unsigned h = hash_states(list, n);
+    for (unsigned i = h & (dhash_size - 1); dhash[i]; i = (i + 1) & (dhash_size - 1)) {
+        DState *d = dstates[dhash[i] - 1];
+        if (d->nstates == n && memcmp(d->states, list, n * sizeof(int)) == 0) {
+            return dhash[i] - 1;
+        }
+    }
+
+    size_t size = sizeof(DState) + nsyms * sizeof(int) + n * sizeof(int);
+    if (dbytes + size > DFA_CACHE_BYTES) {
+        // Thrashing: the cache filled up again before it paid for itself
+        if (bytes_since_flush < 10 * (size_t)dcount) use_nfa = 1;
+        dfa_flush();
+        bytes_since_flush = 0;
+    }
+    if (dcount == dcap) {
+        dcap = dcap ? dcap * 2 : 256;
+        dstates = realloc(dstates, dcap * sizeof(DState *));
+    }
+
+    DState *d = malloc(sizeof(DState) + nsyms * sizeof(int));
+    d->states = malloc((n ? n : 1) * sizeof(int));
+    memcpy(d->states, list, n * sizeof(int));
+    d->nstates = n;
+    d->match = list_has_match(list, n);
+    for (int i = 0; i < nsyms; i++) d->next[i] = -1;
+    dbytes += size;
+    dstates[dcount] = d;
+
+    unsigned j = h & (dhash_size - 1);
+    while (dhash[j]) j = (j + 1) & (dhash_size - 1);
+    dhash[j] = dcount + 1;
+    return dcount++;
+}
+
+// Transition from DFA state d on sym, building the target state if needed.
+// May flush the cache, so callers must not hold other state indices.
+int dfa_next(int d, int sym) {
+    int t = dstates[d]->next[sym];
+    if (t >= 0) return t;
+    int n = nfa_step(dstates[d]->states, dstates[d]->nstates, sym, nfa_next);
+    unsigned long flushes = flush_count;
+    t = dfa_lookup(nfa_next, n);
+    if (flush_count == flushes) {
+        dstates[d]->next[sym] = t;   // otherwise d was freed by the flush
+    }
+    return t;
+}
+
+int dfa_match_line(const unsigned char *p, size_t len) {
+    if (dfa_bol < 0) {
+        int n = 0;
+        generation++;
+        add_closure(nfa_cur, &n, nfa_start, 0);
+        int init = dfa_lookup(nfa_cur, n);
+        dfa_bol = dfa_next(init, sym_bol);
+    }
+    int d = dfa_bol;
+    for (size_t i = 0; i < len; i++) {
+        if (dstates[d]->match) return 1;
+        d = dfa_next(d, class_of[p[i]]);
+        if (use_nfa) return nfa_match_line(p, len);
+    }
+    bytes_since_flush += len;
+    if (dstates[d]->match) return 1;
+    return dstates[dfa_next(d, sym_eol)]->match;
+}
+
+// ---------------------------------------------------------------- patterns
+
+char **patterns = NULL;
+size_t *pattern_lens = NULL;
+int pattern_count = 0, pattern_cap = 0;
+
+// Add each line of text as a pattern; text is split in place
+void add_patterns(char *text, size_t len) {
+    char *end = text + len;
+    while (1) {
+        char *nl = memchr(text, '\n', end - text);
+        if (pattern_count == pattern_cap) {
+            pattern_cap = pattern_cap ? pattern_cap * 2 : 16;
+            patterns = realloc(patterns, pattern_cap * sizeof(char *));
+            pattern_lens = realloc(pattern_lens, pattern_cap * sizeof(size_t));
+        }
+        if (nl) *nl = '\0';
+        patterns[pattern_count] = text;
+        pattern_lens[pattern_count++] = (nl ? nl : end) - text;
+        if (!nl) break;
+        text = nl + 1;
+    }
+}
+
+// Read a -f file; a final newline does not start another pattern
+int add_pattern_file(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    size_t cap = 4096, len = 0;
+    char *text = malloc(cap + 1);
+    ssize_t n;
+    while (text && (n = read(fd, text + len, cap - len)) > 0) {
+        len += n;
+        if (len == cap) {
+            cap *= 2;
+            text = realloc(text, cap + 1);
+        }
+    }
+    close(fd);
+    if (!text || n < 0) {
+        perror(path);
+        free(text);
+        return -1;
+    }
+    text[len] = '\0';
+    if (len == 0) {
+        free(text);   // no patterns at all
+        return 0;
+    }
+    if (text[len - 1] == '\n') len--;
+    add_patterns(text, len);
+    return 0;
+}
+
+// ---------------------------------------------------------------- Aho-Corasick
+
+typedef struct {
+    int fail;           // longest proper suffix that is also a trie node
+    int output;         // pattern ending here, -1 if none
+    int dict;           // nearest node on the fail chain with an output, -1 if none
+    int child;          // first child, -1 if none
+    int sibling;        // next child of the same parent
+    unsigned char byte;
+} ACNode;
+
+ACNode *ac = NULL;
+int ac_count = 0, ac_cap = 0;
+unsigned char *ac_hit = NULL;   // ac_hit[s]: some pattern ends in state s
+int *ac_delta = NULL;           // dense table [state * ac_nclasses + class], NULL if too big
+int ac_class[256];
+int ac_nclasses;
+
+int ac_new_node(unsigned char byte) {
+    if (ac_count == ac_cap) {
+        ac_cap = ac_cap ? ac_cap * 2 : 1024;
+        ac = realloc(ac, ac_cap * sizeof(ACNode));
+    }
+    ACNode *node = &ac[ac_count];
+    node->fail = 0;
+    node->output = node->dict = node->child = node->sibling = -1;
+    node->byte = byte;
+    return ac_count++;
+}
+
+int ac_child(int s, unsigned char c) {
+    for (int t = ac[s].child; t >= 0; t = ac[t].sibling) {
+        if (ac[t].byte == c) return t;
+    }
+    return -1;
+}
+
+// Sparse transition: follow fail links until some node has an edge on c
+int ac_goto(int s, unsigned char c) {
+    while (1) {
+        int t = ac_child(s, c);
+        if (t >= 0) return t;
+        if (s == 0) return 0;
+        s = ac[s].fail;
+    }
+}
+
+static inline int ac_step(int s, unsigned char c) {
+    return ac_delta ? ac_delta[s * ac_nclasses + ac_class[c]] : ac_goto(s, c);
+}
+
+void ac_build() {
+    ac_new_node(0);
+    unsigned char used[256] = {0};
+    for (int p = 0; p < pattern_count; p++) {
+        int s = 0;
+        for (size_t i = 0; i < pattern_lens[p]; i++) {
+            unsigned char c = patterns[p][i];
+            int t = ac_child(s, c);
+            if (t < 0) {
+                t = ac_new_node(c);
+                ac[t].sibling = ac[s].child;
+                ac[s].child = t;
+            }
+            s = t;
+            used[c] = 1;
+        }
+        if (ac[s].output < 0) ac[s].output = p;
+    }
+
+    // Breadth-first, so every fail target is finished before it is used
+    int *queue = malloc(ac_count * sizeof(int));
+    int head = 0, tail = 0;
+    queue[tail++] = 0;
+    while (head < tail) {
+        int s = queue[head++];
+        for (int t = ac[s].child; t >= 0; t = ac[t].sibling) {
+            ac[t].fail = s == 0 ? 0 : ac_goto(ac[s].fail, ac[t].byte);
+            int f = ac[t].fail;
+            ac[t].dict = ac[f].output >= 0 ? f : ac[f].dict;
+            queue[tail++] = t;
+        }
+    }
+
+    ac_hit = malloc(ac_count);
+    for (int s = 0; s < ac_count; s++) {
+        ac_hit[s] = ac[s].output >= 0 || ac[s].dict >= 0;
+    }
+
+    ac_nclasses = 1;
+    for (int c = 0; c < 256; c++) {
+        ac_class[c] = used[c] ? ac_nclasses++ : 0;
+    }
+    size_t table = (size_t)ac_count * ac_nclasses * sizeof(int);
+    if (table <= AC_TABLE_BYTES) {
+        ac_delta = malloc(table);
+    }
+    if (ac_delta) {
+        // Same BFS order: a state's row copies its fail state's row
+        for (int i = 0; i < tail; i++) {
+            int s = queue[i];
+            int *row = &ac_delta[s * ac_nclasses];
+            if (s == 0) {
+                memset(row, 0, ac_nclasses * sizeof(int));
+            } else {
+                memcpy(row, &ac_delta[ac[s].fail * ac_nclasses], ac_nclasses * sizeof(int));
+            }
+            for (int t = ac[s].child; t >= 0; t = ac[t].sibling) {
+                row[ac_class[ac[t].byte]] = t;
+            }
+        }
+    }
+    free(queue);
+}
+
+// ---------------------------------------------------------------- matching
+
+int regex_mode = 0;
+int only_matching = 0;
+int use_ac = 0;         // several fixed strings (or -o): Aho-Corasick scan
+char literal[MAX_LITERAL];
+int literal_len = 0;
+int any_line = 0;       // pattern matches every line (e.g. empty pattern)
+int empty_line = 0;     // pattern matches an empty line, where ^ and $ both hold
+const char *fixed_pattern;
+
+int compile_patterns() {
+    if (pattern_count == 0) {
+        regex_mode = 0;   // e.g. an empty -f file: the empty automaton matches nothing
+    }
+    if (!regex_mode) {
+        for (int p = 0; p < pattern_count; p++) {
+            if (pattern_lens[p] == 0) any_line = 1;
+        }
+        if (pattern_count != 1 || only_matching) {
+            use_ac = 1;
+            ac_build();
+            return 0;
+        }
+        fixed_pattern = patterns[0];
+        literal_len = pattern_lens[0];
+        if (literal_len > MAX_LITERAL) {
+            // Long fixed strings: memmem handles them, keep a pointer instead
+            literal_len = -1;
+        } else {
+            memcpy(literal, fixed_pattern, literal_len);
+        }
+        return 0;
+    }
+
+    // Several -E patterns are just alternatives of one expression
+    int root = -1;
+    for (int p = 0; p < pattern_count; p++) {
+        re_src = patterns[p];
+        int r = parse_alt();
+        if (r >= 0 && *re_src == ')') {
+            re_error = "unmatched )";
+            r = -1;
+        }
+        if (r < 0) {
+            fprintf(stderr, "sandbox_grep: %s\n", re_error ? re_error : "invalid pattern");
+            return -1;
+        }
+        root = root < 0 ? r : new_node(N_ALT, root, r);
+    }
+    Frag f;
+    if (root < 0 || compile(root, &f) < 0) {
+        fprintf(stderr, "sandbox_grep: %s\n", re_error ? re_error : "invalid pattern");
+        return -1;
+    }
+    int match = new_state(S_MATCH, -1, -1, -1);
+    if (match < 0) {
+        fprintf(stderr, "sandbox_grep: %s\n", re_error);
+        return -1;
+    }
+    patch(f.holes, match);
+    nfa_start = f.start;
+
+    char run[MAX_LITERAL];
+    int run_len = 0;
+    find_literal(root, run, &run_len, literal, &literal_len);
+
+    compute_classes();
+    mark = calloc(nfa_count, sizeof(int));
+    stack = malloc(2 * nfa_count * sizeof(int) + sizeof(int));
+    nfa_cur = malloc(nfa_count * sizeof(int));
+    nfa_next = malloc(nfa_count * sizeof(int));
+
+    int n = 0;
+    generation++;
+    add_closure(nfa_cur, &n, nfa_start, (1 << S_BOL) | (1 << S_EOL));
+    empty_line = list_has_match(nfa_cur, n);
+    return 0;
+}
+
+int line_matches(const unsigned char *p, size_t len) {
+    if (!regex_mode) {
+        return 1;   // the prefilter already found the fixed string
+    }
+    if (len == 0) {
+        return empty_line;
+    }
+    return use_nfa ? nfa_match_line(p, len) : dfa_match_line(p, len);
+}
+
+void emit(const char *filename, const unsigned char *line, size_t len) {
+    if (filename) printf("%s:", filename);
+    fwrite(line, 1, len, stdout);
+    putchar('\n');
+}
+
+// -o: print the leftmost-longest, non-overlapping pattern occurrences in a
+// line. Returns how many were printed.
+long emit_matches(const char *filename, const unsigned char *line, size_t len) {
+    static size_t *longest = NULL;   // longest[i]: longest match starting at i
+    static size_t longest_cap = 0;
+    if (len > longest_cap) {
+        longest_cap = len;
+        free(longest);
+        longest = malloc(longest_cap * sizeof(size_t));
+        if (!longest) {
+            fprintf(stderr, "sandbox_grep: out of memory\n");
+            exit(2);
+        }
+    }
+    memset(longest, 0, len * sizeof(size_t));
+
+    int s = 0;
+    for (size_t i = 0; i < len; i++) {
+        s = ac_step(s, line[i]);
+        if (!ac_hit[s]) continue;
+        for (int o = ac[s].output >= 0 ? s : ac[s].dict; o >= 0; o = ac[o].dict) {
+            size_t n = pattern_lens[ac[o].output];
+            if (n > 0 && n > longest[i + 1 - n]) longest[i + 1 - n] = n;
+        }
+    }
+
+    long printed = 0;
+    for (size_t i = 0; i < len; ) {
+        if (longest[i] == 0) {
+            i++;
+            continue;
+        }
+        emit(filename, line + i, longest[i]);
+        i += longest[i];
+        printed++;
+    }
+    return printed;
+}
+
+// One pass of the automaton over the whole buffer. No pattern contains a
+// newline, so the state falls back to the root at every line boundary and
+// only lines with a hit are looked at individually.
+long ac_scan_lines(const unsigned char *buf, const unsigned char *end, const char *filename) {
+    long matched = 0;
+    const unsigned char *p = buf;
+    int s = 0;
+    while (p < end) {
+        s = ac_step(s, *p);
+        if (!ac_hit[s]) {
+            p++;
+            continue;
+        }
+        const unsigned char *line = p;
+        while (line > buf && line[-1] != '\n') line--;
+        const unsigned char *nl = memchr(p, '\n', end - p);
+        const unsigned char *line_end = nl ? nl : end;
+        emit(filename, line, line_end - line);
+        matched++;
+        p = line_end + 1;
+        s = 0;
+    }
+    return matched;
+}
+
+// Scan the lines in [buf, end); each ends with '\n' except possibly the
+// last one at EOF. Returns the number of matching lines.
+long scan_lines(const unsigned char *buf, const unsigned char *end, const char *filename) {
+    long matched = 0;
+    if (only_matching) {
+        for (const unsigned char *pos = buf; pos < end; ) {
+            const unsigned char *nl = memchr(pos, '\n', end - pos);
+            const unsigned char *line_end = nl ? nl : end;
+            if (emit_matches(filename, pos, line_end - pos) > 0 || any_line) matched++;
+            pos = line_end + 1;
+        }
+        return matched;
+    }
+    if (use_ac && !any_line) {
+        return ac_scan_lines(buf, end, filename);
+    }
+    const unsigned char *pos = buf;
+    const char *needle = literal_len < 0 ? fixed_pattern : literal;
+    size_t needle_len = literal_len < 0 ? pattern_lens[0] : (size_t)literal_len;
+
+    while (pos < end) {
+        const unsigned char *line = pos;
+        if (needle_len > 0 && !any_line) {
+            const unsigned char *hit = needle_len == 1
+                ? memchr(pos, needle[0], end - pos)
+                : memmem(pos, end - pos, needle, needle_len);
+            if (!hit) break;
+            line = hit;
+            while (line > pos && line[-1] != '\n') line--;
+        }
+        const unsigned char *nl = memchr(line, '\n', end - line);
+        const unsigned char *line_end = nl ? nl : end;
+        if (any_line || line_matches(line, line_end - line)) {
+            emit(filename, line, line_end - line);
+            matched++;
+        }
+        pos = line_end + 1;
+    }
+    return matched;
+}
+
+long grep_fd(int fd, const char *filename) {
+    size_t cap = READ_CHUNK, len = 0;
+    unsigned char *buf = malloc(cap);
+    long matched = 0;
+    if (!buf) {
+        fprintf(stderr, "sandbox_grep: out of memory\n");
+        return -1;
+    }
+    while (1) {
+        if (len == cap) {
+            // A single line longer than the buffer: grow to hold it
+            unsigned char *bigger = realloc(buf, cap * 2);
+            if (!bigger) {
+                fprintf(stderr, "sandbox_grep: %s: line too long\n", filename ? filename : "(standard input)");
+                free(buf);
+                return -1;
+            }
+            buf = bigger;
+            cap *= 2;
+        }
+        ssize_t n = read(fd, buf + len, cap - len);
+        if (n < 0) {
+            perror("sandbox_grep");
+            free(buf);
+            return -1;
+        }
+        if (n == 0) {
+            if (len > 0) matched += scan_lines(buf, buf + len, filename);
+            break;
+        }
+        len += n;
+        unsigned char *last = buf + len;
+        while (last > buf && last[-1] != '\n') last--;
+        if (last == buf) continue;
+        matched += scan_lines(buf, last, filename);
+        len = buf + len - last;
+        memmove(buf, last, len);
+    }
+    free(buf);
+    return matched;
 }
 
 int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        fprintf(stderr, "sandbox_grep: missing pattern\n");
-        return 1;
+    int i = 1;
+    int have_patterns = 0;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "-E") == 0) {
+            regex_mode = 1;
+        } else if (strcmp(argv[i], "-F") == 0) {
+            regex_mode = 0;
+        } else if (strcmp(argv[i], "-o") == 0) {
+            only_matching = 1;
+        } else if (strcmp(argv[i], "-e") == 0 || strcmp(argv[i], "-f") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "sandbox_grep: %s needs an argument\n", argv[i]);
+                return 2;
+            }
+            if (argv[i][1] == 'e') {
+                add_patterns(argv[i + 1], strlen(argv[i + 1]));
+            } else if (add_pattern_file(argv[i + 1]) < 0) {
+                return 2;
+            }
+            have_patterns = 1;
+            i++;
+        } else if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        } else {
+            fprintf(stderr, "sandbox_grep: unknown option %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if (!have_patterns) {
+        if (i >= argc) {
+            fprintf(stderr, "sandbox_grep: missing pattern\n");
+            return 2;
+        }
+        add_patterns(argv[i], strlen(argv[i]));
+        i++;
     }
-    
-    char *pattern = argv[1];
-    int show_filename = (argc > 2);
-    
-    if (argc == 2) {
+    if (only_matching && regex_mode) {
+        fprintf(stderr, "sandbox_grep: -o is only supported with -F\n");
+        return 2;
+    }
+    if (compile_patterns() < 0) {
+        return 2;
+    }
+    int show_filename = (argc - i > 1);
+    static char outbuf[1 << 16];
+    setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf));
+
+    long total = 0;
+    int errors = 0;
+    if (i == argc) {
         // Read from stdin
-        grep_file(stdin, pattern, "(stdin)", 0);
-        return 0;
+        long n = grep_fd(STDIN_FILENO, NULL);
+        if (n < 0) errors++; else total += n;
     }
-    
-    for (int i = 2; i < argc; i++) {
-        FILE *fp = fopen(argv[i], "r");
-        if (!fp) {
+
+    for (; i < argc; i++) {
+        int fd = open(argv[i], O_RDONLY);
+        if (fd < 0) {
             perror(argv[i]);
+            errors++;
             continue;
         }
-        grep_file(fp, pattern, argv[i], show_filename);
-        fclose(fp);
+        long n = grep_fd(fd, show_filename ? argv[i] : NULL);
+        if (n < 0) errors++; else total += n;
+        close(fd);
     }
-    
-    return 0;
-}
 
+    fflush(stdout);
+    return errors ? 2 : (total > 0 ? 0 : 1);
+}
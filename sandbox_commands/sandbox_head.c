@@ -0,0 +1,122 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+// Custom head implementation - Sandboxed Shell
+// Usage: head [-n lines | -c bytes | -lines] [file...]
+//   -n  print the first lines (default 10)
+//   -c  print the first bytes
+//
+// head stops reading the moment it has written what was asked for and
+// exits, so the stage feeding it through a pipe gets SIGPIPE on its next
+// write instead of having its whole output drained. When the input is
+// seekable (a file redirected to stdin), the read offset is put back just
+// past the last byte printed, leaving the rest for whoever reads next.
+
+#define BLOCK (64 << 10)
+
+int write_all(const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t k = write(STDOUT_FILENO, p, n);
+        if (k < 0) {
+            if (errno == EINTR) continue;
+            perror("sandbox_head: write error");
+            return -1;
+        }
+        p += k;
+        n -= k;
+    }
+    return 0;
+}
+
+// Copy the first limit lines (or bytes) of fd to stdout
+int head_fd(int fd, const char *name, long long limit, int bytes) {
+    static char buf[BLOCK];
+    while (limit > 0) {
+        size_t want = (bytes && limit < BLOCK) ? (size_t)limit : BLOCK;
+        ssize_t n = read(fd, buf, want);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror(name);
+            return -1;
+        }
+        if (n == 0) break;
+
+        size_t take = n;
+        if (bytes) {
+            limit -= n;
+        } else {
+            const char *p = buf, *end = buf + n;
+            while (limit > 0 && (p = memchr(p, '\n', end - p)) != NULL) {
+                p++;
+                limit--;
+            }
+            if (limit == 0) take = p - buf;
+        }
+        if (write_all(buf, take) < 0) return -1;
+        if (take < (size_t)n) {
+            // Give back what was read past the end; fails harmlessly on pipes
+            lseek(fd, (off_t)take - n, SEEK_CUR);
+        }
+    }
+    return 0;
+}
+
+int parse_count(const char *text, long long *count) {
+    char *end;
+    errno = 0;
+    *count = strtoll(text, &end, 10);
+    return (*text && !*end && *count >= 0 && errno == 0) ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    long long limit = 10;
+    int bytes = 0;
+    int i = 1;
+
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        const char *arg = NULL;
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        } else if (argv[i][1] == 'n' || argv[i][1] == 'c') {
+            bytes = argv[i][1] == 'c';
+            arg = argv[i][2] ? argv[i] + 2 : argv[++i];
+        } else if (argv[i][1] >= '0' && argv[i][1] <= '9') {
+            bytes = 0;
+            arg = argv[i] + 1;   // old style: head -5
+        } else {
+            fprintf(stderr, "sandbox_head: unknown option %s\n", argv[i]);
+            return 1;
+        }
+        if (!arg || parse_count(arg, &limit) < 0) {
+            fprintf(stderr, "sandbox_head: invalid number of %s: '%s'\n",
+                    bytes ? "bytes" : "lines", arg ? arg : "");
+            return 1;
+        }
+    }
+
+    if (i >= argc) {
+        return head_fd(STDIN_FILENO, "(standard input)", limit, bytes) < 0;
+    }
+
+    int status = 0;
+    int show_names = argc - i > 1;
+    for (int first = i; i < argc; i++) {
+        int fd = strcmp(argv[i], "-") == 0 ? STDIN_FILENO : open(argv[i], O_RDONLY);
+        if (fd < 0) {
+            perror(argv[i]);
+            status = 1;
+            continue;
+        }
+        if (show_names) printf("%s==> %s <==\n", i > first ? "\n" : "", argv[i]);
+        fflush(stdout);
+        if (head_fd(fd, argv[i], limit, bytes) < 0) status = 1;
+        if (fd != STDIN_FILENO) close(fd);
+    }
+    return status;
+}
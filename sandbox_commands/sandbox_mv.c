@@ -0,0 +1,207 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+// Custom mv implementation - Sandboxed Shell
+// Usage: mv [-n] source... dest
+//   -n  never overwrite an existing file
+//
+// A move is a single renameat2() whenever source and destination share a
+// file system; with -n it passes RENAME_NOREPLACE so the kernel, not a
+// racy stat beforehand, refuses to clobber. Across devices (EXDEV) the
+// sandbox's own cp -r -p copies the data (reflink / copy_file_range) and
+// the source is removed only once the copy has fully succeeded.
+//
+// SANDBOX: both ends must lie under $SANDBOX_ROOT (set by the shell; the
+// current directory when run by hand). The checks look at the parent
+// directory, so moving a symlink moves the link itself, wherever it points.
+
+#define RENAME_NOREPLACE_FLAG 1
+
+int no_clobber = 0;
+char sandbox_root[PATH_MAX];
+
+// SANDBOX: the directory that holds path must be inside the sandbox
+int parent_inside_sandbox(const char *path) {
+    char parent[PATH_MAX], resolved[PATH_MAX];
+    snprintf(parent, sizeof(parent), "%s", path);
+    size_t len = strlen(parent);
+    while (len > 1 && parent[len - 1] == '/') parent[--len] = '\0';
+    char *slash = strrchr(parent, '/');
+    const char *base = slash ? slash + 1 : parent;
+    if (strcmp(base, ".") == 0 || strcmp(base, "..") == 0) return 0;
+    if (slash == parent) slash[1] = '\0';
+    else if (slash) *slash = '\0';
+    else strcpy(parent, ".");
+    if (realpath(parent, resolved) == NULL) return 0;
+    size_t n = strlen(sandbox_root);
+    if (n == 1) return 1;          // root is "/"
+    return strncmp(resolved, sandbox_root, n) == 0 && (resolved[n] == '\0' || resolved[n] == '/');
+}
+
+int do_rename(const char *src, const char *dst) {
+#if defined(__linux__) && defined(SYS_renameat2)
+    if (syscall(SYS_renameat2, AT_FDCWD, src, AT_FDCWD, dst,
+                no_clobber ? RENAME_NOREPLACE_FLAG : 0) == 0) return 0;
+    if (errno != ENOSYS && errno != EINVAL) return -1;
+#endif
+    // No renameat2 (or no RENAME_NOREPLACE on this file system)
+    struct stat st;
+    if (no_clobber && lstat(dst, &st) == 0) {
+        errno = EEXIST;
+        return -1;
+    }
+    return rename(src, dst);
+}
+
+// Delete a tree without following symlinks; names are read up front so
+// only one directory is open at a time whatever the depth
+int remove_tree(const char *path) {
+    struct stat st;
+    if (lstat(path, &st) != 0) return -1;
+    if (!S_ISDIR(st.st_mode)) return unlink(path);
+
+    DIR *dir = opendir(path);
+    if (!dir) return -1;
+    char **names = NULL;
+    size_t count = 0, cap = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+        if (count == cap) {
+            cap = cap ? cap * 2 : 64;
+            names = realloc(names, cap * sizeof(char *));
+        }
+        names[count++] = strdup(ent->d_name);
+    }
+    closedir(dir);
+
+    int rc = 0;
+    char child[PATH_MAX];
+    for (size_t i = 0; i < count; i++) {
+        snprintf(child, sizeof(child), "%s/%s", path, names[i]);
+        if (remove_tree(child) != 0) rc = -1;
+        free(names[i]);
+    }
+    free(names);
+    return rc == 0 ? rmdir(path) : -1;
+}
+
+// Cross-device move: copy with the sandbox cp, then drop the source
+int copy_then_remove(const char *src, const char *dst) {
+    const char *bin = getenv("SANDBOX_BIN");
+    if (!bin) {
+        fprintf(stderr, "sandbox_mv: '%s': cross-device move needs SANDBOX_BIN\n", src);
+        return -1;
+    }
+    struct stat st;
+    if (lstat(dst, &st) == 0) {
+        // cp -n would skip it and still succeed, and the source would go
+        if (no_clobber) return 0;
+        if (S_ISDIR(st.st_mode)) {
+            fprintf(stderr, "sandbox_mv: '%s': cannot move across devices onto an existing directory\n", dst);
+            return -1;
+        }
+    }
+    char cp[PATH_MAX];
+    snprintf(cp, sizeof(cp), "%s/cp", bin);
+    char *argv[] = { "cp", no_clobber ? "-rpn" : "-rp", "--", (char *)src, (char *)dst, NULL };
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("sandbox_mv: fork");
+        return -1;
+    }
+    if (pid == 0) {
+        execv(cp, argv);
+        perror("sandbox_mv: cp");
+        _exit(127);
+    }
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "sandbox_mv: '%s': copy failed, source left in place\n", src);
+        return -1;
+    }
+    if (remove_tree(src) != 0) {
+        perror(src);
+        return -1;
+    }
+    return 0;
+}
+
+int move_operand(const char *src, const char *dst) {
+    if (!parent_inside_sandbox(src) || !parent_inside_sandbox(dst)) {
+        fprintf(stderr, "sandbox_mv: '%s' -> '%s': outside the sandbox\n", src, dst);
+        return -1;
+    }
+    if (do_rename(src, dst) == 0) return 0;
+    if (errno == EEXIST && no_clobber) return 0;
+    if (errno == EXDEV) return copy_then_remove(src, dst);
+    fprintf(stderr, "sandbox_mv: cannot move '%s' to '%s': %s\n", src, dst, strerror(errno));
+    return -1;
+}
+
+int main(int argc, char *argv[]) {
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(argv[i], "-n") != 0) {
+            fprintf(stderr, "sandbox_mv: unknown option %s\n", argv[i]);
+            return 1;
+        }
+        no_clobber = 1;
+    }
+    if (argc - i < 2) {
+        fprintf(stderr, "sandbox_mv: usage: mv [-n] source... dest\n");
+        return 1;
+    }
+    if (!realpath(getenv("SANDBOX_ROOT") ? getenv("SANDBOX_ROOT") : ".", sandbox_root)) {
+        perror("sandbox_mv: sandbox root");
+        return 1;
+    }
+
+    const char *dest = argv[argc - 1];
+    struct stat st;
+    int dest_is_dir = stat(dest, &st) == 0 && S_ISDIR(st.st_mode);
+    if (argc - i > 2 && !dest_is_dir) {
+        fprintf(stderr, "sandbox_mv: target '%s' is not a directory\n", dest);
+        return 1;
+    }
+    int status = 0;
+    for (; i < argc - 1; i++) {
+        const char *src = argv[i];
+        if (!dest_is_dir) {
+            if (move_operand(src, dest) < 0) status = 1;
+            continue;
+        }
+        // mv file dir/ lands at dir/<basename of file>
+        char target[PATH_MAX];
+        size_t end = strlen(src);
+        while (end > 1 && src[end - 1] == '/') end--;
+        size_t base = end;
+        while (base > 0 && src[base - 1] != '/') base--;
+        if (snprintf(target, sizeof(target), "%s%s%.*s", dest,
+                     dest[strlen(dest) - 1] == '/' ? "" : "/", (int)(end - base), src + base)
+            >= (int)sizeof(target)) {
+            fprintf(stderr, "sandbox_mv: '%s': %s\n", src, strerror(ENAMETOOLONG));
+            status = 1;
+            continue;
+        }
+        if (move_operand(src, target) < 0) status = 1;
+    }
+    return status;
+}
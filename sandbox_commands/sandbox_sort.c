@@ -0,0 +1,791 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <limits.h>
+#include <stdint.h>
+
+// Custom sort implementation - Sandboxed Shell
+// Usage: sort [-nru] [-t sep] [-k start[,end]] [-S size] [-T dir] [file...]
+//   -n  compare the key as a number
+//   -r  reverse the result
+//   -u  output only the first of each run of lines with equal keys
+//   -t  field separator (default: a run of blanks starts each field)
+//   -k  sort on fields start through end (1-based, end defaults to the
+//       end of the line); n and r may follow a field number, as in -k2,2n.
+//       A key with n or r of its own ignores the global -n and -r.
+//   -S  memory for sort buffers, e.g. 32M (default 64M)
+//   -T  directory for temporary files (default: the current directory)
+// Lines compare as bytes (the C locale). Equal keys fall back to comparing
+// whole lines, except with -u; only the global -r reverses that comparison.
+//
+// Commands run under a 100 MB RLIMIT_AS, so this is an external merge sort.
+// The input is cut into runs that fit in one buffer slot. Worker threads sort
+// the slots while the main thread reads on. When a slot is needed again, its
+// sorted run is spilled to a file in a private directory under -T, which is
+// inside the sandbox by default. The runs are then merged MERGE_FANIN at a
+// time with a loser tree. If the whole input fits in the slots, it is merged
+// in memory and never touches the disk.
+//
+// Workers only sort memory that the main thread allocated for them. glibc
+// gives every thread that calls malloc its own arena, which reserves 64 MB of
+// address space, and that alone would go over the limit.
+
+#define DEFAULT_MEMORY (64 << 20)
+#define MAX_WORKERS 4           // threads count against RLIMIT_NPROC
+#define WORKER_STACK (256 << 10)
+#define READ_CHUNK (1 << 20)
+#define WRITE_BUFFER (256 << 10)
+#define MERGE_FANIN 16          // runs merged together while reading (RLIMIT_NOFILE is 64)
+#define MERGE_BUFFER (128 << 10)
+#define MAX_NUMBER 512
+
+typedef struct {
+    const char *line;
+    size_t len;             // without the newline
+    const char *key;        // the -k fields of the line
+    size_t key_len;
+    double num;             // -n value of the key
+} Line;
+
+int numeric = 0, reverse = 0, unique = 0;
+int separator = -1;         // -t character, -1 = blank-separated fields
+long key_start = 0, key_end = 0;   // -k fields, 0 = whole line / end of line
+int key_numeric = 0, key_reverse = 0;   // how the key compares
+int key_modifiers = 0;      // the -k spec had n or r; else -n and -r apply
+
+// ---------------------------------------------------------------- keys
+
+int is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// Start of the field after the one starting at p
+const char *next_field(const char *p, const char *end) {
+    if (separator >= 0) {
+        const char *q = memchr(p, separator, end - p);
+        return q ? q + 1 : end;
+    }
+    while (p < end && is_blank(*p)) p++;
+    while (p < end && !is_blank(*p)) p++;
+    return p;
+}
+
+// End of the field starting at p
+const char *field_end(const char *p, const char *end) {
+    if (separator >= 0) {
+        const char *q = memchr(p, separator, end - p);
+        return q ? q : end;
+    }
+    while (p < end && is_blank(*p)) p++;
+    while (p < end && !is_blank(*p)) p++;
+    return p;
+}
+
+// A leading number: blanks, optional '-', digits, optional '.' and digits.
+// Anything else (including no digits at all) counts as zero, as in GNU sort.
+double parse_number(const char *p, size_t len) {
+    const char *end = p + len;
+    char buf[MAX_NUMBER];
+    size_t n = 0;
+    int digits = 0;
+
+    while (p < end && is_blank(*p)) p++;
+    if (p < end && *p == '-') buf[n++] = *p++;
+    while (p < end && *p >= '0' && *p <= '9' && n < MAX_NUMBER - 2) {
+        buf[n++] = *p++;
+        digits++;
+    }
+    if (p < end && *p == '.') {
+        buf[n++] = *p++;
+        while (p < end && *p >= '0' && *p <= '9' && n < MAX_NUMBER - 1) {
+            buf[n++] = *p++;
+            digits++;
+        }
+    }
+    if (!digits) return 0;
+    buf[n] = '\0';
+    return strtod(buf, NULL);
+}
+
+void set_key(Line *l) {
+    l->key = l->line;
+    l->key_len = l->len;
+    if (key_start > 0) {
+        const char *end = l->line + l->len;
+        const char *p = l->line;
+        for (long f = 1; f < key_start && p < end; f++) p = next_field(p, end);
+        const char *q = end;
+        if (key_end > 0) {
+            q = p;
+            for (long f = key_start; f < key_end && q < end; f++) q = next_field(q, end);
+            q = key_end < key_start ? p : field_end(q, end);
+        }
+        l->key = p;
+        l->key_len = q - p;
+    }
+    if (key_numeric) l->num = parse_number(l->key, l->key_len);
+}
+
+int compare_bytes(const char *a, size_t alen, const char *b, size_t blen) {
+    int c = memcmp(a, b, alen < blen ? alen : blen);
+    if (c) return c;
+    return (alen > blen) - (alen < blen);
+}
+
+// Key comparison only: this is what -u treats as "equal"
+int compare_keys(const Line *a, const Line *b) {
+    if (key_numeric) return (a->num > b->num) - (a->num < b->num);
+    return compare_bytes(a->key, a->key_len, b->key, b->key_len);
+}
+
+int compare_lines(const Line *a, const Line *b) {
+    int c = compare_keys(a, b);
+    if (c) return key_reverse ? -c : c;
+    if (unique) return 0;
+    c = compare_bytes(a->line, a->len, b->line, b->len);
+    return reverse ? -c : c;
+}
+
+// Stable merge sort of a[0..n) using tmp[0..n) as scratch
+void merge_sort(Line *a, Line *tmp, size_t n) {
+    if (n <= 16) {
+        for (size_t i = 1; i < n; i++) {
+            Line x = a[i];
+            size_t j = i;
+            while (j > 0 && compare_lines(&a[j - 1], &x) > 0) {
+                a[j] = a[j - 1];
+                j--;
+            }
+            a[j] = x;
+        }
+        return;
+    }
+    size_t half = n / 2;
+    merge_sort(a, tmp, half);
+    merge_sort(a + half, tmp, n - half);
+    if (compare_lines(&a[half - 1], &a[half]) <= 0) return;   // already in order
+
+    memcpy(tmp, a, half * sizeof(Line));
+    size_t i = 0, j = half, k = 0;
+    while (i < half && j < n) {
+        a[k++] = compare_lines(&a[j], &tmp[i]) < 0 ? a[j++] : tmp[i++];
+    }
+    while (i < half) a[k++] = tmp[i++];
+}
+
+// ---------------------------------------------------------------- output
+
+typedef struct {
+    int fd;
+    const char *name;
+    char *buf;
+    size_t len, cap;
+} Writer;
+
+void cleanup_spill();
+
+void fail(const char *what) {
+    perror(what);
+    cleanup_spill();
+    exit(2);
+}
+
+void writer_flush(Writer *w) {
+    size_t done = 0;
+    while (done < w->len) {
+        ssize_t n = write(w->fd, w->buf + done, w->len - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fail(w->name);
+        }
+        done += n;
+    }
+    w->len = 0;
+}
+
+void writer_line(Writer *w, const char *p, size_t n) {
+    if (w->len + n + 1 > w->cap) {
+        writer_flush(w);
+        while (n + 1 > w->cap) {
+            // Longer than the whole buffer: pass it straight through
+            ssize_t k = write(w->fd, p, n);
+            if (k < 0) {
+                if (errno == EINTR) continue;
+                fail(w->name);
+            }
+            p += k;
+            n -= k;
+        }
+    }
+    memcpy(w->buf + w->len, p, n);
+    w->buf[w->len + n] = '\n';
+    w->len += n + 1;
+}
+
+// ---------------------------------------------------------------- spill files
+
+char spill_dir[PATH_MAX];
+int spill_files = 0;        // run files created so far, named run0, run1, ...
+
+void run_path(char *path, size_t size, int run) {
+    snprintf(path, size, "%s/run%d", spill_dir, run);
+}
+
+void cleanup_spill() {
+    if (!spill_dir[0]) return;
+    char path[PATH_MAX + 32];
+    for (int i = 0; i < spill_files; i++) {
+        run_path(path, sizeof(path), i);
+        unlink(path);
+    }
+    rmdir(spill_dir);
+    spill_dir[0] = '\0';
+}
+
+void cleanup_signal(int sig) {
+    cleanup_spill();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+// Create the next run file, making the private spill directory on first use
+int create_run(const char *tmpdir, int *run) {
+    if (!spill_dir[0]) {
+        snprintf(spill_dir, sizeof(spill_dir), "%s/.sandbox_sort.XXXXXX", tmpdir);
+        if (!mkdtemp(spill_dir)) {
+            spill_dir[0] = '\0';
+            fprintf(stderr, "sandbox_sort: cannot create temporary directory in %s: %s\n",
+                    tmpdir, strerror(errno));
+            exit(2);
+        }
+    }
+    char path[PATH_MAX + 32];
+    *run = spill_files++;
+    run_path(path, sizeof(path), *run);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) fail(path);
+    return fd;
+}
+
+// ---------------------------------------------------------------- input
+
+char **inputs;
+int input_count, input_index = 0;
+int input_fd = -1;
+char last_byte = '\n';      // last byte returned from the current input
+
+// Read up to cap bytes of the concatenated inputs. A file that does not end
+// in a newline gets one, so every line the caller sees is terminated.
+size_t input_read(char *buf, size_t cap) {
+    while (1) {
+        if (input_fd < 0) {
+            if (input_index >= input_count) return 0;
+            const char *name = inputs[input_index];
+            if (strcmp(name, "-") == 0) {
+                input_fd = STDIN_FILENO;
+            } else if ((input_fd = open(name, O_RDONLY)) < 0) {
+                fail(name);
+            }
+        }
+        ssize_t n = read(input_fd, buf, cap);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fail(inputs[input_index]);
+        }
+        if (n > 0) {
+            last_byte = buf[n - 1];
+            return n;
+        }
+        if (input_fd != STDIN_FILENO) close(input_fd);
+        input_fd = -1;
+        input_index++;
+        if (last_byte != '\n') {
+            last_byte = '\n';
+            buf[0] = '\n';
+            return 1;
+        }
+    }
+}
+
+// ---------------------------------------------------------------- run slots
+
+// A slot is one arena: line data grows up from the start, Line records are
+// written down from the end, and the gap between them must stay big enough
+// for the merge sort's scratch copy of the records.
+typedef struct {
+    char *mem;
+    size_t size;
+    size_t used;            // bytes of line data
+    Line *lines;            // nlines records, in input order once filled
+    size_t nlines;
+    int sorting;            // a worker owns the slot until joined
+    int sorted;             // holds a sorted run that has not been spilled
+    long seq;               // fill order, to keep the merge stable
+    pthread_t thread;
+} Slot;
+
+#define RECORD_ROOM(n) (2 * ((n) + 1) * sizeof(Line))
+
+Line *slot_scratch(Slot *s) {
+    uintptr_t p = (uintptr_t)(s->mem + s->used);
+    p = (p + sizeof(double) - 1) & ~(uintptr_t)(sizeof(double) - 1);
+    return (Line *)p;
+}
+
+void *sort_slot(void *arg) {
+    Slot *s = arg;
+    for (size_t i = 0; i < s->nlines; i++) set_key(&s->lines[i]);
+    merge_sort(s->lines, slot_scratch(s), s->nlines);
+    return NULL;
+}
+
+// Fill a slot from the input, starting with carry bytes left over from the
+// previous slot. Returns 0 at end of input. *tail/*tail_len are set to the
+// unrecorded end of the data, which the next slot must start with.
+int fill_slot(Slot *s, const char *carry, size_t carry_len, const char **tail, size_t *tail_len) {
+    if (carry_len > 0) memmove(s->mem, carry, carry_len);
+    s->used = carry_len;
+    s->nlines = 0;
+    Line *top = (Line *)(s->mem + s->size);
+    size_t done = 0;
+    int more = 1;
+
+    while (1) {
+        char *nl;
+        while (done < s->used && (nl = memchr(s->mem + done, '\n', s->used - done))) {
+            if (s->used + RECORD_ROOM(s->nlines + 1) > s->size) goto full;
+            Line *l = &top[-(long)++s->nlines];
+            l->line = s->mem + done;
+            l->len = nl - l->line;
+            done = nl + 1 - s->mem;
+        }
+        size_t room = s->size - s->used - RECORD_ROOM(s->nlines);
+        if (room < READ_CHUNK / 16 && s->nlines > 0) break;
+        if (room == 0) goto full;
+        // Leave two thirds of the room for the records of what is read
+        size_t want = room / 3 > READ_CHUNK ? READ_CHUNK : room / 3 > 0 ? room / 3 : room;
+        size_t n = input_read(s->mem + s->used, want);
+        if (n == 0) {
+            more = 0;
+            break;
+        }
+        s->used += n;
+    }
+full:
+    if (s->nlines == 0 && more) {
+        fprintf(stderr, "sandbox_sort: line too long for the sort buffer (try a larger -S)\n");
+        cleanup_spill();
+        exit(2);
+    }
+    s->lines = top - s->nlines;
+    for (size_t i = 0, j = s->nlines; i + 1 < j; i++, j--) {
+        Line tmp = s->lines[i];
+        s->lines[i] = s->lines[j - 1];
+        s->lines[j - 1] = tmp;
+    }
+    *tail = s->mem + done;
+    *tail_len = s->used - done;
+    // A tail only exists when the records ran out of room, so there is more
+    return more || *tail_len > 0;
+}
+
+// ---------------------------------------------------------------- merge
+
+// A merge input: either a sorted slot still in memory or a run file
+typedef struct {
+    Line cur;
+    int done;
+    Slot *slot;
+    size_t index;
+    int fd;
+    char *buf;
+    size_t pos, len, cap;
+} Source;
+
+// Advance to the next line. For files, the previous line's bytes may be
+// moved by the refill, so callers must be finished with src->cur first.
+void source_next(Source *src, const char *name) {
+    if (src->slot) {
+        if (src->index >= src->slot->nlines) {
+            src->done = 1;
+        } else {
+            src->cur = src->slot->lines[src->index++];
+        }
+        return;
+    }
+    while (1) {
+        char *nl = memchr(src->buf + src->pos, '\n', src->len - src->pos);
+        if (nl) {
+            src->cur.line = src->buf + src->pos;
+            src->cur.len = nl - src->cur.line;
+            src->pos = nl + 1 - src->buf;
+            set_key(&src->cur);
+            return;
+        }
+        memmove(src->buf, src->buf + src->pos, src->len - src->pos);
+        src->len -= src->pos;
+        src->pos = 0;
+        if (src->len == src->cap) {
+            char *bigger = realloc(src->buf, src->cap * 2);
+            if (!bigger) {
+                fprintf(stderr, "sandbox_sort: line too long to merge\n");
+                cleanup_spill();
+                exit(2);
+            }
+            src->buf = bigger;
+            src->cap *= 2;
+        }
+        ssize_t n = read(src->fd, src->buf + src->len, src->cap - src->len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fail(name);
+        }
+        if (n == 0) {
+            src->done = 1;   // run files always end with a newline
+            return;
+        }
+        src->len += n;
+    }
+}
+
+// Loser tree over k sources: leaves are k..2k-1, tree[1..k-1] hold the loser
+// of each match and tree[0] the overall winner. Ties go to the lower source
+// index, which keeps the merge stable (earlier runs hold earlier input).
+Source *sources;
+int *tree;
+int nsources;
+
+int source_less(int a, int b) {
+    if (sources[a].done) return 0;
+    if (sources[b].done) return 1;
+    int c = compare_lines(&sources[a].cur, &sources[b].cur);
+    return c < 0 || (c == 0 && a < b);
+}
+
+int tree_init(int node) {
+    if (node >= nsources) return node - nsources;
+    int a = tree_init(2 * node);
+    int b = tree_init(2 * node + 1);
+    if (source_less(b, a)) {
+        tree[node] = a;
+        return b;
+    }
+    tree[node] = b;
+    return a;
+}
+
+void tree_replay(int winner) {
+    for (int node = (winner + nsources) / 2; node > 0; node /= 2) {
+        if (source_less(tree[node], winner)) {
+            int t = tree[node];
+            tree[node] = winner;
+            winner = t;
+        }
+    }
+    tree[0] = winner;
+}
+
+// Merge srcs into w, dropping lines with equal keys under -u
+void merge(Source *srcs, int k, Writer *w) {
+    static char *last = NULL;
+    static size_t last_cap = 0;
+    Line prev;
+    int have_prev = 0;
+
+    sources = srcs;
+    nsources = k;
+    tree = malloc(k * sizeof(int));
+    for (int i = 0; i < k; i++) source_next(&srcs[i], "sandbox_sort");
+    tree[0] = tree_init(1);
+
+    while (!srcs[tree[0]].done) {
+        Source *top = &srcs[tree[0]];
+        if (!unique || !have_prev || compare_keys(&prev, &top->cur) != 0) {
+            writer_line(w, top->cur.line, top->cur.len);
+            if (unique) {
+                // Keep a copy: the source's buffer may be refilled
+                if (top->cur.len > last_cap) {
+                    last_cap = top->cur.len * 2;
+                    free(last);
+                    last = malloc(last_cap);
+                    if (!last) fail("sandbox_sort");
+                }
+                memcpy(last, top->cur.line, top->cur.len);
+                prev.line = last;
+                prev.len = top->cur.len;
+                set_key(&prev);
+                have_prev = 1;
+            }
+        }
+        source_next(top, "sandbox_sort");
+        tree_replay(tree[0]);
+    }
+    free(tree);
+}
+
+void write_slot(Slot *s, Writer *w) {
+    for (size_t i = 0; i < s->nlines; i++) {
+        if (unique && i > 0 && compare_keys(&s->lines[i - 1], &s->lines[i]) == 0) continue;
+        writer_line(w, s->lines[i].line, s->lines[i].len);
+    }
+}
+
+// ---------------------------------------------------------------- runs
+
+const char *tmpdir = ".";
+int runs[2 * MERGE_FANIN];  // spilled runs not merged yet, oldest first
+int nruns = 0;
+Writer out = { STDOUT_FILENO, "sandbox_sort: write error", NULL, 0, WRITE_BUFFER };
+Writer spill = { -1, NULL, NULL, 0, WRITE_BUFFER };
+char spill_name[PATH_MAX + 32];
+
+// Open run file for merging. It is unlinked right away and stays readable
+// through the descriptor.
+void open_run(Source *src, int run, size_t buf_size) {
+    char path[PATH_MAX + 32];
+    run_path(path, sizeof(path), run);
+    memset(src, 0, sizeof(Source));
+    src->fd = open(path, O_RDONLY);
+    src->cap = buf_size;
+    src->buf = malloc(buf_size);
+    if (src->fd < 0 || !src->buf) fail(path);
+    unlink(path);
+}
+
+void start_run(int *run) {
+    spill.fd = create_run(tmpdir, run);
+    run_path(spill_name, sizeof(spill_name), *run);
+    spill.name = spill_name;
+}
+
+void finish_run() {
+    writer_flush(&spill);
+    if (close(spill.fd) < 0) fail(spill_name);
+}
+
+// Write a slot's run to a new file. Every MERGE_FANIN runs, the oldest are
+// merged into one so the number of files (and descriptors) stays bounded.
+void spill_slot(Slot *slot) {
+    start_run(&runs[nruns++]);
+    write_slot(slot, &spill);
+    finish_run();
+    slot->sorted = 0;
+
+    if (nruns == 2 * MERGE_FANIN) {
+        Source srcs[MERGE_FANIN];
+        int merged;
+        for (int r = 0; r < MERGE_FANIN; r++) open_run(&srcs[r], runs[r], MERGE_BUFFER);
+        start_run(&merged);
+        merge(srcs, MERGE_FANIN, &spill);
+        finish_run();
+        for (int r = 0; r < MERGE_FANIN; r++) {
+            close(srcs[r].fd);
+            free(srcs[r].buf);
+        }
+        memmove(runs + 1, runs + MERGE_FANIN, (nruns - MERGE_FANIN) * sizeof(int));
+        runs[0] = merged;
+        nruns -= MERGE_FANIN - 1;
+    }
+}
+
+// ---------------------------------------------------------------- main
+
+size_t parse_size(const char *text) {
+    char *end;
+    double v = strtod(text, &end);
+    switch (*end) {
+    case 'K': case 'k': v *= 1 << 10; end++; break;
+    case 'M': case 'm': v *= 1 << 20; end++; break;
+    case 'G': case 'g': v *= 1 << 30; end++; break;
+    }
+    return (*end || v < (1 << 20)) ? 0 : (size_t)v;
+}
+
+// -k start[,end] with optional n/r modifiers after either number
+int parse_key(const char *spec) {
+    char *end;
+    key_start = strtol(spec, &end, 10);
+    if (key_start < 1) return -1;
+    key_end = key_numeric = key_reverse = key_modifiers = 0;
+    while (*end == 'n' || *end == 'r') {
+        if (*end++ == 'n') key_numeric = 1; else key_reverse = 1;
+        key_modifiers = 1;
+    }
+    if (*end == ',') {
+        key_end = strtol(end + 1, &end, 10);
+        if (key_end < 1) return -1;
+        while (*end == 'n' || *end == 'r') {
+            if (*end++ == 'n') key_numeric = 1; else key_reverse = 1;
+            key_modifiers = 1;
+        }
+    }
+    return *end ? -1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    size_t memory = DEFAULT_MEMORY;
+    int i = 1;
+
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        for (const char *f = argv[i] + 1; *f; f++) {
+            if (*f == 'n') {
+                numeric = 1;
+            } else if (*f == 'r') {
+                reverse = 1;
+            } else if (*f == 'u') {
+                unique = 1;
+            } else if (strchr("tkST", *f)) {
+                // Option argument: the rest of this word, or the next one
+                const char *arg = f[1] ? f + 1 : argv[++i];
+                if (!arg) {
+                    fprintf(stderr, "sandbox_sort: -%c needs an argument\n", *f);
+                    return 2;
+                }
+                if (*f == 't') {
+                    if (strlen(arg) != 1) {
+                        fprintf(stderr, "sandbox_sort: separator must be one character\n");
+                        return 2;
+                    }
+                    separator = (unsigned char)arg[0];
+                } else if (*f == 'k') {
+                    if (parse_key(arg) < 0) {
+                        fprintf(stderr, "sandbox_sort: invalid key '%s'\n", arg);
+                        return 2;
+                    }
+                } else if (*f == 'S') {
+                    if (!(memory = parse_size(arg))) {
+                        fprintf(stderr, "sandbox_sort: invalid size '%s' (minimum 1M)\n", arg);
+                        return 2;
+                    }
+                } else {
+                    tmpdir = arg;
+                }
+                break;
+            } else {
+                fprintf(stderr, "sandbox_sort: unknown option -%c\n", *f);
+                return 2;
+            }
+        }
+    }
+
+    if (!key_modifiers) {
+        key_numeric = numeric;
+        key_reverse = reverse;
+    }
+
+    static char *stdin_only[] = { "-" };
+    inputs = i < argc ? argv + i : stdin_only;
+    input_count = i < argc ? argc - i : 1;
+
+    signal(SIGINT, cleanup_signal);
+    signal(SIGTERM, cleanup_signal);
+    signal(SIGHUP, cleanup_signal);
+    signal(SIGPIPE, cleanup_signal);
+    signal(SIGXCPU, cleanup_signal);   // RLIMIT_CPU from the shell
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = cpus < 1 ? 1 : cpus > MAX_WORKERS ? MAX_WORKERS : (int)cpus;
+    int nslots = workers + 1;          // one more to read into while the rest sort
+    Slot *slots = calloc(nslots, sizeof(Slot));
+    size_t slot_size = (memory / nslots) & ~(size_t)(sizeof(double) - 1);
+    for (int s = 0; s < nslots; s++) {
+        slots[s].size = slot_size;
+        slots[s].mem = malloc(slot_size);
+        if (!slots[s].mem) fail("sandbox_sort");
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, WORKER_STACK);
+
+    out.buf = malloc(WRITE_BUFFER);
+    spill.buf = malloc(WRITE_BUFFER);
+    if (!out.buf || !spill.buf) fail("sandbox_sort");
+
+    // Phase 1: sorted runs. Slots are used round-robin; reusing one first
+    // joins its worker and spills its run.
+    const char *carry = NULL;
+    size_t carry_len = 0;
+    int more = 1;
+    long seq = 0;
+    for (int s = 0; more; s = (s + 1) % nslots) {
+        Slot *slot = &slots[s];
+        if (slot->sorting) {
+            pthread_join(slot->thread, NULL);
+            slot->sorting = 0;
+        }
+        if (slot->sorted) spill_slot(slot);
+
+        more = fill_slot(slot, carry, carry_len, &carry, &carry_len);
+        if (slot->nlines == 0) continue;
+        slot->seq = seq++;
+        slot->sorted = 1;
+        if (!more && seq == 1) {
+            sort_slot(slot);   // everything fit in one slot: no threads needed
+        } else if (pthread_create(&slot->thread, &attr, sort_slot, slot) == 0) {
+            slot->sorting = 1;
+        } else {
+            sort_slot(slot);
+        }
+    }
+
+    // Slots still holding runs, oldest first
+    Slot *order[MAX_WORKERS + 1];
+    int nmem = 0;
+    for (int s = 0; s < nslots; s++) {
+        if (slots[s].sorting) pthread_join(slots[s].thread, NULL);
+        if (!slots[s].sorted) continue;
+        int j = nmem++;
+        while (j > 0 && order[j - 1]->seq > slots[s].seq) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = &slots[s];
+    }
+
+    // Phase 2. Without spilled runs, merge the slots in memory. Otherwise
+    // spill them too and merge the files with the whole budget as buffers.
+    Source *srcs = calloc(nruns + nmem, sizeof(Source));
+    int k = 0;
+    if (nruns == 0) {
+        for (; k < nmem; k++) {
+            srcs[k].slot = order[k];
+            srcs[k].fd = -1;
+        }
+    } else {
+        for (int m = 0; m < nmem; m++) spill_slot(order[m]);
+        for (int s = 0; s < nslots; s++) free(slots[s].mem);
+        for (; k < nruns; k++) open_run(&srcs[k], runs[k], memory / nruns);
+    }
+    if (k == 1 && srcs[0].slot) {
+        write_slot(srcs[0].slot, &out);
+    } else if (k > 0) {
+        merge(srcs, k, &out);
+    }
+    writer_flush(&out);
+    cleanup_spill();
+
+    for (int m = 0; m < k; m++) {
+        if (!srcs[m].slot) {
+            close(srcs[m].fd);
+            free(srcs[m].buf);
+        }
+    }
+    if (nruns == 0) {
+        for (int s = 0; s < nslots; s++) free(slots[s].mem);
+    }
+    free(srcs);
+    free(slots);
+    free(out.buf);
+    free(spill.buf);
+    return 0;
+}
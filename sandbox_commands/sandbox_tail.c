@@ -0,0 +1,403 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+// Custom tail implementation - Sandboxed Shell
+// Usage: tail [-n [+]lines | -c [+]bytes | -lines] [-f] [file...]
+//   -n  print the last lines (default 10); +N starts at line N instead
+//   -c  print the last bytes; +N starts at byte N instead
+//   -f  keep following the files and print whatever is appended to them
+//
+// A regular file is never read further than what gets printed: tail reads
+// backward from EOF in TAIL_BLOCK pieces until it has counted enough
+// newlines, then copies from there. The last lines of a multi-GB log cost a
+// couple of preads. Pipes have to be read to the end; only the blocks that
+// can still hold the last lines are kept.
+//
+// -f sleeps on inotify (Linux) until a followed file changes; elsewhere it
+// checks once a second.
+
+#define TAIL_BLOCK (64 << 10)
+
+long long count = 10;
+int bytes = 0;
+int from_start = 0;         // +N: count from the beginning instead
+
+int write_all(const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t k = write(STDOUT_FILENO, p, n);
+        if (k < 0) {
+            if (errno == EINTR) continue;
+            perror("sandbox_tail: write error");
+            return -1;
+        }
+        p += k;
+        n -= k;
+    }
+    return 0;
+}
+
+// Copy fd from its current offset to EOF
+int copy_rest(int fd, const char *name) {
+    static char buf[TAIL_BLOCK];
+    while (1) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror(name);
+            return -1;
+        }
+        if (n == 0) return 0;
+        if (write_all(buf, n) < 0) return -1;
+    }
+}
+
+// Index of the last '\n' in p[0..len), or -1
+long last_newline(const char *p, size_t len) {
+    while (len > 0) {
+        if (p[--len] == '\n') return (long)len;
+    }
+    return -1;
+}
+
+// Where the last count lines of [0, size) start, scanning backward in
+// blocks. *pending counts newlines seen in earlier (later-in-file) calls, so
+// the scan can be fed piecewise; returns -1 while the start is not found.
+// A newline at the very end of the data ends the last line rather than
+// starting a new one.
+long long scan_back(const char *block, size_t len, long long block_pos, long long end,
+                    long long *pending) {
+    size_t i = len;
+    if (block_pos + (long long)len == end && len > 0 && block[len - 1] == '\n') i--;
+    long nl;
+    while (i > 0 && (nl = last_newline(block, i)) >= 0) {
+        if (++*pending >= count) return block_pos + nl + 1;
+        i = nl;
+    }
+    return -1;
+}
+
+int tail_regular(int fd, const char *name, struct stat *st) {
+    long long size = st->st_size;
+    long long start = 0;
+
+    if (bytes) {
+        start = size > count ? size - count : 0;
+    } else if (count == 0) {
+        start = size;
+    } else {
+        static char buf[TAIL_BLOCK];
+        long long pos = size, pending = 0;
+        while (pos > 0) {
+            size_t len = pos < TAIL_BLOCK ? (size_t)pos : TAIL_BLOCK;
+            pos -= len;
+            size_t got = 0;
+            while (got < len) {
+                ssize_t n = pread(fd, buf + got, len - got, pos + got);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) {
+                    if (n < 0) perror(name);
+                    return -1;
+                }
+                got += n;
+            }
+            long long found = scan_back(buf, len, pos, size, &pending);
+            if (found >= 0) {
+                start = found;
+                break;
+            }
+        }
+    }
+    if (lseek(fd, start, SEEK_SET) < 0) {
+        perror(name);
+        return -1;
+    }
+    return copy_rest(fd, name);
+}
+
+typedef struct Block {
+    struct Block *next;
+    size_t len;
+    long long lines;
+    char data[TAIL_BLOCK];
+} Block;
+
+// Pipes: read to EOF, dropping leading blocks that can no longer hold any
+// of the last count lines (or bytes)
+int tail_stream(int fd, const char *name) {
+    Block *head = NULL, *last = NULL;
+    long long total = 0;     // newlines (or bytes) in the kept blocks
+    int status = 0;
+
+    while (1) {
+        Block *b = malloc(sizeof(Block));
+        if (!b) {
+            perror("sandbox_tail");
+            status = -1;
+            break;
+        }
+        b->next = NULL;
+        b->len = 0;
+        while (b->len < TAIL_BLOCK) {
+            ssize_t n = read(fd, b->data + b->len, TAIL_BLOCK - b->len);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                perror(name);
+                status = -1;
+            }
+            if (n <= 0) break;
+            b->len += n;
+        }
+        if (b->len == 0) {
+            free(b);
+            break;
+        }
+        b->lines = 0;
+        if (!bytes) {
+            for (const char *p = b->data, *end = b->data + b->len;
+                 (p = memchr(p, '\n', end - p)) != NULL; p++) {
+                b->lines++;
+            }
+        }
+        total += bytes ? (long long)b->len : b->lines;
+        if (last) last->next = b; else head = b;
+        last = b;
+
+        long long head_size = bytes ? (long long)head->len : head->lines;
+        while (head != last && total - head_size > count) {
+            Block *drop = head;
+            head = head->next;
+            total -= head_size;
+            free(drop);
+            head_size = bytes ? (long long)head->len : head->lines;
+        }
+        if (b->len < TAIL_BLOCK) break;   // EOF or error
+    }
+
+    // Find the start among the kept blocks, newest first
+    long long end = 0, start_block = 0, start = 0, pending = 0;
+    int nblocks = 0;
+    for (Block *b = head; b; b = b->next) {
+        end += b->len;
+        nblocks++;
+    }
+    Block **order = malloc((nblocks ? nblocks : 1) * sizeof(Block *));
+    long long pos = 0;
+    int k = 0;
+    for (Block *b = head; b; b = b->next) order[k++] = b;
+    if (bytes) {
+        start = end > count ? end - count : 0;
+    } else if (count == 0) {
+        start = end;
+    } else {
+        pos = end;
+        for (k = nblocks - 1; k >= 0; k--) {
+            pos -= order[k]->len;
+            long long found = scan_back(order[k]->data, order[k]->len, pos, end, &pending);
+            if (found >= 0) {
+                start = found;
+                break;
+            }
+        }
+    }
+    pos = 0;
+    for (k = 0; k < nblocks; k++) {
+        Block *b = order[k];
+        if (status == 0 && start < pos + (long long)b->len) {
+            start_block = start > pos ? start - pos : 0;
+            if (write_all(b->data + start_block, b->len - start_block) < 0) status = -1;
+        }
+        pos += b->len;
+        free(b);
+    }
+    free(order);
+    return status;
+}
+
+// +N: skip to line (or byte) N, then copy everything after it
+int tail_from_start(int fd, const char *name) {
+    static char buf[TAIL_BLOCK];
+    long long skip = count > 0 ? count - 1 : 0;
+    while (skip > 0) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            perror(name);
+            return -1;
+        }
+        if (n == 0) return 0;
+        size_t used = n;
+        if (bytes) {
+            used = n < skip ? (size_t)n : (size_t)skip;
+            skip -= used;
+        } else {
+            const char *p = buf, *end = buf + n;
+            while (skip > 0 && (p = memchr(p, '\n', end - p)) != NULL) {
+                p++;
+                skip--;
+            }
+            if (skip == 0) used = p - buf;
+        }
+        if (skip == 0 && write_all(buf + used, n - used) < 0) return -1;
+    }
+    return copy_rest(fd, name);
+}
+
+// ---------------------------------------------------------------- -f
+
+typedef struct {
+    const char *name;
+    int fd;
+    off_t offset;
+    int wd;
+} Followed;
+
+int last_printed = -1;
+
+// Print whatever was appended to file i since the last look
+void follow_update(Followed *files, int nfiles, int i) {
+    Followed *f = &files[i];
+    struct stat st;
+    if (fstat(f->fd, &st) < 0) return;
+    if (st.st_size < f->offset) {
+        fprintf(stderr, "sandbox_tail: %s: file truncated\n", f->name);
+        f->offset = 0;
+    }
+    if (st.st_size == f->offset) return;
+    if (nfiles > 1 && last_printed != i) {
+        char header[512];
+        int n = snprintf(header, sizeof(header), "\n==> %s <==\n", f->name);
+        write_all(header, n < (int)sizeof(header) ? (size_t)n : sizeof(header) - 1);
+    }
+    last_printed = i;
+    lseek(f->fd, f->offset, SEEK_SET);
+    copy_rest(f->fd, f->name);
+    f->offset = lseek(f->fd, 0, SEEK_CUR);
+}
+
+void follow(Followed *files, int nfiles) {
+#ifdef __linux__
+    int ifd = inotify_init1(IN_CLOEXEC);
+    if (ifd >= 0) {
+        for (int i = 0; i < nfiles; i++) {
+            files[i].wd = inotify_add_watch(ifd, files[i].name, IN_MODIFY | IN_ATTRIB);
+        }
+        char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        while (1) {
+            ssize_t n = read(ifd, events, sizeof(events));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            for (char *p = events; p < events + n; ) {
+                struct inotify_event *ev = (struct inotify_event *)p;
+                for (int i = 0; i < nfiles; i++) {
+                    if (files[i].wd == ev->wd) follow_update(files, nfiles, i);
+                }
+                p += sizeof(struct inotify_event) + ev->len;
+            }
+        }
+        close(ifd);
+        return;
+    }
+#endif
+    while (1) {
+        sleep(1);
+        for (int i = 0; i < nfiles; i++) follow_update(files, nfiles, i);
+    }
+}
+
+// ---------------------------------------------------------------- main
+
+int tail_fd(int fd, const char *name) {
+    struct stat st;
+    if (from_start) return tail_from_start(fd, name);
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) return tail_regular(fd, name, &st);
+    return tail_stream(fd, name);
+}
+
+int parse_count(const char *text) {
+    char *end;
+    if (*text == '+') {
+        from_start = 1;
+        text++;
+    }
+    errno = 0;
+    count = strtoll(text, &end, 10);
+    return (*text && !*end && count >= 0 && errno == 0) ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    int follow_mode = 0;
+    int i = 1;
+
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        const char *arg = NULL;
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        } else if (strcmp(argv[i], "-f") == 0) {
+            follow_mode = 1;
+            continue;
+        } else if (argv[i][1] == 'n' || argv[i][1] == 'c') {
+            bytes = argv[i][1] == 'c';
+            arg = argv[i][2] ? argv[i] + 2 : argv[++i];
+        } else if (argv[i][1] >= '0' && argv[i][1] <= '9') {
+            bytes = 0;
+            arg = argv[i] + 1;   // old style: tail -5
+        } else {
+            fprintf(stderr, "sandbox_tail: unknown option %s\n", argv[i]);
+            return 1;
+        }
+        if (!arg || parse_count(arg) < 0) {
+            fprintf(stderr, "sandbox_tail: invalid number of %s: '%s'\n",
+                    bytes ? "bytes" : "lines", arg ? arg : "");
+            return 1;
+        }
+    }
+
+    if (i >= argc) {
+        // A pipe has nothing more to follow once it hits EOF
+        return tail_fd(STDIN_FILENO, "(standard input)") < 0;
+    }
+
+    int status = 0;
+    int nfiles = argc - i;
+    Followed *files = calloc(nfiles, sizeof(Followed));
+    int nfollowed = 0;
+    for (int k = 0; k < nfiles; k++) {
+        const char *name = argv[i + k];
+        int fd = open(name, O_RDONLY);
+        if (fd < 0) {
+            perror(name);
+            status = 1;
+            continue;
+        }
+        if (nfiles > 1) {
+            char header[512];
+            int n = snprintf(header, sizeof(header), "%s==> %s <==\n", k > 0 ? "\n" : "", name);
+            write_all(header, n < (int)sizeof(header) ? (size_t)n : sizeof(header) - 1);
+        }
+        if (tail_fd(fd, name) < 0) status = 1;
+        if (follow_mode) {
+            files[nfollowed].name = name;
+            files[nfollowed].fd = fd;
+            files[nfollowed].offset = lseek(fd, 0, SEEK_END);
+            files[nfollowed].wd = -1;
+            last_printed = nfollowed++;
+        } else {
+            close(fd);
+        }
+    }
+    if (follow_mode && nfollowed > 0) {
+        follow(files, nfollowed);
+    }
+    free(files);
+    return status;
+}
@@ -0,0 +1,611 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <limits.h>
+#include <stdint.h>
+
+// Custom uniq implementation - Sandboxed Shell
+// Usage: uniq [-c] [-d | -u] [-g] [-S size] [-T dir] [file]
+//   -c  prefix each line with its number of occurrences
+//   -d  only print lines that occur more than once
+//   -u  only print lines that occur once
+//   -g  global: count equal lines anywhere in the input, not just adjacent
+//       ones, and print them in order of first appearance
+//   -S  memory for the -g table, e.g. 16M (default 48M)
+//   -T  directory for -g temporary files (default: the current directory)
+//
+// Without -g this is the classic single pass over adjacent lines, so it
+// needs no more memory than the longest line.
+//
+// -g replaces "sort | uniq -c" with one pass over the input. Distinct lines
+// are copied into an arena, and an open-addressing table of arena offsets
+// indexes them. Arena order is first-appearance order. If the table outgrows
+// -S, everything (the table's lines and the rest of the input) is partitioned
+// by hash into SPILL_PARTITIONS files, as records of (first position, count,
+// line). Each partition is then deduplicated on its own, recursively if it
+// is still too big. The per-partition results are merged back by first
+// position, so the output order is the same as without spilling.
+
+#define DEFAULT_MEMORY (48 << 20)
+#define READ_BUFFER (256 << 10)
+#define WRITE_BUFFER (256 << 10)
+#define SPILL_PARTITIONS 16
+#define PARTITION_BITS 4
+#define MAX_LEVEL 16            // 64 hash bits / PARTITION_BITS
+#define INITIAL_SLOTS 4096
+
+int show_count = 0, only_dups = 0, only_unique = 0;
+
+void cleanup_spill();
+
+void fail(const char *what) {
+    perror(what);
+    cleanup_spill();
+    exit(1);
+}
+
+// ---------------------------------------------------------------- buffered I/O
+
+typedef struct {
+    int fd;
+    const char *name;
+    char *buf;
+    size_t pos, len, cap;
+    int eof;
+} Input;
+
+void input_open(Input *in, int fd, const char *name) {
+    in->fd = fd;
+    in->name = name;
+    in->cap = READ_BUFFER;
+    in->buf = malloc(in->cap);
+    in->pos = in->len = 0;
+    in->eof = 0;
+    if (!in->buf) fail("sandbox_uniq");
+}
+
+void input_close(Input *in) {
+    if (in->fd != STDIN_FILENO) close(in->fd);
+    free(in->buf);
+}
+
+// Make at least need bytes available at in->buf + in->pos; returns how many
+// there are (fewer only at end of file)
+size_t input_fill(Input *in, size_t need) {
+    while (in->len - in->pos < need && !in->eof) {
+        if (in->pos > 0) {
+            memmove(in->buf, in->buf + in->pos, in->len - in->pos);
+            in->len -= in->pos;
+            in->pos = 0;
+        }
+        if (in->len == in->cap || need > in->cap) {
+            size_t cap = in->cap * 2 > need ? in->cap * 2 : need;
+            char *bigger = realloc(in->buf, cap);
+            if (!bigger) fail("sandbox_uniq: line too long");
+            in->buf = bigger;
+            in->cap = cap;
+        }
+        ssize_t n = read(in->fd, in->buf + in->len, in->cap - in->len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fail(in->name);
+        }
+        if (n == 0) in->eof = 1;
+        in->len += n;
+    }
+    return in->len - in->pos;
+}
+
+// Next line without its newline; valid until the next call. A last line
+// without a newline still counts. Returns 0 at end of input.
+int next_line(Input *in, const char **line, size_t *len) {
+    size_t scanned = 0;
+    while (1) {
+        size_t avail = in->len - in->pos;
+        char *nl = memchr(in->buf + in->pos + scanned, '\n', avail - scanned);
+        if (nl) {
+            *line = in->buf + in->pos;
+            *len = nl - *line;
+            in->pos += *len + 1;
+            return 1;
+        }
+        scanned = avail;
+        if (input_fill(in, avail + 1) == avail) {
+            if (avail == 0) return 0;
+            *line = in->buf + in->pos;
+            *len = avail;
+            in->pos += avail;
+            return 1;
+        }
+    }
+}
+
+typedef struct {
+    int fd;
+    const char *name;
+    char *buf;
+    size_t len, cap;
+} Writer;
+
+void writer_flush(Writer *w) {
+    size_t done = 0;
+    while (done < w->len) {
+        ssize_t n = write(w->fd, w->buf + done, w->len - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fail(w->name);
+        }
+        done += n;
+    }
+    w->len = 0;
+}
+
+void writer_put(Writer *w, const void *p, size_t n) {
+    if (w->len + n > w->cap) {
+        writer_flush(w);
+        while (n > w->cap) {
+            // Bigger than the whole buffer: write it straight through
+            ssize_t k = write(w->fd, p, n);
+            if (k < 0) {
+                if (errno == EINTR) continue;
+                fail(w->name);
+            }
+            p = (const char *)p + k;
+            n -= k;
+        }
+    }
+    memcpy(w->buf + w->len, p, n);
+    w->len += n;
+}
+
+Writer out = { STDOUT_FILENO, "sandbox_uniq: write error", NULL, 0, WRITE_BUFFER };
+
+// Print one group, applying -c/-d/-u
+void print_line(uint64_t count, const char *line, size_t len) {
+    if ((only_dups && count < 2) || (only_unique && count != 1)) return;
+    if (show_count) {
+        char prefix[32];
+        int n = snprintf(prefix, sizeof(prefix), "%7llu ", (unsigned long long)count);
+        writer_put(&out, prefix, n);
+    }
+    writer_put(&out, line, len);
+    writer_put(&out, "\n", 1);
+}
+
+// ---------------------------------------------------------------- adjacent mode
+
+void uniq_adjacent(Input *in) {
+    char *prev = NULL;
+    size_t prev_len = 0, prev_cap = 0;
+    uint64_t count = 0;
+    const char *line;
+    size_t len;
+
+    while (next_line(in, &line, &len)) {
+        if (count > 0 && len == prev_len && memcmp(line, prev, len) == 0) {
+            count++;
+            continue;
+        }
+        if (count > 0) print_line(count, prev, prev_len);
+        if (len > prev_cap) {
+            prev_cap = len * 2;
+            free(prev);
+            prev = malloc(prev_cap);
+            if (!prev) fail("sandbox_uniq");
+        }
+        memcpy(prev, line, len);
+        prev_len = len;
+        count = 1;
+    }
+    if (count > 0) print_line(count, prev, prev_len);
+    free(prev);
+}
+
+// ---------------------------------------------------------------- spill files
+
+const char *tmpdir = ".";
+char spill_dir[PATH_MAX];
+int spill_files = 0;
+
+void spill_path(char *path, size_t size, int file) {
+    snprintf(path, size, "%s/part%d", spill_dir, file);
+}
+
+void cleanup_spill() {
+    if (!spill_dir[0]) return;
+    char path[PATH_MAX + 32];
+    for (int i = 0; i < spill_files; i++) {
+        spill_path(path, sizeof(path), i);
+        unlink(path);
+    }
+    rmdir(spill_dir);
+    spill_dir[0] = '\0';
+}
+
+void cleanup_signal(int sig) {
+    cleanup_spill();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+// New spill file open for writing; *file is its number for spill_open()
+void spill_create(Writer *w, int *file) {
+    if (!spill_dir[0]) {
+        snprintf(spill_dir, sizeof(spill_dir), "%s/.sandbox_uniq.XXXXXX", tmpdir);
+        if (!mkdtemp(spill_dir)) {
+            spill_dir[0] = '\0';
+            fprintf(stderr, "sandbox_uniq: cannot create temporary directory in %s: %s\n",
+                    tmpdir, strerror(errno));
+            exit(1);
+        }
+    }
+    char path[PATH_MAX + 32];
+    *file = spill_files++;
+    spill_path(path, sizeof(path), *file);
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (w->fd < 0) fail(path);
+    w->name = "sandbox_uniq: temporary file";
+    w->len = 0;
+    w->cap = WRITE_BUFFER;
+    w->buf = malloc(w->cap);
+    if (!w->buf) fail("sandbox_uniq");
+}
+
+void spill_finish(Writer *w) {
+    writer_flush(w);
+    if (close(w->fd) < 0) fail("sandbox_uniq: temporary file");
+    free(w->buf);
+}
+
+// Reopen a finished spill file for reading; it is unlinked right away and
+// stays readable through the descriptor
+void spill_open(Input *in, int file) {
+    char path[PATH_MAX + 32];
+    spill_path(path, sizeof(path), file);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) fail(path);
+    unlink(path);
+    input_open(in, fd, "sandbox_uniq: temporary file");
+}
+
+// Spill records: first position, count, length, then the line bytes
+typedef struct {
+    uint64_t seq;
+    uint64_t count;
+    uint32_t len;
+} RecordHeader;
+
+void put_record(Writer *w, uint64_t seq, uint64_t count, const char *line, uint32_t len) {
+    RecordHeader h;
+    memset(&h, 0, sizeof(h));
+    h.seq = seq;
+    h.count = count;
+    h.len = len;
+    writer_put(w, &h, sizeof(h));
+    writer_put(w, line, len);
+}
+
+int next_record(Input *in, RecordHeader *h, const char **line) {
+    if (input_fill(in, sizeof(*h)) < sizeof(*h)) return 0;
+    memcpy(h, in->buf + in->pos, sizeof(*h));
+    if (input_fill(in, sizeof(*h) + h->len) < sizeof(*h) + h->len) {
+        fprintf(stderr, "sandbox_uniq: temporary file truncated\n");
+        cleanup_spill();
+        exit(1);
+    }
+    *line = in->buf + in->pos + sizeof(*h);
+    in->pos += sizeof(*h) + h->len;
+    return 1;
+}
+
+// ---------------------------------------------------------------- hash table
+
+typedef struct {
+    uint64_t hash;
+    uint64_t seq;           // position of the first occurrence
+    uint64_t count;
+    uint32_t len;
+    char data[];
+} Entry;
+
+size_t memory = DEFAULT_MEMORY;
+char *arena = NULL;         // Entries back to back, in first-seen order
+size_t arena_used = 0, arena_cap = 0;
+uint32_t *slots;            // arena offset / 8 + 1, 0 = empty
+size_t nslots = 0, nentries = 0;
+
+uint64_t hash_line(const char *p, size_t len) {
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ len;
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        h = (h ^ v) * 0xBF58476D1CE4E5B9ull;
+        h ^= h >> 31;
+        p += 8;
+        len -= 8;
+    }
+    uint64_t v = 0;
+    memcpy(&v, p, len);
+    h = (h ^ v) * 0x94D049BB133111EBull;
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ull;
+    return h ^ (h >> 32);
+}
+
+size_t entry_size(size_t len) {
+    return (sizeof(Entry) + len + 7) & ~(size_t)7;
+}
+
+Entry *entry_at(uint32_t slot) {
+    return (Entry *)(arena + (size_t)(slot - 1) * 8);
+}
+
+void table_reset() {
+    arena_used = 0;
+    nentries = 0;
+    memset(slots, 0, nslots * sizeof(uint32_t));
+}
+
+// The arena and both generations of the slot array during a rehash must fit
+// in the budget together; that is what RLIMIT_AS sees.
+int table_grow() {
+    size_t bigger = nslots * 2;
+    if (arena_cap + (nslots + bigger) * sizeof(uint32_t) > memory) return -1;
+    uint32_t *grown = calloc(bigger, sizeof(uint32_t));
+    if (!grown) return -1;
+    for (size_t off = 0; off < arena_used; ) {
+        Entry *e = (Entry *)(arena + off);
+        size_t i = e->hash & (bigger - 1);
+        while (grown[i]) i = (i + 1) & (bigger - 1);
+        grown[i] = off / 8 + 1;
+        off += entry_size(e->len);
+    }
+    free(slots);
+    slots = grown;
+    nslots = bigger;
+    return 0;
+}
+
+// Count a line, adding it on first sight. Returns -1 when it would not fit
+// in the memory budget; the table is unchanged then.
+int table_add(uint64_t hash, uint64_t seq, uint64_t count, const char *line, size_t len) {
+    size_t i = hash & (nslots - 1);
+    for (; slots[i]; i = (i + 1) & (nslots - 1)) {
+        Entry *e = entry_at(slots[i]);
+        if (e->hash == hash && e->len == len && memcmp(e->data, line, len) == 0) {
+            e->count += count;
+            return 0;
+        }
+    }
+    size_t size = entry_size(len);
+    if (len > UINT32_MAX || (arena_used + size) / 8 >= UINT32_MAX) return -1;
+    if (2 * (nentries + 1) > nslots) {
+        if (table_grow() < 0) return -1;
+        return table_add(hash, seq, count, line, len);
+    }
+    if (arena_used + size > arena_cap) {
+        // Entries are found by offset, so the arena may move
+        size_t cap = arena_cap * 2 > arena_used + size ? arena_cap * 2 : arena_used + size;
+        if (cap + nslots * sizeof(uint32_t) > memory) cap = memory - nslots * sizeof(uint32_t);
+        if (cap < arena_used + size) return -1;
+        char *grown = realloc(arena, cap);
+        if (!grown) return -1;
+        arena = grown;
+        arena_cap = cap;
+    }
+    Entry *e = (Entry *)(arena + arena_used);
+    e->hash = hash;
+    e->seq = seq;
+    e->count = count;
+    e->len = len;
+    memcpy(e->data, line, len);
+    slots[i] = arena_used / 8 + 1;
+    arena_used += size;
+    nentries++;
+    return 0;
+}
+
+// ---------------------------------------------------------------- global mode
+
+// Results of one dedupe pass go either to the output or to a spill file
+typedef struct {
+    Writer *spill;          // NULL = print
+} Sink;
+
+void sink_put(Sink *sink, uint64_t seq, uint64_t count, const char *line, size_t len) {
+    if (sink->spill) {
+        put_record(sink->spill, seq, count, line, len);
+    } else {
+        print_line(count, line, len);
+    }
+}
+
+// Deduplicate a stream into sink in first-seen order. At level 0 the stream
+// is the input text; deeper levels read spill records from a partition.
+void dedupe(Input *in, int level, Sink *sink) {
+    uint64_t seq = 0;
+    RecordHeader h = { 0, 1, 0 };
+    const char *line;
+    size_t len;
+    Writer parts[SPILL_PARTITIONS];
+    int part_files[SPILL_PARTITIONS];
+    int spilling = 0;
+
+    table_reset();
+    while (1) {
+        if (level == 0) {
+            if (!next_line(in, &line, &len)) break;
+            h.seq = seq++;
+        } else {
+            if (!next_record(in, &h, &line)) break;
+            len = h.len;
+        }
+        uint64_t hash = hash_line(line, len);
+        if (!spilling && table_add(hash, h.seq, h.count, line, len) == 0) continue;
+
+        if (!spilling) {
+            // Over budget: route the table and the rest of the stream to
+            // partitions by the next PARTITION_BITS of the hash
+            if (level >= MAX_LEVEL) {
+                fprintf(stderr, "sandbox_uniq: too many distinct lines for -S %zu\n", memory);
+                cleanup_spill();
+                exit(1);
+            }
+            for (int p = 0; p < SPILL_PARTITIONS; p++) spill_create(&parts[p], &part_files[p]);
+            for (size_t off = 0; off < arena_used; ) {
+                Entry *e = (Entry *)(arena + off);
+                int p = (e->hash >> (level * PARTITION_BITS)) & (SPILL_PARTITIONS - 1);
+                put_record(&parts[p], e->seq, e->count, e->data, e->len);
+                off += entry_size(e->len);
+            }
+            table_reset();
+            spilling = 1;
+        }
+        int p = (hash >> (level * PARTITION_BITS)) & (SPILL_PARTITIONS - 1);
+        put_record(&parts[p], h.seq, h.count, line, len);
+    }
+
+    if (!spilling) {
+        for (size_t off = 0; off < arena_used; ) {
+            Entry *e = (Entry *)(arena + off);
+            sink_put(sink, e->seq, e->count, e->data, e->len);
+            off += entry_size(e->len);
+        }
+        return;
+    }
+
+    // Each partition holds complete groups; dedupe them one at a time
+    int result_files[SPILL_PARTITIONS];
+    for (int p = 0; p < SPILL_PARTITIONS; p++) {
+        spill_finish(&parts[p]);
+    }
+    for (int p = 0; p < SPILL_PARTITIONS; p++) {
+        Input part;
+        Writer result;
+        Sink to_result = { &result };
+        spill_open(&part, part_files[p]);
+        spill_create(&result, &result_files[p]);
+        dedupe(&part, level + 1, &to_result);
+        spill_finish(&result);
+        input_close(&part);
+    }
+
+    // Every result file is in first-seen order; merge them on that
+    Input results[SPILL_PARTITIONS];
+    RecordHeader heads[SPILL_PARTITIONS];
+    const char *lines[SPILL_PARTITIONS];
+    int live[SPILL_PARTITIONS];
+    for (int p = 0; p < SPILL_PARTITIONS; p++) {
+        spill_open(&results[p], result_files[p]);
+        live[p] = next_record(&results[p], &heads[p], &lines[p]);
+    }
+    while (1) {
+        int best = -1;
+        for (int p = 0; p < SPILL_PARTITIONS; p++) {
+            if (live[p] && (best < 0 || heads[p].seq < heads[best].seq)) best = p;
+        }
+        if (best < 0) break;
+        sink_put(sink, heads[best].seq, heads[best].count, lines[best], heads[best].len);
+        live[best] = next_record(&results[best], &heads[best], &lines[best]);
+    }
+    for (int p = 0; p < SPILL_PARTITIONS; p++) input_close(&results[p]);
+}
+
+// ---------------------------------------------------------------- main
+
+size_t parse_size(const char *text) {
+    char *end;
+    double v = strtod(text, &end);
+    switch (*end) {
+    case 'K': case 'k': v *= 1 << 10; end++; break;
+    case 'M': case 'm': v *= 1 << 20; end++; break;
+    case 'G': case 'g': v *= 1 << 30; end++; break;
+    }
+    return (*end || v < (1 << 20)) ? 0 : (size_t)v;
+}
+
+int main(int argc, char *argv[]) {
+    int global = 0;
+    int i = 1;
+
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        for (const char *f = argv[i] + 1; *f; f++) {
+            if (*f == 'c') {
+                show_count = 1;
+            } else if (*f == 'd') {
+                only_dups = 1;
+            } else if (*f == 'u') {
+                only_unique = 1;
+            } else if (*f == 'g') {
+                global = 1;
+            } else if (*f == 'S' || *f == 'T') {
+                const char *arg = f[1] ? f + 1 : argv[++i];
+                if (!arg) {
+                    fprintf(stderr, "sandbox_uniq: -%c needs an argument\n", *f);
+                    return 1;
+                }
+                if (*f == 'T') {
+                    tmpdir = arg;
+                } else if (!(memory = parse_size(arg))) {
+                    fprintf(stderr, "sandbox_uniq: invalid size '%s' (minimum 1M)\n", arg);
+                    return 1;
+                }
+                break;
+            } else {
+                fprintf(stderr, "sandbox_uniq: unknown option -%c\n", *f);
+                return 1;
+            }
+        }
+    }
+    if (argc - i > 1) {
+        fprintf(stderr, "sandbox_uniq: extra operand '%s'\n", argv[i + 1]);
+        return 1;
+    }
+
+    Input in;
+    if (i < argc && strcmp(argv[i], "-") != 0) {
+        int fd = open(argv[i], O_RDONLY);
+        if (fd < 0) {
+            perror(argv[i]);
+            return 1;
+        }
+        input_open(&in, fd, argv[i]);
+    } else {
+        input_open(&in, STDIN_FILENO, "(standard input)");
+    }
+    out.buf = malloc(out.cap);
+    if (!out.buf) fail("sandbox_uniq");
+
+    if (global) {
+        signal(SIGINT, cleanup_signal);
+        signal(SIGTERM, cleanup_signal);
+        signal(SIGHUP, cleanup_signal);
+        signal(SIGPIPE, cleanup_signal);
+        signal(SIGXCPU, cleanup_signal);   // RLIMIT_CPU from the shell
+
+        nslots = INITIAL_SLOTS;
+        slots = calloc(nslots, sizeof(uint32_t));
+        if (!slots) fail("sandbox_uniq");
+        Sink sink = { NULL };
+        dedupe(&in, 0, &sink);
+        free(arena);
+        free(slots);
+    } else {
+        uniq_adjacent(&in);
+    }
+
+    writer_flush(&out);
+    input_close(&in);
+    free(out.buf);
+    cleanup_spill();
+    return 0;
+}
@@ -58,11 +58,13 @@ int main(int argc, char *argv[]) {
     }
     
     int total_lines = 0, total_words = 0, total_chars = 0;
+    int status = 0;
     
     for (; i < argc; i++) {
         FILE *fp = fopen(argv[i], "r");
         if (!fp) {
             perror(argv[i]);
+            status = 1;
             continue;
         }
         
@@ -100,6 +102,6 @@ int main(int argc, char *argv[]) {
         printf(" total\n");
     }
     
-    return 0;
+    return status;
 }
 
@@ -9,9 +9,13 @@ import subprocess
 import threading
 import queue
 import os
+import re
+import struct
 import sys
+import json
+import time
 from datetime import datetime
-from collections import deque
+from collections import OrderedDict, deque
 
 # Initialize pygame
 pygame.init()
@@ -43,43 +47,125 @@ except:
     title_font = pygame.font.Font(None, 20)
     small_font = pygame.font.Font(None, 14)
 
+# The shell colors its messages for terminals; the GUI colors lines itself
+ANSI_ESCAPE = re.compile(r'\x1b\[[0-9;]*m')
+
+# How long TAB waits for the shell's answer to a completion request
+COMPLETION_TIMEOUT = 0.5
+
+# Terminal area geometry
+TERMINAL_Y = 120
+TERMINAL_HEIGHT = HEIGHT - 200
+LINE_HEIGHT = 18
+VISIBLE_LINES = (TERMINAL_HEIGHT - 20) // LINE_HEIGHT
+MAX_LINE_CHARS = 150
+
+# Output handling: the scrollback keeps the last SCROLLBACK_LINES lines and
+# each frame spends at most DRAIN_BUDGET seconds adding output to it. Every
+# frame takes all the reader thread has queued; lines that more than a
+# scrollback's worth of newer output would push out before they are shown
+# are counted and dropped unread, so a large cat costs what its last
+# SCROLLBACK_LINES lines cost. The reader waits if OUTPUT_QUEUE_BATCHES
+# frames are queued, which only happens while the GUI is not drawing.
+SCROLLBACK_LINES = 10000
+DRAIN_BUDGET = 0.002
+OUTPUT_QUEUE_BATCHES = 256
+# Rendered text surfaces kept, keyed by font, text and color
+TEXT_CACHE_SIZE = 512
+
 class TerminalLine:
     """Represents a single line in the terminal"""
+    __slots__ = ('text', 'color', 'is_prompt')
+
     def __init__(self, text, color=TEXT_COLOR, is_prompt=False):
         self.text = text
         self.color = color
         self.is_prompt = is_prompt
-        self.timestamp = datetime.now()
+
+class Scrollback:
+    """Fixed-capacity ring of TerminalLines; index 0 is the oldest kept"""
+    def __init__(self, capacity):
+        self.slots = [None] * capacity
+        self.capacity = capacity
+        self.start = 0
+        self.count = 0
+        self.total = 0        # lines ever added, so a change shows in it
+
+    def __len__(self):
+        return self.count
+
+    def __getitem__(self, i):
+        if not 0 <= i < self.count:
+            raise IndexError(i)
+        return self.slots[(self.start + i) % self.capacity]
+
+    def append(self, line):
+        self.slots[(self.start + self.count) % self.capacity] = line
+        if self.count < self.capacity:
+            self.count += 1
+        else:
+            self.start = (self.start + 1) % self.capacity
+        self.total += 1
+
+    def skip(self, n):
+        """Count n lines that came and went without being added"""
+        self.total += n
+
+class TextCache:
+    """Rendered text surfaces, least recently used dropped first. Output
+    lines, the header and the help text are rendered once and then only
+    blitted; SDL_ttf renders a whole line in one call, which is cheaper than
+    composing it from per-glyph surfaces in Python."""
+    def __init__(self, size):
+        self.size = size
+        self.surfaces = OrderedDict()
+
+    def render(self, font, text, color):
+        key = (id(font), text, color)
+        surface = self.surfaces.get(key)
+        if surface is None:
+            surface = font.render(text, True, color)
+            self.surfaces[key] = surface
+            if len(self.surfaces) > self.size:
+                self.surfaces.popitem(last=False)
+        else:
+            self.surfaces.move_to_end(key)
+        return surface
 
 class SandboxedTerminal:
     def __init__(self):
-        self.output_lines = deque(maxlen=1000)  # Keep max 1000 lines
+        self.output_lines = Scrollback(SCROLLBACK_LINES)
         self.input_buffer = ""
-        self.scroll_offset = 0
+        self.scroll_offset = 0        # lines above the bottom, 0 or negative
+        self.text_cache = TextCache(TEXT_CACHE_SIZE)
+        self.panel = None             # terminal area as last drawn
+        self.panel_key = None         # (lines ever added, scroll) it shows
+        self.frame_key = None         # everything the last frame showed
         self.cursor_visible = True
         self.cursor_timer = 0
         
         # Process state
         self.process = None
-        self.output_queue = queue.Queue()
+        self.output_queue = queue.Queue(maxsize=OUTPUT_QUEUE_BATCHES)
+        self.pending = deque()        # [kind, lines, next index] not yet added
+        self.pending_lines = 0
         self.reader_thread = None
         self.running = True
+        self.shell_ready = False      # set by the first prompt frame
         
         # Sandbox info
         self.start_time = datetime.now()
         self.commands_executed = 0
         self.commands_blocked = 0
         
-        # Tab completion
-        self.available_commands = [
-            'cd', 'exit', 'print_history', 'add_alias', 'remove_alias', 'help', 'stats', 'commands',
-            'ls', 'cat', 'display', 'pwd', 'grep', 'touch', 'mkdir', 'rmdir', 
-            'cp', 'mv', 'head', 'tail', 'wc', 'sort', 'uniq', 'find', 
-            'which', 'date', 'whoami', 'hostname', 'sleep', 'clear'
-        ]
+        # Tab completion: candidates come from the shell ('complete' request,
+        # answered with a 'C' frame), so they follow its policy and aliases
+        self.completion_queue = queue.Queue()
         self.completion_matches = []
         self.completion_index = 0
-        self.last_completion_input = ""  # Track what input we're completing
+        self.completion_base = b""        # input the matches were asked for
+        self.completion_span = (0, 0)     # bytes of it a match replaces
+        self.last_completion_input = ""   # input after the last TAB
         
         # Start the shell
         self.start_shell()
@@ -97,13 +183,15 @@ class SandboxedTerminal:
                 self.add_line("Please compile with: make clean && make", WARNING_COLOR)
                 return
             
+            # --protocol: the shell sends framed output (see run_protocol()
+            # in project_sandboxed.c) so stdout, stderr and exit status of
+            # each command arrive separately and unbuffered
             self.process = subprocess.Popen(
-                [shell_path],
+                [shell_path, '--protocol'],
                 stdin=subprocess.PIPE,
                 stdout=subprocess.PIPE,
-                stderr=subprocess.STDOUT,
-                bufsize=1,
-                universal_newlines=True,
+                stderr=subprocess.DEVNULL,
+                bufsize=0,
                 cwd=os.path.dirname(os.path.abspath(__file__))
             )
             
@@ -114,20 +202,67 @@ class SandboxedTerminal:
         except Exception as e:
             self.add_line(f"ERROR: Failed to start shell: {e}", ERROR_COLOR)
     
+    def read_frame(self):
+        """Read one protocol frame: 1 byte type, 4 byte length, payload"""
+        header = self.read_exact(5)
+        if header is None:
+            return None, None
+        length = struct.unpack('>I', header[1:])[0]
+        payload = self.read_exact(length)
+        if payload is None:
+            return None, None
+        return chr(header[0]), payload
+
+    def read_exact(self, n):
+        data = b""
+        while len(data) < n:
+            chunk = self.process.stdout.read(n - len(data))
+            if not chunk:
+                return None
+            data += chunk
+        return data
+
     def read_output(self):
-        """Read output from shell in separate thread"""
+        """Read frames from shell in separate thread; queues (kind, [lines])
+        per output frame, one item for up to a whole frame of text"""
+        partial = {'O': "", 'E': ""}
         try:
-            for line in iter(self.process.stdout.readline, ''):
-                if line:
-                    self.output_queue.put(line.rstrip())
-                if not self.running:
+            while self.running:
+                kind, payload = self.read_frame()
+                if kind is None:
                     break
+                if kind in partial:
+                    text = partial[kind] + payload.decode('utf-8', errors='replace')
+                    lines = text.split('\n')
+                    partial[kind] = lines.pop()
+                    if lines:
+                        self.output_queue.put((kind, lines))
+                elif kind == 'X':
+                    for k in partial:
+                        if partial[k]:
+                            self.output_queue.put((k, [partial[k]]))
+                            partial[k] = ""
+                    self.output_queue.put(('X', json.loads(payload)))
+                elif kind == 'P':
+                    self.output_queue.put(('P', payload.decode('utf-8', errors='replace')))
+                elif kind == 'C':
+                    self.completion_queue.put(json.loads(payload))
         except Exception as e:
-            self.output_queue.put(f"[ERROR] {e}")
+            self.output_queue.put(('E', [f"[ERROR] {e}"]))
     
     def add_line(self, text, color=TEXT_COLOR, is_prompt=False):
         """Add a line to the terminal display"""
         self.output_lines.append(TerminalLine(text, color, is_prompt))
+        # Scrolled back: stay on the same lines while new ones arrive
+        if self.scroll_offset < 0:
+            self.scroll_offset = max(self.scroll_offset - 1, self.max_scroll())
+
+    def max_scroll(self):
+        """Furthest scroll_offset that still shows a full screen"""
+        return min(0, VISIBLE_LINES - len(self.output_lines))
+
+    def scroll(self, lines):
+        self.scroll_offset = max(self.max_scroll(), min(0, self.scroll_offset + lines))
     
     def add_welcome_message(self):
         """Add welcome message"""
@@ -138,27 +273,65 @@ class SandboxedTerminal:
         self.add_line("", TEXT_COLOR)
     
     def update_output(self):
-        """Update output from queue"""
-        lines_added = 0
-        while not self.output_queue.empty() and lines_added < 10:  # Process max 10 lines per frame
+        """Take everything queued, then add output to the scrollback for at
+        most DRAIN_BUDGET"""
+        while True:
             try:
-                line = self.output_queue.get_nowait()
-                
+                kind, payload = self.output_queue.get_nowait()
+            except queue.Empty:
+                break
+
+            if kind == 'X':
+                # Exit frame: status 126 means the sandbox refused it
+                if payload.get('status') == 126:
+                    self.commands_blocked += 1
+                continue
+            if kind == 'P':
+                if not self.shell_ready:
+                    self.shell_ready = True
+                    self.add_line("  Shell ready.", TEXT_COLOR)
+                continue
+            self.pending.append([kind, payload, 0])
+            self.pending_lines += len(payload)
+
+        # Output the scrollback would lose before showing it is skipped
+        while self.pending and self.pending_lines - self.pending_left() >= SCROLLBACK_LINES:
+            left = self.pending_left()
+            self.pending.popleft()
+            self.pending_lines -= left
+            self.output_lines.skip(left)
+            if self.scroll_offset < 0:
+                self.scroll(-left)
+
+        deadline = time.perf_counter() + DRAIN_BUDGET
+        while self.pending and time.perf_counter() < deadline:
+            batch = self.pending[0]
+            kind, lines, i = batch
+            # A slice at a time between clock checks
+            end = min(len(lines), i + 256)
+            for line in lines[i:end]:
                 # Determine color based on content
+                line = line.rstrip()
+                if '\x1b' in line:
+                    line = ANSI_ESCAPE.sub('', line)
                 color = TEXT_COLOR
-                if "[SANDBOX BLOCKED]" in line or "ERROR" in line:
+                if kind == 'E' or "[SANDBOX BLOCKED]" in line or "ERROR" in line:
                     color = ERROR_COLOR
-                    self.commands_blocked += 1
                 elif "[Sandbox" in line or "sandbox>" in line:
                     color = PROMPT_COLOR
                 elif "✓" in line or "SUCCESS" in line:
                     color = (100, 255, 100)
-                
                 self.add_line(line, color)
-                lines_added += 1
-                
-            except queue.Empty:
-                break
+            self.pending_lines -= end - i
+            if end == len(lines):
+                self.pending.popleft()
+            else:
+                batch[2] = end
+
+    def pending_left(self):
+        """Lines of the oldest pending batch not added yet"""
+        kind, lines, i = self.pending[0]
+        return len(lines) - i
     
     def send_command(self, command):
         """Send command to shell"""
@@ -167,7 +340,7 @@ class SandboxedTerminal:
             return
         
         try:
-            self.process.stdin.write(command + '\n')
+            self.process.stdin.write((command + '\n').encode())
             self.process.stdin.flush()
             self.add_line(f"$ {command}", PROMPT_COLOR, is_prompt=True)
             self.commands_executed += 1
@@ -183,7 +356,7 @@ class SandboxedTerminal:
         pygame.draw.rect(surface, BORDER_COLOR, (10, 10, WIDTH - 20, header_height), 2)
         
         # Title
-        title = title_font.render("🔒 SANDBOXED SHELL ENVIRONMENT", True, SANDBOX_COLOR)
+        title = self.text_cache.render(title_font, "🔒 SANDBOXED SHELL ENVIRONMENT", SANDBOX_COLOR)
         surface.blit(title, (20, 20))
         
         # Status indicators (two rows)
@@ -198,7 +371,7 @@ class SandboxedTerminal:
         for i, (text, color) in enumerate(indicators):
             x = 20 + (i % 2) * 280
             y_pos = y + (i // 2) * 22
-            status_text = small_font.render(text, True, color)
+            status_text = self.text_cache.render(small_font, text, color)
             surface.blit(status_text, (x, y_pos))
         
         # Runtime stats (right side)
@@ -210,43 +383,44 @@ class SandboxedTerminal:
         ]
         
         for i, line in enumerate(stats_lines):
-            stat_text = small_font.render(line, True, WARNING_COLOR)
+            stat_text = self.text_cache.render(small_font, line, WARNING_COLOR)
             surface.blit(stat_text, (WIDTH - 200, 50 + i * 20))
     
     def draw_terminal(self, surface):
-        """Draw terminal output area"""
-        terminal_y = 120
-        terminal_height = HEIGHT - 200
+        """Draw terminal output area. Only the visible lines are drawn, and
+        only when the output or the scroll position changed; otherwise the
+        last drawing is reused."""
         terminal_width = WIDTH - 40
-        
-        # Terminal background
-        pygame.draw.rect(surface, BG_COLOR, (20, terminal_y, terminal_width, terminal_height))
-        pygame.draw.rect(surface, BORDER_COLOR, (20, terminal_y, terminal_width, terminal_height), 1)
-        
-        # Calculate visible lines
-        line_height = 18
-        max_visible_lines = (terminal_height - 20) // line_height
-        
-        # Get lines to display
-        total_lines = len(self.output_lines)
-        start_idx = max(0, total_lines - max_visible_lines + self.scroll_offset)
-        end_idx = min(total_lines, start_idx + max_visible_lines)
-        
-        visible_lines = list(self.output_lines)[start_idx:end_idx]
-        
-        # Draw lines
-        y = terminal_y + 10
-        for line in visible_lines:
-            # Truncate long lines
-            display_text = line.text[:150] if len(line.text) > 150 else line.text
-            text_surface = font.render(display_text, True, line.color)
-            surface.blit(text_surface, (30, y))
-            y += line_height
-        
-        # Scroll indicator
-        if self.scroll_offset < 0:
-            scroll_text = small_font.render(f"↑ Scrolled {-self.scroll_offset} lines", True, WARNING_COLOR)
-            surface.blit(scroll_text, (WIDTH - 200, terminal_y + 5))
+        key = (self.output_lines.total, self.scroll_offset)
+        if self.panel is None or self.panel_key != key:
+            if self.panel is None:
+                self.panel = pygame.Surface((terminal_width, TERMINAL_HEIGHT))
+            self.panel_key = key
+            panel = self.panel
+
+            # Terminal background
+            panel.fill(BG_COLOR)
+            pygame.draw.rect(panel, BORDER_COLOR, (0, 0, terminal_width, TERMINAL_HEIGHT), 1)
+
+            # Get lines to display
+            total_lines = len(self.output_lines)
+            start_idx = max(0, total_lines - VISIBLE_LINES + self.scroll_offset)
+            end_idx = min(total_lines, start_idx + VISIBLE_LINES)
+
+            # Draw lines
+            y = 10
+            for i in range(start_idx, end_idx):
+                line = self.output_lines[i]
+                # Truncate long lines
+                text_surface = self.text_cache.render(font, line.text[:MAX_LINE_CHARS], line.color)
+                panel.blit(text_surface, (10, y))
+                y += LINE_HEIGHT
+
+            # Scroll indicator
+            if self.scroll_offset < 0:
+                scroll_text = small_font.render(f"↑ Scrolled {-self.scroll_offset} lines", True, WARNING_COLOR)
+                panel.blit(scroll_text, (WIDTH - 220, 5))
+        surface.blit(self.panel, (20, TERMINAL_Y))
     
     def draw_input_area(self, surface):
         """Draw input area at bottom"""
@@ -259,11 +433,11 @@ class SandboxedTerminal:
         
         # Prompt
         prompt_text = "sandbox> "
-        prompt_surface = font.render(prompt_text, True, PROMPT_COLOR)
+        prompt_surface = self.text_cache.render(font, prompt_text, PROMPT_COLOR)
         surface.blit(prompt_surface, (30, input_y + 15))
         
         # Input text
-        input_surface = font.render(self.input_buffer, True, TEXT_COLOR)
+        input_surface = self.text_cache.render(font, self.input_buffer, TEXT_COLOR)
         input_x = 30 + prompt_surface.get_width()
         surface.blit(input_surface, (input_x, input_y + 15))
         
@@ -275,82 +449,81 @@ class SandboxedTerminal:
                            (cursor_x, input_y + 33), 2)
         
         # Help text
-        help_text = small_font.render("Type 'help' for commands | TAB to autocomplete | ↑↓ to scroll | 'exit' to quit", 
-                                     True, (100, 100, 100))
+        help_text = self.text_cache.render(small_font, "Type 'help' for commands | TAB to autocomplete | ↑↓ to scroll | 'exit' to quit",
+                                           (100, 100, 100))
         surface.blit(help_text, (30, input_y + input_height + 5))
     
     def draw_warnings(self, surface):
         """Draw security warning"""
         warning_y = HEIGHT - 15
-        warning = small_font.render("⚠ All commands monitored • Sandboxed environment active", 
-                                   True, WARNING_COLOR)
+        warning = self.text_cache.render(small_font, "⚠ All commands monitored • Sandboxed environment active",
+                                         WARNING_COLOR)
         text_rect = warning.get_rect(center=(WIDTH // 2, warning_y))
         surface.blit(warning, text_rect)
+
+    def draw(self, surface):
+        """Draw a frame if anything on screen changed; returns whether it did"""
+        key = (self.output_lines.total, self.scroll_offset, self.input_buffer, self.cursor_visible,
+               (datetime.now() - self.start_time).seconds, self.commands_executed, self.commands_blocked)
+        if key == self.frame_key:
+            return False
+        self.frame_key = key
+        surface.fill((10, 10, 15))
+        self.draw_header(surface)
+        self.draw_terminal(surface)
+        self.draw_input_area(surface)
+        self.draw_warnings(surface)
+
+        # Draw outer border
+        pygame.draw.rect(surface, BORDER_COLOR, (5, 5, WIDTH - 10, HEIGHT - 10), 3)
+        return True
     
-    def get_file_completions(self, prefix):
-        """Get list of files matching prefix in sandbox directory"""
+    def request_completions(self, line):
+        """Ask the shell to complete line at its end; returns its answer or None"""
+        if not self.process or self.process.poll() is not None:
+            return None
+        while not self.completion_queue.empty():   # late answer to an earlier TAB
+            self.completion_queue.get_nowait()
+        data = line.encode()
         try:
-            sandbox_dir = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'sandbox')
-            if not os.path.exists(sandbox_dir):
-                return []
-            
-            files = os.listdir(sandbox_dir)
-            matches = [f for f in files if f.startswith(prefix)]
-            return sorted(matches)
-        except:
-            return []
-    
+            self.process.stdin.write(b"complete " + data + b" " + str(len(data)).encode() + b"\n")
+            self.process.stdin.flush()
+        except OSError:
+            return None
+        # The answer can sit behind output; keep taking that so the reader
+        # thread never waits on a full queue meanwhile
+        deadline = time.monotonic() + COMPLETION_TIMEOUT
+        while time.monotonic() < deadline:
+            try:
+                return self.completion_queue.get(timeout=0.01)
+            except queue.Empty:
+                self.update_output()
+        return None
+
     def handle_tab_completion(self):
         """Handle tab completion for commands and files"""
         if not self.input_buffer:
             return
-        
-        parts = self.input_buffer.split()
-        
-        # Determine what we're trying to complete
-        if len(parts) <= 1 and not self.input_buffer.endswith(' '):
-            # Completing a command
-            prefix = parts[0] if parts else ""
-            completion_key = f"cmd:{prefix}"
-            
-            # If this is a new completion (different from last time), find matches
-            if completion_key != self.last_completion_input:
-                self.completion_matches = [cmd for cmd in self.available_commands 
-                                          if cmd.startswith(prefix)]
-                self.completion_index = 0
-                self.last_completion_input = completion_key
-            
-            if self.completion_matches:
-                # Show current match and move to next
-                self.input_buffer = self.completion_matches[self.completion_index]
-                self.completion_index = (self.completion_index + 1) % len(self.completion_matches)
-                
+
+        if self.completion_matches and self.input_buffer == self.last_completion_input:
+            # TAB again: next match for the same input
+            self.completion_index = (self.completion_index + 1) % len(self.completion_matches)
         else:
-            # Completing a file argument
-            if self.input_buffer.endswith(' '):
-                prefix = ""
-                base_parts = parts
-            else:
-                prefix = parts[-1] if parts else ""
-                base_parts = parts[:-1]
-            
-            completion_key = f"file:{' '.join(parts[:-1] if not self.input_buffer.endswith(' ') else parts)}:{prefix}"
-            
-            # If this is a new completion, find matches
-            if completion_key != self.last_completion_input:
-                self.completion_matches = self.get_file_completions(prefix)
-                self.completion_index = 0
-                self.last_completion_input = completion_key
-            
-            if self.completion_matches:
-                # Replace the last word with current match
-                if self.input_buffer.endswith(' '):
-                    self.input_buffer = ' '.join(parts) + ' ' + self.completion_matches[self.completion_index]
-                else:
-                    self.input_buffer = ' '.join(base_parts + [self.completion_matches[self.completion_index]])
-                
-                self.completion_index = (self.completion_index + 1) % len(self.completion_matches)
-    
+            answer = self.request_completions(self.input_buffer)
+            if not answer or not answer['candidates']:
+                return
+            self.completion_base = self.input_buffer.encode()
+            self.completion_span = (answer['start'], answer['end'])
+            self.completion_matches = answer['candidates']
+            self.completion_index = 0
+
+        # The shell counts in bytes, so splice the match in as bytes
+        start, end = self.completion_span
+        match = self.completion_matches[self.completion_index].encode()
+        spliced = self.completion_base[:start] + match + self.completion_base[end:]
+        self.input_buffer = spliced.decode('utf-8', errors='replace')
+        self.last_completion_input = self.input_buffer
+
     def handle_key(self, event):
         """Handle keyboard input"""
         if event.key == pygame.K_RETURN:
@@ -375,16 +548,16 @@ class SandboxedTerminal:
             self.last_completion_input = ""
         
         elif event.key == pygame.K_UP:
-            self.scroll_offset -= 1
+            self.scroll(-1)
         
         elif event.key == pygame.K_DOWN:
-            self.scroll_offset = min(0, self.scroll_offset + 1)
+            self.scroll(1)
         
         elif event.key == pygame.K_PAGEUP:
-            self.scroll_offset -= 10
+            self.scroll(-10)
         
         elif event.key == pygame.K_PAGEDOWN:
-            self.scroll_offset = min(0, self.scroll_offset + 10)
+            self.scroll(10)
         
         elif event.unicode and event.unicode.isprintable():
             self.input_buffer += event.unicode
@@ -398,7 +571,8 @@ class SandboxedTerminal:
         self.running = False
         if self.process:
             try:
-                self.process.terminate()
+                # EOF on stdin ends the shell normally, so it saves its session
+                self.process.stdin.close()
                 self.process.wait(timeout=2)
             except:
                 self.process.kill()
@@ -420,6 +594,9 @@ def main():
             
             elif event.type == pygame.KEYDOWN:
                 terminal.handle_key(event)
+
+            elif event.type == pygame.VIDEOEXPOSE:
+                terminal.frame_key = None    # window uncovered: draw it all
         
         # Update cursor blink
         if frame_count % 30 == 0:
@@ -428,17 +605,9 @@ def main():
         # Update output from shell
         terminal.update_output()
         
-        # Drawing
-        screen.fill((10, 10, 15))
-        terminal.draw_header(screen)
-        terminal.draw_terminal(screen)
-        terminal.draw_input_area(screen)
-        terminal.draw_warnings(screen)
-        
-        # Draw outer border
-        pygame.draw.rect(screen, BORDER_COLOR, (5, 5, WIDTH - 10, HEIGHT - 10), 3)
-        
-        pygame.display.flip()
+        # Drawing: nothing is redrawn or flipped while the screen is unchanged
+        if terminal.draw(screen):
+            pygame.display.flip()
         clock.tick(60)  # 60 FPS
     
     # Cleanup
@@ -0,0 +1,651 @@
+#!/usr/bin/env python3
+"""
+Shell-level tests: lines typed into ./myshell, checked by their output.
+
+Each test gets a fresh sandbox in a temp dir with its own policy file; the
+commands come from the repo's sandbox/bin (run make first). Tests that need
+a server start 'myshell --server' on a socket in the same temp dir.
+
+Usage: python3 tests/shell_tests.py [--shell ./myshell] [-k NAME]
+"""
+
+import argparse
+import json
+import os
+import pty
+import re
+import select
+import shutil
+import signal
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+import traceback
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+BIN_DIR = os.path.join(HERE, "..", "sandbox", "bin")
+TIMEOUT = 10.0
+TESTS = []
+
+
+def test(fn):
+    TESTS.append(fn)
+    return fn
+
+
+class Sandbox:
+    """A temp dir holding sandbox/ and the policy file for it"""
+
+    def __init__(self, shell, work):
+        self.shell = shell
+        self.work = work
+        self.root = os.path.join(work, "sandbox")
+        self.config = os.path.join(work, "test.conf")
+        os.makedirs(self.root)
+        self.policy("")
+
+    def policy(self, extra):
+        with open(self.config, "w") as f:
+            f.write(f"root = sandbox\nbin_dir = {os.path.abspath(BIN_DIR)}\nchroot = off\n"
+                    f"wall_time = 20\n{extra}")
+
+    def file(self, rel, text=""):
+        path = os.path.join(self.root, rel)
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        with open(path, "w") as f:
+            f.write(text)
+        return path
+
+    def run(self, *lines):
+        """Pipe lines into a shell started in the sandbox; returns its output"""
+        proc = subprocess.run([self.shell, "-f", self.config], cwd=self.root, input="\n".join(lines) + "\n",
+                              stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True, timeout=TIMEOUT)
+        return proc.stdout
+
+
+class Client:
+    """One session on a 'myshell --server' socket"""
+
+    def __init__(self, path):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        deadline = time.monotonic() + TIMEOUT
+        while True:
+            try:
+                self.sock.connect(path)
+                break
+            except (FileNotFoundError, ConnectionRefusedError):
+                if time.monotonic() > deadline:
+                    raise
+                time.sleep(0.05)
+        self.read_prompt()
+
+    def read_prompt(self):
+        out = b""
+        deadline = time.monotonic() + TIMEOUT
+        while not out.endswith(b"sandbox> "):
+            left = deadline - time.monotonic()
+            if left <= 0 or not select.select([self.sock], [], [], left)[0]:
+                raise TimeoutError(f"no prompt after {out!r}")
+            chunk = self.sock.recv(65536)
+            if not chunk:
+                break
+            out += chunk
+        return out.decode(errors="replace")
+
+    def run(self, line):
+        self.sock.sendall(line.encode() + b"\n")
+        return self.read_prompt()
+
+    def close(self):
+        self.sock.close()
+
+
+class Skip(Exception):
+    """The test cannot run here"""
+
+
+def expect(cond, what, output):
+    if not cond:
+        raise AssertionError(f"{what}; output was:\n{output}")
+
+
+@test
+def reload_from_subdirectory(sb):
+    """SIGHUP after cd: the policy file is still found and still applies"""
+    sb.policy("deny = cat\n")
+    sb.file("sub/x.txt", "hello\n")
+    proc = subprocess.Popen([sb.shell, "-f", os.path.basename(sb.config)], cwd=sb.work, stdin=subprocess.PIPE,
+                            stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+    try:
+        proc.stdin.write("cd sandbox/sub\n")
+        proc.stdin.flush()
+        time.sleep(0.3)
+        proc.send_signal(signal.SIGHUP)
+        time.sleep(0.3)
+        out, _ = proc.communicate("pwd\ncat x.txt\n", timeout=TIMEOUT)
+    finally:
+        proc.kill()
+    expect("Policy reloaded" in out, "reload did not happen", out)
+    expect("Command 'cat' is not allowed" in out, "deny list lost on reload", out)
+
+
+@test
+def reload_missing_file_keeps_policy(sb):
+    sb.policy("deny = cat\n")
+    sb.file("x.txt", "hello\n")
+    proc = subprocess.Popen([sb.shell, "-f", sb.config], cwd=sb.root, stdin=subprocess.PIPE,
+                            stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+    try:
+        time.sleep(0.3)
+        os.rename(sb.config, sb.config + ".gone")
+        proc.send_signal(signal.SIGHUP)
+        time.sleep(0.3)
+        out, _ = proc.communicate("cat x.txt\n", timeout=TIMEOUT)
+    finally:
+        proc.kill()
+    expect("keeping current policy" in out, "missing file not reported", out)
+    expect("Command 'cat' is not allowed" in out, "policy replaced by the defaults", out)
+
+
+@test
+def chroot_takes_only_on_or_off(sb):
+    """chroot = yes is an error: at startup the shell refuses, on reload the policy stays"""
+    sb.policy("chroot = yes\n")
+    out = sb.run("pwd")
+    expect("invalid setting 'chroot'" in out and "sandbox> " not in out, "chroot = yes accepted", out)
+    sb.policy("deny = cat\n")
+    sb.file("x.txt", "hello\n")
+    proc = subprocess.Popen([sb.shell, "-f", sb.config], cwd=sb.root, stdin=subprocess.PIPE,
+                            stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+    try:
+        time.sleep(0.3)
+        sb.policy("chroot = On\n")
+        proc.send_signal(signal.SIGHUP)
+        time.sleep(0.3)
+        out, _ = proc.communicate("cat x.txt\n", timeout=TIMEOUT)
+    finally:
+        proc.kill()
+    expect("invalid setting 'chroot'" in out, "chroot = On accepted on reload", out)
+    expect("Command 'cat' is not allowed" in out, "policy replaced on reload", out)
+
+
+@test
+def relative_files_stay_next_to_the_policy(sb):
+    """state_file and record are taken from the policy's directory, reload or not"""
+    sb.policy("state_file = state\nrecord = rec.jsonl\n")
+    os.makedirs(os.path.join(sb.root, "sub"))
+    proc = subprocess.Popen([sb.shell, "-f", sb.config], cwd=sb.root, stdin=subprocess.PIPE,
+                            stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+    try:
+        proc.stdin.write("cd sub\n")
+        proc.stdin.flush()
+        time.sleep(0.3)
+        proc.send_signal(signal.SIGHUP)
+        time.sleep(0.3)
+        out, _ = proc.communicate("pwd\nexit\n", timeout=TIMEOUT)
+    finally:
+        proc.kill()
+    expect("Policy reloaded" in out, "reload did not happen", out)
+    for name in ("state", "rec.jsonl"):
+        expect(os.path.exists(os.path.join(sb.work, name)), f"{name} not next to the policy file",
+               sorted(os.listdir(sb.work)) + sorted(os.listdir(os.path.join(sb.root, "sub"))))
+    expect(not os.listdir(os.path.join(sb.root, "sub")), "files written to the session's cwd",
+           os.listdir(os.path.join(sb.root, "sub")))
+
+
+@test
+def server_reload_while_session_in_subdirectory(sb):
+    """The server reloads with the cwd of the last session it served"""
+    sb.policy("deny = cat\n")
+    sb.file("sub/x.txt", "hello\n")
+    sock = os.path.join(sb.work, "shell.sock")
+    server = subprocess.Popen([sb.shell, "-f", "../test.conf", "--server", sock], cwd=sb.root,
+                              stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, text=True)
+    try:
+        client = Client(sock)
+        client.run("cd sub")
+        server.send_signal(signal.SIGHUP)
+        time.sleep(0.3)
+        out = client.run("cat x.txt")
+        expect("Command 'cat' is not allowed" in out, "deny list lost on reload", out)
+        out = client.run("pwd")
+        expect(out.startswith(os.path.join(os.path.realpath(sb.root), "sub")), "session cwd changed", out)
+        client.close()
+    finally:
+        server.terminate()
+        _, err = server.communicate(timeout=TIMEOUT)
+    expect("Policy reloaded" in err, "reload did not happen", err)
+
+
+LIST_LINES = [
+    ("display a && display b || display c", ["a", "b"]),
+    ("cat nope && display no || display yes", ["yes"]),
+    ("cat nope || display x && display y", ["x", "y"]),
+    ("display a || display b && display c", ["a", "c"]),
+    ("cat nope; display next", ["next"]),
+    ("(cat nope || (display in && cat nope2)) || display outer", ["in", "outer"]),
+    ("(display g1; cat nope) && display no || display failed", ["g1", "failed"]),
+    ("display s && (cat nope || display r) && display t", ["s", "r", "t"]),
+]
+LIST_WORDS = {w for _, ws in LIST_LINES for w in ws} | {"no", "b", "c"}
+
+
+def list_words(out):
+    return [l.strip() for l in out.splitlines() if l.strip() in LIST_WORDS]
+
+
+@test
+def list_operators_and_groups(sb):
+    """; && || and nested ( ) give the same statuses piped and over the server"""
+    out = sb.run(*(line for line, _ in LIST_LINES))
+    expect(list_words(out) == [w for _, ws in LIST_LINES for w in ws], "wrong elements ran (piped)", out)
+    # Each foreground command parks the list on the session and resumes it
+    sock = os.path.join(sb.work, "shell.sock")
+    server = subprocess.Popen([sb.shell, "-f", sb.config, "--server", sock], cwd=sb.root,
+                              stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    try:
+        client = Client(sock)
+        for line, words in LIST_LINES:
+            out = client.run(line)
+            expect(list_words(out) == words, f"wrong elements ran for {line!r} (server)", out)
+        client.close()
+    finally:
+        server.terminate()
+        server.wait(timeout=TIMEOUT)
+
+
+@test
+def groups_run_in_a_subshell(sb):
+    """cd and aliases inside ( ) end with the group"""
+    os.makedirs(os.path.join(sb.root, "sub"))
+    out = sb.run("(cd sub; pwd); pwd", "(add_alias here=pwd; here); here")
+    root = os.path.realpath(sb.root)
+    expect(f"{root}/sub\n{root}\n" in out, "cd inside a group changed the shell's directory", out)
+    expect(out.count(f"{root}\n") == 2 and "'here'" in out, "alias from a group outlived it", out)
+
+
+@test
+def quoted_patterns_reach_the_command(sb):
+    """find gets '*.c' itself when it is quoted or escaped"""
+    for rel in ("a.c", "src/b.c", "src/c.h", "d.c"):
+        sb.file(rel)
+    for arg in ("'*.c'", '"*.c"', "\\*.c"):
+        out = sb.run(f"find . -name {arg}")
+        expect(sorted(l for l in out.splitlines() if l.startswith("./")) == ["./a.c", "./d.c", "./src/b.c"],
+               f"find -name {arg} did not list the .c files", out)
+
+
+@test
+def find_exec_both_forms(sb):
+    """-exec ... {} + and -exec ... {} \\; (or ';') as typed at the prompt"""
+    sb.file("logs/a.log", "1\n2\n")
+    sb.file("logs/b.log", "3\n")
+    out = sb.run("find logs -name '*.log' -exec wc -l {} +")
+    expect("3 total" in out, "-exec ... + did not run wc once over both files", out)
+    for end in ("\\;", "';'", '";"'):
+        out = sb.run(f"find logs -name '*.log' -exec wc -l {{}} {end} && display ok")
+        expect("2 logs/a.log" in out and "1 logs/b.log" in out and "ok\n" in out,
+               f"-exec ... {end} did not run wc per file", out)
+
+
+@test
+def grep_alternation_is_not_a_pipe(sb):
+    sb.file("fruit.txt", "apple\nbanana\ncherry\n")
+    for pattern in ('"apple|cherry"', "'apple|cherry'", "apple\\|cherry"):
+        out = sb.run(f"grep -E {pattern} fruit.txt")
+        expect("apple\n" in out and "cherry\n" in out and "banana" not in out and "BLOCKED" not in out,
+               f"grep -E {pattern} was split at the |", out)
+    out = sb.run("cat fruit.txt | grep -E 'b|c' | wc -l")
+    expect(out.count("2\n") == 1, "| inside quotes in a real pipeline", out)
+
+
+@test
+def quotes_and_escapes_are_removed(sb):
+    out = sb.run("display a\\*b 'x  y' \"q\\\"z\" '\\'")
+    expect('a*b x  y q"z \\\n' in out, "quotes or escapes left in the arguments", out)
+    sb.file("notes.txt", "one\n")
+    out = sb.run("display *.txt", "display '*.txt'")
+    expect("notes.txt\n" in out and "*.txt\n" in out, "quoted word expanded or bare one not", out)
+
+
+@test
+def complete_offers_commands_paths_and_aliases(sb):
+    """'complete <line> <cursor>' answers with the words the shell would accept"""
+    sb.file("notes.md")
+    sb.file("notes/a.txt")
+    sb.file(".hidden")
+    lines = ["complete so 2", "complete ls 2", "complete cat no 6", "complete cat notes/ 10",
+             "complete cat notes.md | gr 17", "complete cat ../ 7", "complete cat  4"]
+    out = sb.run("add_alias lsx=ls", *lines)
+    answers = [json.loads(l) for l in out.splitlines() if l.startswith("{")]
+    expect(len(answers) == len(lines), "not one JSON answer per request", out)
+    expected = [
+        {"start": 0, "end": 2, "candidates": ["sort"]},
+        {"start": 0, "end": 2, "candidates": ["ls", "lsx"]},
+        {"start": 4, "end": 6, "candidates": ["notes.md", "notes/"]},
+        {"start": 4, "end": 10, "candidates": ["notes/a.txt"]},
+        {"start": 15, "end": 17, "candidates": ["grep"]},
+        {"start": 4, "end": 7, "candidates": []},
+        {"start": 4, "end": 4, "candidates": ["notes.md", "notes/"]},
+    ]
+    for line, got, want in zip(lines, answers, expected):
+        expect(got == want, f"{line!r} gave {got}, not {want}", out)
+
+@test
+def watch_keeps_only_the_start_of_big_output(sb):
+    """watch shows the first 64 KB of a run and counts the rest"""
+    line = "x" * 99 + "\n"
+    sb.file("big.log", line * 2000)
+    out = sb.run("watch cat big.log", "display done")
+    expect(f"... {len(line) * 2000 - 65536} more bytes\n" in out, "rest of the output not counted", out)
+    expect(out.count(line) == 65536 // len(line), "more than 64 KB shown", out)
+    expect("done\n" in out, "the next line did not run", out)
+
+
+@test
+def mv_n_across_devices_keeps_both_files(sb):
+    """mv -n onto an existing file on another file system leaves both alone"""
+    sb.file("a.txt", "source\n")
+    other = os.path.join(sb.root, "other")
+    os.makedirs(other)
+    # A tmpfs on sandbox/other in a mount namespace of the shell's own
+    unshare = ["unshare", "-m"] if os.geteuid() == 0 else ["unshare", "-rm"]
+    if subprocess.run(unshare + ["true"], stderr=subprocess.DEVNULL).returncode != 0:
+        raise Skip("no mount namespace")
+    lines = ["display kept > other/a.txt", "mv -n a.txt other/a.txt && display mv-ok", "cat other/a.txt"]
+    proc = subprocess.run(unshare + ["sh", "-c", 'mount -t tmpfs none "$1" && exec "$2" -f "$3"', "sh",
+                                     other, sb.shell, sb.config],
+                          cwd=sb.root, input="\n".join(lines) + "\n", stdout=subprocess.PIPE,
+                          stderr=subprocess.STDOUT, text=True, timeout=TIMEOUT)
+    out = proc.stdout
+    expect("mv-ok\n" in out, "mv -n onto an existing file failed", out)
+    expect("kept\n" in out, "destination overwritten", out)
+    expect(os.path.exists(os.path.join(sb.root, "a.txt")), "source removed", out)
+
+
+def tree(root):
+    """Every path under root with its contents (None for a directory)"""
+    found = {}
+    for dirpath, dirs, files in os.walk(root):
+        for name in dirs:
+            found[os.path.relpath(os.path.join(dirpath, name), root)] = None
+        for name in files:
+            with open(os.path.join(dirpath, name), "rb") as f:
+                found[os.path.relpath(os.path.join(dirpath, name), root)] = f.read()
+    return found
+
+
+@test
+def restore_undoes_every_change(sb):
+    """snapshot, edit, add and delete files, restore: the tree is as it was"""
+    sb.file("a.txt", "a\n")
+    sb.file("d/b.txt", "b\n")
+    sb.file("d/e/c.txt", "c\n")
+    before = tree(sb.root)
+    out = sb.run("sandbox_snapshot clean", "display changed > a.txt", "mkdir new", "touch new/f",
+                 "mv d/b.txt moved.txt", "mv d/e/c.txt d/c.txt", "sandbox_restore clean")
+    expect("sandbox_restore: 'clean'" in out, "restore did not run", out)
+    expect(tree(sb.root) == before, "the restored tree differs", f"{out}\n{tree(sb.root)}")
+    out = sb.run("sandbox_restore missing")
+    expect("no snapshot named 'missing'" in out and tree(sb.root) == before,
+           "restoring an unknown snapshot changed the tree", out)
+
+@test
+def fifo_reads_are_not_cached(sb):
+    """cat of a FIFO runs every time; its bytes are not replayed from the cache"""
+    sb.policy("cache = 16\n")
+    fifo = os.path.join(sb.root, "feed")
+    os.mkfifo(fifo)
+    old = time.time() - 60
+    os.utime(fifo, (old, old))
+
+    def feed():
+        for n in range(2):
+            deadline = time.monotonic() + TIMEOUT
+            while True:
+                try:
+                    fd = os.open(fifo, os.O_WRONLY | os.O_NONBLOCK)
+                    break
+                except OSError:
+                    if time.monotonic() > deadline:
+                        return
+                    time.sleep(0.02)
+            os.write(fd, f"run {n}\n".encode())
+            os.close(fd)
+            os.utime(fifo, (old, old))
+            time.sleep(0.2)
+
+    writer = threading.Thread(target=feed, daemon=True)
+    writer.start()
+    out = sb.run("cat feed", "cat feed")
+    writer.join(TIMEOUT)
+    expect("run 0\n" in out and "run 1\n" in out, "second read of the FIFO came from the cache", out)
+
+
+@test
+def sort_key_modifiers_belong_to_the_key(sb):
+    """-k2r reverses only the key; a key with modifiers ignores a global -n"""
+    sb.file("a.txt", "b 1\na 1\n")
+    sb.file("b.txt", "x 10\ny 9\n")
+    out = sb.run("sort -k2r a.txt")
+    expect("a 1\nb 1\n" in out, "the key's r reversed the whole-line tie-break", out)
+    out = sb.run("sort -n -k2,2r b.txt")
+    expect("y 9\nx 10\n" in out, "global -n applied to a key with its own modifiers", out)
+    out = sb.run("sort -r -k2n b.txt", "sort -rn -k2,2 b.txt")
+    expect(out.count("y 9\nx 10\n") == 1 and out.count("x 10\ny 9\n") == 1,
+           "global -n/-r not applied to a key without modifiers", out)
+
+
+@test
+def metrics_file_updates_while_idle(sb):
+    """A shell waiting for input, piped or at a terminal, still rewrites metrics_file"""
+    prom = os.path.join(sb.work, "shell.prom")
+    sb.policy("metrics_file = shell.prom\nmetrics_interval = 1\n")
+
+    def uptime():
+        try:
+            with open(prom) as f:
+                return int(re.search(r"^sandbox_uptime_seconds (\d+)$", f.read(), re.M).group(1))
+        except (OSError, AttributeError):
+            return None
+
+    for mode in ("piped", "terminal"):
+        if os.path.exists(prom):
+            os.unlink(prom)
+        if mode == "terminal":
+            master, slave = pty.openpty()
+            proc = subprocess.Popen([sb.shell, "-f", sb.config], cwd=sb.root, stdin=slave, stdout=slave, stderr=slave)
+            os.close(slave)
+        else:
+            master = None
+            proc = subprocess.Popen([sb.shell, "-f", sb.config], cwd=sb.root, stdin=subprocess.PIPE,
+                                    stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        try:
+            time.sleep(0.5)
+            first = uptime()
+            time.sleep(2.5)
+            last = uptime()
+            expect(first is not None and last is not None and last > first,
+                   f"{mode} shell did not rewrite the metrics file while idle", f"uptime {first} then {last}")
+        finally:
+            proc.kill()
+            proc.wait(timeout=TIMEOUT)
+            if master is not None:
+                os.close(master)
+
+@test
+def state_survives_a_restart(sb):
+    """Aliases, history and the working directory come back after exit"""
+    sb.policy("state_file = state\n")
+    os.makedirs(os.path.join(sb.root, "sub"))
+    sb.run("add_alias here=pwd", "cd sub", "display one")
+    out = sb.run("here", "print_history")
+    expect(f"{sb.root}/sub\n" in out, "alias or working directory lost", out)
+    expect(re.search(r"^1 add_alias here=pwd\n2 cd sub\n3 display one\n4 here\n", out, re.M),
+           "history lost", out)
+    with open(os.path.join(sb.work, "state"), "w") as f:
+        f.write("not a snapshot")
+    out = sb.run("here", "pwd")
+    expect("starting fresh" in out and "'here'" in out and f"{sb.root}\n" in out,
+           "a damaged snapshot was used", out)
+
+def running(name):
+    """Processes whose command line mentions name"""
+    return subprocess.run(["pgrep", "-f", name], stdout=subprocess.PIPE, text=True).stdout.split()
+
+
+@test
+def foreground_commands_stop_at_wall_time(sb):
+    """A command past its wall limit is killed, reported and fails the line"""
+    log = f"fg-{os.getpid()}.log"
+    sb.policy("limit = tail wall=1\n")
+    sb.file(log)
+    start = time.monotonic()
+    out = sb.run(f"tail -f {log} | grep x || display stopped", "stats")
+    expect(time.monotonic() - start < 5, "the pipeline was not stopped at its limit", out)
+    expect("[SANDBOX TIMEOUT]\033[0m 'tail' ran past its wall-clock limit (1s)" in out, "no timeout notice", out)
+    expect("stopped\n" in out, "a timed-out line did not fail", out)
+    expect(re.search(r"^\s+tail\s+1\s+1\s+1\s", out, re.M), "timeout not counted in stats", out)
+    expect(not running(log), "the job outlived its limit", running(log))
+
+@test
+def background_jobs_have_a_deadline(sb):
+    """'&' jobs are capped per session, stopped at wall_time and die with the session"""
+    log = f"bg-{os.getpid()}.log"
+    sb.policy("limit = tail wall=1\n")
+    sb.file(log)
+    sock = os.path.join(sb.work, "shell.sock")
+    server = subprocess.Popen([sb.shell, "-f", sb.config, "--server", sock], cwd=sb.root,
+                              stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    try:
+        client = Client(sock)
+        outs = [client.run(f"tail -f {log} &") for _ in range(9)]
+        expect("background jobs are already running" in outs[-1], "no cap on background jobs", outs[-1])
+        time.sleep(3.5)
+        expect(not running(log), "background jobs outlived wall_time", running(log))
+        out = client.run("stats")
+        expect(re.search(r"^\s+tail\s+8\s+\d+\s+8\s", out, re.M), "timeouts not counted in stats", out)
+        client.close()
+
+        sb.policy("")
+        server.send_signal(signal.SIGHUP)
+        client = Client(sock)
+        client.run(f"tail -f {log} &")
+        expect(running(log), "background job did not start", "")
+        client.close()
+        time.sleep(0.5)
+        expect(not running(log), "background job outlived its session", running(log))
+    finally:
+        server.terminate()
+        server.wait(timeout=TIMEOUT)
+
+
+@test
+def disconnect_while_busy_stops_the_job(sb):
+    """A client that hangs up mid-command takes the command with it, and so does SIGTERM"""
+    log = f"busy-{os.getpid()}.log"
+    sb.policy("wall_time = 0\n")
+    sb.file(log)
+    sock = os.path.join(sb.work, "shell.sock")
+    server = subprocess.Popen([sb.shell, "-f", sb.config, "--server", sock], cwd=sb.root,
+                              stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    try:
+        client = Client(sock)
+        client.sock.sendall(f"tail -f {log}\n".encode())
+        time.sleep(0.5)
+        expect(running(log), "job did not start", "")
+        client.close()
+        time.sleep(0.5)
+        expect(not running(log), "job outlived its client", running(log))
+
+        client = Client(sock)
+        expect("sandbox> " in client.run("pwd"), "server stopped serving after the hangup", "")
+        client.sock.sendall(f"tail -f {log}\n".encode())
+        time.sleep(0.5)
+        expect(running(log), "job did not start", "")
+        server.terminate()
+        server.wait(timeout=TIMEOUT)
+        expect(not running(log), "job outlived the server", running(log))
+        client.close()
+    finally:
+        server.kill()
+        server.wait(timeout=TIMEOUT)
+
+
+def read_frame(stream):
+    """One --protocol frame: (type, payload)"""
+    header = stream.read(5)
+    if len(header) < 5:
+        raise EOFError("shell closed its output")
+    return chr(header[0]), stream.read(int.from_bytes(header[1:], "big"))
+
+
+@test
+def protocol_client_going_away_stops_its_jobs(sb):
+    """A --protocol client that stops reading ends the session cleanly, not by SIGPIPE"""
+    fg, bg = f"fg-{os.getpid()}.log", f"bg-{os.getpid()}.log"
+    sb.policy("state_file = state\n")
+    sb.file(fg)
+    sb.file(bg)
+    proc = subprocess.Popen([sb.shell, "-f", sb.config, "--protocol"], cwd=sb.root,
+                            stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+    try:
+        for line in ("add_alias here=pwd", f"tail -f {bg} &"):
+            proc.stdin.write(line.encode() + b"\n")
+            proc.stdin.flush()
+            while read_frame(proc.stdout)[0] != "P":
+                pass
+        proc.stdin.write(f"tail -f {fg}\n".encode())
+        proc.stdin.flush()
+        expect(read_frame(proc.stdout)[0] == "S", "no start frame", "")
+        time.sleep(0.5)
+        expect(running(fg) and running(bg), "jobs did not start", "")
+        proc.stdout.close()
+        with open(os.path.join(sb.root, fg), "a") as f:
+            f.write("output nobody reads\n")
+        status = proc.wait(timeout=TIMEOUT)
+        expect(status == 1, f"shell ended with {status}, not 1", "")
+        time.sleep(0.2)
+        expect(not running(fg), "the running command outlived its client", running(fg))
+        expect(not running(bg), "a background job outlived its client", running(bg))
+        out = sb.run("here")
+        expect(f"{sb.root}\n" in out, "the session snapshot was not saved", out)
+    finally:
+        proc.kill()
+        proc.wait(timeout=TIMEOUT)
+
+def main():
+    parser = argparse.ArgumentParser(description="Shell-level tests")
+    parser.add_argument("--shell", default=os.path.join(HERE, "..", "myshell"))
+    parser.add_argument("-k", dest="only", help="run only tests whose name contains this")
+    opts = parser.parse_args()
+    shell = os.path.abspath(opts.shell)
+    if not os.access(shell, os.X_OK) or not os.path.isdir(BIN_DIR):
+        sys.exit(f"shell or {BIN_DIR} not found (run make)")
+
+    passed = failed = 0
+    for fn in TESTS:
+        if opts.only and opts.only not in fn.__name__:
+            continue
+        work = tempfile.mkdtemp(prefix="shelltest.")
+        try:
+            fn(Sandbox(shell, work))
+            passed += 1
+            print(f"ok    {fn.__name__}")
+        except Skip as why:
+            print(f"skip  {fn.__name__}: {why}")
+        except Exception:
+            failed += 1
+            print(f"FAIL  {fn.__name__}")
+            traceback.print_exc(limit=1)
+        finally:
+            shutil.rmtree(work, ignore_errors=True)
+    print(f"{passed} passed, {failed} failed")
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()